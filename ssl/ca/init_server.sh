@@ -6,10 +6,19 @@ if [ $# -lt 1 ]; then
 fi
 
 SERVER=${1:-mqtt.example.tld}
+# KEY_TYPE=ec for an ECDSA P-256 server key, as used with a CA made by KEY_TYPE=ec init_ca.sh
+KEY_TYPE="${KEY_TYPE:-rsa}"
+EXTENSIONS=server_cert
 
 echo
 echo "Create (unencrypted) server key"
-openssl genrsa -out intermediate/private/"${SERVER}".key.pem 2048 || exit
+if [ "${KEY_TYPE}" = "ec" ]; then
+    openssl genpkey -algorithm EC -pkeyopt ec_paramgen_curve:P-256 -pkeyopt ec_param_enc:named_curve \
+        -out intermediate/private/"${SERVER}".key.pem || exit
+    EXTENSIONS=server_cert_ec
+else
+    openssl genrsa -out intermediate/private/"${SERVER}".key.pem 2048 || exit
+fi
 
 echo
 echo "Generate server CSR"
@@ -17,7 +26,7 @@ openssl req -config server.cnf -key intermediate/private/"${SERVER}".key.pem -ne
 
 echo
 echo "Generate server cert from CSR using intermediate key"
-openssl ca -config server.cnf -extensions server_cert -days 375 -notext -md sha256 -in intermediate/csr/"${SERVER}".csr.pem -out intermediate/certs/"${SERVER}".cert.pem || exit
+openssl ca -config server.cnf -extensions "${EXTENSIONS}" -days 375 -notext -md sha256 -in intermediate/csr/"${SERVER}".csr.pem -out intermediate/certs/"${SERVER}".cert.pem || exit
 openssl x509 -noout -text -in intermediate/certs/"${SERVER}".cert.pem || exit
 
 echo
@@ -12,4 +12,9 @@ if [[ ! "${CN}" == "ESP-"* ]]; then
     echo "CSR subject must end with CN=ESP-*" >&2
     exit 1
 fi
-openssl ca -config intermediate.cnf -extensions usr_cert -days 375 -notext -md sha256 -in "${CSR}" -out intermediate/certs/"${CN}".cert.pem
+# ECDSA keys get a key usage without keyEncipherment
+EXTENSIONS=usr_cert
+if openssl req -noout -text -in "${CSR}" | grep -q "id-ecPublicKey"; then
+    EXTENSIONS=usr_cert_ec
+fi
+openssl ca -config intermediate.cnf -extensions "${EXTENSIONS}" -days 375 -notext -md sha256 -in "${CSR}" -out intermediate/certs/"${CN}".cert.pem
@@ -9,7 +9,10 @@ filename="${1}"
 varname="${2:-$(basename ${filename} | tr '.' '_')}"
 
 echo "${varname}"
-while IFS='' read -r line || [[ -n "${line}" ]]; do
-    printf "%s\r\n" "${line}" | od -A n -t x1 | tr -d " \t\n\r"
-done < "${filename}"
-echo
\ No newline at end of file
+# PEM is sent as DER: smaller to paste and to store, and the node skips the base64 decode
+if grep -q -- "-----BEGIN " "${filename}"; then
+    "$(dirname "${0}")"/pem_to_der.sh "${filename}" | od -A n -v -t x1 | tr -d " \t\n\r"
+else
+    od -A n -v -t x1 < "${filename}" | tr -d " \t\n\r"
+fi
+echo
@@ -7,5 +7,12 @@ fi
 
 CLIENT_ID="${1}"
 KEY_SIZE="${2:-2048}"
+# KEY_TYPE=ec for an ECDSA P-256 key, as used with a CA made by KEY_TYPE=ec init_ca.sh
+KEY_TYPE="${KEY_TYPE:-rsa}"
 
-openssl genrsa -out private/"${CLIENT_ID}".key.pem "${SIZE}"
+if [ "${KEY_TYPE}" = "ec" ]; then
+    openssl genpkey -algorithm EC -pkeyopt ec_paramgen_curve:P-256 -pkeyopt ec_param_enc:named_curve \
+        -out private/"${CLIENT_ID}".key.pem
+else
+    openssl genrsa -out private/"${CLIENT_ID}".key.pem "${KEY_SIZE}"
+fi
@@ -0,0 +1,46 @@
+#!/bin/sh
+
+# Generate a pre-shared key for each client ID, given as arguments or one per line on stdin. Each key is
+# written to private/<client-id>.psk, for file_to_hex.sh or file_to_header.sh, and recorded in
+# private/psk_file in the identity:hexkey format of mosquitto's psk_file option. Client IDs that already
+# have a key are left alone, so the same list can be run again as devices are added.
+
+PSK_BYTES="${PSK_BYTES:-16}"
+PSK_FILE="${PSK_FILE:-private/psk_file}"
+
+if [ "${1}" = "-h" ]; then
+    echo "Usage: ${0} [<client-id>...]   (client IDs are read from stdin if none are given)" >&2
+    exit 1
+fi
+
+umask 077
+touch "${PSK_FILE}" || exit 1
+
+new_psk() {
+    CLIENT_ID="${1}"
+
+    # The identity is sent in the clear and the broker matches it exactly
+    case "${CLIENT_ID}" in
+        ""|*:*|*" "*|*/*) echo "${CLIENT_ID}: invalid client ID" >&2; return 1 ;;
+    esac
+    if grep -q "^${CLIENT_ID}:" "${PSK_FILE}" || [ -e private/"${CLIENT_ID}".psk ]; then
+        echo "${CLIENT_ID}: already has a key, skipped" >&2
+        return 0
+    fi
+
+    openssl rand -out private/"${CLIENT_ID}".psk "${PSK_BYTES}" || return 1
+    echo "${CLIENT_ID}:$(od -A n -v -t x1 < private/"${CLIENT_ID}".psk | tr -d " \t\n\r")" >> "${PSK_FILE}"
+    echo "${CLIENT_ID}"
+}
+
+ret=0
+if [ $# -gt 0 ]; then
+    for id in "$@"; do
+        new_psk "${id}" || ret=1
+    done
+else
+    while read -r id; do
+        [ -n "${id}" ] && { new_psk "${id}" || ret=1; }
+    done
+fi
+exit ${ret}
@@ -0,0 +1,27 @@
+#!/bin/sh
+
+# Write the DER form of a PEM certificate chain or private key to stdout. A chain becomes its certificates'
+# DER encodings back to back, which is how the nodes store and parse it.
+
+if [ $# -lt 1 ]; then
+    echo "Usage: ${0} <pem file>" >&2
+    exit 1
+fi
+
+if grep -q -- "PRIVATE KEY-----" "${1}"; then
+    exec openssl pkey -in "${1}" -outform der
+fi
+
+tmp="$(mktemp -d)"
+trap 'rm -rf "${tmp}"' EXIT
+
+awk -v dir="${tmp}" '
+    /-----BEGIN CERTIFICATE-----/ { f = sprintf("%s/%03d.pem", dir, ++n) }
+    f { print > f }
+    /-----END CERTIFICATE-----/ { close(f); f = "" }
+' "${1}"
+
+for cert in "${tmp}"/*.pem; do
+    [ -e "${cert}" ] || { echo "${1}: no certificates" >&2; exit 1; }
+    openssl x509 -in "${cert}" -outform der || exit 1
+done
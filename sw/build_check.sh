@@ -0,0 +1,66 @@
+#!/bin/bash
+#
+# Build check before merging: every firmware configuration, and the host builds of the same code, must build
+# without a warning. Needs the SDKs where the Makefiles look for them (../sdk from each target), with their
+# toolchains on the PATH, and for the host builds what sw/host/README.md lists.
+#
+#   esp32        ESP-IDF firmware, from sdkconfig.defaults
+#   loadgen      The ESP32 MQTT client on Linux
+#   esp8266      esp-open-rtos firmware, default PKI (RSA certificates)
+#   esp8266-ec   The same with PKI=ec, ECDSA keys only
+#   esp8266-psk  The same with PKI=psk
+#   esp8266-rec  Default PKI with the record buffers overridden, as for a broker with a short chain
+#   tls_bench    Handshake benchmark over the ESP8266 mbedTLS configuration, also for PKI=ec
+#
+# Each build starts clean, and its output is kept in <log dir>/<name>.log. ESP8266 credential files that are
+# missing are copied from the examples, and a placeholder private_ssid_config.h is written, which is enough to
+# build but not to connect.
+
+if [ $# -gt 1 ]; then
+    echo "Usage: ${0} [log dir]" >&2
+    exit 1
+fi
+
+cd "$(dirname "${0}")" || exit 1
+LOGS="${1:-build/check}"
+mkdir -p "${LOGS}" || exit 1
+FAILED=0
+
+# <name> <directory> <make arguments>
+check() {
+    local name="${1}" dir="${2}" log result
+    shift 2
+    log="${LOGS}/${name}.log"
+
+    make -C "${dir}" clean >/dev/null 2>&1
+    if ! make -C "${dir}" "$@" >"${log}" 2>&1; then
+        result="failed"
+    elif grep -q "warning:" "${log}"; then
+        result="$(grep -c "warning:" "${log}") warnings"
+    else
+        result="ok"
+    fi
+    [ "${result}" = "ok" ] || FAILED=1
+    printf "%-16s %s\n" "${name}" "${result}"
+}
+
+# Takes new options from sdkconfig.defaults, keeping an existing sdkconfig
+make -C esp32 defconfig BATCH_BUILD=1 >/dev/null 2>&1
+check esp32 esp32 all BATCH_BUILD=1
+check loadgen host loadgen
+
+for example in esp8266/*.c.example; do
+    [ -f "${example%.example}" ] || cp "${example}" "${example%.example}"
+done
+# Without it esp-open-rtos warns that WIFI_SSID is not set
+[ -f esp8266/private_ssid_config.h ] || printf '#define WIFI_SSID "ssid"\n#define WIFI_PASS "password"\n' \
+    >esp8266/private_ssid_config.h
+check esp8266 esp8266
+check esp8266-ec esp8266 PKI=ec
+check esp8266-psk esp8266 PKI=psk
+check esp8266-rec esp8266 TLS_IN_LEN=2048 TLS_OUT_LEN=1024
+
+check tls_bench host tls_bench
+check tls_bench-ec host tls_bench PKI=ec
+
+exit ${FAILED}
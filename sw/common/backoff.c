@@ -0,0 +1,29 @@
+#include "backoff.h"
+
+void backoff_init(backoff_t *backoff, uint32_t base_ms, uint32_t cap_ms)
+{
+    backoff->base_ms = base_ms;
+    backoff->cap_ms = cap_ms;
+    backoff->attempt = 0;
+}
+
+uint32_t backoff_next(backoff_t *backoff, uint32_t random)
+{
+    uint32_t ceiling = backoff->base_ms;
+    uint32_t half;
+
+    for (uint32_t i = 0; i < backoff->attempt && ceiling < backoff->cap_ms; i++)
+        ceiling *= 2;
+    if (ceiling > backoff->cap_ms)
+        ceiling = backoff->cap_ms;
+    else
+        backoff->attempt++;
+
+    half = ceiling / 2;
+    return half + random % (ceiling - half + 1);
+}
+
+void backoff_reset(backoff_t *backoff)
+{
+    backoff->attempt = 0;
+}
@@ -0,0 +1,32 @@
+#ifndef BACKOFF_H
+#define BACKOFF_H
+
+#include <stdint.h>
+
+/*
+ * Exponential backoff with jitter.
+ *
+ * Each attempt doubles the ceiling, starting at base_ms and capped at cap_ms. The returned delay is half the
+ * ceiling plus a random share of the other half, so a fleet that lost its broker at the same moment
+ * reconnects spread out over time instead of in lockstep.
+ */
+typedef struct backoff_t {
+    uint32_t base_ms;
+    uint32_t cap_ms;
+    uint32_t attempt;
+} backoff_t;
+
+void backoff_init(backoff_t *backoff, uint32_t base_ms, uint32_t cap_ms);
+
+/**
+ * \param random Uniformly distributed random value, e.g. from the hardware RNG
+ * \return Delay in ms before the next attempt
+ */
+uint32_t backoff_next(backoff_t *backoff, uint32_t random);
+
+/**
+ * Call after a successful attempt
+ */
+void backoff_reset(backoff_t *backoff);
+
+#endif // BACKOFF_H
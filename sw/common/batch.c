@@ -0,0 +1,66 @@
+#include <string.h>
+
+#include "batch.h"
+
+void batch_init(batch_t *batch, uint8_t *buf, size_t size, uint8_t max_count, uint32_t window_ms)
+{
+    batch->buf = buf;
+    batch->size = size;
+    batch->seq = 0;
+    batch->max_count = max_count;
+    batch->window_ms = window_ms;
+    batch->len = BATCH_HEADER_LEN;
+    batch->count = 0;
+    batch->opened_ms = 0;
+}
+
+int batch_add(batch_t *batch, const void *data, size_t len, uint32_t now_ms)
+{
+    if (len > BATCH_RECORD_MAX || batch->count == 0xff)
+        return -1;
+    if (batch->len + 1 + len > batch->size)
+        return -1;
+
+    if (batch->count == 0)
+        batch->opened_ms = now_ms;
+
+    batch->buf[batch->len++] = len;
+    memcpy(batch->buf + batch->len, data, len);
+    batch->len += len;
+    batch->count++;
+
+    return 0;
+}
+
+int batch_ready(const batch_t *batch, uint32_t now_ms)
+{
+    if (batch->count == 0)
+        return 0;
+    if (batch->count >= batch->max_count)
+        return 1;
+    return (now_ms - batch->opened_ms) >= batch->window_ms;
+}
+
+size_t batch_finish(batch_t *batch)
+{
+    uint8_t *p = batch->buf;
+
+    if (batch->count == 0)
+        return 0;
+
+    *p++ = BATCH_VERSION;
+    *p++ = batch->seq >> 24;
+    *p++ = batch->seq >> 16;
+    *p++ = batch->seq >> 8;
+    *p++ = batch->seq;
+    *p++ = batch->count;
+
+    return batch->len;
+}
+
+void batch_reset(batch_t *batch)
+{
+    batch->seq++;
+    batch->len = BATCH_HEADER_LEN;
+    batch->count = 0;
+}
@@ -0,0 +1,61 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Batch frame layout (all integers big-endian):
+ *
+ *   u8  version   BATCH_VERSION
+ *   u32 seq       Incremented for every batch sent
+ *   u8  count     Number of records
+ *   count * { u8 len, u8 data[len] }
+ */
+#define BATCH_VERSION 1
+#define BATCH_HEADER_LEN 6
+#define BATCH_RECORD_MAX 255
+
+typedef struct batch_t {
+    uint8_t *buf;
+    size_t size;
+    size_t len;
+    uint32_t seq;
+    uint8_t count;
+    uint8_t max_count;
+    uint32_t window_ms;
+    uint32_t opened_ms;
+} batch_t;
+
+/**
+ * Initialize batch
+ * \param buf Frame buffer, must be larger than BATCH_HEADER_LEN
+ * \param max_count Batch is ready once it holds this many records
+ * \param window_ms Batch is ready once its first record is this old
+ */
+void batch_init(batch_t *batch, uint8_t *buf, size_t size, uint8_t max_count, uint32_t window_ms);
+
+/**
+ * Append a record
+ * \param now_ms Current time, used to open the time window on the first record
+ * \return 0 on success, -1 if the record does not fit: send the batch and retry
+ */
+int batch_add(batch_t *batch, const void *data, size_t len, uint32_t now_ms);
+
+/**
+ * \return true if the batch has reached its count or its time window has expired
+ */
+int batch_ready(const batch_t *batch, uint32_t now_ms);
+
+/**
+ * Finalize the frame header
+ * \return Frame length, or 0 if the batch is empty
+ */
+size_t batch_finish(batch_t *batch);
+
+/**
+ * Empty the batch after it was sent, advancing the sequence number
+ */
+void batch_reset(batch_t *batch);
+
+#endif // BATCH_H
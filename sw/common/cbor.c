@@ -0,0 +1,310 @@
+#include <math.h>
+#include <string.h>
+
+#include "cbor.h"
+
+#define CBOR_DEPTH_MAX 8
+
+void cbor_writer_init(cbor_writer_t *w, uint8_t *buf, size_t size)
+{
+    w->buf = buf;
+    w->size = size;
+    w->len = 0;
+    w->overflow = 0;
+}
+
+size_t cbor_writer_len(const cbor_writer_t *w)
+{
+    return w->overflow ? 0 : w->len;
+}
+
+static uint8_t *cbor_reserve(cbor_writer_t *w, size_t len)
+{
+    uint8_t *p;
+
+    if (w->overflow || w->len + len > w->size) {
+        w->overflow = 1;
+        return NULL;
+    }
+
+    p = w->buf + w->len;
+    w->len += len;
+    return p;
+}
+
+static void cbor_put_head(cbor_writer_t *w, int major, uint32_t arg)
+{
+    uint8_t *p;
+
+    major <<= 5;
+    if (arg < 24) {
+        if ((p = cbor_reserve(w, 1)))
+            p[0] = major | arg;
+    } else if (arg <= 0xff) {
+        if ((p = cbor_reserve(w, 2))) {
+            p[0] = major | 24;
+            p[1] = arg;
+        }
+    } else if (arg <= 0xffff) {
+        if ((p = cbor_reserve(w, 3))) {
+            p[0] = major | 25;
+            p[1] = arg >> 8;
+            p[2] = arg;
+        }
+    } else {
+        if ((p = cbor_reserve(w, 5))) {
+            p[0] = major | 26;
+            p[1] = arg >> 24;
+            p[2] = arg >> 16;
+            p[3] = arg >> 8;
+            p[4] = arg;
+        }
+    }
+}
+
+void cbor_put_uint(cbor_writer_t *w, uint32_t value)
+{
+    cbor_put_head(w, CBOR_UINT, value);
+}
+
+void cbor_put_int(cbor_writer_t *w, int32_t value)
+{
+    if (value >= 0)
+        cbor_put_head(w, CBOR_UINT, value);
+    else
+        cbor_put_head(w, CBOR_NINT, (uint32_t)(-(value + 1)));
+}
+
+void cbor_put_text(cbor_writer_t *w, const char *text, size_t len)
+{
+    uint8_t *p;
+
+    cbor_put_head(w, CBOR_TEXT, len);
+    if ((p = cbor_reserve(w, len)))
+        memcpy(p, text, len);
+}
+
+void cbor_put_array(cbor_writer_t *w, uint32_t count)
+{
+    cbor_put_head(w, CBOR_ARRAY, count);
+}
+
+void cbor_put_map(cbor_writer_t *w, uint32_t count)
+{
+    cbor_put_head(w, CBOR_MAP, count);
+}
+
+void cbor_put_float(cbor_writer_t *w, float value)
+{
+    uint32_t bits;
+    uint8_t *p;
+
+    if (value >= -2147483648.0f && value < 2147483648.0f && value == (float)(int32_t)value
+            && !(value == 0 && signbit(value))) {
+        cbor_put_int(w, (int32_t)value);
+        return;
+    }
+
+    memcpy(&bits, &value, sizeof(bits));
+    if ((p = cbor_reserve(w, 5))) {
+        p[0] = (CBOR_SIMPLE << 5) | 26;
+        p[1] = bits >> 24;
+        p[2] = bits >> 16;
+        p[3] = bits >> 8;
+        p[4] = bits;
+    }
+}
+
+void cbor_reader_init(cbor_reader_t *r, const uint8_t *buf, size_t len)
+{
+    r->buf = buf;
+    r->len = len;
+    r->pos = 0;
+    r->error = 0;
+}
+
+static int cbor_fail(cbor_reader_t *r)
+{
+    r->error = 1;
+    return -1;
+}
+
+/**
+ * Read n big-endian bytes, n <= 8
+ */
+static int cbor_get_be(cbor_reader_t *r, int n, uint64_t *value)
+{
+    if (r->pos + n > r->len)
+        return cbor_fail(r);
+
+    *value = 0;
+    for (int i = 0; i < n; i++)
+        *value = (*value << 8) | r->buf[r->pos++];
+
+    return 0;
+}
+
+int cbor_get_head(cbor_reader_t *r, int *major, uint32_t *arg)
+{
+    uint64_t value;
+    int info;
+
+    if (r->error || r->pos >= r->len)
+        return cbor_fail(r);
+
+    *major = r->buf[r->pos] >> 5;
+    info = r->buf[r->pos++] & 0x1f;
+
+    if (info < 24) {
+        *arg = info;
+        return 0;
+    }
+    if (info > 27)
+        return cbor_fail(r); // Indefinite lengths are not used by this schema
+
+    if (cbor_get_be(r, 1 << (info - 24), &value) != 0)
+        return -1;
+
+    if (*major == CBOR_SIMPLE) {
+        *arg = info;
+    } else {
+        if (value > UINT32_MAX)
+            return cbor_fail(r);
+        *arg = value;
+    }
+
+    return 0;
+}
+
+int cbor_get_uint(cbor_reader_t *r, uint32_t *value)
+{
+    int major;
+
+    if (cbor_get_head(r, &major, value) != 0)
+        return -1;
+    if (major != CBOR_UINT)
+        return cbor_fail(r);
+
+    return 0;
+}
+
+int cbor_get_int(cbor_reader_t *r, int32_t *value)
+{
+    uint32_t arg;
+    int major;
+
+    if (cbor_get_head(r, &major, &arg) != 0)
+        return -1;
+
+    if (major == CBOR_UINT && arg <= INT32_MAX)
+        *value = arg;
+    else if (major == CBOR_NINT && arg <= INT32_MAX)
+        *value = -1 - (int32_t)arg;
+    else
+        return cbor_fail(r);
+
+    return 0;
+}
+
+static float cbor_half(uint16_t half)
+{
+    uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+    uint32_t exp = (half >> 10) & 0x1f;
+    uint32_t mant = half & 0x3ff;
+    uint32_t bits;
+    float value;
+
+    if (exp == 0) {
+        // Subnormal: mant * 2^-24
+        value = mant / 16777216.0f;
+        return sign ? -value : value;
+    }
+
+    if (exp == 0x1f)
+        bits = sign | 0x7f800000 | (mant << 13);
+    else
+        bits = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+int cbor_get_float(cbor_reader_t *r, float *value)
+{
+    uint64_t bits;
+    uint32_t single;
+    double dbl;
+    int32_t integer;
+    int info;
+
+    if (r->error || r->pos >= r->len)
+        return cbor_fail(r);
+
+    if (r->buf[r->pos] >> 5 != CBOR_SIMPLE) {
+        if (cbor_get_int(r, &integer) != 0)
+            return -1;
+        *value = integer;
+        return 0;
+    }
+
+    info = r->buf[r->pos++] & 0x1f;
+    switch (info) {
+    case 25:
+        if (cbor_get_be(r, 2, &bits) != 0)
+            return -1;
+        *value = cbor_half(bits);
+        return 0;
+    case 26:
+        if (cbor_get_be(r, 4, &bits) != 0)
+            return -1;
+        single = bits;
+        memcpy(value, &single, sizeof(*value));
+        return 0;
+    case 27:
+        if (cbor_get_be(r, 8, &bits) != 0)
+            return -1;
+        memcpy(&dbl, &bits, sizeof(dbl));
+        *value = dbl;
+        return 0;
+    }
+
+    return cbor_fail(r);
+}
+
+static int cbor_skip_depth(cbor_reader_t *r, int depth)
+{
+    uint32_t arg;
+    int major;
+
+    if (depth > CBOR_DEPTH_MAX || cbor_get_head(r, &major, &arg) != 0)
+        return cbor_fail(r);
+
+    switch (major) {
+    case CBOR_BYTES:
+    case CBOR_TEXT:
+        if (r->pos + arg > r->len)
+            return cbor_fail(r);
+        r->pos += arg;
+        break;
+    case CBOR_MAP:
+        if (arg > UINT32_MAX / 2)
+            return cbor_fail(r);
+        arg *= 2;
+        // fall through
+    case CBOR_ARRAY:
+        while (arg--) {
+            if (cbor_skip_depth(r, depth + 1) != 0)
+                return -1;
+        }
+        break;
+    case CBOR_TAG:
+        return cbor_skip_depth(r, depth + 1);
+    }
+
+    return 0;
+}
+
+int cbor_skip(cbor_reader_t *r)
+{
+    return cbor_skip_depth(r, 0);
+}
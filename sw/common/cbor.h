@@ -0,0 +1,80 @@
+#ifndef CBOR_H
+#define CBOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Minimal CBOR (RFC 7049) writer and reader over caller supplied buffers.
+ *
+ * Only what readings need: unsigned and negative integers, definite length text, arrays and maps, and
+ * floats. Integers always use the shortest head. The writer never allocates; once an item does not fit,
+ * the writer is marked as overflowed and cbor_writer_len returns 0.
+ */
+#define CBOR_UINT 0
+#define CBOR_NINT 1
+#define CBOR_BYTES 2
+#define CBOR_TEXT 3
+#define CBOR_ARRAY 4
+#define CBOR_MAP 5
+#define CBOR_TAG 6
+#define CBOR_SIMPLE 7
+
+typedef struct cbor_writer_t {
+    uint8_t *buf;
+    size_t size;
+    size_t len;
+    int overflow;
+} cbor_writer_t;
+
+void cbor_writer_init(cbor_writer_t *w, uint8_t *buf, size_t size);
+
+/**
+ * \return Encoded length, or 0 if anything did not fit
+ */
+size_t cbor_writer_len(const cbor_writer_t *w);
+
+void cbor_put_uint(cbor_writer_t *w, uint32_t value);
+void cbor_put_int(cbor_writer_t *w, int32_t value);
+void cbor_put_text(cbor_writer_t *w, const char *text, size_t len);
+void cbor_put_array(cbor_writer_t *w, uint32_t count);
+void cbor_put_map(cbor_writer_t *w, uint32_t count);
+/**
+ * Integral values that fit in 32 bits are written as integers, everything else as a single precision float
+ */
+void cbor_put_float(cbor_writer_t *w, float value);
+
+typedef struct cbor_reader_t {
+    const uint8_t *buf;
+    size_t len;
+    size_t pos;
+    int error;
+} cbor_reader_t;
+
+void cbor_reader_init(cbor_reader_t *r, const uint8_t *buf, size_t len);
+
+/**
+ * Read an item head
+ * \param[out] major CBOR_UINT etc.
+ * \param[out] arg Value, length or count; for CBOR_SIMPLE the additional information bits
+ * \return 0 on success, -1 on malformed or truncated input
+ */
+int cbor_get_head(cbor_reader_t *r, int *major, uint32_t *arg);
+
+/**
+ * \return 0 on success, -1 if the next item is not an integer in range
+ */
+int cbor_get_int(cbor_reader_t *r, int32_t *value);
+int cbor_get_uint(cbor_reader_t *r, uint32_t *value);
+
+/**
+ * Read a number: integers and half, single or double precision floats are all accepted
+ */
+int cbor_get_float(cbor_reader_t *r, float *value);
+
+/**
+ * Skip the next item including everything nested in it
+ */
+int cbor_skip(cbor_reader_t *r);
+
+#endif // CBOR_H
@@ -0,0 +1,164 @@
+#include <string.h>
+
+#include "batch.h"
+#include "dutycycle.h"
+
+#define DUTY_MAGIC 0x44545931 // "DTY1"
+
+static uint32_t fnv1a(uint32_t hash, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+
+    while (len--)
+        hash = (hash ^ *p++) * 16777619u;
+    return hash;
+}
+
+static uint32_t state_check(const duty_state_t *state)
+{
+    return fnv1a(2166136261u, state, offsetof(duty_state_t, check));
+}
+
+static void state_seal(duty_state_t *state)
+{
+    state->check = state_check(state);
+}
+
+/**
+ * \return Seconds until t, or 0 if t is past or further ahead than max (the clock restarted)
+ */
+static uint32_t time_left(uint32_t t, uint32_t now_s, uint32_t max)
+{
+    uint32_t left = t - now_s;
+
+    return left <= max ? left : 0;
+}
+
+/**
+ * \return Longest wait after a failed upload
+ */
+static uint32_t retry_max(const duty_policy_t *policy)
+{
+    return policy->max_latency_s > policy->retry_s ? policy->max_latency_s : policy->retry_s;
+}
+
+int duty_init(duty_state_t *state)
+{
+    if (state->magic == DUTY_MAGIC && state->check == state_check(state) && state->len <= sizeof(state->buf))
+        return 0;
+
+    memset(state, 0, sizeof(*state));
+    state->magic = DUTY_MAGIC;
+    state_seal(state);
+    return 1;
+}
+
+int duty_sample_due(const duty_state_t *state, const duty_policy_t *policy, uint32_t now_s)
+{
+    return !time_left(state->next_sample, now_s, policy->sample_s);
+}
+
+int duty_add(duty_state_t *state, const void *data, size_t len, uint32_t now_s)
+{
+    if (len > BATCH_RECORD_MAX || state->len + 1 + len > sizeof(state->buf))
+        return -1;
+
+    if (state->count == 0)
+        state->oldest = now_s;
+    state->buf[state->len] = len;
+    memcpy(state->buf + state->len + 1, data, len);
+    state->len += 1 + len;
+    state->adding += 1 + len;
+    state->count++;
+    state_seal(state);
+
+    return 0;
+}
+
+void duty_sampled(duty_state_t *state, const duty_policy_t *policy, uint32_t now_s)
+{
+    uint32_t next = state->next_sample + policy->sample_s;
+
+    if (!time_left(next, now_s, policy->sample_s))
+        next = now_s + policy->sample_s;
+    state->next_sample = next;
+    state->wake_len = state->adding;
+    state->adding = 0;
+    state_seal(state);
+}
+
+int duty_upload_due(const duty_state_t *state, const duty_policy_t *policy, uint32_t now_s)
+{
+    if (state->count == 0)
+        return 0;
+    // Retrying early would only spend the battery on another failure
+    if (state->failures)
+        return !time_left(state->retry_at, now_s, retry_max(policy));
+
+    if (policy->upload_count && state->count >= policy->upload_count)
+        return 1;
+    // Readings vary in length, so leave room for two more wakes
+    if (sizeof(state->buf) - state->len < 2u * state->wake_len)
+        return 1;
+    // Also true if the clock went back past the oldest reading
+    return now_s - state->oldest >= policy->max_latency_s;
+}
+
+void duty_upload_begin(duty_state_t *state, const duty_policy_t *policy, uint32_t now_s)
+{
+    uint32_t wait_s = policy->retry_s;
+
+    for (int n = 0; n < state->failures && wait_s < retry_max(policy); n++)
+        wait_s *= 2;
+    if (wait_s > retry_max(policy))
+        wait_s = retry_max(policy);
+
+    if (state->failures < UINT8_MAX)
+        state->failures++;
+    state->retry_at = now_s + wait_s;
+    state_seal(state);
+}
+
+void duty_upload_done(duty_state_t *state)
+{
+    state->failures = 0;
+    duty_clear(state);
+}
+
+void duty_clear(duty_state_t *state)
+{
+    state->count = 0;
+    state->len = 0;
+    state_seal(state);
+}
+
+const uint8_t *duty_next(const duty_state_t *state, size_t *pos, uint8_t *len)
+{
+    const uint8_t *record;
+
+    if (*pos >= state->len)
+        return NULL;
+
+    *len = state->buf[*pos];
+    record = state->buf + *pos + 1;
+    *pos += 1 + *len;
+    return record;
+}
+
+uint32_t duty_sleep_s(const duty_state_t *state, const duty_policy_t *policy, uint32_t now_s)
+{
+    uint32_t sleep_s = time_left(state->next_sample, now_s, policy->sample_s);
+
+    if (state->count) {
+        uint32_t upload_s;
+
+        if (state->failures)
+            upload_s = time_left(state->retry_at, now_s, retry_max(policy));
+        else
+            upload_s = time_left(state->oldest + policy->max_latency_s, now_s, policy->max_latency_s);
+        if (upload_s < sleep_s)
+            sleep_s = upload_s;
+    }
+
+    return sleep_s ? sleep_s : 1;
+}
@@ -0,0 +1,108 @@
+#ifndef DUTYCYCLE_H
+#define DUTYCYCLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Wake, sample, sleep duty cycle with burst uploads, for battery nodes.
+ *
+ * The node wakes every sample_s seconds, appends that wake's readings to a buffer it keeps in RTC memory and
+ * goes straight back to deep sleep without touching the radio. The radio only comes up when the buffer holds
+ * upload_count readings, when it is close to full, or when its oldest reading is
+ * max_latency_s old; that wake connects, publishes the whole buffer in one burst and sleeps again. Connecting
+ * costs far more than sampling, so the policy trades reading latency for battery life.
+ *
+ * duty_upload_begin counts the attempt as failed before the radio is touched, so a node that crashes or hangs
+ * halfway through an upload still backs off; duty_upload_done empties the buffer once the broker has
+ * acknowledged everything. After a failure the buffer is kept and the next attempt waits retry_s, doubling up
+ * to max_latency_s, however full the buffer gets. duty_add fails when it is full: the target moves the buffer
+ * to its offline log and clears it.
+ *
+ * Records are laid out as in a batch frame, { u8 len, u8 data[len] }. Times are in seconds of a clock the
+ * target keeps across sleep; times further ahead than the policy allows are treated as past, so a clock that
+ * restarted costs at most an early wake. The module does no I/O, so sw/host/duty_sim runs it on a simulated
+ * clock to compare policies.
+ */
+#ifndef DUTY_BUF_LEN
+#define DUTY_BUF_LEN 1024
+#endif
+
+typedef struct duty_policy_t {
+    uint32_t sample_s;      // Wake to sample this often
+    uint16_t upload_count;  // Upload once this many readings are buffered, 0 for none
+    uint32_t max_latency_s; // Upload once the oldest buffered reading is this old
+    uint32_t retry_s;       // First wait after a failed upload
+} duty_policy_t;
+
+typedef struct duty_state_t {
+    uint32_t magic;
+    uint32_t next_sample; // Wake to sample then
+    uint32_t oldest;      // Time of the oldest buffered reading
+    uint32_t retry_at;    // No upload before then after a failure
+    uint16_t count;       // Readings buffered
+    uint16_t len;         // Bytes buffered
+    uint16_t wake_len;    // Bytes added by the last wake that sampled
+    uint16_t adding;      // Bytes added by this wake so far
+    uint8_t failures;     // Failed uploads in a row
+    uint8_t buf[DUTY_BUF_LEN];
+    uint32_t check;       // Over everything above
+} duty_state_t;
+
+/**
+ * Take over the state kept in RTC memory, resetting it if it is torn or has never been set
+ * \return 1 if it was reset: the first sample is due now
+ */
+int duty_init(duty_state_t *state);
+
+/**
+ * \return true if the wake at now_s should take readings
+ */
+int duty_sample_due(const duty_state_t *state, const duty_policy_t *policy, uint32_t now_s);
+
+/**
+ * Buffer a reading, taken at now_s
+ * \return 0 on success, -1 if the buffer is full (or len is over BATCH_RECORD_MAX)
+ */
+int duty_add(duty_state_t *state, const void *data, size_t len, uint32_t now_s);
+
+/**
+ * Call once the wake's readings are added: schedules the next sample, keeping to the sample_s grid unless
+ * the node fell more than one interval behind
+ */
+void duty_sampled(duty_state_t *state, const duty_policy_t *policy, uint32_t now_s);
+
+/**
+ * \return true if the wake at now_s should connect and upload the buffer
+ */
+int duty_upload_due(const duty_state_t *state, const duty_policy_t *policy, uint32_t now_s);
+
+/**
+ * Call before connecting: the attempt counts as failed until duty_upload_done
+ */
+void duty_upload_begin(duty_state_t *state, const duty_policy_t *policy, uint32_t now_s);
+
+/**
+ * Call once every buffered reading is acknowledged: empties the buffer and clears the failures
+ */
+void duty_upload_done(duty_state_t *state);
+
+/**
+ * Empty the buffer, e.g. after moving it to the offline log; any backoff stays in place
+ */
+void duty_clear(duty_state_t *state);
+
+/**
+ * Iterate over the buffered readings, oldest first
+ * \param[in,out] pos 0 to start
+ * \param[out] len Length of the reading
+ * \return The reading, or NULL past the last one
+ */
+const uint8_t *duty_next(const duty_state_t *state, size_t *pos, uint8_t *len);
+
+/**
+ * \return Seconds to sleep from now_s until the next sample or upload is due, at least 1
+ */
+uint32_t duty_sleep_s(const duty_state_t *state, const duty_policy_t *policy, uint32_t now_s);
+
+#endif // DUTYCYCLE_H
@@ -0,0 +1,203 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "endpoint.h"
+
+#define ENDPOINT_MAGIC 0x45505431 // "EPT1"
+
+static uint32_t fnv1a(uint32_t hash, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+
+    while (len--)
+        hash = (hash ^ *p++) * 16777619u;
+    return hash;
+}
+
+static uint32_t list_hash(const endpoint_list_t *list)
+{
+    uint32_t hash = 2166136261u;
+
+    for (int i = 0; i < list->count; i++) {
+        hash = fnv1a(hash, list->endpoint[i].host, strlen(list->endpoint[i].host) + 1);
+        hash = fnv1a(hash, &list->endpoint[i].port, sizeof(list->endpoint[i].port));
+    }
+    return hash;
+}
+
+static uint32_t cache_check(const endpoint_cache_t *cache)
+{
+    return fnv1a(2166136261u, cache, offsetof(endpoint_cache_t, check));
+}
+
+static void cache_seal(endpoint_cache_t *cache)
+{
+    cache->check = cache_check(cache);
+}
+
+/**
+ * Parse one "host[:port]" entry of len bytes, surrounding spaces allowed
+ */
+static int parse_entry(endpoint_t *endpoint, const char *entry, size_t len, uint16_t default_port)
+{
+    const char *colon;
+    uint32_t port = 0;
+
+    while (len && *entry == ' ') {
+        entry++;
+        len--;
+    }
+    while (len && entry[len - 1] == ' ')
+        len--;
+
+    if ((colon = memchr(entry, ':', len)) != NULL) {
+        for (const char *p = colon + 1; p < entry + len; p++) {
+            if (*p < '0' || *p > '9' || (port = port * 10 + (*p - '0')) > UINT16_MAX)
+                return -1;
+        }
+        len = colon - entry;
+    } else {
+        port = default_port;
+    }
+
+    if (len == 0 || len >= sizeof(endpoint->host) || port == 0)
+        return -1;
+    memcpy(endpoint->host, entry, len);
+    endpoint->host[len] = '\0';
+    endpoint->port = port;
+
+    return 0;
+}
+
+int endpoint_list_init(endpoint_list_t *list, const char *conf, uint16_t default_port, endpoint_cache_t *cache)
+{
+    const char *entry = conf;
+
+    memset(list, 0, sizeof(*list));
+    for (;;) {
+        const char *end = strchr(entry, ',');
+        size_t len = end ? (size_t)(end - entry) : strlen(entry);
+
+        if (list->count == ENDPOINT_MAX || parse_entry(&list->endpoint[list->count], entry, len, default_port) != 0)
+            return -1;
+        list->count++;
+        if (!end)
+            break;
+        entry = end + 1;
+    }
+
+    list->cache = cache;
+    if (cache->magic != ENDPOINT_MAGIC || cache->list_hash != list_hash(list) || cache->check != cache_check(cache)) {
+        memset(cache, 0, sizeof(*cache));
+        cache->magic = ENDPOINT_MAGIC;
+        cache->list_hash = list_hash(list);
+        cache_seal(cache);
+    }
+
+    return 0;
+}
+
+/**
+ * \return Seconds until t, or 0 if t is past or further ahead than max (the clock restarted)
+ */
+static uint32_t time_left(uint32_t t, uint32_t now_s, uint32_t max)
+{
+    uint32_t left = t - now_s;
+
+    return left <= max ? left : 0;
+}
+
+int endpoint_select(const endpoint_list_t *list, uint32_t now_s)
+{
+    uint32_t best_score = 0, due_left = UINT32_MAX;
+    int best = -1, due = 0;
+
+    for (int i = 0; i < list->count; i++) {
+        const endpoint_state_t *s = &list->cache->state[i];
+        uint32_t left = s->fails ? time_left(s->retry_at, now_s, ENDPOINT_RETRY_MAX_S) : 0;
+        // Never connected to scores best, so every endpoint gets measured; ties go to the configured order
+        uint32_t score = s->connects ? (uint32_t)s->connect_ms + s->ack_ms : 0;
+
+        if (left) {
+            if (left < due_left) {
+                due = i;
+                due_left = left;
+            }
+        } else if (best < 0 || score < best_score) {
+            best = i;
+            best_score = score;
+        }
+    }
+
+    return best >= 0 ? best : due;
+}
+
+const char *endpoint_addr(const endpoint_list_t *list, int i, uint32_t now_s, char *buf)
+{
+    const endpoint_state_t *s = &list->cache->state[i];
+
+    if (!s->has_addr || !time_left(s->addr_expires, now_s, ENDPOINT_DNS_TTL_S))
+        return NULL;
+
+    snprintf(buf, ENDPOINT_ADDR_STR_LEN, "%u.%u.%u.%u", s->addr[0], s->addr[1], s->addr[2], s->addr[3]);
+    return buf;
+}
+
+void endpoint_resolved(endpoint_list_t *list, int i, const uint8_t *addr, uint32_t now_s)
+{
+    endpoint_state_t *s = &list->cache->state[i];
+
+    memcpy(s->addr, addr, sizeof(s->addr));
+    s->addr_expires = now_s + ENDPOINT_DNS_TTL_S;
+    s->has_addr = 1;
+    cache_seal(list->cache);
+}
+
+/**
+ * Fold a sample into a smoothed time, a quarter at a time; the first sample is taken as is
+ */
+static uint16_t smooth(uint16_t avg, uint8_t *samples, uint32_t sample_ms)
+{
+    if (sample_ms > UINT16_MAX)
+        sample_ms = UINT16_MAX;
+    if (*samples < UINT8_MAX)
+        (*samples)++;
+
+    return *samples == 1 ? sample_ms : avg - avg / 4 + sample_ms / 4;
+}
+
+void endpoint_connected(endpoint_list_t *list, int i, uint32_t connect_ms)
+{
+    endpoint_state_t *s = &list->cache->state[i];
+
+    s->connect_ms = smooth(s->connect_ms, &s->connects, connect_ms);
+    s->fails = 0;
+    cache_seal(list->cache);
+}
+
+void endpoint_acked(endpoint_list_t *list, int i, uint32_t ack_ms)
+{
+    endpoint_state_t *s = &list->cache->state[i];
+
+    s->ack_ms = smooth(s->ack_ms, &s->acks, ack_ms);
+    cache_seal(list->cache);
+}
+
+void endpoint_failed(endpoint_list_t *list, int i, uint32_t now_s)
+{
+    endpoint_state_t *s = &list->cache->state[i];
+    uint32_t wait_s = ENDPOINT_RETRY_BASE_S;
+
+    for (int n = 0; n < s->fails && wait_s < ENDPOINT_RETRY_MAX_S; n++)
+        wait_s *= 2;
+    if (wait_s > ENDPOINT_RETRY_MAX_S)
+        wait_s = ENDPOINT_RETRY_MAX_S;
+
+    // The broker may have moved
+    s->has_addr = 0;
+    if (s->fails < UINT8_MAX)
+        s->fails++;
+    s->retry_at = now_s + wait_s;
+    cache_seal(list->cache);
+}
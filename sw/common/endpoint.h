@@ -0,0 +1,100 @@
+#ifndef ENDPOINT_H
+#define ENDPOINT_H
+
+#include <stdint.h>
+
+/*
+ * Broker endpoint list with a DNS cache and latency-aware failover.
+ *
+ * The list is configured as "host[:port],host[:port],...". Each endpoint keeps its resolved IPv4 address,
+ * smoothed connect and PUBACK times, and its consecutive failures in an endpoint_cache_t that the target
+ * keeps in RTC memory, so a node waking from deep sleep connects by address without a DNS lookup and goes
+ * straight to the broker that served it best. The cache is reset when the list changes.
+ *
+ * endpoint_select prefers endpoints never connected to (so each gets measured), then the lowest connect
+ * plus PUBACK time. A failure drops the endpoint's cached address and passes it over for a while, longer
+ * after each failure in a row; when every endpoint is being passed over the one due first is tried.
+ *
+ * Times are in seconds of a clock the target keeps across sleep. getaddrinfo does not report record TTLs,
+ * so addresses are kept for ENDPOINT_DNS_TTL_S; a failed connect re-resolves sooner. Expiry and retry times
+ * further ahead than their maximum are treated as past, so a clock that restarted only costs a lookup.
+ */
+#define ENDPOINT_MAX 4
+#define ENDPOINT_HOST_LEN 64
+#define ENDPOINT_ADDR_STR_LEN 16 // Dotted quad
+
+#ifndef ENDPOINT_DNS_TTL_S
+#define ENDPOINT_DNS_TTL_S 3600
+#endif
+#define ENDPOINT_RETRY_BASE_S 30
+#define ENDPOINT_RETRY_MAX_S 3600
+
+typedef struct endpoint_t {
+    char host[ENDPOINT_HOST_LEN];
+    uint16_t port;
+} endpoint_t;
+
+typedef struct endpoint_state_t {
+    uint8_t addr[4];       // IPv4, valid if has_addr until addr_expires
+    uint32_t addr_expires;
+    uint32_t retry_at;     // Passed over until then after a failure
+    uint16_t connect_ms;   // Smoothed TCP, TLS and MQTT CONNECT time
+    uint16_t ack_ms;       // Smoothed QoS1 PUBLISH to PUBACK time
+    uint8_t has_addr;
+    uint8_t fails;         // Failures in a row
+    uint8_t connects;      // Connect time samples, saturating
+    uint8_t acks;          // PUBACK time samples, saturating
+} endpoint_state_t;
+
+typedef struct endpoint_cache_t {
+    uint32_t magic;
+    uint32_t list_hash; // Of the endpoints it describes
+    endpoint_state_t state[ENDPOINT_MAX];
+    uint32_t check;     // Over everything above
+} endpoint_cache_t;
+
+typedef struct endpoint_list_t {
+    endpoint_t endpoint[ENDPOINT_MAX];
+    int count;
+    endpoint_cache_t *cache;
+} endpoint_list_t;
+
+/**
+ * Parse the configured list and take over the cache, resetting it if it is torn or for another list
+ * \param default_port For entries without one
+ * \return 0 on success, -1 if the list is empty, has more than ENDPOINT_MAX entries or an invalid one
+ */
+int endpoint_list_init(endpoint_list_t *list, const char *conf, uint16_t default_port, endpoint_cache_t *cache);
+
+/**
+ * \return Index of the endpoint to connect to next
+ */
+int endpoint_select(const endpoint_list_t *list, uint32_t now_s);
+
+/**
+ * \param[out] buf ENDPOINT_ADDR_STR_LEN bytes
+ * \return buf holding the cached address of endpoint i, or NULL if it has none: resolve the host
+ */
+const char *endpoint_addr(const endpoint_list_t *list, int i, uint32_t now_s, char *buf);
+
+/**
+ * Cache the IPv4 address (network order) the host of endpoint i resolved to
+ */
+void endpoint_resolved(endpoint_list_t *list, int i, const uint8_t *addr, uint32_t now_s);
+
+/**
+ * Record a successful connect to endpoint i and how long it took
+ */
+void endpoint_connected(endpoint_list_t *list, int i, uint32_t connect_ms);
+
+/**
+ * Record a PUBACK time from endpoint i
+ */
+void endpoint_acked(endpoint_list_t *list, int i, uint32_t ack_ms);
+
+/**
+ * Record a failed connect to endpoint i: its address is resolved again and it is passed over for a while
+ */
+void endpoint_failed(endpoint_list_t *list, int i, uint32_t now_s);
+
+#endif // ENDPOINT_H
@@ -0,0 +1,134 @@
+#include <string.h>
+
+#include "filter.h"
+
+void filter_chain_init(filter_chain_t *chain)
+{
+    memset(chain, 0, sizeof(*chain));
+}
+
+static filter_stage_t *filter_append(filter_chain_t *chain, filter_type_t type)
+{
+    filter_stage_t *stage;
+
+    if (chain->count >= FILTER_STAGES_MAX)
+        return NULL;
+
+    stage = &chain->stage[chain->count++];
+    memset(stage, 0, sizeof(*stage));
+    stage->type = type;
+    return stage;
+}
+
+int filter_add_average(filter_chain_t *chain, uint16_t n)
+{
+    filter_stage_t *stage;
+
+    if (n < 1 || n > FILTER_WINDOW_MAX || !(stage = filter_append(chain, FILTER_AVERAGE)))
+        return -1;
+    stage->n = n;
+    return 0;
+}
+
+int filter_add_window(filter_chain_t *chain, uint16_t n, filter_stat_t stat)
+{
+    filter_stage_t *stage;
+
+    if (n < 1 || !(stage = filter_append(chain, FILTER_WINDOW)))
+        return -1;
+    stage->n = n;
+    stage->stat = stat;
+    return 0;
+}
+
+int filter_add_delta(filter_chain_t *chain, float deadband, uint32_t heartbeat_ms)
+{
+    filter_stage_t *stage;
+
+    if (!(deadband >= 0) || !(stage = filter_append(chain, FILTER_DELTA)))
+        return -1;
+    stage->deadband = deadband;
+    stage->heartbeat_ms = heartbeat_ms;
+    return 0;
+}
+
+void filter_reset(filter_chain_t *chain)
+{
+    for (int i = 0; i < chain->count; i++) {
+        chain->stage[i].count = 0;
+        chain->stage[i].pos = 0;
+    }
+}
+
+static int filter_average(filter_stage_t *stage, reading_t *reading)
+{
+    float sum = 0;
+
+    stage->values[stage->pos] = reading->value;
+    stage->pos = (stage->pos + 1) % stage->n;
+    if (stage->count < stage->n)
+        stage->count++;
+
+    // Summed afresh every time: a running sum would drift as float rounding piles up
+    for (int i = 0; i < stage->count; i++)
+        sum += stage->values[i];
+    reading->value = sum / stage->count;
+    return 1;
+}
+
+static int filter_window(filter_stage_t *stage, reading_t *reading)
+{
+    float value = reading->value;
+
+    if (stage->count++ == 0)
+        stage->acc = value;
+    else if (stage->stat == FILTER_STAT_MIN)
+        stage->acc = value < stage->acc ? value : stage->acc;
+    else if (stage->stat == FILTER_STAT_MAX)
+        stage->acc = value > stage->acc ? value : stage->acc;
+    else
+        stage->acc += value;
+
+    if (stage->count < stage->n)
+        return 0;
+
+    reading->value = stage->stat == FILTER_STAT_MEAN ? stage->acc / stage->n : stage->acc;
+    stage->count = 0;
+    return 1;
+}
+
+static int filter_delta(filter_stage_t *stage, reading_t *reading)
+{
+    float change = reading->value - stage->last;
+
+    if (change < 0)
+        change = -change;
+    // A clock that went back past the last reading counts as a heartbeat
+    if (stage->count && change < stage->deadband
+            && !(stage->heartbeat_ms && reading->ts - stage->last_ts >= stage->heartbeat_ms))
+        return 0;
+
+    stage->last = reading->value;
+    stage->last_ts = reading->ts;
+    stage->count = 1;
+    return 1;
+}
+
+int filter_run(filter_chain_t *chain, reading_t *reading)
+{
+    for (int i = 0; i < chain->count; i++) {
+        filter_stage_t *stage = &chain->stage[i];
+        int pass;
+
+        switch (stage->type) {
+        case FILTER_AVERAGE: pass = filter_average(stage, reading); break;
+        case FILTER_WINDOW: pass = filter_window(stage, reading); break;
+        case FILTER_DELTA: pass = filter_delta(stage, reading); break;
+        default: pass = 1; break;
+        }
+        if (!pass)
+            return 0;
+    }
+
+    return 1;
+}
@@ -0,0 +1,95 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stdint.h>
+
+#include "reading.h"
+
+/*
+ * Per sensor filter chain between a fast fixed rate sampler and the uplink.
+ *
+ * Each reading runs through the stages in order; a stage either passes it on, possibly with a new value, or
+ * holds it back, which ends the run. Whatever leaves the last stage is queued for publishing.
+ *
+ *   average  Moving average of the last n readings; passes every reading, smoothed. Takes off sampling noise
+ *            before a delta stage, which would otherwise publish it.
+ *   window   One reading per n: their minimum, maximum or mean, with the time of the last. Decimates.
+ *   delta    Send on delta: passes a reading only if it moved at least deadband from the last one passed, or
+ *            heartbeat_ms went by without one, so a quiet sensor is still heard from. The first reading
+ *            always passes. Between readings passed, the value stays within deadband of the last one sent.
+ *
+ * Stages keep their state in the chain, so a chain belongs to one sensor. Times are the readings' ts, in ms.
+ * The module does no I/O; sw/host/filter_bench checks each stage against a reference and measures it.
+ */
+#define FILTER_STAGES_MAX 4
+#define FILTER_WINDOW_MAX 16 // Longest moving average
+
+typedef enum {
+    FILTER_AVERAGE = 0,
+    FILTER_WINDOW,
+    FILTER_DELTA,
+} filter_type_t;
+
+typedef enum {
+    FILTER_STAT_MEAN = 0,
+    FILTER_STAT_MIN,
+    FILTER_STAT_MAX,
+} filter_stat_t;
+
+typedef struct filter_stage_t {
+    uint8_t type;         // filter_type_t
+    uint8_t stat;         // filter_stat_t, window only
+    uint16_t n;           // Readings averaged or per window
+    float deadband;       // Delta only
+    uint32_t heartbeat_ms; // Delta only, 0 for none
+    // State
+    uint16_t count;       // Readings held
+    uint16_t pos;         // Next slot of values, average only
+    float values[FILTER_WINDOW_MAX]; // Average only
+    float acc;            // Window sum, minimum or maximum
+    float last;           // Delta: value last passed
+    uint32_t last_ts;
+} filter_stage_t;
+
+typedef struct filter_chain_t {
+    uint8_t count;
+    filter_stage_t stage[FILTER_STAGES_MAX];
+} filter_chain_t;
+
+/**
+ * Start a chain without stages: it passes every reading
+ */
+void filter_chain_init(filter_chain_t *chain);
+
+/**
+ * Append a moving average over n readings
+ * \return 0 on success, -1 if the chain is full or n is not 1 to FILTER_WINDOW_MAX
+ */
+int filter_add_average(filter_chain_t *chain, uint16_t n);
+
+/**
+ * Append a window passing one reading per n
+ * \return 0 on success, -1 if the chain is full or n is 0
+ */
+int filter_add_window(filter_chain_t *chain, uint16_t n, filter_stat_t stat);
+
+/**
+ * Append a send on delta stage
+ * \param heartbeat_ms Pass a reading at least this often, 0 for only on change
+ * \return 0 on success, -1 if the chain is full or deadband is negative
+ */
+int filter_add_delta(filter_chain_t *chain, float deadband, uint32_t heartbeat_ms);
+
+/**
+ * Forget the readings held, e.g. after a gap in sampling; the stages stay
+ */
+void filter_reset(filter_chain_t *chain);
+
+/**
+ * Run a reading through the chain
+ * \param[in,out] reading Takes the value the last stage passed
+ * \return 1 if the reading came out of the chain: publish it, 0 if a stage held it back
+ */
+int filter_run(filter_chain_t *chain, reading_t *reading);
+
+#endif // FILTER_H
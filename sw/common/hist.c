@@ -0,0 +1,72 @@
+#include <string.h>
+
+#include "hist.h"
+
+static int hist_index(uint32_t value)
+{
+    int e = 0;
+    int idx;
+
+    if (value < 4)
+        return value;
+
+    for (uint32_t v = value; v > 1; v >>= 1)
+        e++;
+
+    idx = 4 * (e - 1) + ((value >> (e - 2)) & 3);
+    return idx < HIST_BUCKETS ? idx : HIST_BUCKETS - 1;
+}
+
+static uint32_t hist_upper(int idx)
+{
+    int e = idx / 4 + 1;
+
+    if (idx < 4)
+        return idx;
+
+    return ((uint32_t)(4 + idx % 4) << (e - 2)) + ((uint32_t)1 << (e - 2)) - 1;
+}
+
+void hist_init(hist_t *hist)
+{
+    memset(hist, 0, sizeof(*hist));
+}
+
+void hist_add(hist_t *hist, uint32_t value)
+{
+    hist->bucket[hist_index(value)]++;
+    hist->count++;
+    if (value > hist->max)
+        hist->max = value;
+}
+
+void hist_merge(hist_t *dst, const hist_t *src)
+{
+    for (int i = 0; i < HIST_BUCKETS; i++)
+        dst->bucket[i] += src->bucket[i];
+    dst->count += src->count;
+    if (src->max > dst->max)
+        dst->max = src->max;
+}
+
+uint32_t hist_percentile(const hist_t *hist, unsigned percent)
+{
+    uint64_t rank = ((uint64_t)hist->count * percent + 99) / 100;
+    uint64_t seen = 0;
+
+    if (hist->count == 0)
+        return 0;
+    if (rank == 0)
+        rank = 1;
+
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += hist->bucket[i];
+        if (seen >= rank) {
+            uint32_t upper = hist_upper(i);
+            // The last bucket is open ended, and no bucket bound should exceed what was actually seen
+            return i == HIST_BUCKETS - 1 || upper > hist->max ? hist->max : upper;
+        }
+    }
+
+    return hist->max;
+}
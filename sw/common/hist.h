@@ -0,0 +1,30 @@
+#ifndef HIST_H
+#define HIST_H
+
+#include <stdint.h>
+
+/*
+ * Fixed size latency histogram.
+ *
+ * Values 0-3 get a bucket each; above that every power of two is split into four buckets, so a bucket is at
+ * most 25% wide and values up to 131071 (e.g. ms) are resolved. Larger values share the last bucket.
+ */
+#define HIST_BUCKETS 64
+
+typedef struct hist_t {
+    uint32_t count;
+    uint32_t max;
+    uint32_t bucket[HIST_BUCKETS];
+} hist_t;
+
+void hist_init(hist_t *hist);
+void hist_add(hist_t *hist, uint32_t value);
+void hist_merge(hist_t *dst, const hist_t *src);
+
+/**
+ * \param percent 0-100
+ * \return Upper bound of the bucket holding the percentile, 0 if the histogram is empty
+ */
+uint32_t hist_percentile(const hist_t *hist, unsigned percent);
+
+#endif // HIST_H
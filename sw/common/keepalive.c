@@ -0,0 +1,101 @@
+#include "keepalive.h"
+
+void keepalive_init(keepalive_t *keepalive, uint32_t interval_ms, uint32_t now_ms)
+{
+    keepalive->interval_ms = interval_ms;
+    keepalive->last_tx_ms = now_ms;
+    keepalive->last_rx_ms = now_ms;
+    keepalive->expecting = 0;
+    keepalive->pinging = 0;
+    keepalive->srtt_ms = 0;
+    keepalive->rttvar_ms = 0;
+}
+
+void keepalive_sent(keepalive_t *keepalive, uint32_t now_ms, int expects_reply)
+{
+    keepalive->last_tx_ms = now_ms;
+    if (expects_reply && !keepalive->expecting) {
+        keepalive->expecting = 1;
+        keepalive->expect_ms = now_ms;
+    }
+}
+
+void keepalive_received(keepalive_t *keepalive, uint32_t now_ms)
+{
+    // Any reply shows the link is alive; later requests restart the clock
+    keepalive->last_rx_ms = now_ms;
+    keepalive->expecting = 0;
+}
+
+void keepalive_pong(keepalive_t *keepalive, uint32_t now_ms)
+{
+    uint32_t rtt;
+
+    keepalive_received(keepalive, now_ms);
+    if (!keepalive->pinging)
+        return;
+    keepalive->pinging = 0;
+
+    rtt = now_ms - keepalive->ping_ms;
+    if (keepalive->srtt_ms == 0) {
+        keepalive->srtt_ms = rtt ? rtt : 1;
+        keepalive->rttvar_ms = rtt / 2;
+    } else {
+        uint32_t err = rtt > keepalive->srtt_ms ? rtt - keepalive->srtt_ms : keepalive->srtt_ms - rtt;
+        keepalive->rttvar_ms = (3 * keepalive->rttvar_ms + err) / 4;
+        keepalive->srtt_ms = (7 * keepalive->srtt_ms + rtt) / 8;
+    }
+}
+
+uint32_t keepalive_timeout(const keepalive_t *keepalive)
+{
+    uint32_t timeout;
+
+    if (keepalive->srtt_ms == 0)
+        timeout = KEEPALIVE_TIMEOUT_INITIAL_MS;
+    else
+        timeout = keepalive->srtt_ms + 4 * keepalive->rttvar_ms;
+
+    if (timeout < KEEPALIVE_TIMEOUT_MIN_MS)
+        timeout = KEEPALIVE_TIMEOUT_MIN_MS;
+    if (timeout > keepalive->interval_ms / 2)
+        timeout = keepalive->interval_ms / 2;
+
+    return timeout;
+}
+
+keepalive_action_t keepalive_poll(keepalive_t *keepalive, uint32_t now_ms)
+{
+    uint32_t timeout = keepalive_timeout(keepalive);
+
+    if (keepalive->pinging) {
+        if (now_ms - keepalive->ping_ms >= timeout)
+            return KEEPALIVE_DEAD;
+        return KEEPALIVE_IDLE;
+    }
+
+    // Probe early if a request has gone unanswered, or before the broker's keepalive would expire
+    if ((keepalive->expecting && now_ms - keepalive->expect_ms >= timeout) ||
+        now_ms - keepalive->last_tx_ms >= keepalive->interval_ms - timeout) {
+        keepalive->pinging = 1;
+        keepalive->ping_ms = now_ms;
+        return KEEPALIVE_PING;
+    }
+
+    return KEEPALIVE_IDLE;
+}
+
+uint32_t keepalive_next(const keepalive_t *keepalive, uint32_t now_ms)
+{
+    uint32_t timeout = keepalive_timeout(keepalive);
+    uint32_t due;
+
+    if (keepalive->pinging)
+        due = keepalive->ping_ms + timeout;
+    else if (keepalive->expecting && keepalive->expect_ms + timeout < keepalive->last_tx_ms + keepalive->interval_ms - timeout)
+        due = keepalive->expect_ms + timeout;
+    else
+        due = keepalive->last_tx_ms + keepalive->interval_ms - timeout;
+
+    return (int32_t)(due - now_ms) > 0 ? due - now_ms : 0;
+}
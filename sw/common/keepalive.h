@@ -0,0 +1,70 @@
+#ifndef KEEPALIVE_H
+#define KEEPALIVE_H
+
+#include <stdint.h>
+
+/*
+ * MQTT keepalive scheduler.
+ *
+ * Any outbound packet satisfies the broker's keepalive, so a PINGREQ is only due once the link has been idle
+ * long enough that the ping would otherwise arrive late. PINGRESP round trips feed a smoothed RTT estimate
+ * (RFC 6298 style), and the response deadline is derived from it rather than from the keepalive interval.
+ * When a reply-bearing packet (e.g. a QoS1 PUBLISH) goes unanswered past that deadline, an early PINGREQ
+ * probes the link, so a half-open connection is detected within a few round trips.
+ */
+#define KEEPALIVE_TIMEOUT_MIN_MS 1000
+#define KEEPALIVE_TIMEOUT_INITIAL_MS 5000
+
+typedef enum {
+    KEEPALIVE_IDLE = 0, // Nothing to do
+    KEEPALIVE_PING,     // Send a PINGREQ now and record it with keepalive_sent
+    KEEPALIVE_DEAD,     // No response in time: reconnect
+} keepalive_action_t;
+
+typedef struct keepalive_t {
+    uint32_t interval_ms;
+    uint32_t last_tx_ms;
+    uint32_t last_rx_ms;
+    uint32_t expect_ms; // Oldest unanswered request, valid if expecting
+    int expecting;
+    uint32_t ping_ms;   // Outstanding PINGREQ, valid if pinging
+    int pinging;
+    uint32_t srtt_ms;   // Smoothed RTT, 0 until the first sample
+    uint32_t rttvar_ms;
+} keepalive_t;
+
+/**
+ * \param interval_ms Keepalive interval sent in CONNECT
+ */
+void keepalive_init(keepalive_t *keepalive, uint32_t interval_ms, uint32_t now_ms);
+
+/**
+ * Record an outbound packet
+ * \param expects_reply Set for requests the broker must answer (PUBLISH QoS1, SUBSCRIBE). PINGREQs are
+ *        tracked by keepalive_poll already.
+ */
+void keepalive_sent(keepalive_t *keepalive, uint32_t now_ms, int expects_reply);
+
+/**
+ * Record an inbound packet
+ */
+void keepalive_received(keepalive_t *keepalive, uint32_t now_ms);
+
+/**
+ * Record a PINGRESP: completes the outstanding ping and takes an RTT sample
+ */
+void keepalive_pong(keepalive_t *keepalive, uint32_t now_ms);
+
+keepalive_action_t keepalive_poll(keepalive_t *keepalive, uint32_t now_ms);
+
+/**
+ * \return Current response deadline in ms
+ */
+uint32_t keepalive_timeout(const keepalive_t *keepalive);
+
+/**
+ * \return Time in ms until keepalive_poll next needs to be called
+ */
+uint32_t keepalive_next(const keepalive_t *keepalive, uint32_t now_ms);
+
+#endif // KEEPALIVE_H
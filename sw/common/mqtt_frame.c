@@ -0,0 +1,98 @@
+#include "mqtt_frame.h"
+
+#define FRAME_DISCARD_LEN 64
+
+enum { FRAME_TYPE, FRAME_LENGTH, FRAME_BODY, FRAME_DONE };
+
+void mqtt_frame_init(mqtt_frame_t *frame, uint8_t *buf, uint32_t size)
+{
+    frame->buf = buf;
+    frame->size = size;
+    frame->state = FRAME_TYPE;
+    frame->rem_len = 0;
+    frame->multiplier = 1;
+    frame->total = 0;
+    frame->len = 0;
+    frame->left = 0;
+}
+
+int mqtt_frame_read(mqtt_frame_t *frame, mqtt_frame_read_t read, void *ctx)
+{
+    uint8_t discard[FRAME_DISCARD_LEN];
+    int ret;
+
+    if (frame->state == FRAME_DONE)
+        frame->state = FRAME_TYPE;
+
+    if (frame->state == FRAME_TYPE) {
+        if ((ret = read(ctx, frame->buf, 1)) <= 0)
+            return ret < 0 ? MQTT_FRAME_ERR : 0;
+        frame->len = 1;
+        frame->rem_len = 0;
+        frame->multiplier = 1;
+        frame->state = FRAME_LENGTH;
+    }
+
+    while (frame->state == FRAME_LENGTH) {
+        uint8_t byte;
+
+        if ((ret = read(ctx, &byte, 1)) <= 0)
+            return ret < 0 ? MQTT_FRAME_ERR : 0;
+        frame->buf[frame->len++] = byte;
+        frame->rem_len += (byte & 0x7f) * frame->multiplier;
+        frame->multiplier *= 128;
+        if (!(byte & 0x80)) {
+            frame->total = frame->len + frame->rem_len;
+            frame->left = frame->rem_len;
+            frame->state = FRAME_BODY;
+        } else if (frame->len == MQTT_FRAME_MIN) {
+            return MQTT_FRAME_ERR;
+        }
+    }
+
+    // Into the buffer while it has room, then discarded
+    while (frame->left) {
+        uint32_t room = frame->size - frame->len;
+        uint32_t want = frame->left;
+        uint8_t *dst = frame->buf + frame->len;
+
+        if (room == 0) {
+            dst = discard;
+            room = sizeof(discard);
+        }
+        if (want > room)
+            want = room;
+        if ((ret = read(ctx, dst, want)) <= 0)
+            return ret < 0 ? MQTT_FRAME_ERR : 0;
+        if (dst != discard)
+            frame->len += ret;
+        frame->left -= ret;
+    }
+
+    frame->state = FRAME_DONE;
+    return frame->buf[0] >> 4;
+}
+
+int mqtt_frame_truncated(const mqtt_frame_t *frame)
+{
+    return frame->len < frame->total;
+}
+
+int mqtt_frame_publish_qos(const mqtt_frame_t *frame, uint16_t *packet_id)
+{
+    int qos = (frame->buf[0] >> 1) & 3;
+    uint32_t header = frame->total - frame->rem_len;
+    uint32_t id;
+
+    *packet_id = 0;
+    if (qos == 0)
+        return 0;
+    // Topic name, then the packet ID
+    if (header + 2 > frame->len)
+        return -1;
+    id = header + 2 + (frame->buf[header] << 8 | frame->buf[header + 1]);
+    if (id + 2 > frame->len || id + 2 > frame->total)
+        return -1;
+    *packet_id = frame->buf[id] << 8 | frame->buf[id + 1];
+    return qos;
+}
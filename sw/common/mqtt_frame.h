@@ -0,0 +1,61 @@
+#ifndef MQTT_FRAME_H
+#define MQTT_FRAME_H
+
+#include <stdint.h>
+
+/*
+ * Inbound MQTT packet framing over a non-blocking byte stream.
+ *
+ * Packets are read into a caller supplied buffer laid out as on the wire (fixed header, remaining length,
+ * body), so the paho deserializers can parse them in place. A read that stops short resumes on the next call.
+ *
+ * A packet larger than the buffer does not fail the link: its start is kept, up to the size of the buffer,
+ * and the rest is read and discarded. With a persistent session the broker redelivers an unacknowledged
+ * PUBLISH on every connect, so one too large for the node must still be acknowledged;
+ * mqtt_frame_publish_qos finds its packet ID in the part that was kept.
+ */
+#define MQTT_FRAME_ERR -1 // Transport error or malformed remaining length
+#define MQTT_FRAME_MIN 5  // Smallest buffer: the fixed header with the longest remaining length
+
+/**
+ * \return Bytes read into buf, up to len, 0 if none are available yet, or -1 on error
+ */
+typedef int (*mqtt_frame_read_t)(void *ctx, uint8_t *buf, int len);
+
+typedef struct mqtt_frame_t {
+    uint8_t *buf;
+    uint32_t size;
+    int state;
+    uint32_t rem_len;    // Remaining length of the packet being read
+    uint32_t multiplier;
+    uint32_t total;      // Its length, fixed header included
+    uint32_t len;        // Bytes of it in buf
+    uint32_t left;       // Bytes of it still to read
+} mqtt_frame_t;
+
+/**
+ * \param size At least MQTT_FRAME_MIN
+ */
+void mqtt_frame_init(mqtt_frame_t *frame, uint8_t *buf, uint32_t size);
+
+/**
+ * Read until a whole packet has been framed or the stream has nothing more for now
+ * \return Packet type once a packet is complete, 0 if more data is needed, or MQTT_FRAME_ERR, after which the
+ *         stream is out of step: start over with mqtt_frame_init on a new connection. A packet stays in buf
+ *         until the next call.
+ */
+int mqtt_frame_read(mqtt_frame_t *frame, mqtt_frame_read_t read, void *ctx);
+
+/**
+ * \return true if the packet last framed did not fit in the buffer, and only its first len bytes were kept
+ */
+int mqtt_frame_truncated(const mqtt_frame_t *frame);
+
+/**
+ * Find the QoS and packet ID of the PUBLISH last framed, even if it was truncated
+ * \param[out] packet_id Set for QoS 1 and 2
+ * \return QoS, or -1 if the packet ID lies beyond the part kept
+ */
+int mqtt_frame_publish_qos(const mqtt_frame_t *frame, uint16_t *packet_id);
+
+#endif // MQTT_FRAME_H
@@ -0,0 +1,93 @@
+#include <string.h>
+
+#include "cbor.h"
+#include "reading.h"
+
+static const char *unit_names[READING_UNIT_MAX] = {
+    "", "count", "B", "C", "%RH", "Pa", "V",
+};
+
+static const char *sensor_names[READING_SENSOR_MAX] = {
+    "counter", "heap_free", "stack_free", "temperature", "humidity", "pressure", "supply",
+};
+
+size_t reading_encode(const reading_t *reading, uint8_t *buf, size_t size)
+{
+    cbor_writer_t w;
+
+    cbor_writer_init(&w, buf, size);
+    cbor_put_map(&w, 5);
+    cbor_put_uint(&w, READING_KEY_VERSION);
+    cbor_put_uint(&w, READING_VERSION);
+    cbor_put_uint(&w, READING_KEY_TS);
+    cbor_put_uint(&w, reading->ts);
+    cbor_put_uint(&w, READING_KEY_SENSOR);
+    cbor_put_uint(&w, reading->sensor);
+    cbor_put_uint(&w, READING_KEY_VALUE);
+    cbor_put_float(&w, reading->value);
+    cbor_put_uint(&w, READING_KEY_UNIT);
+    cbor_put_uint(&w, reading->unit);
+
+    return cbor_writer_len(&w);
+}
+
+int reading_decode(reading_t *reading, int *version, const uint8_t *buf, size_t len)
+{
+    cbor_reader_t r;
+    uint32_t count, key, value;
+    int major;
+
+    memset(reading, 0, sizeof(*reading));
+    *version = 0;
+
+    cbor_reader_init(&r, buf, len);
+    if (cbor_get_head(&r, &major, &count) != 0 || major != CBOR_MAP)
+        return -1;
+
+    while (count--) {
+        if (cbor_get_uint(&r, &key) != 0)
+            return -1;
+
+        switch (key) {
+        case READING_KEY_VERSION:
+            if (cbor_get_uint(&r, &value) != 0)
+                return -1;
+            *version = value;
+            break;
+        case READING_KEY_TS:
+            if (cbor_get_uint(&r, &reading->ts) != 0)
+                return -1;
+            break;
+        case READING_KEY_SENSOR:
+            if (cbor_get_uint(&r, &value) != 0 || value > UINT16_MAX)
+                return -1;
+            reading->sensor = value;
+            break;
+        case READING_KEY_VALUE:
+            if (cbor_get_float(&r, &reading->value) != 0)
+                return -1;
+            break;
+        case READING_KEY_UNIT:
+            if (cbor_get_uint(&r, &value) != 0 || value > UINT8_MAX)
+                return -1;
+            reading->unit = value;
+            break;
+        default:
+            if (cbor_skip(&r) != 0)
+                return -1;
+            break;
+        }
+    }
+
+    return 0;
+}
+
+const char *reading_unit_name(int unit)
+{
+    return unit >= 0 && unit < READING_UNIT_MAX ? unit_names[unit] : "?";
+}
+
+const char *reading_sensor_name(int sensor)
+{
+    return sensor >= 0 && sensor < READING_SENSOR_MAX ? sensor_names[sensor] : "unknown";
+}
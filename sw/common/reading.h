@@ -0,0 +1,67 @@
+#ifndef READING_H
+#define READING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Sensor reading, encoded as one CBOR map per batch record:
+ *
+ *   { 0: version, 1: ts, 2: sensor, 3: value, 4: unit }
+ *
+ * Integer keys keep a typical record around a dozen bytes. Decoders skip keys they do not know, so fields
+ * can be added without bumping READING_VERSION; it changes only when an existing field changes meaning.
+ */
+#define READING_VERSION 1
+#define READING_CBOR_MAX 32
+
+#define READING_KEY_VERSION 0
+#define READING_KEY_TS 1
+#define READING_KEY_SENSOR 2
+#define READING_KEY_VALUE 3
+#define READING_KEY_UNIT 4
+
+typedef enum {
+    READING_UNIT_NONE = 0,
+    READING_UNIT_COUNT,
+    READING_UNIT_BYTES,
+    READING_UNIT_CELSIUS,
+    READING_UNIT_PERCENT_RH,
+    READING_UNIT_PASCAL,
+    READING_UNIT_VOLT,
+    READING_UNIT_MAX,
+} reading_unit_t;
+
+typedef enum {
+    READING_SENSOR_COUNTER = 0, // Test counter
+    READING_SENSOR_HEAP_FREE,
+    READING_SENSOR_STACK_FREE,
+    READING_SENSOR_TEMPERATURE,
+    READING_SENSOR_HUMIDITY,
+    READING_SENSOR_PRESSURE,
+    READING_SENSOR_SUPPLY,
+    READING_SENSOR_MAX,
+} reading_sensor_t;
+
+typedef struct reading_t {
+    uint32_t ts;     // ms since boot, or of the RTC clock on a duty cycled node
+    uint16_t sensor; // reading_sensor_t
+    uint8_t unit;    // reading_unit_t
+    float value;
+} reading_t;
+
+/**
+ * \return Encoded length, or 0 if buf is too small
+ */
+size_t reading_encode(const reading_t *reading, uint8_t *buf, size_t size);
+
+/**
+ * \param[out] version Schema version found in the record
+ * \return 0 on success, -1 on a malformed record
+ */
+int reading_decode(reading_t *reading, int *version, const uint8_t *buf, size_t len);
+
+const char *reading_unit_name(int unit);
+const char *reading_sensor_name(int sensor);
+
+#endif // READING_H
@@ -0,0 +1,339 @@
+#include <string.h>
+
+#include "ringlog.h"
+
+#define RINGLOG_MAGIC 0x474f4c52 // "RLOG"
+#define SECTOR_HEADER_LEN 8
+#define RECORD_HEADER_LEN 4
+
+#define STATE_UNREAD 0xff
+#define STATE_CONSUMED 0x00
+#define LEN_ERASED 0xff
+
+#define RECORD_OK 0
+#define RECORD_END 1
+#define RECORD_BAD 2
+
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;
+} sector_header_t;
+
+typedef struct {
+    uint8_t state;
+    uint8_t len;
+    uint16_t crc;
+} record_header_t;
+
+static uint16_t crc16(uint16_t crc, const uint8_t *data, size_t len)
+{
+    while (len--) {
+        crc ^= (uint16_t)*data++ << 8;
+        for (int i = 0; i < 8; i++)
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
+
+static uint16_t record_crc(uint8_t len, const uint8_t *data)
+{
+    return crc16(crc16(0xffff, &len, 1), data, len);
+}
+
+static uint32_t record_size(uint8_t len)
+{
+    return RECORD_HEADER_LEN + ((len + 3) & ~3);
+}
+
+static uint32_t sector_addr(uint32_t sector)
+{
+    return sector * RINGLOG_SECTOR_SIZE;
+}
+
+static uint32_t next_sector(const ringlog_t *log, uint32_t sector)
+{
+    return (sector + 1) % log->sectors;
+}
+
+/**
+ * Load and validate the record at sector/offset
+ * \param data Must hold RINGLOG_RECORD_MAX bytes
+ */
+static int record_load(const ringlog_t *log, uint32_t sector, uint32_t offset, record_header_t *hdr, uint8_t *data)
+{
+    const ringlog_flash_t *flash = log->flash;
+    uint32_t addr = sector_addr(sector) + offset;
+
+    if (offset + RECORD_HEADER_LEN > RINGLOG_SECTOR_SIZE)
+        return RECORD_END;
+    if (flash->read(flash->ctx, addr, hdr, sizeof(*hdr)) != 0)
+        return RECORD_BAD;
+
+    if (hdr->len == LEN_ERASED)
+        return (hdr->state == 0xff && hdr->crc == 0xffff) ? RECORD_END : RECORD_BAD;
+    if (offset + record_size(hdr->len) > RINGLOG_SECTOR_SIZE)
+        return RECORD_BAD;
+    if (flash->read(flash->ctx, addr + RECORD_HEADER_LEN, data, hdr->len) != 0)
+        return RECORD_BAD;
+    if (record_crc(hdr->len, data) != hdr->crc)
+        return RECORD_BAD;
+
+    return RECORD_OK;
+}
+
+/**
+ * Move cursor forward to the next valid record, crossing sector boundaries as needed
+ */
+static int cursor_seek(const ringlog_t *log, ringlog_cursor_t *cursor, record_header_t *hdr, uint8_t *data)
+{
+    for (;;) {
+        if (cursor->sector == log->head && cursor->offset >= log->head_offset)
+            return RINGLOG_ERR_EMPTY;
+
+        if (record_load(log, cursor->sector, cursor->offset, hdr, data) == RECORD_OK)
+            return RINGLOG_OK;
+
+        // End of sector, or a torn record which invalidates the rest of it
+        if (cursor->sector == log->head)
+            return RINGLOG_ERR_EMPTY;
+        cursor->sector = next_sector(log, cursor->sector);
+        cursor->offset = SECTOR_HEADER_LEN;
+    }
+}
+
+static uint32_t count_unread(const ringlog_t *log, uint32_t sector)
+{
+    uint8_t data[RINGLOG_RECORD_MAX];
+    record_header_t hdr;
+    uint32_t offset = SECTOR_HEADER_LEN;
+    uint32_t count = 0;
+
+    while (record_load(log, sector, offset, &hdr, data) == RECORD_OK) {
+        if (hdr.state == STATE_UNREAD)
+            count++;
+        offset += record_size(hdr.len);
+    }
+
+    return count;
+}
+
+static int start_sector(ringlog_t *log, uint32_t sector, uint32_t seq)
+{
+    const ringlog_flash_t *flash = log->flash;
+    sector_header_t header = { RINGLOG_MAGIC, seq };
+
+    if (flash->erase(flash->ctx, sector_addr(sector)) != 0)
+        return RINGLOG_ERR_IO;
+    if (flash->write(flash->ctx, sector_addr(sector), &header, sizeof(header)) != 0)
+        return RINGLOG_ERR_IO;
+
+    log->head = sector;
+    log->head_seq = seq;
+    log->head_offset = SECTOR_HEADER_LEN;
+
+    return RINGLOG_OK;
+}
+
+static int advance_head(ringlog_t *log)
+{
+    uint32_t next = next_sector(log, log->head);
+
+    if (next == log->tail) {
+        // Ring is full: the oldest sector is overwritten
+        uint32_t lost = count_unread(log, log->tail);
+        log->pending -= lost;
+        log->dropped += lost;
+        log->tail = next_sector(log, log->tail);
+        if (log->unread.sector == next) {
+            log->unread.sector = log->tail;
+            log->unread.offset = SECTOR_HEADER_LEN;
+        }
+    }
+
+    return start_sector(log, next, log->head_seq + 1);
+}
+
+static int check_geometry(ringlog_t *log, const ringlog_flash_t *flash)
+{
+    memset(log, 0, sizeof(*log));
+    log->flash = flash;
+    log->sectors = flash->size / RINGLOG_SECTOR_SIZE;
+
+    return log->sectors < 2 ? RINGLOG_ERR_SIZE : RINGLOG_OK;
+}
+
+int ringlog_format(ringlog_t *log, const ringlog_flash_t *flash)
+{
+    int ret;
+
+    if ((ret = check_geometry(log, flash)) != RINGLOG_OK)
+        return ret;
+
+    for (uint32_t s = 1; s < log->sectors; s++) {
+        if (flash->erase(flash->ctx, sector_addr(s)) != 0)
+            return RINGLOG_ERR_IO;
+    }
+
+    log->tail = 0;
+    log->unread.sector = 0;
+    log->unread.offset = SECTOR_HEADER_LEN;
+
+    return start_sector(log, 0, 1);
+}
+
+int ringlog_mount(ringlog_t *log, const ringlog_flash_t *flash)
+{
+    uint8_t data[RINGLOG_RECORD_MAX];
+    record_header_t hdr;
+    ringlog_cursor_t cursor;
+    uint32_t tail_seq = 0;
+    int found = 0;
+    int ret;
+
+    if ((ret = check_geometry(log, flash)) != RINGLOG_OK)
+        return ret;
+
+    for (uint32_t s = 0; s < log->sectors; s++) {
+        sector_header_t header;
+
+        if (flash->read(flash->ctx, sector_addr(s), &header, sizeof(header)) != 0)
+            return RINGLOG_ERR_IO;
+        if (header.magic != RINGLOG_MAGIC)
+            continue;
+
+        if (!found || (int32_t)(header.seq - log->head_seq) > 0) {
+            log->head = s;
+            log->head_seq = header.seq;
+        }
+        if (!found || (int32_t)(header.seq - tail_seq) < 0) {
+            log->tail = s;
+            tail_seq = header.seq;
+        }
+        found = 1;
+    }
+
+    if (!found)
+        return ringlog_format(log, flash);
+
+    // Find the end of the head sector. After a torn write, leave the sector alone and continue in the next one.
+    log->head_offset = SECTOR_HEADER_LEN;
+    for (;;) {
+        ret = record_load(log, log->head, log->head_offset, &hdr, data);
+        if (ret == RECORD_END)
+            break;
+        if (ret == RECORD_BAD) {
+            log->head_offset = RINGLOG_SECTOR_SIZE;
+            break;
+        }
+        log->head_offset += record_size(hdr.len);
+    }
+
+    // Find the oldest unconsumed record and count the backlog
+    cursor.sector = log->tail;
+    cursor.offset = SECTOR_HEADER_LEN;
+    log->unread.sector = log->head;
+    log->unread.offset = log->head_offset;
+    while (cursor_seek(log, &cursor, &hdr, data) == RINGLOG_OK) {
+        if (hdr.state == STATE_UNREAD) {
+            if (log->pending++ == 0)
+                log->unread = cursor;
+        }
+        cursor.offset += record_size(hdr.len);
+    }
+
+    return RINGLOG_OK;
+}
+
+int ringlog_append(ringlog_t *log, const void *data, size_t len)
+{
+    const ringlog_flash_t *flash = log->flash;
+    uint8_t record[RECORD_HEADER_LEN + ((RINGLOG_RECORD_MAX + 3) & ~3)];
+    record_header_t hdr;
+    uint32_t size;
+    int ret;
+
+    if (len > RINGLOG_RECORD_MAX)
+        return RINGLOG_ERR_SIZE;
+
+    size = record_size(len);
+    if (log->head_offset + size > RINGLOG_SECTOR_SIZE) {
+        if ((ret = advance_head(log)) != RINGLOG_OK)
+            return ret;
+    }
+
+    hdr.state = STATE_UNREAD;
+    hdr.len = len;
+    hdr.crc = record_crc(len, data);
+    memset(record, 0xff, size);
+    memcpy(record, &hdr, sizeof(hdr));
+    memcpy(record + RECORD_HEADER_LEN, data, len);
+
+    if (flash->write(flash->ctx, sector_addr(log->head) + log->head_offset, record, size) != 0) {
+        // Whatever reached flash fails its crc on the next scan: skip the rest of the sector
+        log->head_offset = RINGLOG_SECTOR_SIZE;
+        return RINGLOG_ERR_IO;
+    }
+
+    if (log->pending++ == 0) {
+        log->unread.sector = log->head;
+        log->unread.offset = log->head_offset;
+    }
+    log->head_offset += size;
+
+    return RINGLOG_OK;
+}
+
+void ringlog_rewind(const ringlog_t *log, ringlog_cursor_t *cursor)
+{
+    *cursor = log->unread;
+}
+
+int ringlog_read(const ringlog_t *log, ringlog_cursor_t *cursor, void *buf, size_t size)
+{
+    uint8_t data[RINGLOG_RECORD_MAX];
+    record_header_t hdr;
+    int ret;
+
+    for (;;) {
+        if ((ret = cursor_seek(log, cursor, &hdr, data)) != RINGLOG_OK)
+            return ret;
+        if (hdr.state == STATE_UNREAD)
+            break;
+        cursor->offset += record_size(hdr.len);
+    }
+
+    if (hdr.len > size)
+        return RINGLOG_ERR_SIZE;
+
+    memcpy(buf, data, hdr.len);
+    cursor->offset += record_size(hdr.len);
+
+    return hdr.len;
+}
+
+int ringlog_consume(ringlog_t *log, const ringlog_cursor_t *cursor)
+{
+    const ringlog_flash_t *flash = log->flash;
+    uint8_t data[RINGLOG_RECORD_MAX];
+    record_header_t hdr;
+    ringlog_cursor_t pos = log->unread;
+
+    while (pos.sector != cursor->sector || pos.offset != cursor->offset) {
+        if (cursor_seek(log, &pos, &hdr, data) != RINGLOG_OK)
+            break;
+        if (pos.sector == cursor->sector && pos.offset == cursor->offset)
+            break;
+
+        if (hdr.state == STATE_UNREAD) {
+            hdr.state = STATE_CONSUMED;
+            if (flash->write(flash->ctx, sector_addr(pos.sector) + pos.offset, &hdr, sizeof(hdr)) != 0)
+                return RINGLOG_ERR_IO;
+            log->pending--;
+        }
+        pos.offset += record_size(hdr.len);
+    }
+
+    log->unread = pos;
+
+    return RINGLOG_OK;
+}
@@ -0,0 +1,91 @@
+#ifndef RINGLOG_H
+#define RINGLOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Append-only record log over a ring of flash sectors.
+ *
+ * Each sector starts with a header { u32 magic, u32 seq }; the sector with the highest seq is written to, the
+ * one with the lowest holds the oldest records. Sectors are used strictly in ring order, so erases are spread
+ * evenly across the partition. When the ring is full the oldest sector is erased and its records are dropped.
+ *
+ * Records are 4-byte aligned: { u8 state, u8 len, u16 crc, u8 data[len], padding }. The crc covers len and
+ * data. Consuming a record clears its state byte in place, so draining never erases. A record whose crc does
+ * not match (torn write) invalidates the rest of its sector.
+ */
+#define RINGLOG_SECTOR_SIZE 4096
+#define RINGLOG_RECORD_MAX 254
+
+#define RINGLOG_OK 0
+#define RINGLOG_ERR_IO -1
+#define RINGLOG_ERR_SIZE -2
+#define RINGLOG_ERR_EMPTY -3
+
+/**
+ * Flash access callbacks. Writes may only clear bits, as on NOR flash.
+ */
+typedef struct ringlog_flash_t {
+    int (*read)(void *ctx, uint32_t addr, void *buf, size_t len);
+    int (*write)(void *ctx, uint32_t addr, const void *buf, size_t len);
+    int (*erase)(void *ctx, uint32_t addr); // Erase the RINGLOG_SECTOR_SIZE sector at addr
+    void *ctx;
+    uint32_t size; // Multiple of RINGLOG_SECTOR_SIZE, at least two sectors
+} ringlog_flash_t;
+
+typedef struct ringlog_cursor_t {
+    uint32_t sector;
+    uint32_t offset;
+} ringlog_cursor_t;
+
+typedef struct ringlog_t {
+    const ringlog_flash_t *flash;
+    uint32_t sectors;
+    uint32_t head; // Sector being written
+    uint32_t head_seq;
+    uint32_t head_offset;
+    uint32_t tail; // Oldest sector
+    ringlog_cursor_t unread; // Oldest unconsumed record
+    uint32_t pending; // Unconsumed records
+    uint32_t dropped; // Unconsumed records lost to wrap-around since mount
+} ringlog_t;
+
+/**
+ * Recover log state from flash, formatting it if no valid sector is found
+ */
+int ringlog_mount(ringlog_t *log, const ringlog_flash_t *flash);
+
+/**
+ * Erase every sector and start an empty log
+ */
+int ringlog_format(ringlog_t *log, const ringlog_flash_t *flash);
+
+/**
+ * Append a record, dropping the oldest sector if the ring is full
+ */
+int ringlog_append(ringlog_t *log, const void *data, size_t len);
+
+/**
+ * Position cursor at the oldest unconsumed record
+ */
+void ringlog_rewind(const ringlog_t *log, ringlog_cursor_t *cursor);
+
+/**
+ * Read the record at cursor and advance cursor past it
+ * \return Record length, RINGLOG_ERR_EMPTY once cursor reaches the end of the log, RINGLOG_ERR_SIZE if size is
+ *         too small for the record
+ */
+int ringlog_read(const ringlog_t *log, ringlog_cursor_t *cursor, void *buf, size_t size);
+
+/**
+ * Mark every record before cursor as consumed
+ */
+int ringlog_consume(ringlog_t *log, const ringlog_cursor_t *cursor);
+
+static inline uint32_t ringlog_pending(const ringlog_t *log)
+{
+    return log->pending;
+}
+
+#endif // RINGLOG_H
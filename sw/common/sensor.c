@@ -0,0 +1,125 @@
+#include "sensor.h"
+
+/**
+ * Take one sample of a sensor and power it down again
+ * \return Number of readings taken, -1 on failure
+ */
+static int sensor_take(sensor_t *sensor, uint32_t ts, reading_t *readings, int max)
+{
+    int count = sensor->ops->sample(sensor, readings, max);
+
+    if (count < 0) {
+        sensor->failures++;
+    } else {
+        sensor->samples++;
+        for (int i = 0; i < count; i++)
+            readings[i].ts = ts;
+    }
+    if (sensor->ops->sleep)
+        sensor->ops->sleep(sensor);
+    return count;
+}
+
+int sensor_init_all(sensor_t *sensors, int count)
+{
+    int enabled = 0;
+
+    for (int i = 0; i < count; i++) {
+        sensor_t *sensor = &sensors[i];
+
+        sensor->enabled = !sensor->ops->init || sensor->ops->init(sensor) == 0;
+        sensor->samples = 0;
+        sensor->failures = 0;
+        sensor->missed = 0;
+        sensor->late_max = 0;
+        enabled += sensor->enabled;
+    }
+
+    return enabled;
+}
+
+int sensor_sample_all(sensor_t *sensors, int count, uint32_t ts, reading_t *readings, int max)
+{
+    int taken = 0;
+
+    for (int i = 0; i < count && taken < max; i++) {
+        int n;
+
+        if (!sensors[i].enabled)
+            continue;
+        n = sensor_take(&sensors[i], ts, readings + taken, max - taken);
+        if (n > 0)
+            taken += n;
+    }
+
+    return taken;
+}
+
+int sensor_sched_init(sensor_sched_t *sched, sensor_t *sensors, int count, uint32_t tick_ms, uint32_t slack_ms,
+                      uint32_t now)
+{
+    int enabled = sensor_init_all(sensors, count);
+
+    tw_init(&sched->wheel, now);
+    sched->sensors = sensors;
+    sched->count = count;
+    sched->tick_ms = tick_ms;
+    sched->slack = slack_ms / tick_ms;
+
+    for (int i = 0; i < count; i++) {
+        sensor_t *sensor = &sensors[i];
+
+        sensor->timer.next = NULL;
+        sensor->timer.pprev = NULL;
+        sensor->timer.ctx = sensor;
+        if (!sensor->enabled)
+            continue;
+        sensor->period = sensor->period_ms / tick_ms;
+        if (sensor->period == 0)
+            sensor->period = 1;
+        // On the grid of the period, so that sensors with commensurate periods come due together
+        sensor->due = (now / sensor->period + 1) * sensor->period;
+        tw_add(&sched->wheel, &sensor->timer, sensor->due);
+    }
+
+    return enabled;
+}
+
+static void sensor_expired(void *ctx, tw_timer_t *timer)
+{
+    sensor_sched_t *sched = ctx;
+    sensor_t *sensor = timer->ctx;
+    reading_t readings[SENSOR_READINGS_MAX];
+    int32_t late = sched->now - sensor->due;
+    int count;
+
+    if (late > 0 && (uint32_t)late > sensor->late_max)
+        sensor->late_max = late;
+
+    count = sensor_take(sensor, sched->now * sched->tick_ms, readings, SENSOR_READINGS_MAX);
+    for (int i = 0; i < count; i++)
+        sched->emit(sched->ctx, &readings[i]);
+
+    // Next point of the grid still ahead, skipping any missed
+    if (late >= (int32_t)sensor->period) {
+        uint32_t skipped = late / sensor->period;
+
+        sensor->missed += skipped;
+        sensor->due += skipped * sensor->period;
+    }
+    sensor->due += sensor->period;
+    tw_add(&sched->wheel, &sensor->timer, sensor->due);
+}
+
+int sensor_sched_run(sensor_sched_t *sched, uint32_t now, sensor_emit_t emit, void *ctx)
+{
+    sched->now = now;
+    sched->emit = emit;
+    sched->ctx = ctx;
+    return tw_advance(&sched->wheel, now + sched->slack, sensor_expired, sched);
+}
+
+int sensor_sched_next(const sensor_sched_t *sched, uint32_t *wake)
+{
+    return tw_next(&sched->wheel, wake);
+}
@@ -0,0 +1,115 @@
+#ifndef SENSOR_H
+#define SENSOR_H
+
+#include <stdint.h>
+
+#include "reading.h"
+#include "timer_wheel.h"
+
+/*
+ * Sensor drivers and the scheduler that samples them.
+ *
+ * A driver is a table of ops over its own context. The application keeps a static registry, an array of
+ * sensor_t naming each sensor's driver and sampling period, and hands it to one scheduler task. The scheduler
+ * keeps a timer per sensor on a timer wheel (see timer_wheel.h) ticking with the caller's clock, e.g. the
+ * FreeRTOS tick, and sleeps until the earliest is due.
+ *
+ * Sampling times are aligned to multiples of each sensor's period, so sensors whose periods divide each
+ * other come due on the same tick and are sampled in one wake. slack pulls in anything due that much later
+ * as well, trading a little early sampling for fewer wakes. A sensor that falls behind by a whole period
+ * skips the samples it missed rather than catching up in a burst, and keeps its grid.
+ *
+ * The module does no I/O of its own; sw/host/sensor_bench runs it over fake drivers to measure jitter and
+ * throughput.
+ */
+#define SENSOR_READINGS_MAX 4 // Per sample of one sensor
+
+typedef struct sensor_t sensor_t;
+
+typedef struct sensor_ops_t {
+    /**
+     * Optional: probe and set up the device
+     * \return 0 on success, -1 leaves the sensor disabled
+     */
+    int (*init)(sensor_t *sensor);
+    /**
+     * Take a sample, waking the device if it sleeps. ts is filled in by the caller.
+     * \param[out] readings max readings
+     * \return Number of readings taken, -1 on failure
+     */
+    int (*sample)(sensor_t *sensor, reading_t *readings, int max);
+    /**
+     * Optional: power the device down until the next sample
+     */
+    void (*sleep)(sensor_t *sensor);
+} sensor_ops_t;
+
+struct sensor_t {
+    const char *name;
+    const sensor_ops_t *ops;
+    void *ctx;               // Driver's own
+    uint32_t period_ms;
+    // State
+    uint8_t enabled;         // Set by a successful init
+    tw_timer_t timer;
+    uint32_t period;         // Ticks
+    uint32_t due;            // Tick of the sample being taken, or the next
+    uint32_t samples;
+    uint32_t failures;
+    uint32_t missed;         // Samples skipped after falling behind
+    uint32_t late_max;       // Ticks
+};
+
+/**
+ * Receives each reading sampled, with ts set
+ */
+typedef void (*sensor_emit_t)(void *ctx, const reading_t *reading);
+
+typedef struct sensor_sched_t {
+    tw_wheel_t wheel;
+    sensor_t *sensors;
+    int count;
+    uint32_t tick_ms;
+    uint32_t slack;          // Ticks
+    // During sensor_sched_run
+    uint32_t now;
+    sensor_emit_t emit;
+    void *ctx;
+} sensor_sched_t;
+
+/**
+ * Run the init op of every sensor, enabling those that succeed
+ * \return Number of sensors enabled
+ */
+int sensor_init_all(sensor_t *sensors, int count);
+
+/**
+ * Sample every enabled sensor once, e.g. on a duty cycled wake
+ * \param[out] readings max readings
+ * \return Number of readings taken
+ */
+int sensor_sample_all(sensor_t *sensors, int count, uint32_t ts, reading_t *readings, int max);
+
+/**
+ * Initialize the sensors and schedule each enabled one on its period
+ * \param tick_ms Length of a tick of the caller's clock
+ * \param slack_ms Sample sensors this early to share a wake, 0 for none
+ * \param now Current tick
+ * \return Number of sensors enabled
+ */
+int sensor_sched_init(sensor_sched_t *sched, sensor_t *sensors, int count, uint32_t tick_ms, uint32_t slack_ms,
+                      uint32_t now);
+
+/**
+ * Sample every sensor that is due by now, or within slack of it, and schedule its next sample
+ * \return Number of sensors sampled
+ */
+int sensor_sched_run(sensor_sched_t *sched, uint32_t now, sensor_emit_t emit, void *ctx);
+
+/**
+ * \param[out] wake Tick to call sensor_sched_run next
+ * \return 0 on success, -1 if no sensor is enabled
+ */
+int sensor_sched_next(const sensor_sched_t *sched, uint32_t *wake);
+
+#endif // SENSOR_H
@@ -0,0 +1,52 @@
+#include <string.h>
+
+#include "spsc.h"
+
+int spsc_init(spsc_t *ring, void *buf, size_t elem_size, uint32_t count)
+{
+    if (count == 0 || (count & (count - 1)) != 0)
+        return -1;
+
+    ring->buf = buf;
+    ring->elem_size = elem_size;
+    ring->mask = count - 1;
+    ring->head = 0;
+    ring->tail = 0;
+    ring->dropped = 0;
+    return 0;
+}
+
+int spsc_push(spsc_t *ring, const void *elem)
+{
+    uint32_t head = ring->head;
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+    if (head - tail > ring->mask) {
+        ring->dropped++;
+        return -1;
+    }
+
+    memcpy(ring->buf + (head & ring->mask) * ring->elem_size, elem, ring->elem_size);
+    // The element is in place before the consumer can see the new head
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int spsc_pop(spsc_t *ring, void *elem)
+{
+    uint32_t tail = ring->tail;
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    if (head == tail)
+        return -1;
+
+    memcpy(elem, ring->buf + (tail & ring->mask) * ring->elem_size, ring->elem_size);
+    // The element is copied out before the producer can reuse its slot
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+uint32_t spsc_count(const spsc_t *ring)
+{
+    return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
@@ -0,0 +1,51 @@
+#ifndef SPSC_H
+#define SPSC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Lock-free single producer, single consumer ring of fixed size elements.
+ *
+ * The producer only writes head and the consumer only writes tail; each publishes its index with a release
+ * store after touching the slot, and reads the other's with an acquire load, so one task (or an ISR) can push
+ * while another pops without a lock, on either core. The indices run freely and wrap at 2^32; the slot is the
+ * index masked by count - 1, so count must be a power of two, and every slot is usable.
+ *
+ * A push to a full ring fails and counts the element as dropped: the producer is the fixed rate side and
+ * never waits for the consumer.
+ */
+typedef struct spsc_t {
+    uint8_t *buf;
+    size_t elem_size;
+    uint32_t mask;    // count - 1
+    uint32_t head;    // Next slot to push, written by the producer only
+    uint32_t tail;    // Next slot to pop, written by the consumer only
+    uint32_t dropped; // Pushes that found the ring full, written by the producer only
+} spsc_t;
+
+/**
+ * \param buf count * elem_size bytes
+ * \param count Power of two
+ * \return 0 on success, -1 if count is not a power of two
+ */
+int spsc_init(spsc_t *ring, void *buf, size_t elem_size, uint32_t count);
+
+/**
+ * Copy an element in; producer only
+ * \return 0 on success, -1 if the ring is full
+ */
+int spsc_push(spsc_t *ring, const void *elem);
+
+/**
+ * Copy the oldest element out; consumer only
+ * \return 0 on success, -1 if the ring is empty
+ */
+int spsc_pop(spsc_t *ring, void *elem);
+
+/**
+ * \return Elements in the ring; exact from either side, a snapshot from anywhere else
+ */
+uint32_t spsc_count(const spsc_t *ring);
+
+#endif // SPSC_H
@@ -0,0 +1,172 @@
+#include <stddef.h>
+
+#include "timer_wheel.h"
+
+#define TW_MASK (TW_SLOTS - 1)
+// Ticks covered by levels 0 to level
+#define TW_SPAN(level) (1u << (TW_BITS * ((level) + 1)))
+
+static void tw_link(tw_timer_t **head, tw_timer_t *timer)
+{
+    timer->next = *head;
+    if (timer->next)
+        timer->next->pprev = &timer->next;
+    timer->pprev = head;
+    *head = timer;
+}
+
+static void tw_unlink(tw_timer_t *timer)
+{
+    *timer->pprev = timer->next;
+    if (timer->next)
+        timer->next->pprev = timer->pprev;
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+/**
+ * Put a timer in the slot its expiry falls into
+ * \param base First tick not processed yet
+ */
+static void tw_place(tw_wheel_t *wheel, tw_timer_t *timer, uint32_t base)
+{
+    int32_t delta = timer->expires - base;
+    uint32_t at = timer->expires;
+
+    if (delta < 0) {
+        // Overdue: fires with base
+        tw_link(&wheel->slot[0][base & TW_MASK], timer);
+        return;
+    }
+
+    for (int level = 0; level < TW_LEVELS; level++) {
+        if ((uint32_t)delta < TW_SPAN(level)) {
+            tw_link(&wheel->slot[level][(at >> (TW_BITS * level)) & TW_MASK], timer);
+            return;
+        }
+    }
+
+    // Beyond the top level: park in the slot it cascades last, to be placed again from there
+    at = base + TW_SPAN(TW_LEVELS - 1) - 1;
+    tw_link(&wheel->slot[TW_LEVELS - 1][(at >> (TW_BITS * (TW_LEVELS - 1))) & TW_MASK], timer);
+}
+
+void tw_init(tw_wheel_t *wheel, uint32_t now)
+{
+    wheel->now = now;
+    wheel->pending = 0;
+    for (int level = 0; level < TW_LEVELS; level++) {
+        for (int i = 0; i < TW_SLOTS; i++)
+            wheel->slot[level][i] = NULL;
+    }
+}
+
+void tw_add(tw_wheel_t *wheel, tw_timer_t *timer, uint32_t expires)
+{
+    if (tw_pending(timer))
+        tw_unlink(timer);
+    else
+        wheel->pending++;
+
+    timer->expires = expires;
+    tw_place(wheel, timer, wheel->now + 1);
+}
+
+void tw_cancel(tw_wheel_t *wheel, tw_timer_t *timer)
+{
+    if (!tw_pending(timer))
+        return;
+    tw_unlink(timer);
+    wheel->pending--;
+}
+
+/**
+ * Move the timers of a slot down to wherever they belong from the tick being processed, wheel->now
+ * \return The slot's index, 0 when the level above is due to cascade as well
+ */
+static int tw_cascade(tw_wheel_t *wheel, int level)
+{
+    int index = (wheel->now >> (TW_BITS * level)) & TW_MASK;
+    tw_timer_t *timer = wheel->slot[level][index];
+
+    wheel->slot[level][index] = NULL;
+    while (timer) {
+        tw_timer_t *next = timer->next;
+
+        timer->next = NULL;
+        timer->pprev = NULL;
+        tw_place(wheel, timer, wheel->now);
+        timer = next;
+    }
+    return index;
+}
+
+int tw_advance(tw_wheel_t *wheel, uint32_t now, tw_expired_t expired, void *ctx)
+{
+    int count = 0;
+
+    while ((int32_t)(now - wheel->now) > 0) {
+        tw_timer_t *timer;
+
+        if (wheel->pending == 0) {
+            wheel->now = now;
+            break;
+        }
+
+        wheel->now++;
+        if ((wheel->now & TW_MASK) == 0) {
+            for (int level = 1; level < TW_LEVELS && tw_cascade(wheel, level) == 0; level++)
+                ;
+        }
+
+        // Unlinked before the callback, which may add it again; anything added now goes to a later slot
+        while ((timer = wheel->slot[0][wheel->now & TW_MASK]) != NULL) {
+            tw_unlink(timer);
+            wheel->pending--;
+            count++;
+            expired(ctx, timer);
+        }
+    }
+
+    return count;
+}
+
+int tw_next(const tw_wheel_t *wheel, uint32_t *expires)
+{
+    int found = 0;
+    uint32_t best = 0;
+
+    if (wheel->pending == 0)
+        return -1;
+
+    // Level 0 holds one tick per slot, in order
+    for (int i = 1; i <= TW_SLOTS && !found; i++) {
+        uint32_t tick = wheel->now + i;
+
+        if (wheel->slot[0][tick & TW_MASK]) {
+            best = tick;
+            found = 1;
+        }
+    }
+    // A slot further up holds a range, none of it before the slot cascades; parked timers are later still.
+    // The current slot has been cascaded, so anything in it is a whole turn away and comes last.
+    for (int level = 1; level < TW_LEVELS; level++) {
+        int shift = TW_BITS * level;
+
+        for (int i = 1; i <= TW_SLOTS; i++) {
+            uint32_t cascade = ((wheel->now >> shift) + i) << shift;
+
+            if (found && (int32_t)(cascade - best) >= 0)
+                break;
+            for (const tw_timer_t *timer = wheel->slot[level][(cascade >> shift) & TW_MASK]; timer; timer = timer->next) {
+                if (!found || (int32_t)(timer->expires - best) < 0) {
+                    best = timer->expires;
+                    found = 1;
+                }
+            }
+        }
+    }
+
+    *expires = best;
+    return found ? 0 : -1;
+}
@@ -0,0 +1,74 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+
+/*
+ * Hierarchical timer wheel over a free running tick count.
+ *
+ * Level 0 has a slot per tick for the next TW_SLOTS ticks; each level up has slots TW_SLOTS times as wide.
+ * A timer goes into the lowest level whose span covers its expiry, so adding and cancelling are O(1) however
+ * many timers there are. Whenever level 0 wraps, the next slot of level 1 is cascaded down, re-inserting its
+ * timers by their exact expiry, and likewise up the levels; the slot of level 0 for the current tick then
+ * holds exactly the timers due. Timers further out than the top level can reach are parked in its last slot
+ * and re-inserted from there, so any expiry up to 2^31 ticks ahead works.
+ *
+ * Timers are intrusive: the caller owns the storage, embeds a tw_timer_t and finds its object through ctx.
+ * Ticks wrap at 2^32. The module does no locking; use a wheel from one task.
+ */
+#define TW_BITS 6
+#define TW_SLOTS (1 << TW_BITS)
+#define TW_LEVELS 3 // Spans 2^18 ticks, about 44 minutes of 10 ms ticks
+
+typedef struct tw_timer_t {
+    struct tw_timer_t *next;
+    struct tw_timer_t **pprev; // NULL while not pending
+    uint32_t expires;
+    void *ctx;
+} tw_timer_t;
+
+typedef struct tw_wheel_t {
+    uint32_t now; // Last tick processed
+    uint32_t pending;
+    tw_timer_t *slot[TW_LEVELS][TW_SLOTS];
+} tw_wheel_t;
+
+/**
+ * Called for every timer that expires. The timer is no longer pending, so it may be added again.
+ */
+typedef void (*tw_expired_t)(void *ctx, tw_timer_t *timer);
+
+/**
+ * Start an empty wheel at tick now
+ */
+void tw_init(tw_wheel_t *wheel, uint32_t now);
+
+/**
+ * Arm a timer, re-arming it if it is pending. An expiry that is not ahead of the wheel fires on the next tick
+ * processed.
+ */
+void tw_add(tw_wheel_t *wheel, tw_timer_t *timer, uint32_t expires);
+
+/**
+ * Disarm a timer; nothing happens if it is not pending
+ */
+void tw_cancel(tw_wheel_t *wheel, tw_timer_t *timer);
+
+static inline int tw_pending(const tw_timer_t *timer)
+{
+    return timer->pprev != 0;
+}
+
+/**
+ * Process every tick up to and including now, calling expired for each timer due, in expiry order
+ * \return Number of timers that expired
+ */
+int tw_advance(tw_wheel_t *wheel, uint32_t now, tw_expired_t expired, void *ctx);
+
+/**
+ * \param[out] expires Tick the first pending timer fires: its expiry, or the next tick if it is overdue
+ * \return 0 on success, -1 if no timer is pending
+ */
+int tw_next(const tw_wheel_t *wheel, uint32_t *expires);
+
+#endif // TIMER_WHEEL_H
@@ -0,0 +1,237 @@
+#include <string.h>
+
+#include "mbedtls/ssl_ciphersuites.h"
+#include "tls_creds.h"
+#if defined(MBEDTLS_X509_CRT_PARSE_C)
+#include "mbedtls/asn1.h"
+#endif
+
+#if defined(MBEDTLS_KEY_EXCHANGE_ECDHE_ECDSA_ENABLED)
+// Strongest first; GCM and CBC both cover brokers built without one of them
+static const int ec_ciphersuites[] = {
+    MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256,
+    MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_CBC_SHA256,
+    MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_CBC_SHA,
+    0
+};
+
+static const mbedtls_ecp_group_id ec_curves[] = {
+    MBEDTLS_ECP_DP_SECP256R1,
+    MBEDTLS_ECP_DP_NONE
+};
+#endif
+
+#if defined(MBEDTLS_KEY_EXCHANGE_PSK_ENABLED)
+// No key exchange at all: a handshake is a few hashes and one block cipher key setup
+static const int psk_ciphersuites[] = {
+    MBEDTLS_TLS_PSK_WITH_AES_128_GCM_SHA256,
+    MBEDTLS_TLS_PSK_WITH_AES_128_CBC_SHA256,
+    MBEDTLS_TLS_PSK_WITH_AES_128_CBC_SHA,
+    0
+};
+#endif
+
+void tls_creds_init(tls_creds_t *creds)
+{
+#if defined(MBEDTLS_X509_CRT_PARSE_C)
+    mbedtls_x509_crt_init(&creds->ca);
+    mbedtls_x509_crt_init(&creds->cert);
+    mbedtls_pk_init(&creds->key);
+#endif
+    creds->has_ca = 0;
+    creds->has_cert = 0;
+#if defined(MBEDTLS_KEY_EXCHANGE_PSK_ENABLED)
+    creds->psk_len = 0;
+    creds->identity[0] = '\0';
+#endif
+}
+
+void tls_creds_free(tls_creds_t *creds)
+{
+#if defined(MBEDTLS_X509_CRT_PARSE_C)
+    mbedtls_x509_crt_free(&creds->ca);
+    mbedtls_x509_crt_free(&creds->cert);
+    mbedtls_pk_free(&creds->key);
+#endif
+    creds->has_ca = 0;
+    creds->has_cert = 0;
+#if defined(MBEDTLS_KEY_EXCHANGE_PSK_ENABLED)
+    tls_creds_wipe(creds->psk, sizeof(creds->psk));
+    creds->psk_len = 0;
+#endif
+}
+
+#if defined(MBEDTLS_X509_CRT_PARSE_C)
+
+static int is_pem(const uint8_t *buf, size_t len)
+{
+    return len > 0 && buf[len - 1] == '\0' && strstr((const char *)buf, "-----BEGIN ") != NULL;
+}
+
+/**
+ * Parse PEM, or DER certificates back to back (mbedtls_x509_crt_parse takes only one DER certificate)
+ */
+static int parse_chain(mbedtls_x509_crt *chain, const uint8_t *buf, size_t len)
+{
+    unsigned char *p = (unsigned char *)buf;
+    const unsigned char *end = buf + len;
+    size_t cert_len;
+    int ret;
+
+    if (is_pem(buf, len))
+        return mbedtls_x509_crt_parse(chain, buf, len);
+
+    while (p < end) {
+        const unsigned char *start = p;
+
+        ret = mbedtls_asn1_get_tag(&p, end, &cert_len, MBEDTLS_ASN1_CONSTRUCTED | MBEDTLS_ASN1_SEQUENCE);
+        if (ret != 0)
+            return ret;
+        p += cert_len;
+        if ((ret = mbedtls_x509_crt_parse_der(chain, start, p - start)) != 0)
+            return ret;
+    }
+
+    return len ? 0 : MBEDTLS_ERR_X509_INVALID_FORMAT;
+}
+
+int tls_creds_set_ca(tls_creds_t *creds, const uint8_t *buf, size_t len)
+{
+    int ret;
+
+    mbedtls_x509_crt_free(&creds->ca);
+    mbedtls_x509_crt_init(&creds->ca);
+    creds->has_ca = (ret = parse_chain(&creds->ca, buf, len)) == 0;
+
+    return ret;
+}
+
+int tls_creds_set_cert(tls_creds_t *creds, const uint8_t *cert, size_t cert_len, const uint8_t *key, size_t key_len)
+{
+    int ret;
+
+    mbedtls_x509_crt_free(&creds->cert);
+    mbedtls_x509_crt_init(&creds->cert);
+    mbedtls_pk_free(&creds->key);
+    mbedtls_pk_init(&creds->key);
+    creds->has_cert = 0;
+
+    if ((ret = parse_chain(&creds->cert, cert, cert_len)) != 0)
+        return ret;
+    // Takes DER or PEM alike
+    if ((ret = mbedtls_pk_parse_key(&creds->key, key, key_len, NULL, 0)) != 0)
+        return ret;
+    creds->has_cert = 1;
+
+    return 0;
+}
+
+
+size_t tls_creds_chain_der(const mbedtls_x509_crt *chain, uint8_t *buf, size_t size)
+{
+    size_t len = 0;
+
+    // The parsed certificates keep their DER encoding in raw
+    for (const mbedtls_x509_crt *crt = chain; crt && crt->raw.p; crt = crt->next) {
+        if (crt->raw.len > size - len)
+            return 0;
+        memcpy(buf + len, crt->raw.p, crt->raw.len);
+        len += crt->raw.len;
+    }
+
+    return len;
+}
+
+int tls_creds_key_der(mbedtls_pk_context *key, uint8_t *buf, size_t size)
+{
+#if defined(MBEDTLS_PK_WRITE_C)
+    // Written at the end of buf
+    int len = mbedtls_pk_write_key_der(key, buf, size);
+
+    if (len > 0)
+        memmove(buf, buf + size - len, len);
+    return len;
+#else
+    (void)key;
+    (void)buf;
+    (void)size;
+    return MBEDTLS_ERR_PK_FEATURE_UNAVAILABLE;
+#endif
+}
+#endif // MBEDTLS_X509_CRT_PARSE_C
+
+#if defined(MBEDTLS_KEY_EXCHANGE_PSK_ENABLED)
+int tls_creds_set_psk(tls_creds_t *creds, const uint8_t *psk, size_t psk_len, const char *identity)
+{
+    size_t identity_len = strlen(identity);
+
+    tls_creds_wipe(creds->psk, sizeof(creds->psk));
+    creds->psk_len = 0;
+    if (psk_len == 0 || psk_len > sizeof(creds->psk) || identity_len == 0 || identity_len > TLS_CREDS_IDENTITY_MAX)
+        return MBEDTLS_ERR_SSL_BAD_INPUT_DATA;
+
+    memcpy(creds->psk, psk, psk_len);
+    memcpy(creds->identity, identity, identity_len + 1);
+    creds->psk_len = psk_len;
+
+    return 0;
+}
+#endif
+
+int tls_creds_is_psk(const tls_creds_t *creds)
+{
+#if defined(MBEDTLS_KEY_EXCHANGE_PSK_ENABLED)
+    return creds->psk_len > 0;
+#else
+    (void)creds;
+    return 0;
+#endif
+}
+
+int tls_creds_is_ec(const tls_creds_t *creds)
+{
+#if defined(MBEDTLS_X509_CRT_PARSE_C)
+    if (creds->has_cert)
+        return mbedtls_pk_can_do(&creds->key, MBEDTLS_PK_ECDSA);
+    return creds->has_ca && mbedtls_pk_can_do(&creds->ca.pk, MBEDTLS_PK_ECDSA);
+#else
+    (void)creds;
+    return 0;
+#endif
+}
+
+int tls_creds_conf(tls_creds_t *creds, mbedtls_ssl_config *conf)
+{
+#if defined(MBEDTLS_KEY_EXCHANGE_PSK_ENABLED)
+    if (tls_creds_is_psk(creds)) {
+        mbedtls_ssl_conf_ciphersuites(conf, psk_ciphersuites);
+        // Copied into conf
+        return mbedtls_ssl_conf_psk(conf, creds->psk, creds->psk_len, (const unsigned char *)creds->identity,
+                                    strlen(creds->identity));
+    }
+#endif
+
+#if defined(MBEDTLS_KEY_EXCHANGE_ECDHE_ECDSA_ENABLED)
+    if (tls_creds_is_ec(creds)) {
+        mbedtls_ssl_conf_ciphersuites(conf, ec_ciphersuites);
+        mbedtls_ssl_conf_curves(conf, ec_curves);
+    }
+#endif
+
+#if defined(MBEDTLS_X509_CRT_PARSE_C)
+    if (creds->has_ca)
+        mbedtls_ssl_conf_ca_chain(conf, &creds->ca, NULL);
+    if (creds->has_cert)
+        return mbedtls_ssl_conf_own_cert(conf, &creds->cert, &creds->key);
+#endif
+
+    return 0;
+}
+
+void tls_creds_wipe(void *buf, size_t len)
+{
+    volatile uint8_t *p = buf;
+
+    while (len--)
+        *p++ = 0;
+}
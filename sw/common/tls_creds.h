@@ -0,0 +1,104 @@
+#ifndef TLS_CREDS_H
+#define TLS_CREDS_H
+
+// Resolves to the target's own mbedTLS configuration, which must come before any other mbedTLS header
+#include "mbedtls/config.h"
+#include "mbedtls/ssl.h"
+#if defined(MBEDTLS_X509_CRT_PARSE_C)
+#include "mbedtls/pk.h"
+#include "mbedtls/x509_crt.h"
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * TLS client credentials, parsed once at boot and shared by every connection after that.
+ *
+ * Credentials are stored as DER: a CA chain is its certificates' encodings back to back, a key is PKCS#1 or
+ * PKCS#8. Parsing DER skips the base64 decode and the PEM buffer copies. NUL terminated PEM is still
+ * accepted, and the *_der functions write parsed credentials back out so they can be stored as DER.
+ *
+ * A node can instead hold a pre-shared key, with its client ID as the PSK identity. The handshake then has
+ * no certificates and no public key operations at all, and a build with only PSK ciphersuites can leave
+ * X.509 out of mbedTLS (MBEDTLS_X509_CRT_PARSE_C undefined), which drops the certificate functions here.
+ */
+#define TLS_CREDS_PSK_MAX 32
+#define TLS_CREDS_IDENTITY_MAX 32
+
+typedef struct tls_creds_t {
+#if defined(MBEDTLS_X509_CRT_PARSE_C)
+    mbedtls_x509_crt ca;
+    mbedtls_x509_crt cert;
+    mbedtls_pk_context key;
+#endif
+    int has_ca;
+    int has_cert; // Client certificate and its key
+#if defined(MBEDTLS_KEY_EXCHANGE_PSK_ENABLED)
+    uint8_t psk[TLS_CREDS_PSK_MAX];
+    size_t psk_len; // Set: PSK mode, the certificates are not used
+    char identity[TLS_CREDS_IDENTITY_MAX + 1];
+#endif
+} tls_creds_t;
+
+void tls_creds_init(tls_creds_t *creds);
+void tls_creds_free(tls_creds_t *creds);
+
+#if defined(MBEDTLS_X509_CRT_PARSE_C)
+/**
+ * \param buf DER chain, or NUL terminated PEM with len including the terminator
+ * \return 0 on success, or an mbedTLS error
+ */
+int tls_creds_set_ca(tls_creds_t *creds, const uint8_t *buf, size_t len);
+
+/**
+ * \return 0 on success, or an mbedTLS error
+ */
+int tls_creds_set_cert(tls_creds_t *creds, const uint8_t *cert, size_t cert_len, const uint8_t *key, size_t key_len);
+
+/**
+ * \return Length of the DER chain written to buf, or 0 if it does not fit
+ */
+size_t tls_creds_chain_der(const mbedtls_x509_crt *chain, uint8_t *buf, size_t size);
+
+/**
+ * \return Length of the DER key written to the start of buf, or an mbedTLS error
+ */
+int tls_creds_key_der(mbedtls_pk_context *key, uint8_t *buf, size_t size);
+#endif
+
+#if defined(MBEDTLS_KEY_EXCHANGE_PSK_ENABLED)
+/**
+ * Use a pre-shared key instead of the certificates
+ * \param identity PSK identity, the node's client ID
+ * \return 0 on success, or MBEDTLS_ERR_SSL_BAD_INPUT_DATA if the key or identity is empty or too long
+ */
+int tls_creds_set_psk(tls_creds_t *creds, const uint8_t *psk, size_t psk_len, const char *identity);
+#endif
+
+/**
+ * \return true in PSK mode
+ */
+int tls_creds_is_psk(const tls_creds_t *creds);
+
+/**
+ * \return true for an ECDSA PKI: the client key, or without one the CA, is an EC key
+ */
+int tls_creds_is_ec(const tls_creds_t *creds);
+
+/**
+ * Use the credentials in an SSL configuration. They must outlive it.
+ *
+ * With an ECDSA PKI only ECDHE-ECDSA ciphersuites over P-256 are offered, so the handshake never falls back
+ * to RSA and every public key operation uses the one curve. In PSK mode only PSK ciphersuites are offered
+ * and the certificates are left out of the configuration.
+ * \return 0 on success, or an mbedTLS error
+ */
+int tls_creds_conf(tls_creds_t *creds, mbedtls_ssl_config *conf);
+
+/**
+ * Clear key material from a buffer in a way the compiler cannot drop before a free
+ */
+void tls_creds_wipe(void *buf, size_t len);
+
+#endif // TLS_CREDS_H
@@ -0,0 +1,117 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "tls_mem.h"
+
+// The allocator can be swapped at runtime unless the configuration fixed it with macros
+#if defined(MBEDTLS_PLATFORM_MEMORY) && !(defined(MBEDTLS_PLATFORM_CALLOC_MACRO) && defined(MBEDTLS_PLATFORM_FREE_MACRO))
+#define TLS_MEM_COUNT
+#include "mbedtls/platform.h"
+#endif
+
+// mbedTLS before 2.13 has one length for both buffers
+#if !defined(MBEDTLS_SSL_IN_CONTENT_LEN)
+#define MBEDTLS_SSL_IN_CONTENT_LEN MBEDTLS_SSL_MAX_CONTENT_LEN
+#endif
+
+#if defined(TLS_MEM_COUNT)
+// Keep the target's allocator, e.g. ESP-IDF's choice of internal RAM
+#if defined(MBEDTLS_PLATFORM_STD_CALLOC)
+#define TLS_MEM_CALLOC MBEDTLS_PLATFORM_STD_CALLOC
+#define TLS_MEM_FREE MBEDTLS_PLATFORM_STD_FREE
+#else
+#define TLS_MEM_CALLOC calloc
+#define TLS_MEM_FREE free
+#endif
+
+// Each block is prefixed with its size
+typedef union {
+    size_t size;
+    long long align;
+    void *ptr;
+} block_t;
+
+static size_t mem_used = 0;
+static size_t mem_peak = 0;
+
+static void *mem_calloc(size_t n, size_t size)
+{
+    block_t *block;
+
+    if (size && n > (SIZE_MAX - sizeof(block_t)) / size)
+        return NULL;
+    size *= n;
+    if (!(block = TLS_MEM_CALLOC(1, sizeof(block_t) + size)))
+        return NULL;
+
+    block->size = size;
+    mem_used += size;
+    if (mem_used > mem_peak)
+        mem_peak = mem_used;
+    return block + 1;
+}
+
+static void mem_free(void *p)
+{
+    block_t *block = (block_t *)p - 1;
+
+    if (!p)
+        return;
+    mem_used -= block->size;
+    TLS_MEM_FREE(block);
+}
+#endif
+
+void tls_mem_init(void)
+{
+#if defined(TLS_MEM_COUNT)
+    mbedtls_platform_set_calloc_free(mem_calloc, mem_free);
+#endif
+}
+
+void tls_mem_stats(size_t *used, size_t *peak)
+{
+#if defined(TLS_MEM_COUNT)
+    *used = mem_used;
+    *peak = mem_peak;
+#else
+    *used = 0;
+    *peak = 0;
+#endif
+}
+
+void tls_mem_reset_peak(void)
+{
+#if defined(TLS_MEM_COUNT)
+    mem_peak = mem_used;
+#endif
+}
+
+int tls_mem_conf(mbedtls_ssl_config *conf)
+{
+#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+    unsigned char code = MBEDTLS_SSL_MAX_FRAG_LEN_NONE;
+
+    // Codes 1-4 are 512 << (code - 1) bytes. A buffer over 4 KB has no code to ask for: a smaller fragment
+    // would split a certificate chain that was meant to fit.
+    for (unsigned char c = MBEDTLS_SSL_MAX_FRAG_LEN_512; c <= MBEDTLS_SSL_MAX_FRAG_LEN_4096; c++) {
+        if ((size_t)256 << c <= MBEDTLS_SSL_IN_CONTENT_LEN)
+            code = c;
+    }
+    if (MBEDTLS_SSL_IN_CONTENT_LEN <= 4096 && code != MBEDTLS_SSL_MAX_FRAG_LEN_NONE)
+        return mbedtls_ssl_conf_max_frag_len(conf, code);
+#else
+    (void)conf;
+#endif
+    return 0;
+}
+
+size_t tls_mem_fragment_len(const mbedtls_ssl_context *ssl)
+{
+#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+    return mbedtls_ssl_get_max_frag_len(ssl);
+#else
+    (void)ssl;
+    return MBEDTLS_SSL_MAX_CONTENT_LEN;
+#endif
+}
@@ -0,0 +1,55 @@
+#ifndef TLS_MEM_H
+#define TLS_MEM_H
+
+// Resolves to the target's own mbedTLS configuration, which must come before any other mbedTLS header
+#include "mbedtls/config.h"
+#include "mbedtls/ssl.h"
+
+#include <stddef.h>
+
+/*
+ * TLS memory footprint: record buffer size negotiation and heap accounting.
+ *
+ * mbedTLS allocates an input and an output record buffer per connection, sized by MBEDTLS_SSL_IN_CONTENT_LEN
+ * and MBEDTLS_SSL_OUT_CONTENT_LEN (one MBEDTLS_SSL_MAX_CONTENT_LEN for both before mbedTLS 2.13), 16 KB each
+ * by default. The targets build them to fit their traffic. A peer may still send records up to 16 KB unless
+ * the max_fragment_length extension is negotiated, so tls_mem_conf asks for the largest fragment that fits
+ * the input buffer (512 bytes to 4 KB; a larger buffer gets no limit). A broker that ignores the extension
+ * must be sending small records anyway.
+ *
+ * mbedTLS 2.x cannot reassemble a TLS handshake message split over records: the input buffer, and so the
+ * fragment length, must also hold the broker's certificate chain in one piece.
+ *
+ * With MBEDTLS_PLATFORM_MEMORY, tls_mem_init counts every byte mbedTLS allocates, so the cost of a
+ * connection can be reported on the device. The counters are not locked: with several tasks in mbedTLS at
+ * once they are approximate.
+ */
+
+/**
+ * Route mbedTLS allocations through the counters. Call before any other mbedTLS use.
+ */
+void tls_mem_init(void);
+
+/**
+ * \param[out] used Bytes mbedTLS holds now, 0 if mbedTLS allocations cannot be counted
+ * \param[out] peak Most held at once since the last tls_mem_reset_peak
+ */
+void tls_mem_stats(size_t *used, size_t *peak);
+
+/**
+ * Start a new peak, e.g. at connect
+ */
+void tls_mem_reset_peak(void);
+
+/**
+ * Request the max fragment length that fits the input buffer. Call when configuring a client.
+ * \return 0 on success, or an mbedTLS error
+ */
+int tls_mem_conf(mbedtls_ssl_config *conf);
+
+/**
+ * \return Fragment length negotiated on a connection, the full record size if none was
+ */
+size_t tls_mem_fragment_len(const mbedtls_ssl_context *ssl);
+
+#endif // TLS_MEM_H
@@ -0,0 +1,124 @@
+#include <string.h>
+
+#include "tls_pin.h"
+#if defined(MBEDTLS_X509_CRT_PARSE_C) && defined(MBEDTLS_PK_WRITE_C) && defined(MBEDTLS_SHA256_C)
+#include "mbedtls/md.h"
+#include "mbedtls/pk.h"
+#include "mbedtls/x509_crt.h"
+#define TLS_PIN_KEYS
+#endif
+
+// Largest SubjectPublicKeyInfo hashed: an RSA 4096 key takes 550 bytes
+#define TLS_PIN_SPKI_MAX 600
+
+void tls_pin_init(tls_pin_t *pin)
+{
+    memset(pin, 0, sizeof(*pin));
+}
+
+int tls_pin_set(tls_pin_t *pin, const uint8_t *hash, size_t len)
+{
+    tls_pin_init(pin);
+    if (len != TLS_PIN_LEN)
+        return MBEDTLS_ERR_SSL_BAD_INPUT_DATA;
+
+    memcpy(pin->hash, hash, len);
+    pin->set = 1;
+
+    return 0;
+}
+
+/**
+ * \return true if the broker is authenticated by its certificate chain
+ */
+static int has_chain(const tls_creds_t *creds)
+{
+    return creds->has_ca && !tls_creds_is_psk(creds);
+}
+
+void tls_pin_conf(const tls_pin_t *pin, const tls_creds_t *creds, mbedtls_ssl_config *conf)
+{
+    if (!has_chain(creds)) {
+        mbedtls_ssl_conf_authmode(conf, MBEDTLS_SSL_VERIFY_NONE);
+        return;
+    }
+
+#if defined(TLS_PIN_KEYS)
+    // The handshake still checks that the broker holds the key in its certificate; tls_pin_check does the rest
+    if (pin && pin->set) {
+        mbedtls_ssl_conf_authmode(conf, MBEDTLS_SSL_VERIFY_NONE);
+        return;
+    }
+#else
+    (void)pin;
+#endif
+    mbedtls_ssl_conf_authmode(conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+}
+
+#if defined(TLS_PIN_KEYS)
+static int key_hash(const mbedtls_x509_crt *crt, uint8_t *hash)
+{
+    unsigned char der[TLS_PIN_SPKI_MAX];
+    // Written at the end of der
+    int len = mbedtls_pk_write_pubkey_der((mbedtls_pk_context *)&crt->pk, der, sizeof(der));
+
+    if (len < 0)
+        return len;
+    return mbedtls_md(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), der + sizeof(der) - len, len, hash);
+}
+
+/**
+ * Record the session as verified, in place of MBEDTLS_X509_BADCERT_SKIP_VERIFY, so it is saved and resumed as
+ * one that passed
+ */
+static void set_trusted(mbedtls_ssl_context *ssl)
+{
+    ssl->session->verify_result = 0;
+}
+#endif
+
+int tls_pin_check(tls_pin_t *pin, tls_creds_t *creds, mbedtls_ssl_context *ssl, const char *host, uint32_t *flags)
+{
+#if defined(TLS_PIN_KEYS)
+    const mbedtls_x509_crt *peer;
+    uint8_t hash[TLS_PIN_LEN];
+    int ret;
+#endif
+
+    *flags = 0;
+    if (!has_chain(creds))
+        return TLS_PIN_OK;
+
+#if defined(TLS_PIN_KEYS)
+    // A resumed handshake has no certificate: its session was trusted when it was saved
+    if (pin && (peer = mbedtls_ssl_get_peer_cert(ssl)) != NULL) {
+        if ((ret = key_hash(peer, hash)) != 0)
+            return ret;
+
+        if (pin->set && memcmp(hash, pin->hash, sizeof(hash)) == 0) {
+            set_trusted(ssl);
+            return TLS_PIN_OK;
+        }
+
+        // Without a pin mbedTLS verified the chain in the handshake
+        if (pin->set) {
+            ret = mbedtls_x509_crt_verify((mbedtls_x509_crt *)peer, &creds->ca, NULL, host, flags, NULL, NULL);
+            if (ret != 0)
+                return ret;
+            set_trusted(ssl);
+        } else if ((*flags = mbedtls_ssl_get_verify_result(ssl)) != 0) {
+            return MBEDTLS_ERR_X509_CERT_VERIFY_FAILED;
+        }
+
+        memcpy(pin->hash, hash, sizeof(hash));
+        pin->set = 1;
+        return TLS_PIN_UPDATED;
+    }
+#else
+    (void)pin;
+    (void)host;
+#endif
+
+    *flags = mbedtls_ssl_get_verify_result(ssl);
+    return *flags ? MBEDTLS_ERR_X509_CERT_VERIFY_FAILED : TLS_PIN_OK;
+}
@@ -0,0 +1,61 @@
+#ifndef TLS_PIN_H
+#define TLS_PIN_H
+
+// Resolves to the target's own mbedTLS configuration, which must come before any other mbedTLS header
+#include "mbedtls/config.h"
+#include "mbedtls/ssl.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tls_creds.h"
+
+/*
+ * Broker public key pinning: trust the broker by its key instead of verifying its chain on every connect.
+ *
+ * The pin is the SHA-256 of the SubjectPublicKeyInfo in the broker's certificate. With a pin set the
+ * handshake skips the chain verification, and tls_pin_check compares the key the broker has just proven it
+ * holds with the pin: one hash instead of a signature check per certificate. On a mismatch, e.g. after the
+ * broker's key was rotated, it verifies the chain against the CA and the hostname, and a chain that passes
+ * becomes the new pin. Without a pin the handshake verifies the chain as usual and the pin is learned from
+ * it. A renewed certificate for the same key keeps the pin.
+ *
+ * There is nothing to pin in PSK mode, and without a CA there is nothing to fall back on, so neither is
+ * checked. Pinning needs the peer certificate after the handshake (the mbedTLS default), MBEDTLS_PK_WRITE_C
+ * and MBEDTLS_SHA256_C; without them every full handshake verifies the chain.
+ */
+#define TLS_PIN_LEN 32
+
+#define TLS_PIN_OK 0      // Trusted: the key matched the pin, or the handshake resumed a trusted session
+#define TLS_PIN_UPDATED 1 // Trusted after verifying the chain, and the pin changed: save it
+
+typedef struct tls_pin_t {
+    uint8_t hash[TLS_PIN_LEN];
+    int set;
+} tls_pin_t;
+
+void tls_pin_init(tls_pin_t *pin);
+
+/**
+ * Load a saved pin
+ * \return 0 on success, or MBEDTLS_ERR_SSL_BAD_INPUT_DATA if len is not TLS_PIN_LEN (the pin is cleared)
+ */
+int tls_pin_set(tls_pin_t *pin, const uint8_t *hash, size_t len);
+
+/**
+ * Set how the handshake verifies the broker: not at all in PSK mode or without a CA, by tls_pin_check with
+ * a pin, and by mbedTLS itself without one (or with a NULL pin). Call after tls_creds_conf.
+ */
+void tls_pin_conf(const tls_pin_t *pin, const tls_creds_t *creds, mbedtls_ssl_config *conf);
+
+/**
+ * Decide whether the broker is trusted. Call after the handshake, before anything is sent over it and before
+ * the session is saved: a trusted session is recorded as verified, so resuming it later is trusted too.
+ * \param pin NULL: only check the result of the handshake's own verification
+ * \param host Name the broker's certificate must be issued for
+ * \param[out] flags Why the chain was rejected, for mbedtls_x509_crt_verify_info
+ * \return TLS_PIN_OK, TLS_PIN_UPDATED, MBEDTLS_ERR_X509_CERT_VERIFY_FAILED, or another mbedTLS error
+ */
+int tls_pin_check(tls_pin_t *pin, tls_creds_t *creds, mbedtls_ssl_context *ssl, const char *host, uint32_t *flags);
+
+#endif // TLS_PIN_H
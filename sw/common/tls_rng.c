@@ -0,0 +1,41 @@
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/entropy.h"
+#include "tls_rng.h"
+
+static mbedtls_entropy_context entropy;
+static mbedtls_ctr_drbg_context drbg;
+static int seeded = 0;
+
+int tls_rng_init(const void *pers, size_t len)
+{
+    int ret;
+
+    if (seeded)
+        return 0;
+
+    mbedtls_entropy_init(&entropy);
+    mbedtls_ctr_drbg_init(&drbg);
+    if ((ret = mbedtls_ctr_drbg_seed(&drbg, mbedtls_entropy_func, &entropy, pers, len)) != 0) {
+        mbedtls_ctr_drbg_free(&drbg);
+        mbedtls_entropy_free(&entropy);
+        return ret;
+    }
+    mbedtls_ctr_drbg_set_reseed_interval(&drbg, TLS_RNG_RESEED_INTERVAL);
+    seeded = 1;
+
+    return 0;
+}
+
+int tls_rng_random(void *ctx, unsigned char *out, size_t len)
+{
+    (void)ctx;
+
+    if (!seeded)
+        return MBEDTLS_ERR_CTR_DRBG_ENTROPY_SOURCE_FAILED;
+    return mbedtls_ctr_drbg_random(&drbg, out, len);
+}
+
+void tls_rng_conf(mbedtls_ssl_config *conf)
+{
+    mbedtls_ssl_conf_rng(conf, tls_rng_random, NULL);
+}
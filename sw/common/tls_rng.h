@@ -0,0 +1,43 @@
+#ifndef TLS_RNG_H
+#define TLS_RNG_H
+
+// Resolves to the target's own mbedTLS configuration, which must come before any other mbedTLS header
+#include "mbedtls/config.h"
+#include "mbedtls/ssl.h"
+
+#include <stddef.h>
+
+/*
+ * Process-wide random bit generator for TLS and any other crypto user.
+ *
+ * One CTR_DRBG is seeded at boot from the platform's entropy sources, which on both targets include the
+ * hardware RNG, and personalized with something unique to the device such as its client ID. It reseeds
+ * itself from the same sources every TLS_RNG_RESEED_INTERVAL requests, so connections never gather entropy
+ * on their own and hold no RNG state.
+ *
+ * With MBEDTLS_THREADING_C mbedTLS serializes the callers of tls_rng_random; without it they must not draw
+ * from it at the same time.
+ */
+#ifndef TLS_RNG_RESEED_INTERVAL
+#define TLS_RNG_RESEED_INTERVAL 1024 // A handshake makes a few requests
+#endif
+
+/**
+ * Seed the generator. Later calls do nothing and return 0.
+ * \param pers Personalization, e.g. the client ID
+ * \return 0 on success, or an mbedTLS error
+ */
+int tls_rng_init(const void *pers, size_t len);
+
+/**
+ * mbedTLS RNG callback: fill out with len random bytes. ctx is unused.
+ * \return 0 on success, or an mbedTLS error (also if tls_rng_init has not succeeded)
+ */
+int tls_rng_random(void *ctx, unsigned char *out, size_t len);
+
+/**
+ * Use the generator for an SSL configuration
+ */
+void tls_rng_conf(mbedtls_ssl_config *conf);
+
+#endif // TLS_RNG_H
@@ -0,0 +1,136 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tls_session.h"
+
+// mbedtls_ssl_session_free releases the ticket with mbedTLS's allocator, which tls_mem_init may have replaced
+#if defined(MBEDTLS_PLATFORM_C)
+#include "mbedtls/platform.h"
+#else
+#define mbedtls_calloc calloc
+#endif
+
+#define TLS_SESSION_MAGIC 0x544c5331 // "TLS1"
+
+static uint32_t fnv1a(uint32_t hash, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+
+    while (len--)
+        hash = (hash ^ *p++) * 16777619u;
+    return hash;
+}
+
+static uint32_t host_hash(const char *host)
+{
+    return fnv1a(2166136261u, host, strlen(host));
+}
+
+static uint32_t session_check(const tls_session_t *session)
+{
+    return fnv1a(2166136261u, session, offsetof(tls_session_t, check));
+}
+
+int tls_session_valid(const tls_session_t *session, const char *host)
+{
+    return session->magic == TLS_SESSION_MAGIC && session->host_hash == host_hash(host)
+        && session->id_len <= sizeof(session->id) && session->ticket_len <= sizeof(session->ticket)
+        && session->check == session_check(session);
+}
+
+void tls_session_clear(tls_session_t *session)
+{
+    // Wipes the master secret too
+    memset(session, 0, sizeof(*session));
+}
+
+int tls_session_offer(const tls_session_t *session, const char *host, mbedtls_ssl_context *ssl)
+{
+    mbedtls_ssl_session s;
+    int ret;
+
+    if (!tls_session_valid(session, host))
+        return -1;
+
+    mbedtls_ssl_session_init(&s);
+    s.ciphersuite = session->ciphersuite;
+    s.compression = session->compression;
+    s.id_len = session->id_len;
+    memcpy(s.id, session->id, session->id_len);
+    memcpy(s.master, session->master, sizeof(s.master));
+    s.verify_result = session->verify_result;
+#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+    s.mfl_code = session->mfl_code;
+#endif
+#if defined(MBEDTLS_SSL_TRUNCATED_HMAC)
+    s.trunc_hmac = session->trunc_hmac;
+#endif
+#if defined(MBEDTLS_SSL_ENCRYPT_THEN_MAC)
+    s.encrypt_then_mac = session->encrypt_then_mac;
+#endif
+#if defined(MBEDTLS_SSL_SESSION_TICKETS) && defined(MBEDTLS_SSL_CLI_C)
+    // The session owns its ticket; mbedtls_ssl_session_free releases it below
+    if (session->ticket_len) {
+        if (!(s.ticket = mbedtls_calloc(1, session->ticket_len)))
+            return -1;
+        memcpy(s.ticket, session->ticket, session->ticket_len);
+        s.ticket_len = session->ticket_len;
+        s.ticket_lifetime = session->ticket_lifetime;
+    }
+#endif
+
+    // Deep copies s into the handshake
+    ret = mbedtls_ssl_set_session(ssl, &s);
+    mbedtls_ssl_session_free(&s);
+
+    return ret == 0 ? 0 : -1;
+}
+
+int tls_session_update(tls_session_t *session, const char *host, const mbedtls_ssl_context *ssl)
+{
+    mbedtls_ssl_session s;
+    int resumed;
+
+    mbedtls_ssl_session_init(&s);
+    if (mbedtls_ssl_get_session(ssl, &s) != 0 || s.id_len > sizeof(session->id)) {
+        mbedtls_ssl_session_free(&s);
+        tls_session_clear(session);
+        return TLS_SESSION_ERR;
+    }
+
+    // A resumed handshake keeps the master secret; a full one always derives a new one
+    resumed = tls_session_valid(session, host) && !memcmp(session->master, s.master, sizeof(session->master));
+
+    tls_session_clear(session);
+    session->magic = TLS_SESSION_MAGIC;
+    session->host_hash = host_hash(host);
+    session->ciphersuite = s.ciphersuite;
+    session->compression = s.compression;
+    session->id_len = s.id_len;
+    memcpy(session->id, s.id, s.id_len);
+    memcpy(session->master, s.master, sizeof(session->master));
+    session->verify_result = s.verify_result;
+#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+    session->mfl_code = s.mfl_code;
+#endif
+#if defined(MBEDTLS_SSL_TRUNCATED_HMAC)
+    session->trunc_hmac = s.trunc_hmac;
+#endif
+#if defined(MBEDTLS_SSL_ENCRYPT_THEN_MAC)
+    session->encrypt_then_mac = s.encrypt_then_mac;
+#endif
+#if defined(MBEDTLS_SSL_SESSION_TICKETS) && defined(MBEDTLS_SSL_CLI_C)
+    // A ticket too large to keep still leaves the session ID to resume with
+    if (s.ticket && s.ticket_len <= sizeof(session->ticket)) {
+        memcpy(session->ticket, s.ticket, s.ticket_len);
+        session->ticket_len = s.ticket_len;
+        session->ticket_lifetime = s.ticket_lifetime;
+    }
+#endif
+    session->check = session_check(session);
+
+    mbedtls_ssl_session_free(&s);
+
+    return resumed ? TLS_SESSION_RESUMED : TLS_SESSION_NEW;
+}
@@ -0,0 +1,66 @@
+#ifndef TLS_SESSION_H
+#define TLS_SESSION_H
+
+// Resolves to the target's own mbedTLS configuration, which must come before any other mbedTLS header
+#include "mbedtls/config.h"
+#include "mbedtls/ssl.h"
+
+#include <stdint.h>
+
+/*
+ * Flat copy of an mbedTLS client session, for resuming it on a later connect.
+ *
+ * mbedtls_ssl_session holds pointers (ticket, peer certificate), so it cannot be kept across deep sleep or
+ * written to flash as is. This keeps the parts needed to offer a session ID or ticket again, with a check
+ * value so a torn or stale copy in RTC memory or NVS is never offered. The peer verify result of the full
+ * handshake is kept with it, so checks made after a resumed handshake see the same result.
+ *
+ * The copy contains the session's master secret: keep it on the device.
+ */
+#define TLS_SESSION_TICKET_MAX 256
+
+#define TLS_SESSION_NEW 1     // Full handshake: a new session was saved
+#define TLS_SESSION_RESUMED 0 // The offered session was accepted
+#define TLS_SESSION_ERR -1
+
+typedef struct tls_session_t {
+    uint32_t magic;
+    uint32_t host_hash; // Only offered to the host it was negotiated with
+    uint16_t ciphersuite;
+    uint8_t compression;
+    uint8_t id_len;
+    uint8_t id[32];
+    uint8_t master[48];
+    uint8_t mfl_code;
+    uint8_t trunc_hmac;
+    uint8_t encrypt_then_mac;
+    uint8_t reserved;
+    uint32_t verify_result;
+    uint32_t ticket_lifetime;
+    uint16_t ticket_len;
+    uint8_t ticket[TLS_SESSION_TICKET_MAX];
+    uint32_t check; // Over everything above
+} tls_session_t;
+
+/**
+ * \return true if session holds a complete copy negotiated with host
+ */
+int tls_session_valid(const tls_session_t *session, const char *host);
+
+void tls_session_clear(tls_session_t *session);
+
+/**
+ * Offer the saved session in the next handshake. Call after mbedtls_ssl_setup.
+ * \return 0 if a session was offered, -1 if there was none for host
+ */
+int tls_session_offer(const tls_session_t *session, const char *host, mbedtls_ssl_context *ssl);
+
+/**
+ * Call after a successful handshake
+ * \return TLS_SESSION_RESUMED if the handshake resumed the saved session (the copy is refreshed, e.g. with a
+ *         new ticket), TLS_SESSION_NEW if it was a full handshake and session now holds the new one, or
+ *         TLS_SESSION_ERR if the session could not be saved (session is cleared)
+ */
+int tls_session_update(tls_session_t *session, const char *host, const mbedtls_ssl_context *ssl);
+
+#endif // TLS_SESSION_H
@@ -0,0 +1,261 @@
+#include <string.h>
+
+#include "topic_trie.h"
+
+#define ROOT 0
+
+void topic_trie_init(topic_trie_t *trie, topic_node_t *nodes, int node_max, char *names, int names_max)
+{
+    trie->nodes = nodes;
+    trie->node_max = node_max;
+    trie->names = names;
+    trie->names_max = names_max;
+    trie->names_len = 0;
+
+    memset(&nodes[ROOT], 0, sizeof(nodes[ROOT]));
+    nodes[ROOT].child = nodes[ROOT].sibling = nodes[ROOT].plus = nodes[ROOT].hash = TOPIC_NONE;
+    trie->node_count = 1;
+}
+
+/**
+ * Check a filter against the MQTT rules: `+` and `#` must fill a whole level, and `#` must be the last one
+ */
+static int filter_valid(const char *filter)
+{
+    const char *p = filter;
+
+    if (!*filter)
+        return 0;
+
+    for (; *p; p++) {
+        if (*p != '+' && *p != '#')
+            continue;
+        if (p != filter && p[-1] != '/')
+            return 0;
+        if (*p == '#' && p[1] != '\0')
+            return 0;
+        if (*p == '+' && p[1] != '\0' && p[1] != '/')
+            return 0;
+    }
+
+    return 1;
+}
+
+static int level_equal(const topic_trie_t *trie, const topic_node_t *node, const char *level, int len)
+{
+    return node->name_len == len && !memcmp(&trie->names[node->name], level, len);
+}
+
+static uint16_t node_new(topic_trie_t *trie, const char *level, int len)
+{
+    topic_node_t *node;
+
+    if (trie->node_count >= trie->node_max || len > UINT8_MAX || trie->names_len + len > trie->names_max)
+        return TOPIC_NONE;
+
+    node = &trie->nodes[trie->node_count];
+    memset(node, 0, sizeof(*node));
+    node->child = node->sibling = node->plus = node->hash = TOPIC_NONE;
+    node->name = trie->names_len;
+    node->name_len = len;
+    memcpy(&trie->names[trie->names_len], level, len);
+    trie->names_len += len;
+
+    return trie->node_count++;
+}
+
+/**
+ * Find the child of parent for one filter level
+ * \param create Add the child if it is missing
+ */
+static uint16_t node_child(topic_trie_t *trie, uint16_t parent, const char *level, int len, int create)
+{
+    topic_node_t *node = &trie->nodes[parent];
+    uint16_t idx;
+
+    if (len == 1 && (*level == '+' || *level == '#')) {
+        uint16_t *slot = *level == '+' ? &node->plus : &node->hash;
+
+        if (*slot == TOPIC_NONE && create)
+            *slot = node_new(trie, level, len);
+        return *slot;
+    }
+
+    for (idx = node->child; idx != TOPIC_NONE; idx = trie->nodes[idx].sibling) {
+        if (level_equal(trie, &trie->nodes[idx], level, len))
+            return idx;
+    }
+
+    if (!create || (idx = node_new(trie, level, len)) == TOPIC_NONE)
+        return TOPIC_NONE;
+
+    trie->nodes[idx].sibling = node->child;
+    node->child = idx;
+
+    return idx;
+}
+
+static uint16_t node_find(topic_trie_t *trie, const char *filter, int create)
+{
+    uint16_t idx = ROOT;
+    const char *p = filter;
+
+    while (idx != TOPIC_NONE) {
+        const char *slash = strchr(p, '/');
+        int len = slash ? slash - p : (int)strlen(p);
+
+        idx = node_child(trie, idx, p, len, create);
+        if (!slash)
+            break;
+        p = slash + 1;
+    }
+
+    return idx;
+}
+
+int topic_trie_add(topic_trie_t *trie, const char *filter, int qos, topic_handler_t handler, void *ctx)
+{
+    uint16_t idx;
+
+    if (!filter_valid(filter) || !handler)
+        return TOPIC_TRIE_INVALID;
+
+    if ((idx = node_find(trie, filter, 1)) == TOPIC_NONE)
+        return TOPIC_TRIE_FULL;
+
+    trie->nodes[idx].handler = handler;
+    trie->nodes[idx].ctx = ctx;
+    trie->nodes[idx].qos = qos;
+
+    return 0;
+}
+
+int topic_trie_remove(topic_trie_t *trie, const char *filter)
+{
+    uint16_t idx;
+
+    if (!filter_valid(filter))
+        return TOPIC_TRIE_INVALID;
+
+    if ((idx = node_find(trie, filter, 0)) == TOPIC_NONE || !trie->nodes[idx].handler)
+        return TOPIC_TRIE_NOT_FOUND;
+
+    trie->nodes[idx].handler = NULL;
+    trie->nodes[idx].ctx = NULL;
+
+    return 0;
+}
+
+typedef struct match_t {
+    const char *topic;
+    const char *end;
+    int topic_len;
+    const unsigned char *payload;
+    int payload_len;
+} match_t;
+
+static int node_call(const topic_trie_t *trie, uint16_t idx, const match_t *m)
+{
+    const topic_node_t *node;
+
+    if (idx == TOPIC_NONE)
+        return 0;
+    node = &trie->nodes[idx];
+    if (!node->handler)
+        return 0;
+
+    node->handler(node->ctx, m->topic, m->topic_len, m->payload, m->payload_len);
+    return 1;
+}
+
+/**
+ * \param level Start of the next topic level, NULL once the topic is exhausted
+ */
+static int node_match(const topic_trie_t *trie, uint16_t idx, const char *level, const match_t *m)
+{
+    const topic_node_t *node = &trie->nodes[idx];
+    const char *slash, *next;
+    int called = 0;
+    int wild;
+    int len;
+
+    if (!level) {
+        // "a/#" also matches "a"
+        return node_call(trie, idx, m) + node_call(trie, node->hash, m);
+    }
+
+    slash = memchr(level, '/', m->end - level);
+    len = slash ? slash - level : m->end - level;
+    next = slash ? slash + 1 : NULL;
+
+    // Wildcards at the first level never match $SYS style topics
+    wild = !(idx == ROOT && len > 0 && *level == '$');
+
+    if (wild) {
+        called += node_call(trie, node->hash, m);
+        if (node->plus != TOPIC_NONE)
+            called += node_match(trie, node->plus, next, m);
+    }
+
+    for (uint16_t child = node->child; child != TOPIC_NONE; child = trie->nodes[child].sibling) {
+        if (level_equal(trie, &trie->nodes[child], level, len)) {
+            called += node_match(trie, child, next, m);
+            break;
+        }
+    }
+
+    return called;
+}
+
+int topic_trie_dispatch(const topic_trie_t *trie, const char *topic, int topic_len,
+        const unsigned char *payload, int payload_len)
+{
+    match_t m = { topic, topic + topic_len, topic_len, payload, payload_len };
+
+    return node_match(trie, ROOT, topic, &m);
+}
+
+static int node_walk(const topic_trie_t *trie, uint16_t idx, char *buf, int len, int buf_len,
+        topic_walk_t cb, void *ctx)
+{
+    const topic_node_t *node = &trie->nodes[idx];
+    uint16_t children[3] = { node->child, node->plus, node->hash };
+    int count = 0;
+    int ret;
+
+    if (node->handler) {
+        buf[len] = '\0';
+        cb(ctx, buf, node->qos);
+        count++;
+    }
+
+    // Wildcard children have no siblings, so each of the three lists is walked the same way
+    for (int i = 0; i < 3; i++) {
+        for (uint16_t child = children[i]; child != TOPIC_NONE; child = trie->nodes[child].sibling) {
+            const topic_node_t *c = &trie->nodes[child];
+            int n = len;
+
+            if (idx != ROOT)
+                n++;
+            if (n + c->name_len + 1 > buf_len)
+                return TOPIC_TRIE_FULL;
+            if (idx != ROOT)
+                buf[len] = '/';
+            memcpy(buf + n, &trie->names[c->name], c->name_len);
+
+            if ((ret = node_walk(trie, child, buf, n + c->name_len, buf_len, cb, ctx)) < 0)
+                return ret;
+            count += ret;
+        }
+    }
+
+    return count;
+}
+
+int topic_trie_walk(const topic_trie_t *trie, char *buf, int buf_len, topic_walk_t cb, void *ctx)
+{
+    if (buf_len < 1)
+        return TOPIC_TRIE_FULL;
+
+    return node_walk(trie, ROOT, buf, 0, buf_len, cb, ctx);
+}
@@ -0,0 +1,78 @@
+#ifndef TOPIC_TRIE_H
+#define TOPIC_TRIE_H
+
+#include <stdint.h>
+
+/*
+ * MQTT subscription registry.
+ *
+ * Topic filters are stored one level per node in a trie built from a caller supplied node pool and name
+ * arena, so nothing is allocated at runtime. Each node keeps its `+` and `#` children apart from the literal
+ * ones, and dispatching a topic walks it level by level: the cost depends on the topic depth and the fanout
+ * at each level, not on the total number of subscriptions.
+ */
+#define TOPIC_NONE 0xffff
+
+typedef void (*topic_handler_t)(void *ctx, const char *topic, int topic_len,
+        const unsigned char *payload, int payload_len);
+
+typedef struct topic_node_t {
+    uint16_t child;   // First literal child
+    uint16_t sibling; // Next literal sibling
+    uint16_t plus;    // `+` child
+    uint16_t hash;    // `#` child
+    uint16_t name;    // Offset of the level name in the arena
+    uint8_t name_len;
+    uint8_t qos;
+    topic_handler_t handler; // NULL if no filter ends here
+    void *ctx;
+} topic_node_t;
+
+typedef struct topic_trie_t {
+    topic_node_t *nodes;
+    uint16_t node_max;
+    uint16_t node_count;
+    char *names;
+    uint16_t names_max;
+    uint16_t names_len;
+} topic_trie_t;
+
+#define TOPIC_TRIE_INVALID -1 // Malformed filter
+#define TOPIC_TRIE_FULL -2    // Out of nodes or name space
+#define TOPIC_TRIE_NOT_FOUND -3
+
+/**
+ * \param nodes Node pool, one node per distinct filter level plus the root
+ * \param names Arena for level names
+ */
+void topic_trie_init(topic_trie_t *trie, topic_node_t *nodes, int node_max, char *names, int names_max);
+
+/**
+ * Register a filter. Adding a filter that already exists replaces its handler.
+ * \return 0 on success
+ */
+int topic_trie_add(topic_trie_t *trie, const char *filter, int qos, topic_handler_t handler, void *ctx);
+
+/**
+ * Remove a filter's handler. Its nodes stay in the trie and are reused if the filter is added again.
+ * \return 0 on success
+ */
+int topic_trie_remove(topic_trie_t *trie, const char *filter);
+
+/**
+ * Call the handler of every filter matching topic
+ * \return Number of handlers called
+ */
+int topic_trie_dispatch(const topic_trie_t *trie, const char *topic, int topic_len,
+        const unsigned char *payload, int payload_len);
+
+typedef void (*topic_walk_t)(void *ctx, const char *filter, int qos);
+
+/**
+ * Call cb for every registered filter, e.g. to subscribe again after a new session
+ * \param buf Scratch space for rebuilding filters, at least as long as the longest filter plus one
+ * \return Number of filters visited, or TOPIC_TRIE_FULL if buf was too short
+ */
+int topic_trie_walk(const topic_trie_t *trie, char *buf, int buf_len, topic_walk_t cb, void *ctx);
+
+#endif // TOPIC_TRIE_H
@@ -0,0 +1,100 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "wifi_cache.h"
+
+#define WIFI_CACHE_MAGIC 0x57464332 // "WFC2"
+
+static uint32_t fnv1a(uint32_t hash, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+
+    while (len--)
+        hash = (hash ^ *p++) * 16777619u;
+    return hash;
+}
+
+static uint32_t cache_check(const wifi_cache_t *cache)
+{
+    return fnv1a(2166136261u, cache, offsetof(wifi_cache_t, check));
+}
+
+static void cache_seal(wifi_cache_t *cache)
+{
+    cache->check = cache_check(cache);
+}
+
+int wifi_cache_init(wifi_cache_t *cache, const char *ssid)
+{
+    uint32_t ssid_hash = fnv1a(2166136261u, ssid, strlen(ssid));
+
+    if (cache->magic == WIFI_CACHE_MAGIC && cache->ssid_hash == ssid_hash && cache->check == cache_check(cache))
+        return 0;
+
+    memset(cache, 0, sizeof(*cache));
+    cache->magic = WIFI_CACHE_MAGIC;
+    cache->ssid_hash = ssid_hash;
+    cache_seal(cache);
+    return 1;
+}
+
+void wifi_cache_restored(wifi_cache_t *cache)
+{
+    cache->has_lease = 0;
+    cache_seal(cache);
+}
+
+int wifi_cache_has_ap(const wifi_cache_t *cache)
+{
+    return cache->channel != 0;
+}
+
+int wifi_cache_has_lease(const wifi_cache_t *cache, uint32_t now_s)
+{
+    uint32_t reuse_s = cache->lease_s / 2;
+
+    if (reuse_s > WIFI_CACHE_LEASE_S)
+        reuse_s = WIFI_CACHE_LEASE_S;
+    // Also false if the clock went back past leased_at
+    return cache->channel && cache->has_lease && now_s - cache->leased_at < reuse_s;
+}
+
+int wifi_cache_set_ap(wifi_cache_t *cache, const uint8_t *bssid, uint8_t channel)
+{
+    uint8_t none[sizeof(cache->bssid)] = {0};
+    int changed;
+
+    if (!bssid)
+        bssid = none;
+    changed = cache->channel != channel || memcmp(cache->bssid, bssid, sizeof(cache->bssid)) != 0;
+
+    if (changed) {
+        // The lease may be for another network behind the same SSID
+        cache->has_lease = 0;
+        memcpy(cache->bssid, bssid, sizeof(cache->bssid));
+        cache->channel = channel;
+        cache_seal(cache);
+    }
+    return changed;
+}
+
+void wifi_cache_set_lease(wifi_cache_t *cache, const uint8_t *ip, const uint8_t *netmask, const uint8_t *gw,
+                          const uint8_t *dns, uint32_t now_s, uint32_t lease_s)
+{
+    memcpy(cache->ip, ip, sizeof(cache->ip));
+    memcpy(cache->netmask, netmask, sizeof(cache->netmask));
+    memcpy(cache->gw, gw, sizeof(cache->gw));
+    memcpy(cache->dns, dns, sizeof(cache->dns));
+    cache->leased_at = now_s;
+    cache->lease_s = lease_s;
+    cache->has_lease = 1;
+    cache_seal(cache);
+}
+
+void wifi_cache_failed(wifi_cache_t *cache)
+{
+    memset(cache->bssid, 0, sizeof(cache->bssid));
+    cache->channel = 0;
+    cache->has_lease = 0;
+    cache_seal(cache);
+}
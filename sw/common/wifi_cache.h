@@ -0,0 +1,84 @@
+#ifndef WIFI_CACHE_H
+#define WIFI_CACHE_H
+
+#include <stdint.h>
+
+/*
+ * Fast Wi-Fi rejoin: the access point and DHCP lease of the last good connection.
+ *
+ * A full join scans every channel for the SSID, associates and then runs DHCP: seconds of radio time on every
+ * boot or wake, most of what a duty cycled node spends on air. With the cache the target joins the cached
+ * BSSID on its channel and configures the cached address statically, skipping the scan and DHCP. If that does
+ * not connect within a short timeout the target calls wifi_cache_failed and does a full join, whose result is
+ * cached again.
+ *
+ * The address is only reused until T1 of the lease DHCP granted, half its length, when a DHCP client would
+ * start renewing it, and never for more than WIFI_CACHE_LEASE_S; so the router does not hand it to someone
+ * else meanwhile. After that the join still skips the scan but runs DHCP, which renews the lease. An address
+ * whose lease length the target could not read is not reused. Lease times are in seconds of a clock the
+ * target keeps across sleep, and a lease timed further back than that is treated as expired.
+ *
+ * The target keeps the cache in RTC memory, plus a copy in flash for cold boots that it writes only when the
+ * access point changes; wifi_cache_restored drops the lease of that copy, since the clock did not survive.
+ * The cache is kept for one SSID and starts over when it changes.
+ */
+#ifndef WIFI_CACHE_LEASE_S
+#define WIFI_CACHE_LEASE_S (4 * 3600) // Cap on reusing an address, whatever the lease
+#endif
+
+typedef struct wifi_cache_t {
+    uint32_t magic;
+    uint32_t ssid_hash;
+    uint8_t bssid[6];   // All zero if the target could not tell
+    uint8_t channel;    // 0: no access point cached
+    uint8_t has_lease;
+    uint8_t ip[4];      // Network order, as are the rest
+    uint8_t netmask[4];
+    uint8_t gw[4];
+    uint8_t dns[4];
+    uint32_t leased_at;
+    uint32_t lease_s;   // Granted by DHCP, 0 if unknown
+    uint32_t check;     // Over everything above
+} wifi_cache_t;
+
+/**
+ * Take over the cache, resetting it if it is torn or for another SSID
+ * \return 1 if it was reset
+ */
+int wifi_cache_init(wifi_cache_t *cache, const char *ssid);
+
+/**
+ * Drop the lease of a cache restored from flash, after wifi_cache_init accepted it
+ */
+void wifi_cache_restored(wifi_cache_t *cache);
+
+/**
+ * \return true if an access point is cached: join it directly
+ */
+int wifi_cache_has_ap(const wifi_cache_t *cache);
+
+/**
+ * \return true if the cached address can be configured statically at now_s
+ */
+int wifi_cache_has_lease(const wifi_cache_t *cache, uint32_t now_s);
+
+/**
+ * Cache the access point joined
+ * \param bssid NULL if the target cannot tell
+ * \return 1 if it differs from the one cached: save the cache to flash
+ */
+int wifi_cache_set_ap(wifi_cache_t *cache, const uint8_t *bssid, uint8_t channel);
+
+/**
+ * Cache the address, netmask, gateway and DNS server DHCP assigned at now_s, each 4 bytes in network order
+ * \param lease_s Lease time DHCP granted, 0 if the target cannot tell
+ */
+void wifi_cache_set_lease(wifi_cache_t *cache, const uint8_t *ip, const uint8_t *netmask, const uint8_t *gw,
+                          const uint8_t *dns, uint32_t now_s, uint32_t lease_s);
+
+/**
+ * Forget the access point and lease after a fast join failed
+ */
+void wifi_cache_failed(wifi_cache_t *cache);
+
+#endif // WIFI_CACHE_H
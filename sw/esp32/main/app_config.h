@@ -15,8 +15,14 @@
 #define WIFI_PREFIX "wifi."
 #define MQTT_PREFIX "mqtt."
 #define SSL_PREFIX "ssl."
+#define DUTY_PREFIX "duty."
+// DER form of a certificate or key given as PEM under SSL_PREFIX: an NVS key holds one type
+#define SSL_DER_PREFIX "der."
+#define SSL_KEY_LEN 15
 
 esp_err_t nvs_get_str_static(nvs_handle nvs, const char *param, char *buffer, size_t len);
 esp_err_t nvs_get_str_heap(nvs_handle nvs, const char *param, char **buffer);
+esp_err_t nvs_get_blob_heap(nvs_handle nvs, const char *param, void **buffer, size_t *len);
+void ssl_der_key(char *der_key, const char *key);
 
 #endif
\ No newline at end of file
@@ -143,10 +143,17 @@ esp_err_t command_wifi_param_check(const char *param, int *read_only)
         return ESP_OK;
     } else if (strcmp(param, WIFI_PREFIX "bssid") == 0) {
         return ESP_OK;
+    } else if (strcmp(param, WIFI_PREFIX "ntp_server") == 0) {
+        return ESP_OK;
     } else if (strcmp(param, WIFI_PREFIX "password") == 0) {
         if (read_only)
             *read_only = true;
         return ESP_OK;
+    } else if (strcmp(param, WIFI_PREFIX "cache") == 0) {
+        // Last access point joined, written by app_init_wifi; only clearing it makes sense
+        if (read_only)
+            *read_only = true;
+        return ESP_OK;
     }
 
     return ESP_ERR_INVALID_ARG;
@@ -166,6 +173,12 @@ esp_err_t command_mqtt_param_check(const char *param, int *read_only)
         return ESP_OK;
     } else if (strcmp(param, MQTT_PREFIX "port") == 0) {
         return ESP_OK;
+    } else if (strcmp(param, MQTT_PREFIX "endpoints") == 0) {
+        return ESP_OK;
+    } else if (strcmp(param, MQTT_PREFIX "batch_count") == 0) {
+        return ESP_OK;
+    } else if (strcmp(param, MQTT_PREFIX "batch_ms") == 0) {
+        return ESP_OK;
     } else if (strcmp(param, MQTT_PREFIX "username") == 0) {
         if (read_only)
             *read_only = true;
@@ -195,6 +208,10 @@ esp_err_t command_ssl_param_check(const char *param, int *read_only)
         return ESP_OK;
     } else if (strcmp(param, SSL_PREFIX "client_key") == 0) {
         return ESP_OK;
+    } else if (strcmp(param, SSL_PREFIX "psk") == 0) {
+        return ESP_OK;
+    } else if (strcmp(param, SSL_PREFIX "pin") == 0) {
+        return ESP_OK;
     }
 
     return ESP_ERR_INVALID_ARG;
@@ -207,7 +224,11 @@ static int command_ssl(int argc, const char * const * argv)
     int len = 0;
     int c;
     bool digit = false;
+    bool pem;
     char param[32];
+    char der_key[SSL_KEY_LEN + 1];
+    const char *stale = NULL;
+    esp_err_t err;
     bool waiting = true;
 
     if (argc < 2) {
@@ -283,23 +304,71 @@ param_usage:
         goto err;
     }
     buf[len] = '\0';
-    printf("\n%s\n", buf);
+    pem = strncmp(buf, "-----BEGIN ", 11) == 0;
+    if (pem)
+        printf("\n%s\n", buf);
 
-    if (open_config() != ESP_OK)
+    if (open_config() != ESP_OK) {
+        free(buf);
         return 1;
-    nvs_set_str(nvs, param, buf);
-    nvs_commit(nvs);
+    }
+    /*
+     * The PSK and the pin are blobs. A certificate or key is a PEM string under param, converted by mqtt_init
+     * on the next boot, or a DER blob under its own key: a key holds one type. The other form is only erased
+     * once the new one is committed, so a reset in between keeps the old credential rather than neither.
+     */
+    ssl_der_key(der_key, param);
+    if (strcmp(param, SSL_PREFIX "psk") == 0 || strcmp(param, SSL_PREFIX "pin") == 0) {
+        err = nvs_set_blob(nvs, param, buf, len);
+    } else if (pem) {
+        err = nvs_set_str(nvs, param, buf);
+        stale = der_key;
+    } else {
+        err = nvs_set_blob(nvs, der_key, buf, len);
+        stale = param;
+    }
+    if (err == ESP_OK)
+        err = nvs_commit(nvs);
+    if (err == ESP_OK && stale) {
+        nvs_erase_key(nvs, stale);
+        nvs_commit(nvs);
+    }
     close_config();
 
-    printf("%s: %d bytes\n", param, len);;
+    if (err != ESP_OK)
+        printf("%s: failed to store: %d\n", param, err);
+    else
+        printf("%s: %d bytes%s\n", param, len, pem ? "" : " DER");
+    free(buf);
 
-    return 0;
+    return err != ESP_OK;
 err:
     printf("Failed to parse hex input");
     free(buf);
     return 1;
 }
 
+esp_err_t command_duty_param_check(const char *param, int *read_only)
+{
+    if (read_only)
+        *read_only = false;
+
+    if (strcmp(param, DUTY_PREFIX "sample_s") == 0) {
+        return ESP_OK;
+    } else if (strcmp(param, DUTY_PREFIX "upload_count") == 0) {
+        return ESP_OK;
+    } else if (strcmp(param, DUTY_PREFIX "latency_s") == 0) {
+        return ESP_OK;
+    }
+
+    return ESP_ERR_INVALID_ARG;
+}
+
+static int command_duty(int argc, const char * const * argv)
+{
+    return command_param(argc, argv, DUTY_PREFIX, command_duty_param_check);
+}
+
 static int command_client_id(int argc, const char * const * argv)
 {
     esp_err_t err;
@@ -340,11 +409,14 @@ int command_help(int argc, const char * const * argv)
     (void)argv;
 
     printf("Available commands:\n"
-           "  wifi <param> [<value>] -- Set wifi <param> (one of ssid, bssid, password) to <value>, use empty string to clear\n"
+           "  wifi <param> [<value>] -- Set wifi <param> (one of ssid, bssid, password, ntp_server) to <value>, use empty string to clear\n"
+           "  wifi cache             -- Clear the copy of the cached access point kept for cold boots\n"
            "  wifi <param>?          -- Read wifi <param>\n"
-           "  mqtt <param> [<value>] -- Set mqtt <param> (one of endpoint, port, username, password) to <value>\n"
+           "  mqtt <param> [<value>] -- Set mqtt <param> (one of endpoint, port, username, password, batch_count, batch_ms) to <value>\n"
            "  mqtt <param>?          -- Read mqtt <param>\n"
-           "  ssl <param>            -- Set ssl <param> (one of ca_cert, client_cert, client_key) to binary value represented as hex, terminated by newline\n"
+           "  ssl <param>            -- Set ssl <param> (one of ca_cert, client_cert, client_key, psk) to binary value represented as hex, terminated by newline\n"
+           "  duty <param> [<value>] -- Set duty cycle <param> (one of sample_s, upload_count, latency_s) to <value>, clear sample_s to stay awake\n"
+           "  duty <param>?          -- Read duty cycle <param>\n"
            "  client_id              -- Print MQTT client-id\n"
            "  clear                  -- Delete all params\n"
            "  list                   -- List keys and their lengths\n"
@@ -357,6 +429,7 @@ command_t commands[] = {
     { command_wifi, "wifi" },
     { command_mqtt, "mqtt" },
     { command_ssl, "ssl" },
+    { command_duty, "duty" },
     { command_client_id, "client_id" },
     { command_clear, "clear" },
     { command_echo, "echo" },
@@ -6,3 +6,7 @@
 # in the build directory. This behaviour is entirely configurable,
 # please read the ESP-IDF documents if you need to do this.
 #
+
+# Platform independent modules shared with the ESP8266 build
+COMPONENT_SRCDIRS := . ../../common
+COMPONENT_ADD_INCLUDEDIRS := . ../../common
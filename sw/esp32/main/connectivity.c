@@ -0,0 +1,92 @@
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <freertos/timers.h>
+#include <apps/sntp/sntp.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "connectivity.h"
+
+// Any earlier wall clock was never set: it counts from boot
+#define CONN_TIME_VALID_S 1500000000
+// SNTP here has no completion callback, so the clock is checked this often until it is set
+#define CONN_TIME_CHECK_MS 1000
+
+static EventGroupHandle_t events;
+static TimerHandle_t time_check;
+// Referenced by SNTP, which does not copy it
+static char ntp_server[CONN_NTP_SERVER_LEN];
+
+static int conn_time_valid(void)
+{
+    return time(NULL) >= CONN_TIME_VALID_S;
+}
+
+static void conn_time_check(TimerHandle_t timer)
+{
+    if (conn_time_valid()) {
+        printf("Clock set by SNTP\n");
+        xEventGroupSetBits(events, CONN_TIME_BIT);
+        xTimerStop(timer, 0);
+    }
+}
+
+esp_err_t conn_init(const char *server)
+{
+    events = xEventGroupCreate();
+    time_check = xTimerCreate("conn_time", CONN_TIME_CHECK_MS / portTICK_PERIOD_MS, pdTRUE, NULL, conn_time_check);
+    if (!events || !time_check)
+        return ESP_ERR_NO_MEM;
+
+    strncpy(ntp_server, server ? server : CONN_NTP_SERVER_DEFAULT, sizeof(ntp_server) - 1);
+    if (conn_time_valid())
+        xEventGroupSetBits(events, CONN_TIME_BIT);
+
+    return ESP_OK;
+}
+
+EventGroupHandle_t conn_events(void)
+{
+    return events;
+}
+
+void conn_set(EventBits_t bits)
+{
+    xEventGroupSetBits(events, bits);
+}
+
+void conn_clear(EventBits_t bits)
+{
+    xEventGroupClearBits(events, bits);
+}
+
+static EventBits_t conn_wait_bits(EventBits_t bits, BaseType_t all, uint32_t timeout_ms)
+{
+    TickType_t ticks = timeout_ms == CONN_FOREVER ? portMAX_DELAY : timeout_ms / portTICK_PERIOD_MS;
+
+    return xEventGroupWaitBits(events, bits, pdFALSE, all, ticks);
+}
+
+EventBits_t conn_wait(EventBits_t bits, uint32_t timeout_ms)
+{
+    return conn_wait_bits(bits, pdTRUE, timeout_ms);
+}
+
+EventBits_t conn_wait_any(EventBits_t bits, uint32_t timeout_ms)
+{
+    return conn_wait_bits(bits, pdFALSE, timeout_ms);
+}
+
+void conn_sync_time(void)
+{
+    // Once started, SNTP keeps the clock in step by itself
+    if ((xEventGroupGetBits(events) & CONN_TIME_BIT) || sntp_enabled())
+        return;
+
+    printf("Setting clock from %s\n", ntp_server);
+    sntp_setoperatingmode(SNTP_OPMODE_POLL);
+    sntp_setservername(0, ntp_server);
+    sntp_init();
+    xTimerStart(time_check, 0);
+}
@@ -0,0 +1,60 @@
+#ifndef CONNECTIVITY_H
+#define CONNECTIVITY_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <esp_err.h>
+#include <stdint.h>
+
+/*
+ * Connectivity readiness, as one FreeRTOS event group shared by every task.
+ *
+ * Each layer sets its bit when it comes up and clears it when it goes down: the Wi-Fi event handler the
+ * Wi-Fi and IP bits, the MQTT task the broker bit, and the SNTP check the time bit. A task that needs a layer
+ * blocks on exactly the bits it needs and is woken as soon as they are set, instead of polling a flag, so a
+ * reconnect propagates up the layers without a poll interval at each one and idle tasks do not wake the CPU.
+ */
+#define CONN_WIFI_BIT (1 << 0)      // Associated with the access point
+#define CONN_IP_BIT (1 << 1)        // Address assigned, by DHCP or from the cache
+#define CONN_BROKER_BIT (1 << 2)    // MQTT session established
+#define CONN_TIME_BIT (1 << 3)      // Wall clock set, by SNTP or kept through deep sleep
+#define CONN_WIFI_LOST_BIT (1 << 4) // Disconnected since the last join started
+
+#define CONN_FOREVER UINT32_MAX
+
+#define CONN_NTP_SERVER_LEN 64
+#define CONN_NTP_SERVER_DEFAULT "pool.ntp.org"
+
+/**
+ * Create the event group. Sets CONN_TIME_BIT if the clock is already set, e.g. after deep sleep.
+ * \param ntp_server Synchronized with by conn_sync_time, NULL for CONN_NTP_SERVER_DEFAULT
+ */
+esp_err_t conn_init(const char *ntp_server);
+
+/**
+ * \return The event group, NULL before conn_init
+ */
+EventGroupHandle_t conn_events(void);
+
+void conn_set(EventBits_t bits);
+void conn_clear(EventBits_t bits);
+
+/**
+ * Block until all of bits are set
+ * \param timeout_ms CONN_FOREVER to wait for ever
+ * \return The bits set when the wait ended: check them for a timeout
+ */
+EventBits_t conn_wait(EventBits_t bits, uint32_t timeout_ms);
+
+/**
+ * Block until any of bits is set, see conn_wait
+ */
+EventBits_t conn_wait_any(EventBits_t bits, uint32_t timeout_ms);
+
+/**
+ * Start synchronizing the clock once an address is assigned, unless it is already set. Safe to call from the
+ * event handler, and again on every reconnect.
+ */
+void conn_sync_time(void);
+
+#endif // CONNECTIVITY_H
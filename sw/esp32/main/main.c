@@ -2,37 +2,230 @@
 #include <freertos/semphr.h>
 #include <rom/rtc.h>
 #include <nvs.h>
+#include <esp_attr.h>
+#include <esp_deep_sleep.h>
 #include <esp_wifi.h>
 #include <esp_system.h>
 #include <esp_event.h>
 #include <esp_event_loop.h>
 #include <nvs_flash.h>
 #include <driver/gpio.h>
+#include <lwip/dhcp.h>
+#include <lwip/dns.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/time.h>
+#include <time.h>
 
 #include "app_config.h"
 #include "command.h"
+#include "connectivity.h"
+#include "dutycycle.h"
+#include "filter.h"
 #include "mqtt.h"
+#include "sensor.h"
+#include "spsc.h"
+#include "telemetry.h"
+#include "wifi_cache.h"
+
+#define CONTROL_TOPIC "espnode/control"
+#define GPIO_LED GPIO_NUM_2 // Active high, as on most ESP32 boards
+
+#define WIFI_FAST_TIMEOUT_MS 3000 // Joining the cached access point, before scanning
+#define WIFI_CACHE_PARAM WIFI_PREFIX "cache"
+
+#define APP_READINGS_MAX 8
+
+// Always on: sample each sensor on its period, and publish only what the filter chains let through, see filter.h
+#define APP_COUNTER_MS 1000
+#define APP_HEAP_MS 2000
+#define APP_SAMPLE_SLACK_MS 20 // Sensors due this much later are sampled in the same wake
+#define APP_SAMPLE_RING_LEN 16 // Power of two; covers a flash erase holding up the consumer
+#define APP_SAMPLER_STACK_SIZE 2048
+#define APP_SAMPLER_PRIORITY (tskIDLE_PRIORITY + 2)
+#define APP_COUNTER_WINDOW 30
+#define APP_HEAP_AVERAGE 8
+#define APP_HEAP_DEADBAND 1024
+#define APP_HEARTBEAT_MS (5 * 60 * 1000)
+
+#define DUTY_LATENCY_S_DEFAULT 3600
+#define DUTY_RETRY_S 300
+#define DUTY_CONSOLE_MS (30 * 1000) // After power on, before the first sleep
+#define DUTY_WIFI_TIMEOUT_MS (15 * 1000)
+#define DUTY_CONNECT_TIMEOUT_MS (30 * 1000) // Includes failing over between brokers
+#define DUTY_ACK_TIMEOUT_MS (10 * 1000)
 
 mqtt_client_t mqtt;
-int wifi_ready = false;
+
+RTC_DATA_ATTR static wifi_cache_t rtc_wifi;
+static int wifi_static = false; // Address configured from the cache
+static int wifi_ap_changed = false;
+static volatile int wifi_rejoin = false; // Set once up: rejoin whenever the connection drops
+
+static spsc_t sample_ring;
+static reading_t sample_buf[APP_SAMPLE_RING_LEN];
+static sensor_sched_t sensor_sched;
+static filter_chain_t filters[READING_SENSOR_MAX];
+
+RTC_DATA_ATTR static duty_state_t rtc_duty;
+RTC_DATA_ATTR static uint32_t sample_count;
+static int telemetry_ready = false;
+
+/**
+ * Control topic: "on" and "off" switch the LED, as on the ESP8266 node
+ */
+static void control_received(void *ctx, const char *topic, int topic_len, const unsigned char *payload, int payload_len)
+{
+    if (payload_len >= 2 && !strncmp((const char *)payload, "on", 2)) {
+        printf("Turning on LED\n");
+        gpio_set_level(GPIO_LED, 1);
+    } else if (payload_len >= 3 && !strncmp((const char *)payload, "off", 3)) {
+        printf("Turning off LED\n");
+        gpio_set_level(GPIO_LED, 0);
+    } else {
+        printf("Unknown control message: %.*s\n", payload_len, (const char *)payload);
+    }
+}
+
+/**
+ * Cache the lease DHCP assigned, with the lease time the server granted
+ */
+static void app_wifi_lease(const tcpip_adapter_ip_info_t *info)
+{
+    uint32_t dns = ip4_addr_get_u32(ip_2_ip4(dns_getserver(0)));
+    struct netif *netif = NULL;
+    struct dhcp *dhcp = NULL;
+
+    if (tcpip_adapter_get_netif(TCPIP_ADAPTER_IF_STA, (void **)&netif) == ESP_OK && netif)
+        dhcp = netif_dhcp_data(netif);
+    wifi_cache_set_lease(&rtc_wifi, (const uint8_t *)&info->ip.addr, (const uint8_t *)&info->netmask.addr,
+                         (const uint8_t *)&info->gw.addr, (const uint8_t *)&dns, time(NULL),
+                         dhcp ? dhcp->offered_t0_lease : 0);
+}
 
 esp_err_t event_handler(void *ctx, system_event_t *event)
 {
-    if (event->event_id == SYSTEM_EVENT_STA_GOT_IP)
-        wifi_ready = true;
+    switch (event->event_id) {
+    case SYSTEM_EVENT_STA_CONNECTED:
+        if (wifi_cache_set_ap(&rtc_wifi, event->event_info.connected.bssid, event->event_info.connected.channel))
+            wifi_ap_changed = true;
+        conn_set(CONN_WIFI_BIT);
+        break;
+    case SYSTEM_EVENT_STA_GOT_IP:
+        if (!wifi_static)
+            app_wifi_lease(&event->event_info.got_ip.ip_info);
+        wifi_rejoin = true;
+        conn_set(CONN_IP_BIT);
+        conn_sync_time();
+        break;
+    case SYSTEM_EVENT_STA_DISCONNECTED:
+        conn_clear(CONN_WIFI_BIT | CONN_IP_BIT);
+        conn_set(CONN_WIFI_LOST_BIT);
+        if (wifi_rejoin)
+            esp_wifi_connect();
+        break;
+    default:
+        break;
+    }
     return ESP_OK;
 }
 
-void app_init_wifi(void)
+/**
+ * \return ms left of timeout_ms since start, 0 once it has passed; CONN_FOREVER if timeout_ms is 0
+ */
+static uint32_t app_remaining_ms(TickType_t start, uint32_t timeout_ms)
+{
+    uint32_t elapsed = (xTaskGetTickCount() - start) * portTICK_PERIOD_MS;
+
+    if (timeout_ms == 0)
+        return CONN_FOREVER;
+    return elapsed < timeout_ms ? timeout_ms - elapsed : 0;
+}
+
+/**
+ * Take over the cache in RTC memory, or after a cold boot the copy in NVS
+ */
+static void app_load_wifi_cache(nvs_handle nvs, const char *ssid)
+{
+    size_t len = sizeof(rtc_wifi);
+
+    if (!wifi_cache_init(&rtc_wifi, ssid))
+        return;
+    if (nvs_get_blob(nvs, WIFI_CACHE_PARAM, &rtc_wifi, &len) == ESP_OK && len == sizeof(rtc_wifi)
+            && !wifi_cache_init(&rtc_wifi, ssid))
+        wifi_cache_restored(&rtc_wifi);
+}
+
+/**
+ * Keep a copy of the cache for cold boots; only written when the access point changed
+ */
+static void app_save_wifi_cache(void)
 {
     nvs_handle nvs;
+
+    if (nvs_open(APP_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK)
+        return;
+    if (nvs_set_blob(nvs, WIFI_CACHE_PARAM, &rtc_wifi, sizeof(rtc_wifi)) == ESP_OK)
+        nvs_commit(nvs);
+    nvs_close(nvs);
+}
+
+/**
+ * Configure the cached address statically, skipping DHCP
+ */
+static void app_wifi_static(void)
+{
+    tcpip_adapter_ip_info_t info;
+    ip_addr_t dns;
+
+    memcpy(&info.ip.addr, rtc_wifi.ip, sizeof(info.ip.addr));
+    memcpy(&info.netmask.addr, rtc_wifi.netmask, sizeof(info.netmask.addr));
+    memcpy(&info.gw.addr, rtc_wifi.gw, sizeof(info.gw.addr));
+    IP_ADDR4(&dns, rtc_wifi.dns[0], rtc_wifi.dns[1], rtc_wifi.dns[2], rtc_wifi.dns[3]);
+
+    tcpip_adapter_dhcpc_stop(TCPIP_ADAPTER_IF_STA);
+    ESPNODE_ERROR_CHECK(tcpip_adapter_set_ip_info(TCPIP_ADAPTER_IF_STA, &info));
+    dns_setserver(0, &dns);
+    wifi_static = true;
+}
+
+/**
+ * Give up on the cached access point and lease: scan for the configured one and run DHCP
+ */
+static void app_wifi_full_join(wifi_config_t *configured)
+{
+    wifi_cache_failed(&rtc_wifi);
+    wifi_ap_changed = true;
+
+    esp_wifi_disconnect();
+    if (wifi_static) {
+        wifi_static = false;
+        tcpip_adapter_dhcpc_start(TCPIP_ADAPTER_IF_STA);
+    }
+    conn_clear(CONN_WIFI_LOST_BIT);
+    ESPNODE_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, configured));
+    ESPNODE_ERROR_CHECK(esp_wifi_connect());
+}
+
+/**
+ * Connect to the configured access point: directly to the cached one if there is one, with its cached lease,
+ * then by scanning and DHCP if that fails, see wifi_cache.h
+ * \param timeout_ms Give up after this long, 0 to wait for ever
+ * \return ESP_OK once an address is assigned, ESP_ERR_TIMEOUT otherwise
+ */
+esp_err_t app_init_wifi(uint32_t timeout_ms)
+{
+    TickType_t start = xTaskGetTickCount();
+    nvs_handle nvs;
     esp_err_t err;
     size_t len;
-    wifi_config_t sta_config;
+    int fast;
+    char ntp_server[CONN_NTP_SERVER_LEN];
+    wifi_config_t sta_config, configured;
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
 
     printf("Starting wifi...\n");
+    memset(&sta_config, 0, sizeof(sta_config));
 
     ESPNODE_ERROR_CHECK(nvs_open(APP_NAMESPACE, NVS_READONLY, &nvs));
     len = sizeof(sta_config.sta.ssid);
@@ -53,9 +246,27 @@ void app_init_wifi(void)
         abort();
     }
 
+    app_load_wifi_cache(nvs, (const char *)sta_config.sta.ssid);
+    if (nvs_get_str_static(nvs, WIFI_PREFIX "ntp_server", ntp_server, sizeof(ntp_server)) != ESP_OK)
+        strcpy(ntp_server, CONN_NTP_SERVER_DEFAULT);
     nvs_close(nvs);
+    ESPNODE_ERROR_CHECK(conn_init(ntp_server));
+
+    configured = sta_config;
+    fast = wifi_cache_has_ap(&rtc_wifi);
+    if (fast) {
+        static const uint8_t no_bssid[sizeof(rtc_wifi.bssid)];
+
+        if (memcmp(rtc_wifi.bssid, no_bssid, sizeof(no_bssid)) != 0) {
+            memcpy(sta_config.sta.bssid, rtc_wifi.bssid, sizeof(sta_config.sta.bssid));
+            sta_config.sta.bssid_set = true;
+        }
+        sta_config.sta.channel = rtc_wifi.channel;
+    }
 
     tcpip_adapter_init();
+    if (fast && wifi_cache_has_lease(&rtc_wifi, time(NULL)))
+        app_wifi_static();
     ESPNODE_ERROR_CHECK(esp_event_loop_init(event_handler, NULL));
     ESPNODE_ERROR_CHECK(esp_wifi_init(&cfg));
     ESPNODE_ERROR_CHECK(esp_wifi_set_storage(WIFI_STORAGE_RAM));
@@ -64,31 +275,317 @@ void app_init_wifi(void)
     ESPNODE_ERROR_CHECK(esp_wifi_start());
     ESPNODE_ERROR_CHECK(esp_wifi_connect());
 
-    while (!wifi_ready) {
-        vTaskDelay(10 * portTICK_PERIOD_MS);
+    if (fast) {
+        uint32_t fast_ms = app_remaining_ms(start, timeout_ms);
+
+        if (fast_ms > WIFI_FAST_TIMEOUT_MS)
+            fast_ms = WIFI_FAST_TIMEOUT_MS;
+        if (!(conn_wait_any(CONN_IP_BIT | CONN_WIFI_LOST_BIT, fast_ms) & CONN_IP_BIT)) {
+            printf("Cached access point failed, scanning\n");
+            app_wifi_full_join(&configured);
+            fast = false;
+        }
     }
+    if (!(conn_wait(CONN_IP_BIT, app_remaining_ms(start, timeout_ms)) & CONN_IP_BIT))
+        return ESP_ERR_TIMEOUT;
+
+    printf("Wifi up in %u ms%s\n", (xTaskGetTickCount() - start) * portTICK_PERIOD_MS,
+           fast ? (wifi_static ? ", cached access point and address" : ", cached access point") : "");
+    if (wifi_ap_changed) {
+        app_save_wifi_cache();
+        wifi_ap_changed = false;
+    }
+
+    return ESP_OK;
 }
 
 void app_close_wifi(void)
 {
+    wifi_rejoin = false;
     ESPNODE_ERROR_CHECK(esp_wifi_disconnect());
     ESPNODE_ERROR_CHECK(esp_wifi_stop());
     ESPNODE_ERROR_CHECK(esp_wifi_deinit());
 }
 
+/**
+ * \return ms of the RTC clock, which keeps running through deep sleep; wraps every 49 days
+ */
+static uint32_t app_clock_ms(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+static int app_counter_sample(sensor_t *sensor, reading_t *readings, int max)
+{
+    readings[0] = (reading_t){
+        .sensor = READING_SENSOR_COUNTER,
+        .unit = READING_UNIT_COUNT,
+        .value = sample_count++,
+    };
+    return 1;
+}
+
+static int app_heap_sample(sensor_t *sensor, reading_t *readings, int max)
+{
+    readings[0] = (reading_t){
+        .sensor = READING_SENSOR_HEAP_FREE,
+        .unit = READING_UNIT_BYTES,
+        .value = esp_get_free_heap_size(),
+    };
+    return 1;
+}
+
+static const sensor_ops_t app_counter_ops = { .sample = app_counter_sample };
+static const sensor_ops_t app_heap_ops = { .sample = app_heap_sample };
+
+//TODO: read temp
+static sensor_t sensors[] = {
+    { .name = "counter", .ops = &app_counter_ops, .period_ms = APP_COUNTER_MS },
+    { .name = "heap", .ops = &app_heap_ops, .period_ms = APP_HEAP_MS },
+};
+
+#define APP_SENSOR_COUNT (sizeof(sensors) / sizeof(sensors[0]))
+
+static void app_push_reading(void *ctx, const reading_t *reading)
+{
+    spsc_push(&sample_ring, reading);
+}
+
+/**
+ * Sensor scheduler: samples each sensor of the registry on its period, pushing readings to the ring without
+ * waiting on anything downstream, and wakes the consumer task passed as param once per wake
+ */
+static void app_sensor_task(void *param)
+{
+    TaskHandle_t consumer = param;
+
+    sensor_sched_init(&sensor_sched, sensors, APP_SENSOR_COUNT, portTICK_PERIOD_MS, APP_SAMPLE_SLACK_MS,
+                      xTaskGetTickCount());
+    while (true) {
+        uint32_t wake;
+        int32_t delay;
+
+        if (sensor_sched_run(&sensor_sched, xTaskGetTickCount(), app_push_reading, NULL) > 0)
+            xTaskNotifyGive(consumer);
+        if (sensor_sched_next(&sensor_sched, &wake) != 0) {
+            printf("No sensors to sample\n");
+            vTaskDelete(NULL);
+        }
+        delay = wake - xTaskGetTickCount();
+        if (delay > 0)
+            vTaskDelay(delay);
+    }
+}
+
+/**
+ * Per sensor filter chains: the counter once per window, free heap smoothed and only when it moves
+ */
+static void app_init_filters(void)
+{
+    for (int i = 0; i < READING_SENSOR_MAX; i++)
+        filter_chain_init(&filters[i]);
+    filter_add_window(&filters[READING_SENSOR_COUNTER], APP_COUNTER_WINDOW, FILTER_STAT_MAX);
+    filter_add_average(&filters[READING_SENSOR_HEAP_FREE], APP_HEAP_AVERAGE);
+    filter_add_delta(&filters[READING_SENSOR_HEAP_FREE], APP_HEAP_DEADBAND, APP_HEARTBEAT_MS);
+}
+
+/**
+ * Drain the sample ring through the filter chains into telemetry
+ */
+static void app_filter_samples(void)
+{
+    reading_t reading;
+    uint32_t dropped = sample_ring.dropped;
+    static uint32_t dropped_seen;
+
+    while (spsc_pop(&sample_ring, &reading) == 0) {
+        if (reading.sensor >= READING_SENSOR_MAX || filter_run(&filters[reading.sensor], &reading))
+            telemetry_add_reading(&reading);
+    }
+    if (dropped != dropped_seen) {
+        printf("Sample ring full, %u readings dropped\n", dropped - dropped_seen);
+        dropped_seen = dropped;
+    }
+}
+
+static void app_init_telemetry(void)
+{
+    if (!telemetry_ready) {
+        ESPNODE_ERROR_CHECK(telemetry_init(&mqtt));
+        telemetry_ready = true;
+    }
+}
+
+/**
+ * Load the duty cycle policy
+ * \return true if duty cycling is configured
+ */
+static int app_duty_policy(duty_policy_t *policy)
+{
+    nvs_handle nvs;
+    char value[12];
+
+    memset(policy, 0, sizeof(*policy));
+    policy->max_latency_s = DUTY_LATENCY_S_DEFAULT;
+    policy->retry_s = DUTY_RETRY_S;
+
+    if (nvs_open(APP_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK)
+        return false;
+    if (nvs_get_str_static(nvs, DUTY_PREFIX "sample_s", value, sizeof(value)) == ESP_OK)
+        policy->sample_s = atoi(value);
+    if (nvs_get_str_static(nvs, DUTY_PREFIX "upload_count", value, sizeof(value)) == ESP_OK)
+        policy->upload_count = atoi(value);
+    if (nvs_get_str_static(nvs, DUTY_PREFIX "latency_s", value, sizeof(value)) == ESP_OK)
+        policy->max_latency_s = atoi(value);
+    nvs_close(nvs);
+
+    return policy->sample_s > 0;
+}
+
+/**
+ * Move the buffered readings to the offline log: telemetry_add stores them there while MQTT is down
+ */
+static void app_duty_spill(void)
+{
+    const uint8_t *data;
+    size_t pos = 0;
+    uint8_t len;
+
+    app_init_telemetry();
+    printf("Duty cycle buffer full, moving %u readings to the offline log\n", rtc_duty.count);
+    while ((data = duty_next(&rtc_duty, &pos, &len)) != NULL)
+        telemetry_add(data, len);
+    duty_clear(&rtc_duty);
+}
+
+static void app_duty_sample(const duty_policy_t *policy, uint32_t now)
+{
+    reading_t readings[APP_READINGS_MAX];
+    uint8_t buf[READING_CBOR_MAX];
+    int count;
+
+    sensor_init_all(sensors, APP_SENSOR_COUNT);
+    count = sensor_sample_all(sensors, APP_SENSOR_COUNT, app_clock_ms(), readings, APP_READINGS_MAX);
+
+    for (int i = 0; i < count; i++) {
+        size_t len = reading_encode(&readings[i], buf, sizeof(buf));
+
+        if (len == 0) {
+            printf("Reading too large to encode\n");
+            continue;
+        }
+        if (duty_add(&rtc_duty, buf, len, now) != 0) {
+            app_duty_spill();
+            duty_add(&rtc_duty, buf, len, now);
+        }
+    }
+    duty_sampled(&rtc_duty, policy, now);
+}
+
+/**
+ * Connect, publish the offline log and the buffered readings, and wait for the broker to acknowledge them.
+ * Readings published before a failure may be delivered again by the next upload.
+ * \return ESP_OK once everything is delivered
+ */
+static esp_err_t app_duty_upload(void)
+{
+    const uint8_t *data;
+    size_t pos = 0;
+    uint8_t len;
+
+    if (app_init_wifi(DUTY_WIFI_TIMEOUT_MS) != ESP_OK) {
+        printf("Wifi connect timed out\n");
+        return ESP_ERR_TIMEOUT;
+    }
+
+    app_init_telemetry();
+    mqtt.conn = conn_events();
+    // No control topic: the LED would not stay lit through deep sleep
+    ESPNODE_ERROR_CHECK(mqtt_init(&mqtt));
+    ESPNODE_ERROR_CHECK(mqtt_start(&mqtt));
+
+    if (!(conn_wait(CONN_BROKER_BIT, DUTY_CONNECT_TIMEOUT_MS) & CONN_BROKER_BIT)) {
+        printf("MQTT connect timed out\n");
+        return ESP_ERR_TIMEOUT;
+    }
+
+    // Oldest first: the backlog, then this buffer. A reconnect meanwhile retransmits what is unacknowledged,
+    // within the same timeout; the backlog keeps whatever is not acknowledged.
+    if (telemetry_sync(DUTY_ACK_TIMEOUT_MS) != ESP_OK) {
+        printf("Backlog not acknowledged\n");
+        return ESP_ERR_TIMEOUT;
+    }
+    while ((data = duty_next(&rtc_duty, &pos, &len)) != NULL)
+        telemetry_add(data, len);
+    if (telemetry_sync(DUTY_ACK_TIMEOUT_MS) != ESP_OK) {
+        printf("Publishes not acknowledged\n");
+        return ESP_ERR_TIMEOUT;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * One wake of the duty cycle: sample and upload if due, then deep sleep until the next event. Never returns.
+ */
+static void app_duty_cycle(const duty_policy_t *policy)
+{
+    uint32_t now = time(NULL);
+    uint32_t sleep_s;
+
+    if (duty_init(&rtc_duty))
+        printf("Duty cycle state reset\n");
+
+    if (duty_sample_due(&rtc_duty, policy, now))
+        app_duty_sample(policy, now);
+
+    if (duty_upload_due(&rtc_duty, policy, now)) {
+        printf("Uploading %u readings\n", rtc_duty.count);
+        // Counts as failed until done, so a crash or hang here backs off too
+        duty_upload_begin(&rtc_duty, policy, now);
+        if (app_duty_upload() == ESP_OK)
+            duty_upload_done(&rtc_duty);
+        else
+            printf("Upload failed, %u readings kept\n", rtc_duty.count);
+    }
+
+    sleep_s = duty_sleep_s(&rtc_duty, policy, time(NULL));
+    printf("Sleeping %u s, %u readings buffered\n", sleep_s, rtc_duty.count);
+    esp_deep_sleep((uint64_t)sleep_s * 1000000);
+}
+
 void app_main(void)
 {
-    //TODO: Does this need re-init after deep sleep?
+    duty_policy_t policy;
+
+    // Also on every wake from deep sleep, which boots from scratch
     ESPNODE_ERROR_CHECK(nvs_flash_init());
+    // Before any mbedTLS allocation, so the TLS heap report counts all of it
+    tls_mem_init();
 
     //TODO: Semaphore around nvs?
-    //TODO: When deep-sleep is supported, use voting mechanism to prevent deep-sleep if user starts interacting (command and/or timeout to return?)
+    //TODO: Use voting mechanism to prevent deep-sleep if user starts interacting (command and/or timeout to return?)
     command_init();
 
     RESET_REASON reset_cause = rtc_get_reset_reason(0);
     printf("Reset cause: %02x\n", reset_cause);
 
-    //TODO: When deep-sleep is supported, move temp reading to co-CPU and do periodic wake-then-upload
+    // Readings are buffered in RTC memory across deep sleep and uploaded in bursts, see dutycycle.h. Wakes
+    // from deep sleep are expected, and any other reset finds the failed upload already counted.
+    if (reset_cause == POWERON_RESET && app_duty_policy(&policy)) {
+        printf("Sleeping in %d s: clear duty sample_s to stay awake\n", DUTY_CONSOLE_MS / 1000);
+        vTaskDelay(DUTY_CONSOLE_MS / portTICK_PERIOD_MS);
+    }
+    // Read again, the console may have changed it
+    if (app_duty_policy(&policy)) {
+        printf("Duty cycle: sample every %u s, upload %u readings or after %u s\n", policy.sample_s,
+               policy.upload_count, policy.max_latency_s);
+        app_duty_cycle(&policy);
+    }
+
     while (true) {
         printf("Loop\n");
 
@@ -99,32 +596,38 @@ void app_main(void)
         //TODO: Manage/deal-with watchdog in ssl read-binary loop
 
         if (reset_cause == POWERON_RESET) {
-            app_init_wifi();
+            app_init_wifi(0);
         } else {
             printf("Skipped WIFI initialization due to unexpected reset\n");
         }
 
+        // Readings are kept in the offline log even when MQTT is skipped
+        app_init_telemetry();
+
         if (reset_cause == POWERON_RESET) {
+            gpio_pad_select_gpio(GPIO_LED);
+            gpio_set_direction(GPIO_LED, GPIO_MODE_OUTPUT);
+            gpio_set_level(GPIO_LED, 0);
+            mqtt.conn = conn_events();
             ESPNODE_ERROR_CHECK(mqtt_init(&mqtt));
+            ESPNODE_ERROR_CHECK(mqtt_subscribe(&mqtt, CONTROL_TOPIC, 1, control_received, NULL));
             ESPNODE_ERROR_CHECK(mqtt_start(&mqtt));
         } else {
             printf("Skipped MQTT initialization due to unexpected reset\n");
         }
 
+        app_init_filters();
+        spsc_init(&sample_ring, sample_buf, sizeof(sample_buf[0]), APP_SAMPLE_RING_LEN);
+        xTaskCreate(&app_sensor_task, "sensor_task", APP_SAMPLER_STACK_SIZE, xTaskGetCurrentTaskHandle(),
+                    APP_SAMPLER_PRIORITY, NULL);
+
         while (true) {
-            //TODO: read temp
-            //TODO: mqtt_publish(...)
-            vTaskDelay(30 * 1000 * portTICK_PERIOD_MS);
+            // Woken by the sensor task whenever it sampled, at least every APP_COUNTER_MS, which also runs the
+            // batch window
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            app_filter_samples();
+            telemetry_service();
         }
-
-        // mqtt_stop(&mqtt);
-        // mqtt_close(&mqtt);
-
-        //TODO: How much of wifi can be left initialized when entering deep-sleep?
-        // app_close_wifi();
-
-        //TODO: Deep sleep
-        vTaskDelay(30 * 1000 * portTICK_PERIOD_MS);
     }
 }
 
@@ -1,40 +1,263 @@
 #include <freertos/FreeRTOS.h>
+#include <esp_attr.h>
 #include <esp_system.h>
 #include <nvs.h>
 #include <nvs_flash.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stddef.h>
+#include <time.h>
+#include <lwip/sockets.h>
+#include <lwip/netdb.h>
 
 #include "app_config.h"
+#include "connectivity.h"
 #include "mqtt.h"
+#include "backoff.h"
+#include "keepalive.h"
 
 
 #define TASK_STACK_SIZE 1024 * 30
 #define TASK_PRIORITY tskIDLE_PRIORITY
+#define RX_TASK_STACK_SIZE 1024 * 6
+#define RX_TASK_PRIORITY tskIDLE_PRIORITY + 1
 
 #define MQTT_READ_TIMEOUT 10 * 1000
+// Bounds how long a read holds the TLS context once the socket is readable
+#define MQTT_POLL_TIMEOUT_MS 50
+#define MQTT_HANDSHAKE_TIMEOUT_MS 15 * 1000
+// A write that cannot go out for this long means the broker stopped reading
+#define MQTT_WRITE_TIMEOUT_MS 10 * 1000
+// Receive task re-checks connection state at least this often
+#define MQTT_RX_WAIT_MS 1000
+#define MQTT_RETRY_TIMEOUT_MS 5 * 1000
+#define MQTT_PUBLISH_WAIT_MS 1000
+#define MQTT_BACKOFF_BASE_MS 1000
+#define MQTT_BACKOFF_CAP_MS 5 * 60 * 1000
+// Failing over to another broker waits a random share of this, so a fleet does not move in lockstep
+#define MQTT_FAILOVER_SPREAD_MS 1000
+// mqtt.endpoints: up to ENDPOINT_MAX "host[:port]" separated by commas
+#define MQTT_ENDPOINTS_LEN (ENDPOINT_MAX * (MQTT_HOSTNAME_LEN + 7))
+// PINGREQs are only sent when nothing else went out for about this long
+#define MQTT_KEEPALIVE_S 60
+// Fixed header (max 5), protocol name and version, flags, keepalive, then client id, username and password
+#define MQTT_CONNECT_BUF_LEN (5 + 10 + 2 + MQTT_CLIENT_ID_LEN + 2 + MQTT_USERNAME_LEN + 2 + MQTT_PASSWORD_LEN)
+
+typedef struct {
+    const unsigned char *buf;
+    int len;
+} ssl_segment_t;
 
 #define MQTT_CHECK_ERROR(x) do { int err = (x); if (err != ESP_OK) { printf("CHECK FAILED: %s:%d " #x " returned %d\n", __FILE__, __LINE__, err); return ESP_FAIL; } } while (0);
 #define SSL_CHECK_ERROR(x) do { int rc = (x); if (rc) { char buf[32]; mbedtls_strerror(rc, buf, sizeof(buf)); printf("CHECK FAILED: %s:%d " #x ": %d, %s\n", __FILE__, __LINE__, rc, buf); return ESP_FAIL; } } while (0);
 
+// Kept through deep sleep; NVS holds a copy for cold boots
+RTC_DATA_ATTR static tls_session_t rtc_session;
+// Resolved broker addresses and their latencies, kept through deep sleep only
+RTC_DATA_ATTR static endpoint_cache_t rtc_endpoints;
+
+static uint32_t now_ms(void)
+{
+    return xTaskGetTickCount() * portTICK_PERIOD_MS;
+}
+
+/**
+ * \return Seconds on the RTC clock, which keeps counting through deep sleep
+ */
+static uint32_t now_s(void)
+{
+    return (uint32_t)time(NULL);
+}
+
+/**
+ * Read a credential from NVS: a PEM string, or the DER blob it was converted to
+ *
+ * Both are only set while one form replaces the other: the old form is erased once the new one is committed,
+ * so a reset part way through leaves one credential or the other, never neither.
+ * \param[out] pem Set if the credential is a NUL terminated PEM string
+ * \return Heap copy, or NULL if the credential is not set
+ */
+static unsigned char *ssl_read_credential(nvs_handle nvs, const char *key, size_t *len, bool *pem)
+{
+    char der_key[SSL_KEY_LEN + 1];
+    unsigned char *buf = NULL;
+
+    *pem = false;
+    if (nvs_get_str_heap(nvs, key, (char**)&buf) == ESP_OK && buf) {
+        *pem = true;
+        *len = strlen((char*)buf) + 1;
+        return buf;
+    }
+    ssl_der_key(der_key, key);
+    nvs_get_blob_heap(nvs, der_key, (void**)&buf, len);
+    return buf;
+}
+
+/**
+ * Replace a PEM credential in NVS with its DER form, so later boots skip the base64 decode. The PEM string is
+ * only erased once the DER blob is committed, so a reset in between leaves it to be converted again.
+ */
+static void ssl_store_der(const char *key, const unsigned char *der, size_t len)
+{
+    char der_key[SSL_KEY_LEN + 1];
+    nvs_handle nvs;
+
+    if (len == 0 || nvs_open(APP_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK)
+        return;
+    ssl_der_key(der_key, key);
+    if (nvs_set_blob(nvs, der_key, der, len) == ESP_OK && nvs_commit(nvs) == ESP_OK) {
+        nvs_erase_key(nvs, key);
+        nvs_commit(nvs);
+        printf("%s: stored as DER, %u bytes\n", key, (unsigned)len);
+    }
+    nvs_close(nvs);
+}
+
+#if defined(MBEDTLS_KEY_EXCHANGE_PSK_ENABLED)
+/**
+ * Use the pre-shared key in NVS, if one is set, with the client ID as its identity
+ * \return true in PSK mode
+ */
+static bool ssl_load_psk(mqtt_client_t *client, nvs_handle nvs)
+{
+    uint8_t psk[TLS_CREDS_PSK_MAX];
+    size_t len = sizeof(psk);
+    int ret;
+
+    if (nvs_get_blob(nvs, SSL_PREFIX "psk", psk, &len) != ESP_OK)
+        return false;
+    ret = tls_creds_set_psk(&client->creds, psk, len, (char*)client->client_id);
+    tls_creds_wipe(psk, sizeof(psk));
+    if (ret != 0) {
+        printf("%s: invalid: -0x%x\n", SSL_PREFIX "psk", -ret);
+        return false;
+    }
+
+    printf("TLS credentials: PSK, identity %s\n", (char*)client->client_id);
+    return true;
+}
+#endif
+
+/**
+ * Parse the CA chain and client certificate and key into the contexts every connection uses
+ *
+ * The NVS copies are freed once parsed. Credentials still held as PEM are converted to DER in place: DER is
+ * always shorter than its PEM encoding. With a PSK set the certificates are not loaded at all.
+ */
+static void ssl_load_credentials(mqtt_client_t *client, nvs_handle nvs)
+{
+    unsigned char *ca, *cert, *key;
+    size_t ca_len, cert_len, key_len;
+    bool ca_pem, cert_pem, key_pem;
+    int ret;
+
+    tls_creds_init(&client->creds);
+#if defined(MBEDTLS_KEY_EXCHANGE_PSK_ENABLED)
+    if (ssl_load_psk(client, nvs))
+        return;
+#endif
+
+    if ((ca = ssl_read_credential(nvs, SSL_PREFIX "ca_cert", &ca_len, &ca_pem))) {
+        if ((ret = tls_creds_set_ca(&client->creds, ca, ca_len)) != 0)
+            printf("%s: parse failed: -0x%x\n", SSL_PREFIX "ca_cert", -ret);
+        else if (ca_pem)
+            ssl_store_der(SSL_PREFIX "ca_cert", ca, tls_creds_chain_der(&client->creds.ca, ca, ca_len));
+        free(ca);
+    }
+
+    cert = ssl_read_credential(nvs, SSL_PREFIX "client_cert", &cert_len, &cert_pem);
+    key = ssl_read_credential(nvs, SSL_PREFIX "client_key", &key_len, &key_pem);
+    if (cert && key) {
+        if ((ret = tls_creds_set_cert(&client->creds, cert, cert_len, key, key_len)) != 0) {
+            printf("%s: parse failed: -0x%x\n", SSL_PREFIX "client_cert", -ret);
+        } else {
+            if (cert_pem)
+                ssl_store_der(SSL_PREFIX "client_cert", cert, tls_creds_chain_der(&client->creds.cert, cert, cert_len));
+            if (key_pem && (ret = tls_creds_key_der(&client->creds.key, key, key_len)) > 0)
+                ssl_store_der(SSL_PREFIX "client_key", key, ret);
+        }
+    }
+    if (client->creds.has_ca || client->creds.has_cert)
+        printf("TLS credentials: %s\n", tls_creds_is_ec(&client->creds) ? "ECDSA P-256, ECDHE-ECDSA only" : "RSA");
+    free(cert);
+    if (key) {
+        tls_creds_wipe(key, key_len);
+        free(key);
+    }
+}
+
+/**
+ * Use the broker key pinned in NVS, if there is one; the first verified connection pins it otherwise
+ */
+static void ssl_load_pin(mqtt_client_t *client, nvs_handle nvs)
+{
+    uint8_t hash[TLS_PIN_LEN];
+    size_t len = sizeof(hash);
+
+    tls_pin_init(&client->pin);
+    if (nvs_get_blob(nvs, SSL_PREFIX "pin", hash, &len) != ESP_OK)
+        return;
+    if (tls_pin_set(&client->pin, hash, len) != 0)
+        printf("%s: invalid, %u bytes\n", SSL_PREFIX "pin", (unsigned)len);
+}
+
 esp_err_t mqtt_init(mqtt_client_t *client)
 {
     nvs_handle nvs;
+    char endpoints[MQTT_ENDPOINTS_LEN];
     MQTTPacket_connectData connectData = MQTTPacket_connectData_initializer;
 
     memcpy(&client->data, &connectData, sizeof(client->data));
+    memset(client->inflight, 0, sizeof(client->inflight));
+    client->packet_id = 0;
+    client->state = MQTT_STATE_CONNECT;
+    backoff_init(&client->backoff, MQTT_BACKOFF_BASE_MS, MQTT_BACKOFF_CAP_MS);
+    client->rx_failed = false;
+    // Parked until the first session is up
+    client->rx_park = true;
+    memset(&client->stats, 0, sizeof(client->stats));
+    client->task = NULL;
+    client->rx_task = NULL;
+    topic_trie_init(&client->subs, client->sub_nodes, MQTT_SUB_NODES, client->sub_names, MQTT_SUB_NAMES_LEN);
+    client->subscribed = false;
+    client->lock = xSemaphoreCreateMutex();
+    client->io_lock = xSemaphoreCreateMutex();
+    client->sub_lock = xSemaphoreCreateMutex();
+    client->inflight_free = xSemaphoreCreateCounting(MQTT_INFLIGHT_MAX, MQTT_INFLIGHT_MAX);
+    client->rx_parked = xSemaphoreCreateBinary();
+    if (!client->lock || !client->io_lock || !client->sub_lock || !client->inflight_free || !client->rx_parked)
+        return ESP_ERR_NO_MEM;
     ESPNODE_ERROR_CHECK(mqtt_client_id((char*)&client->client_id[0]));
+    // Shared by every connection and any other crypto user; only the first client seeds it
+    if (tls_rng_init(client->client_id, strlen((char*)client->client_id)) != 0)
+        return ESP_FAIL;
 
     ESPNODE_ERROR_CHECK(nvs_open(APP_NAMESPACE, NVS_READONLY, &nvs));
 
-    ESPNODE_ERROR_CHECK(nvs_get_str_static(nvs, MQTT_PREFIX "hostname", (char*)client->hostname, sizeof(client->hostname)));
     ESPNODE_ERROR_CHECK(nvs_get_str_static(nvs, MQTT_PREFIX "port", (char*)client->port, sizeof(client->port)));
+    // A list of brokers, or the one in mqtt.hostname; mqtt.port is the default port for both
+    if (nvs_get_str_static(nvs, MQTT_PREFIX "endpoints", endpoints, sizeof(endpoints)) != ESP_OK)
+        ESPNODE_ERROR_CHECK(nvs_get_str_static(nvs, MQTT_PREFIX "hostname", endpoints, sizeof(endpoints)));
+    if (endpoint_list_init(&client->endpoints, endpoints, atoi((char*)client->port), &rtc_endpoints) != 0) {
+        printf("%s: invalid: %s\n", MQTT_PREFIX "endpoints", endpoints);
+        nvs_close(nvs);
+        return ESP_FAIL;
+    }
+    client->endpoint = 0;
+    client->failover = false;
+    strcpy((char*)client->hostname, client->endpoints.endpoint[0].host);
     nvs_get_str_static(nvs, MQTT_PREFIX "username", (char*)client->username, sizeof(client->username));
     nvs_get_str_static(nvs, MQTT_PREFIX "password", (char*)client->password, sizeof(client->password));
-    nvs_get_str_heap(nvs, SSL_PREFIX "ca_cert", (char**)&client->ca_cert_str);
-    nvs_get_str_heap(nvs, SSL_PREFIX "client_cert", (char**)&client->client_cert_str);
-    nvs_get_str_heap(nvs, SSL_PREFIX "client_key", (char**)&client->client_key_str);
+    ssl_load_credentials(client, nvs);
+    ssl_load_pin(client, nvs);
+
+    client->session = &rtc_session;
+    if (!tls_session_valid(client->session, (char*)client->hostname)) {
+        size_t len = sizeof(*client->session);
+
+        if (nvs_get_blob(nvs, SSL_PREFIX "session", client->session, &len) != ESP_OK || len != sizeof(*client->session))
+            tls_session_clear(client->session);
+    }
 
     nvs_close(nvs);
 
@@ -43,70 +266,238 @@ esp_err_t mqtt_init(mqtt_client_t *client)
 
 esp_err_t mqtt_close(mqtt_client_t *client)
 {
-    free(client->ca_cert_str);
-    free(client->client_cert_str);
-    free(client->client_key_str);
+    for (int i = 0; i < MQTT_INFLIGHT_MAX; i++)
+        free(client->inflight[i].payload);
+    memset(client->inflight, 0, sizeof(client->inflight));
+    vSemaphoreDelete(client->inflight_free);
+    vSemaphoreDelete(client->rx_parked);
+    vSemaphoreDelete(client->io_lock);
+    vSemaphoreDelete(client->sub_lock);
+    vSemaphoreDelete(client->lock);
+
+    tls_creds_free(&client->creds);
 
     return ESP_OK;
 }
 
-static esp_err_t ssl_start(mqtt_client_t *client)
+/**
+ * Pick the broker to connect to, and make it client->hostname and client->port
+ * \param[out] addr ENDPOINT_ADDR_STR_LEN bytes
+ * \return Its address: cached, or resolved now and cached. The hostname if it has no IPv4 address, so that
+ *         mbedtls_net_connect resolves it.
+ */
+static const char *ssl_select_endpoint(mqtt_client_t *client, char *addr)
+{
+    struct addrinfo hints, *res = NULL;
+    const endpoint_t *endpoint;
+    const char *cached;
+    int i;
+
+    xSemaphoreTake(client->lock, portMAX_DELAY);
+    i = client->endpoint = endpoint_select(&client->endpoints, now_s());
+    endpoint = &client->endpoints.endpoint[i];
+    strcpy((char*)client->hostname, endpoint->host);
+    snprintf((char*)client->port, sizeof(client->port), "%u", (unsigned)endpoint->port);
+    cached = endpoint_addr(&client->endpoints, i, now_s(), addr);
+    xSemaphoreGive(client->lock);
+    if (cached)
+        return cached;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(endpoint->host, NULL, &hints, &res) != 0 || !res)
+        return endpoint->host;
+
+    xSemaphoreTake(client->lock, portMAX_DELAY);
+    endpoint_resolved(&client->endpoints, i, (uint8_t*)&((struct sockaddr_in*)res->ai_addr)->sin_addr, now_s());
+    cached = endpoint_addr(&client->endpoints, i, now_s(), addr);
+    xSemaphoreGive(client->lock);
+    freeaddrinfo(res);
+
+    return cached ? cached : endpoint->host;
+}
+
+/**
+ * Record a failed connect to the selected broker, and whether another one can be tried right away
+ */
+static void ssl_endpoint_failed(mqtt_client_t *client)
+{
+    xSemaphoreTake(client->lock, portMAX_DELAY);
+    endpoint_failed(&client->endpoints, client->endpoint, now_s());
+    client->failover = endpoint_select(&client->endpoints, now_s()) != client->endpoint;
+    xSemaphoreGive(client->lock);
+}
+
+/**
+ * Set up TLS contexts and open the TCP connection
+ */
+static esp_err_t ssl_connect(mqtt_client_t *client)
 {
-    int ret;
     mbedtls_net_context *ctx = &client->ctx;
-    mbedtls_ssl_config *conf = &client->conf;
+    char addr[ENDPOINT_ADDR_STR_LEN];
+    const char *target;
 
     // Init
+    tls_mem_reset_peak();
     mbedtls_net_init(ctx);
     mbedtls_ssl_init(&client->ssl);
     mbedtls_ssl_config_init(&client->conf);
-    mbedtls_ctr_drbg_init(&client->ctr_drbg);
-    mbedtls_x509_crt_init(&client->cacert);
-    mbedtls_x509_crt_init(&client->clicert);
-    mbedtls_pk_init(&client->pkey);
-    mbedtls_entropy_init(&client->entropy);
 
-    SSL_CHECK_ERROR(mbedtls_ctr_drbg_seed(&client->ctr_drbg, mbedtls_entropy_func, &client->entropy, client->client_id, strlen((char*)client->client_id)));
-    if (client->ca_cert_str)
-        SSL_CHECK_ERROR(mbedtls_x509_crt_parse(&client->cacert, client->ca_cert_str, strlen((char*)client->ca_cert_str) + 1));
-    if (client->client_cert_str && client->client_key_str) {
-        SSL_CHECK_ERROR(mbedtls_x509_crt_parse(&client->clicert, client->client_cert_str, strlen((char*)client->client_cert_str) + 1));
-        SSL_CHECK_ERROR(mbedtls_pk_parse_key(&client->pkey, client->client_key_str, strlen((char*)client->client_key_str) + 1, NULL, 0));
-    }
+    // Connect; TLS still uses the hostname for SNI, the session and the certificate check
+    target = ssl_select_endpoint(client, addr);
+    printf("Connecting to %s:%s (%s)...\n", client->hostname, client->port, target);
+    SSL_CHECK_ERROR(mbedtls_net_connect(ctx, target, (char*)client->port, MBEDTLS_NET_PROTO_TCP));
+    // mbedTLS returns WANT_READ/WANT_WRITE instead of blocking, and ssl_wait sleeps in select() until then
+    SSL_CHECK_ERROR(mbedtls_net_set_nonblock(ctx));
+
+    return ESP_OK;
+}
+
+/**
+ * Save a newly negotiated session to NVS, for resuming it after a cold boot
+ *
+ * Resumed handshakes only refresh the RTC copy, so flash is written once per full handshake.
+ */
+static void ssl_save_session(mqtt_client_t *client)
+{
+    nvs_handle nvs;
+
+    if (nvs_open(APP_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK)
+        return;
+    if (nvs_set_blob(nvs, SSL_PREFIX "session", client->session, sizeof(*client->session)) == ESP_OK)
+        nvs_commit(nvs);
+    nvs_close(nvs);
+}
+
+/**
+ * Save the broker key pinned after verifying its chain
+ */
+static void ssl_save_pin(mqtt_client_t *client)
+{
+    nvs_handle nvs;
+
+    if (nvs_open(APP_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK)
+        return;
+    if (nvs_set_blob(nvs, SSL_PREFIX "pin", client->pin.hash, sizeof(client->pin.hash)) == ESP_OK)
+        nvs_commit(nvs);
+    nvs_close(nvs);
+}
+
+/**
+ * Record whether the handshake resumed the saved session, and save it if not
+ */
+static void ssl_update_session(mqtt_client_t *client)
+{
+    int ret = tls_session_update(client->session, (char*)client->hostname, &client->ssl);
 
-    // Connect
-    printf("Connecting to %s:%s...\n", client->hostname, client->port);
-    SSL_CHECK_ERROR(mbedtls_net_connect(ctx, (char*)client->hostname, (char*)client->port, MBEDTLS_NET_PROTO_TCP));
-    SSL_CHECK_ERROR(mbedtls_net_set_block(ctx));
+    xSemaphoreTake(client->lock, portMAX_DELAY);
+    if (ret == TLS_SESSION_RESUMED)
+        client->stats.resumed++;
+    else
+        client->stats.full_handshakes++;
+    xSemaphoreGive(client->lock);
+
+    printf("    [ Session %s ]\n", ret == TLS_SESSION_RESUMED ? "resumed" : ret == TLS_SESSION_NEW ? "new" : "not saved");
+    if (ret == TLS_SESSION_NEW)
+        ssl_save_session(client);
+}
+
+/**
+ * Sleep until the socket is ready for what mbedTLS asked for
+ * \param want MBEDTLS_ERR_SSL_WANT_READ or MBEDTLS_ERR_SSL_WANT_WRITE
+ * \param timeout_ms 0 or less only polls
+ * \return true if ready, false on timeout or error
+ */
+static bool ssl_wait(mqtt_client_t *client, int want, int timeout_ms)
+{
+    struct timeval tv;
+    fd_set fds;
+    int fd = client->ctx.fd;
+
+    if (fd < 0)
+        return false;
+    if (timeout_ms < 0)
+        timeout_ms = 0;
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+
+    FD_ZERO(&fds);
+    FD_SET(fd, &fds);
+    if (want == MBEDTLS_ERR_SSL_WANT_WRITE)
+        return select(fd + 1, NULL, &fds, NULL, &tv) > 0;
+    return select(fd + 1, &fds, NULL, NULL, &tv) > 0;
+}
+
+/**
+ * \return Time left of timeout_ms since start, may be negative
+ */
+static int ssl_remaining(uint32_t start, int timeout_ms)
+{
+    return timeout_ms - (int)(now_ms() - start);
+}
+
+/**
+ * Report what mbedTLS holds now and the most it held since ssl_connect
+ */
+static void ssl_print_heap(mqtt_client_t *client, const char *what)
+{
+    size_t used, peak;
+
+    tls_mem_stats(&used, &peak);
+    printf("    [ TLS heap after %s: %u bytes, peak %u, fragment %u ]\n", what, (unsigned)used, (unsigned)peak,
+           (unsigned)tls_mem_fragment_len(&client->ssl));
+}
+
+/**
+ * Configure TLS and run the handshake over the connection opened by ssl_connect
+ */
+static esp_err_t ssl_handshake(mqtt_client_t *client)
+{
+    int ret;
+    uint32_t start;
+    mbedtls_net_context *ctx = &client->ctx;
+    mbedtls_ssl_config *conf = &client->conf;
 
     // Configure SSL
     SSL_CHECK_ERROR(mbedtls_ssl_config_defaults(conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT));
-    mbedtls_ssl_conf_authmode(conf, MBEDTLS_SSL_VERIFY_OPTIONAL); //TODO: Back to required
-    mbedtls_ssl_conf_rng(conf, mbedtls_ctr_drbg_random, &client->ctr_drbg);
-    if (client->ca_cert_str)
-        mbedtls_ssl_conf_ca_chain(conf, &client->cacert, NULL);
-    if (client->client_cert_str && client->client_key_str)
-        SSL_CHECK_ERROR(mbedtls_ssl_conf_own_cert(conf, &client->clicert, &client->pkey));
-    // mbedtls_ssl_conf_read_timeout() ?
+    // Seeded once in mqtt_init, so a reconnect gathers no entropy
+    tls_rng_conf(conf);
+    SSL_CHECK_ERROR(tls_creds_conf(&client->creds, conf));
+    // A pinned broker key is checked after the handshake instead of the chain
+    tls_pin_conf(&client->pin, &client->creds, conf);
+    // Keep the broker's records within the input buffer
+    SSL_CHECK_ERROR(tls_mem_conf(conf));
     SSL_CHECK_ERROR(mbedtls_ssl_setup(&client->ssl, conf));
     SSL_CHECK_ERROR(mbedtls_ssl_set_hostname(&client->ssl, (char*)client->hostname));
-    mbedtls_ssl_set_bio(&client->ssl, ctx, mbedtls_net_send, NULL,
-                        mbedtls_net_recv_timeout);
+    // A resumed handshake skips the certificate exchange and the public key operations
+    if (client->session)
+        tls_session_offer(client->session, (char*)client->hostname, &client->ssl);
+    mbedtls_ssl_set_bio(&client->ssl, ctx, mbedtls_net_send, mbedtls_net_recv, NULL);
 
     printf("Negotiating SSL...\n");
+    start = now_ms();
     while((ret = mbedtls_ssl_handshake(&client->ssl)) != 0) {
-        if(ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+        // Each flight from the broker is waited for in select(), not polled
+        if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+            if (ssl_wait(client, ret, ssl_remaining(start, MQTT_HANDSHAKE_TIMEOUT_MS)))
+                continue;
+            printf(" failed\n  ! no response from the server in %u ms\n", (unsigned)(now_ms() - start));
+        } else {
             printf(" failed\n  ! mbedtls_ssl_handshake returned -0x%x\n", -ret);
-            if(ret == MBEDTLS_ERR_X509_CERT_VERIFY_FAILED) {
-                printf("    Unable to verify the server's certificate. "
-                       "Either it is invalid,\n"
-                       "    or you didn't set ca_file or ca_path "
-                       "to an appropriate value.\n"
-                       "    Alternatively, you may want to use "
-                       "auth_mode=optional for testing purposes.\n");
-            }
-            return ESP_FAIL;
         }
+        // Do not offer a session the server may be choking on again
+        if (client->session)
+            tls_session_clear(client->session);
+        if(ret == MBEDTLS_ERR_X509_CERT_VERIFY_FAILED) {
+            printf("    Unable to verify the server's certificate. "
+                   "Either it is invalid,\n"
+                   "    or you didn't set ca_file or ca_path "
+                   "to an appropriate value.\n"
+                   "    Alternatively, you may want to use "
+                   "auth_mode=optional for testing purposes.\n");
+        }
+        return ESP_FAIL;
     }
 
     printf("    [ Protocol is %s ]\n    [ Ciphersuite is %s ]\n", mbedtls_ssl_get_version(&client->ssl), mbedtls_ssl_get_ciphersuite(&client->ssl));
@@ -115,76 +506,169 @@ static esp_err_t ssl_start(mqtt_client_t *client)
     } else {
         printf("    [ Record expansion is unknown (compression) ]\n");
     }
+    ssl_print_heap(client, "handshake");
 
-    if (client->ca_cert_str) {
+    if (client->creds.has_ca && !tls_creds_is_psk(&client->creds)) {
         printf("Verifying server certificate...");
-        if((client->flags = mbedtls_ssl_get_verify_result(&client->ssl)) != 0) {
+        ret = tls_pin_check(&client->pin, &client->creds, &client->ssl, (char*)client->hostname, &client->flags);
+        if (ret < 0) {
             char buf[512];
-            mbedtls_x509_crt_verify_info(buf, sizeof(buf), "  ! ", client->flags);
+
+            if (client->flags)
+                mbedtls_x509_crt_verify_info(buf, sizeof(buf), "  ! ", client->flags);
+            else
+                mbedtls_strerror(ret, buf, sizeof(buf));
             printf("Fail: %s\n", buf);
+            if (client->session)
+                tls_session_clear(client->session);
             return ESP_FAIL;
+        } else if (ret == TLS_PIN_UPDATED) {
+            printf("Pass, chain verified and key pinned\n");
+            ssl_save_pin(client);
         } else {
             printf("Pass\n");
         }
     }
 
-    mbedtls_ssl_conf_read_timeout(&client->conf, MQTT_READ_TIMEOUT);
+    // Only a session whose peer passed the checks above is kept
+    if (client->session)
+        ssl_update_session(client);
+
+    client->read_timeout_ms = MQTT_READ_TIMEOUT;
 
     return ESP_OK;
 }
 
+/**
+ * Tear down the connection and free everything ssl_connect and ssl_handshake set up
+ */
+static void ssl_stop(mqtt_client_t *client)
+{
+    mbedtls_net_free(&client->ctx);
+    mbedtls_ssl_free(&client->ssl);
+    mbedtls_ssl_config_free(&client->conf);
+}
+
+/**
+ * Write all of buf, sleeping in select() whenever the socket buffer is full
+ * \return len, or -1 if the connection failed or nothing could be written for MQTT_WRITE_TIMEOUT_MS
+ */
 static int ssl_send(mqtt_client_t *client, const unsigned char *buf, int len)
 {
-    size_t written_so_far;
+    uint32_t start = now_ms();
+    int written_so_far = 0;
     int ret;
 
-    ret = 0;
-    for(written_so_far = 0; written_so_far < len; written_so_far += ret) {
-        while((ret = mbedtls_ssl_write(&client->ssl, buf + written_so_far, len - written_so_far)) <= 0) {
-            if(ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
-                printf("write failed\n  ! mbedtls_ssl_write returned -0x%x\n\n", -ret);
-                /* All other negative return values indicate connection needs to be reset.
-                * Will be caught in ping request so ignored here */
+    while (written_so_far < len) {
+        ret = mbedtls_ssl_write(&client->ssl, buf + written_so_far, len - written_so_far);
+        if (ret > 0) {
+            written_so_far += ret;
+            start = now_ms();
+        } else if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+            // mbedTLS keeps the pending record; the same call finishes it once the socket is ready
+            if (!ssl_wait(client, ret, ssl_remaining(start, MQTT_WRITE_TIMEOUT_MS))) {
+                printf("write failed\n  ! socket not writable for %u ms\n\n", (unsigned)(now_ms() - start));
                 return -1;
             }
+        } else {
+            printf("write failed\n  ! mbedtls_ssl_write returned -0x%x\n\n", -ret);
+            /* All other negative return values indicate connection needs to be reset.
+            * Will be caught in ping request so ignored here */
+            return -1;
         }
     }
 
     return written_so_far;
 }
 
+/**
+ * Send a packet given as a list of segments
+ *
+ * The packet is gathered into txbuf up to the size of a TLS record, so the header of a PUBLISH goes out in
+ * one record with the start of its payload instead of in a record of its own. Whatever does not fit, e.g. the
+ * rest of a large payload, is handed to mbedTLS straight from its owner, without an intermediate copy.
+ * The TLS context is held for the whole packet so it cannot interleave with a read.
+ */
+static int ssl_send_segments(mqtt_client_t *client, const ssl_segment_t *segments, int count)
+{
+    size_t record;
+    int total = 0;
+    int len = 0;
+    int off = 0;
+    int i = 0;
+    int ret;
+
+    for (int j = 0; j < count; j++)
+        total += segments[j].len;
+
+    xSemaphoreTake(client->io_lock, portMAX_DELAY);
+    record = tls_mem_fragment_len(&client->ssl);
+    if (record > sizeof(client->txbuf))
+        record = sizeof(client->txbuf);
+
+    // The first record, possibly ending part way through a segment
+    while (i < count && len < (int)record) {
+        int n = segments[i].len - off;
+
+        if (n > (int)record - len)
+            n = record - len;
+        memcpy(client->txbuf + len, segments[i].buf + off, n);
+        len += n;
+        off += n;
+        if (off == segments[i].len) {
+            i++;
+            off = 0;
+        }
+    }
+    ret = ssl_send(client, client->txbuf, len) == len ? len : -1;
+
+    // The rest in place
+    for (; ret >= 0 && i < count; i++, off = 0) {
+        if (ssl_send(client, segments[i].buf + off, segments[i].len - off) != segments[i].len - off)
+            ret = -1;
+    }
+    xSemaphoreGive(client->io_lock);
+
+    return ret < 0 ? ret : total;
+}
+
+static int ssl_send_packet(mqtt_client_t *client, const unsigned char *buf, int len)
+{
+    ssl_segment_t segment = { buf, len };
+
+    return ssl_send_segments(client, &segment, 1);
+}
+
+/**
+ * Transport read for mqtt_frame_read: reads up to len bytes, waiting at most read_timeout_ms for them
+ * \return Bytes read, possibly fewer than len, or -1 if the connection failed
+ */
 static int ssl_read(void *sck, unsigned char *buf, int len)
 {
     mqtt_client_t *client = (mqtt_client_t *)sck;
     mbedtls_ssl_context *ssl = &client->ssl;
+    uint32_t start = now_ms();
     size_t rxLen = 0;
     int ret;
 
     while (len > 0) {
-        // This read will timeout after IOT_SSL_READ_TIMEOUT if there's no data to be read
         ret = mbedtls_ssl_read(ssl, buf, len);
         if (ret > 0) {
             rxLen += ret;
             buf += ret;
             len -= ret;
-        } else if (ret == MBEDTLS_ERR_SSL_TIMEOUT) {
-            printf("SSL_READ TIMEOUT\n");
-            goto err;
+        } else if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+            // Nothing more for now: mqtt_frame_read resumes the packet on its next call
+            if (!ssl_wait(client, ret, ssl_remaining(start, client->read_timeout_ms)))
+                break;
         } else if (ret == 0) {
             printf("SSL_READ NULL READ\n");
             goto err;
-        } else if (ret == MBEDTLS_ERR_SSL_WANT_READ) {
-            printf("SSL_READ WANT READ\n");
-            continue;
-        } else if (ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
-            printf("SSL_READ WANT WRITE\n");
-            continue;
         } else {
             goto err;
         }
     }
 
-
     return rxLen;
 
 err:
@@ -192,27 +676,24 @@ err:
     return -1;
 }
 
-esp_err_t _mqtt_start(mqtt_client_t *client)
+/**
+ * Send CONNECT and wait for CONNACK
+ * \param[out] session_present Set if the broker resumed a previous session
+ */
+static esp_err_t mqtt_connect(mqtt_client_t *client, unsigned char *session_present)
 {
-    unsigned char buf[200];
+    unsigned char buf[MQTT_CONNECT_BUF_LEN];
     int len;
     int ret;
-    MQTTTransport *transport;
     MQTTPacket_connectData *data;
 
-    printf("Starting MQTT...\n");
-
-    ESPNODE_ERROR_CHECK(ssl_start(client));
-
-    transport = &client->transport;
-    transport->getfn = ssl_read;
-    transport->sck = client;
-    transport->state = 0;
+    mqtt_frame_init(&client->frame, client->rxbuf, sizeof(client->rxbuf));
 
     data = &client->data;
     data->clientID.cstring = (char*)client->client_id;
-    data->keepAliveInterval = 20;
-    data->cleansession = 1;
+    data->keepAliveInterval = MQTT_KEEPALIVE_S;
+    // Keep subscriptions and queued QoS1 messages across short drops: requires a stable client id
+    data->cleansession = 0;
     data->username.cstring = (char*)client->username;
     data->password.cstring = (char*)client->password;
     data->MQTTVersion = 4;
@@ -227,10 +708,11 @@ esp_err_t _mqtt_start(mqtt_client_t *client)
     }
 
     // Wait for CONNACK
-    if ((ret = MQTTPacket_readnb(buf, sizeof(buf), transport)) == CONNACK) {
-        unsigned char sessionPresent, connack_rc;
+    if ((ret = mqtt_frame_read(&client->frame, ssl_read, client)) == CONNACK) {
+        unsigned char connack_rc;
 
-        if (MQTTDeserialize_connack(&sessionPresent, &connack_rc, buf, sizeof(buf)) != 1 || connack_rc != 0)
+        if (MQTTDeserialize_connack(session_present, &connack_rc, client->rxbuf, client->frame.len) != 1
+                || connack_rc != 0)
         {
             printf("Unable to connect, return code %d\n", connack_rc);
             return ESP_FAIL;
@@ -240,54 +722,598 @@ esp_err_t _mqtt_start(mqtt_client_t *client)
         return ESP_FAIL;
     }
 
-    printf("MQTT connected\n");
+    printf("MQTT connected%s\n", *session_present ? ", session resumed" : "");
 
     return ESP_OK;
 }
 
-void mqtt_task(void *param)
+static void mqtt_inflight_release(mqtt_client_t *client, mqtt_inflight_t *slot)
 {
-    mqtt_client_t *client = (mqtt_client_t *)param;
+    if (slot->delivered)
+        slot->delivered(slot->delivered_ctx);
+    free(slot->payload);
+    memset(slot, 0, sizeof(*slot));
+    xSemaphoreGive(client->inflight_free);
+}
 
-    _mqtt_start(client);
+/**
+ * Caller must hold client->lock
+ */
+static void mqtt_inflight_acked(mqtt_client_t *client, mqtt_inflight_t *slot)
+{
+    uint32_t ack_ms = (xTaskGetTickCount() - slot->sent) * portTICK_PERIOD_MS;
 
-    printf("MQTT task started\n");
-    unsigned char buf[64];
-    const int buf_len = 32;
+    hist_add(&client->stats.ack_ms, ack_ms);
+    endpoint_acked(&client->endpoints, client->endpoint, ack_ms);
+    client->stats.published++;
+    mqtt_inflight_release(client, slot);
+}
+
+static void mqtt_handle_puback(mqtt_client_t *client)
+{
+    unsigned char dummy;
+    unsigned short packet_id;
+
+    if (MQTTDeserialize_ack(&dummy, &dummy, &packet_id, client->rxbuf, sizeof(client->rxbuf)) != 1) {
+        printf("Unable to deserialize PUBACK\n");
+        return;
+    }
+
+    xSemaphoreTake(client->lock, portMAX_DELAY);
+    for (int i = 0; i < MQTT_INFLIGHT_MAX; i++) {
+        mqtt_inflight_t *slot = &client->inflight[i];
+        if (slot->qos == 0 || slot->packet_id != packet_id)
+            continue;
+        if (slot->state == MQTT_INFLIGHT_SENDING) {
+            // The retransmission still owns the payload: the transmit task releases the slot when done
+            slot->acked = true;
+            xSemaphoreGive(client->lock);
+            return;
+        }
+        if (slot->state == MQTT_INFLIGHT_SENT) {
+            mqtt_inflight_acked(client, slot);
+            xSemaphoreGive(client->lock);
+            return;
+        }
+    }
+    xSemaphoreGive(client->lock);
+
+    printf("Puback for unknown packet_id: %d\n", packet_id);
+}
+
+/**
+ * Pick the next slot to transmit and mark it SENDING; caller must hold client->lock
+ * \return NULL if nothing is due
+ */
+static mqtt_inflight_t *mqtt_next_inflight(mqtt_client_t *client, TickType_t now)
+{
+    for (int i = 0; i < MQTT_INFLIGHT_MAX; i++) {
+        mqtt_inflight_t *slot = &client->inflight[i];
+
+        if (slot->state == MQTT_INFLIGHT_SENT) {
+            if (now - slot->sent < MQTT_RETRY_TIMEOUT_MS / portTICK_PERIOD_MS)
+                continue;
+            printf("Retransmit packet_id %d\n", slot->packet_id);
+            client->stats.retransmits++;
+            slot->header[0] |= 0x08; // DUP
+        } else if (slot->state != MQTT_INFLIGHT_QUEUED) {
+            continue;
+        }
+
+        slot->state = MQTT_INFLIGHT_SENDING;
+        return slot;
+    }
+
+    return NULL;
+}
+
+/**
+ * Send queued publishes and retransmit QoS1 publishes whose PUBACK is overdue
+ *
+ * client->lock is only held to pick a slot and to update it afterwards, never across the write, which may
+ * block for MQTT_WRITE_TIMEOUT_MS. A SENDING slot belongs to this task: publishers only take FREE slots and
+ * a PUBACK meanwhile is left for it to handle.
+ */
+static esp_err_t mqtt_service_inflight(mqtt_client_t *client)
+{
+    unsigned char header[MQTT_PUBLISH_HEADER_LEN];
+    ssl_segment_t segments[2];
+    mqtt_inflight_t *slot;
     int len, ret;
-    unsigned short packet_id = 0;
-    MQTTTransport *transport = &client->transport;
-    while (1) {
-        //TODO: Read from publish queue, send to host
-        //TODO: Maintain packet id
 
-        unsigned char payload[32];
-        int payload_len = snprintf((char*)payload, sizeof(payload), "Hello, World! %d", packet_id);
-        MQTTString topic = MQTTString_initializer;
-        topic.cstring = "test";
+    while (true) {
+        xSemaphoreTake(client->lock, portMAX_DELAY);
+        slot = mqtt_next_inflight(client, xTaskGetTickCount());
+        if (slot) {
+            memcpy(header, slot->header, slot->header_len);
+            segments[0].buf = header;
+            segments[0].len = slot->header_len;
+            segments[1].buf = slot->payload;
+            segments[1].len = slot->payload_len;
+        }
+        xSemaphoreGive(client->lock);
+        if (!slot)
+            return ESP_OK;
 
-        printf("Publish: %s\n", payload);
-        len = MQTTSerialize_publish(buf, buf_len, 0, 1/*qos*/, 0, packet_id, topic, payload, payload_len);
-        if ((ret = ssl_send(client, buf, len)) < 0 || ret != len)
-            printf("ssl_send failed: %d\n", ret);
-        if ((ret = MQTTPacket_readnb(buf, sizeof(buf), transport)) == PUBACK) {
-            unsigned char dummy;
-            unsigned short packet_id_ret;
-            if (MQTTDeserialize_ack(&dummy, &dummy, &packet_id_ret, buf, sizeof(buf)) == 1) {
-                if (packet_id == packet_id_ret) {
-                    printf("Publish succeeded\n");
-                } else {
-                    printf("Puback for wrong packet_id: %d\n", packet_id_ret);
-                }
+        len = segments[0].len + segments[1].len;
+        ret = ssl_send_segments(client, segments, 2);
+
+        xSemaphoreTake(client->lock, portMAX_DELAY);
+        if (ret != len) {
+            if (slot->acked) {
+                mqtt_inflight_acked(client, slot);
             } else {
-                printf("Unable to deserialize PUBACK\n");
+                // Possibly part sent: goes again on the next session, as a duplicate
+                if (slot->qos > 0)
+                    slot->header[0] |= 0x08; // DUP
+                slot->state = MQTT_INFLIGHT_QUEUED;
             }
+            xSemaphoreGive(client->lock);
+            printf("ssl_send failed: %d\n", ret);
+            return ESP_FAIL;
+        }
+
+        keepalive_sent(&client->keepalive, now_ms(), slot->qos > 0);
+        if (slot->qos == 0) {
+            client->stats.published++;
+            mqtt_inflight_release(client, slot);
+        } else if (slot->acked) {
+            mqtt_inflight_acked(client, slot);
         } else {
-            printf("Unexpected response to publish: %d\n", ret);
+            // From when the write finished: it may have blocked on a full socket
+            slot->state = MQTT_INFLIGHT_SENT;
+            slot->sent = xTaskGetTickCount();
         }
-        packet_id++;
+        xSemaphoreGive(client->lock);
+    }
+}
 
-        vTaskDelay(5 * 1000 * portTICK_PERIOD_MS);
+/**
+ * Queue every unacknowledged publish for immediate retransmission with DUP set
+ */
+static void mqtt_requeue_inflight(mqtt_client_t *client)
+{
+    xSemaphoreTake(client->lock, portMAX_DELAY);
+    for (int i = 0; i < MQTT_INFLIGHT_MAX; i++) {
+        mqtt_inflight_t *slot = &client->inflight[i];
+        if (slot->state == MQTT_INFLIGHT_SENT) {
+            slot->header[0] |= 0x08; // DUP
+            slot->state = MQTT_INFLIGHT_QUEUED;
+        }
+    }
+    xSemaphoreGive(client->lock);
+}
+
+static void mqtt_handle_publish(mqtt_client_t *client)
+{
+    unsigned char dup, retained, ack[4];
+    int qos, payload_len, len;
+    unsigned short packet_id;
+    MQTTString topic;
+    unsigned char *payload;
+
+    if (mqtt_frame_truncated(&client->frame)) {
+        // Not dispatched, but acknowledged: the session would redeliver it on every connect otherwise
+        printf("Dropped PUBLISH of %u bytes, larger than the receive buffer\n", (unsigned)client->frame.total);
+        if ((qos = mqtt_frame_publish_qos(&client->frame, &packet_id)) < 0) {
+            printf("Packet ID beyond the receive buffer, not acknowledged\n");
+            return;
+        }
+    } else if (MQTTDeserialize_publish(&dup, &qos, &retained, &packet_id, &topic, &payload, &payload_len,
+                                       client->rxbuf, client->frame.len) != 1) {
+        printf("Unable to deserialize PUBLISH\n");
+        return;
+    } else {
+        xSemaphoreTake(client->sub_lock, portMAX_DELAY);
+        if (!topic_trie_dispatch(&client->subs, topic.lenstring.data, topic.lenstring.len, payload, payload_len))
+            printf("No subscription for %.*s\n", topic.lenstring.len, topic.lenstring.data);
+        xSemaphoreGive(client->sub_lock);
+    }
+
+    if (qos > 0) {
+        len = MQTTSerialize_puback(ack, sizeof(ack), packet_id);
+        if (ssl_send_packet(client, ack, len) != len)
+            printf("Failed to send PUBACK\n");
+    }
+}
+
+static void mqtt_handle_suback(mqtt_client_t *client)
+{
+    unsigned short packet_id;
+    int count, qos;
+
+    if (MQTTDeserialize_suback(&packet_id, 1, &count, &qos, client->rxbuf, sizeof(client->rxbuf)) != 1) {
+        printf("Unable to deserialize SUBACK\n");
+        return;
+    }
+
+    if (qos == 0x80)
+        printf("Subscription %d refused\n", packet_id);
+}
+
+/**
+ * Read and dispatch at most one packet. Only the read itself holds the TLS context; handlers run without it.
+ */
+static esp_err_t mqtt_service_read(mqtt_client_t *client)
+{
+    int ret;
+
+    xSemaphoreTake(client->io_lock, portMAX_DELAY);
+    ret = mqtt_frame_read(&client->frame, ssl_read, client);
+    xSemaphoreGive(client->io_lock);
+
+    if (ret > 0) {
+        xSemaphoreTake(client->lock, portMAX_DELAY);
+        if (ret == PINGRESP)
+            keepalive_pong(&client->keepalive, now_ms());
+        else
+            keepalive_received(&client->keepalive, now_ms());
+        xSemaphoreGive(client->lock);
+    }
+
+    // Only a PUBLISH can carry more than the buffer holds; anything else that large is not from a broker
+    if (ret > 0 && ret != PUBLISH && mqtt_frame_truncated(&client->frame)) {
+        printf("Dropped packet %d of %u bytes\n", ret, (unsigned)client->frame.total);
+        return ESP_OK;
+    }
+
+    switch (ret) {
+    case PUBACK:
+        mqtt_handle_puback(client);
+        break;
+    case PUBLISH:
+        mqtt_handle_publish(client);
+        break;
+    case SUBACK:
+        mqtt_handle_suback(client);
+        break;
+    case PINGRESP:
+    case 0:
+        break;
+    default:
+        if (ret < 0) {
+            printf("MQTT read failed\n");
+            return ESP_FAIL;
+        }
+        printf("Unexpected packet: %d\n", ret);
+        break;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * Wait until the socket is readable or mbedTLS already holds decrypted data
+ * \return true if a read will make progress
+ */
+static int mqtt_rx_wait(mqtt_client_t *client, int timeout_ms)
+{
+    struct timeval tv = { timeout_ms / 1000, (timeout_ms % 1000) * 1000 };
+    fd_set rfds;
+    int fd;
+
+    xSemaphoreTake(client->io_lock, portMAX_DELAY);
+    fd = client->ctx.fd;
+    if (mbedtls_ssl_get_bytes_avail(&client->ssl) > 0) {
+        xSemaphoreGive(client->io_lock);
+        return true;
+    }
+    xSemaphoreGive(client->io_lock);
+
+    if (fd < 0)
+        return false;
+
+    FD_ZERO(&rfds);
+    FD_SET(fd, &rfds);
+    return select(fd + 1, &rfds, NULL, NULL, &tv) > 0;
+}
+
+/**
+ * Receive path: parses packets as they arrive and dispatches them, so senders never wait on reads
+ *
+ * The transmit task parks it before tearing the connection down and resumes it after the next CONNACK, so it
+ * never touches the TLS context while that is freed, set up again or used by the handshake, and a failure it
+ * reports always belongs to the current session.
+ */
+static void mqtt_rx_task(void *param)
+{
+    mqtt_client_t *client = (mqtt_client_t *)param;
+    int parked = true;
+
+    while (1) {
+        if (client->rx_park) {
+            if (!parked) {
+                parked = true;
+                xSemaphoreGive(client->rx_parked);
+            }
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+        parked = false;
+
+        if (client->rx_failed) {
+            // Until the state machine parks it
+            ulTaskNotifyTake(pdTRUE, MQTT_RX_WAIT_MS / portTICK_PERIOD_MS);
+            continue;
+        }
+
+        if (!mqtt_rx_wait(client, MQTT_RX_WAIT_MS))
+            continue;
+
+        if (mqtt_service_read(client) != ESP_OK) {
+            client->rx_failed = true;
+            xTaskNotifyGive(client->task);
+        }
+    }
+}
+
+/**
+ * Stop the receive task from using the TLS context, waiting until it has. It checks at least every
+ * MQTT_RX_WAIT_MS.
+ */
+static void mqtt_rx_park(mqtt_client_t *client)
+{
+    // Not resumed since it was last parked
+    if (client->rx_park)
+        return;
+    client->rx_park = true;
+    xTaskNotifyGive(client->rx_task);
+    xSemaphoreTake(client->rx_parked, portMAX_DELAY);
+}
+
+static void mqtt_rx_resume(mqtt_client_t *client)
+{
+    client->rx_park = false;
+    xTaskNotifyGive(client->rx_task);
+}
+
+/**
+ * \return Ticks until the transmit path next has work: a retransmission or a keepalive check. Rounded up and at
+ *         least one, so a deadline closer than a tick is not polled for in a busy loop; a publish queued
+ *         meanwhile notifies the task anyway.
+ */
+static TickType_t mqtt_next_wakeup(mqtt_client_t *client)
+{
+    uint32_t now = now_ms();
+    uint32_t next;
+
+    xSemaphoreTake(client->lock, portMAX_DELAY);
+    next = keepalive_next(&client->keepalive, now);
+    for (int i = 0; i < MQTT_INFLIGHT_MAX; i++) {
+        mqtt_inflight_t *slot = &client->inflight[i];
+        uint32_t elapsed, due;
+
+        if (slot->state == MQTT_INFLIGHT_QUEUED) {
+            next = 0;
+        } else if (slot->state == MQTT_INFLIGHT_SENT) {
+            elapsed = (xTaskGetTickCount() - slot->sent) * portTICK_PERIOD_MS;
+            due = elapsed < MQTT_RETRY_TIMEOUT_MS ? MQTT_RETRY_TIMEOUT_MS - elapsed : 0;
+            if (due < next)
+                next = due;
+        }
+    }
+    xSemaphoreGive(client->lock);
+
+    if (next < portTICK_PERIOD_MS)
+        return 1;
+    return (next + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS;
+}
+
+/**
+ * Send a PINGREQ if the link has been idle, or detect that the broker stopped answering
+ */
+static esp_err_t mqtt_service_keepalive(mqtt_client_t *client)
+{
+    unsigned char buf[2];
+    keepalive_action_t action;
+    int len;
+
+    xSemaphoreTake(client->lock, portMAX_DELAY);
+    action = keepalive_poll(&client->keepalive, now_ms());
+    xSemaphoreGive(client->lock);
+
+    switch (action) {
+    case KEEPALIVE_IDLE:
+        break;
+    case KEEPALIVE_PING:
+        len = MQTTSerialize_pingreq(buf, sizeof(buf));
+        if (ssl_send_packet(client, buf, len) != len)
+            return ESP_FAIL;
+        xSemaphoreTake(client->lock, portMAX_DELAY);
+        keepalive_sent(&client->keepalive, now_ms(), false);
+        xSemaphoreGive(client->lock);
+        break;
+    case KEEPALIVE_DEAD:
+        printf("No PINGRESP within %u ms, link is dead\n", (unsigned)keepalive_timeout(&client->keepalive));
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * Caller must hold client->lock
+ */
+static unsigned short mqtt_next_packet_id(mqtt_client_t *client)
+{
+    // Packet id 0 is reserved
+    if (++client->packet_id == 0)
+        ++client->packet_id;
+    return client->packet_id;
+}
+
+static esp_err_t mqtt_send_subscribe(mqtt_client_t *client, const char *filter, int qos)
+{
+    unsigned char buf[MQTT_TOPIC_LEN + 16];
+    MQTTString topic = MQTTString_initializer;
+    unsigned short packet_id;
+    int len;
+
+    topic.cstring = (char *)filter;
+    xSemaphoreTake(client->lock, portMAX_DELAY);
+    packet_id = mqtt_next_packet_id(client);
+    xSemaphoreGive(client->lock);
+
+    if ((len = MQTTSerialize_subscribe(buf, sizeof(buf), 0, packet_id, 1, &topic, &qos)) <= 0)
+        return ESP_ERR_INVALID_ARG;
+    if (ssl_send_packet(client, buf, len) != len)
+        return ESP_FAIL;
+
+    return ESP_OK;
+}
+
+static void mqtt_resubscribe_one(void *ctx, const char *filter, int qos)
+{
+    mqtt_client_t *client = (mqtt_client_t *)ctx;
+
+    if (mqtt_send_subscribe(client, filter, qos) != ESP_OK) {
+        printf("Failed to subscribe to %s\n", filter);
+        // Again on the next connect
+        client->subscribed = false;
+    }
+}
+
+/**
+ * Subscribe to every registered filter, unless the broker resumed a session they were all sent in since boot
+ */
+static void mqtt_resubscribe(mqtt_client_t *client, int session_present)
+{
+    char filter[MQTT_TOPIC_LEN + 1];
+
+    xSemaphoreTake(client->sub_lock, portMAX_DELAY);
+    if (!session_present || !client->subscribed) {
+        client->subscribed = true;
+        topic_trie_walk(&client->subs, filter, sizeof(filter), mqtt_resubscribe_one, client);
+    }
+    xSemaphoreGive(client->sub_lock);
+}
+
+static const char *mqtt_state_name(mqtt_state_t state)
+{
+    switch (state) {
+    case MQTT_STATE_CONNECT: return "connect";
+    case MQTT_STATE_TLS: return "tls";
+    case MQTT_STATE_CONNACK: return "connack";
+    case MQTT_STATE_DRAINING: return "draining";
+    case MQTT_STATE_ONLINE: return "online";
+    case MQTT_STATE_BACKOFF: return "backoff";
+    }
+    return "?";
+}
+
+/**
+ * \return true if the network is known to be down, see connectivity.h
+ */
+static int mqtt_link_down(mqtt_client_t *client)
+{
+    return client->conn && !(xEventGroupGetBits(client->conn) & CONN_IP_BIT);
+}
+
+/**
+ * Run one step of the connection state machine
+ * \return Next state
+ */
+static mqtt_state_t mqtt_step(mqtt_client_t *client, mqtt_state_t state)
+{
+    unsigned char session_present = 0;
+    uint32_t delay_ms;
+
+    switch (state) {
+    case MQTT_STATE_CONNECT:
+        if (mqtt_link_down(client)) {
+            printf("MQTT waiting for the network\n");
+            xEventGroupWaitBits(client->conn, CONN_IP_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
+            // It was the link that failed, not the broker
+            backoff_reset(&client->backoff);
+        }
+        client->connect_start_ms = now_ms();
+        if (ssl_connect(client) == ESP_OK)
+            return MQTT_STATE_TLS;
+        ssl_endpoint_failed(client);
+        return MQTT_STATE_BACKOFF;
+
+    case MQTT_STATE_TLS:
+        if (ssl_handshake(client) == ESP_OK)
+            return MQTT_STATE_CONNACK;
+        ssl_endpoint_failed(client);
+        return MQTT_STATE_BACKOFF;
+
+    case MQTT_STATE_CONNACK:
+        if (mqtt_connect(client, &session_present) != ESP_OK) {
+            ssl_endpoint_failed(client);
+            return MQTT_STATE_BACKOFF;
+        }
+        xSemaphoreTake(client->lock, portMAX_DELAY);
+        client->stats.connects++;
+        hist_add(&client->stats.connect_ms, now_ms() - client->connect_start_ms);
+        endpoint_connected(&client->endpoints, client->endpoint, now_ms() - client->connect_start_ms);
+        xSemaphoreGive(client->lock);
+        backoff_reset(&client->backoff);
+        keepalive_init(&client->keepalive, MQTT_KEEPALIVE_S * 1000, now_ms());
+        client->rx_failed = false;
+        // Reads now only poll, so queued publishes are not held up behind an idle link
+        client->read_timeout_ms = MQTT_POLL_TIMEOUT_MS;
+        // Unacknowledged publishes must be resent even if the broker lost the session
+        mqtt_requeue_inflight(client);
+        mqtt_resubscribe(client, session_present);
+        return MQTT_STATE_DRAINING;
+
+    case MQTT_STATE_DRAINING:
+        if (mqtt_service_inflight(client) != ESP_OK)
+            return MQTT_STATE_BACKOFF;
+        return MQTT_STATE_ONLINE;
+
+    case MQTT_STATE_ONLINE:
+        if (mqtt_link_down(client))
+            return MQTT_STATE_BACKOFF;
+        if (client->rx_failed || mqtt_service_inflight(client) != ESP_OK || mqtt_service_keepalive(client) != ESP_OK)
+            return MQTT_STATE_BACKOFF;
+        // Sleep until a publish is queued, the receive task reports a failure, or a timer is due
+        ulTaskNotifyTake(pdTRUE, mqtt_next_wakeup(client));
+        return MQTT_STATE_ONLINE;
+
+    case MQTT_STATE_BACKOFF:
+        mqtt_rx_park(client);
+        xSemaphoreTake(client->io_lock, portMAX_DELAY);
+        ssl_stop(client);
+        xSemaphoreGive(client->io_lock);
+        // No use backing off from a broker that cannot be reached: wait for the network instead
+        if (mqtt_link_down(client))
+            return MQTT_STATE_CONNECT;
+        if (client->failover) {
+            client->failover = false;
+            delay_ms = esp_random() % MQTT_FAILOVER_SPREAD_MS;
+            printf("MQTT failing over from %s in %u ms\n", client->hostname, (unsigned)delay_ms);
+            vTaskDelay(delay_ms / portTICK_PERIOD_MS);
+            return MQTT_STATE_CONNECT;
+        }
+        delay_ms = backoff_next(&client->backoff, esp_random());
+        printf("MQTT reconnecting in %u ms\n", (unsigned)delay_ms);
+        vTaskDelay(delay_ms / portTICK_PERIOD_MS);
+        return MQTT_STATE_CONNECT;
+    }
+
+    return MQTT_STATE_BACKOFF;
+}
+
+void mqtt_task(void *param)
+{
+    mqtt_client_t *client = (mqtt_client_t *)param;
+
+    printf("MQTT task started\n");
+    while (1) {
+        mqtt_state_t next = mqtt_step(client, client->state);
+        if (next != client->state)
+            printf("MQTT state: %s -> %s\n", mqtt_state_name(client->state), mqtt_state_name(next));
+        client->state = next;
+
+        if (next == MQTT_STATE_DRAINING) {
+            mqtt_rx_resume(client);
+            if (client->conn)
+                xEventGroupSetBits(client->conn, CONN_BROKER_BIT);
+        } else if (next == MQTT_STATE_BACKOFF && client->conn) {
+            xEventGroupClearBits(client->conn, CONN_BROKER_BIT);
+        }
     }
 }
 
@@ -295,6 +1321,7 @@ esp_err_t mqtt_start(mqtt_client_t *client)
 {
     // Start background
     xTaskCreate(&mqtt_task, "mqtt_task", TASK_STACK_SIZE, client, TASK_PRIORITY, &client->task);
+    xTaskCreate(&mqtt_rx_task, "mqtt_rx_task", RX_TASK_STACK_SIZE, client, RX_TASK_PRIORITY, &client->rx_task);
 
     return ESP_OK;
 }
@@ -307,6 +1334,39 @@ esp_err_t mqtt_stop(mqtt_client_t *client)
     return ESP_OK;
 }
 
+void mqtt_get_stats(mqtt_client_t *client, mqtt_stats_t *stats)
+{
+    xSemaphoreTake(client->lock, portMAX_DELAY);
+    memcpy(stats, &client->stats, sizeof(*stats));
+    xSemaphoreGive(client->lock);
+}
+
+int mqtt_is_connected(mqtt_client_t *client)
+{
+    return client->state == MQTT_STATE_ONLINE || client->state == MQTT_STATE_DRAINING;
+}
+
+esp_err_t mqtt_flush(mqtt_client_t *client, uint32_t timeout_ms)
+{
+    TickType_t start = xTaskGetTickCount();
+    TickType_t timeout = timeout_ms / portTICK_PERIOD_MS;
+    esp_err_t err;
+    int taken;
+
+    // Every slot is free once everything is delivered: hold them all, blocking on each release
+    for (taken = 0; taken < MQTT_INFLIGHT_MAX; taken++) {
+        TickType_t elapsed = xTaskGetTickCount() - start;
+
+        if (elapsed > timeout || xSemaphoreTake(client->inflight_free, timeout - elapsed) != pdTRUE)
+            break;
+    }
+    err = taken == MQTT_INFLIGHT_MAX ? ESP_OK : ESP_ERR_TIMEOUT;
+    while (taken-- > 0)
+        xSemaphoreGive(client->inflight_free);
+
+    return err;
+}
+
 esp_err_t mqtt_client_id(char *buf)
 {
     esp_err_t err;
@@ -326,8 +1386,133 @@ esp_err_t mqtt_client_id(char *buf)
     return ESP_OK;
 }
 
-esp_err_t mqtt_publish(mqtt_client_t *client, unsigned char dup, int qos, unsigned char retained, unsigned short packetid,
-                       const unsigned char *topicName, unsigned char* payload, int payloadlen)
+/**
+ * Serialize the fixed and variable headers of a PUBLISH, leaving the payload to be sent as its own segment
+ * \return Header length, or -1 if the topic is too long
+ */
+static int mqtt_serialize_publish_header(unsigned char *buf, int qos, unsigned char retained,
+                                         unsigned short packet_id, const char *topicName, int payloadlen)
+{
+    MQTTString topic = MQTTString_initializer;
+    MQTTHeader header = {0};
+    unsigned char *ptr = buf;
+    int topic_len = strlen(topicName);
+    int rem_len;
+
+    if (topic_len > MQTT_TOPIC_LEN)
+        return -1;
+
+    topic.cstring = (char*)topicName;
+    rem_len = 2 + topic_len + (qos > 0 ? 2 : 0) + payloadlen;
+
+    header.bits.type = PUBLISH;
+    header.bits.dup = 0;
+    header.bits.qos = qos;
+    header.bits.retain = retained;
+    *ptr++ = header.byte;
+    ptr += MQTTPacket_encode(ptr, rem_len);
+    writeMQTTString(&ptr, topic);
+    if (qos > 0)
+        writeInt(&ptr, packet_id);
+
+    return ptr - buf;
+}
+
+esp_err_t mqtt_subscribe(mqtt_client_t *client, const char *filter, int qos, topic_handler_t handler, void *ctx)
 {
+    int ret;
+
+    if (qos < 0 || qos > 1 || strlen(filter) > MQTT_TOPIC_LEN)
+        return ESP_ERR_INVALID_ARG;
+
+    xSemaphoreTake(client->sub_lock, portMAX_DELAY);
+    ret = topic_trie_add(&client->subs, filter, qos, handler, ctx);
+    xSemaphoreGive(client->sub_lock);
+
+    if (ret == TOPIC_TRIE_FULL)
+        return ESP_ERR_NO_MEM;
+    if (ret != 0)
+        return ESP_ERR_INVALID_ARG;
+
+    if (mqtt_is_connected(client)) {
+        esp_err_t err = mqtt_send_subscribe(client, filter, qos);
+
+        if (err == ESP_OK)
+            return ESP_OK;
+        client->subscribed = false;
+        return err;
+    }
+
+    // Otherwise sent on the next connect, even if the broker resumes the session
+    client->subscribed = false;
     return ESP_OK;
 }
+
+/**
+ * Queue a message in a free inflight slot, taking ownership of payload
+ */
+static esp_err_t mqtt_queue(mqtt_client_t *client, int qos, unsigned char retained, const char *topicName,
+                            unsigned char *payload, int payloadlen, mqtt_delivered_t delivered, void *ctx)
+{
+    mqtt_inflight_t *slot = NULL;
+    unsigned short packet_id = 0;
+
+    if (qos < 0 || qos > 1 || strlen(topicName) > MQTT_TOPIC_LEN) {
+        free(payload);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (xSemaphoreTake(client->inflight_free, MQTT_PUBLISH_WAIT_MS / portTICK_PERIOD_MS) != pdTRUE) {
+        free(payload);
+        return ESP_ERR_TIMEOUT;
+    }
+
+    xSemaphoreTake(client->lock, portMAX_DELAY);
+    for (int i = 0; i < MQTT_INFLIGHT_MAX; i++) {
+        if (client->inflight[i].state == MQTT_INFLIGHT_FREE) {
+            slot = &client->inflight[i];
+            break;
+        }
+    }
+    if (qos > 0)
+        packet_id = mqtt_next_packet_id(client);
+
+    slot->header_len = mqtt_serialize_publish_header(slot->header, qos, retained, packet_id, topicName, payloadlen);
+    slot->qos = qos;
+    slot->packet_id = packet_id;
+    slot->payload = payload;
+    slot->payload_len = payloadlen;
+    slot->delivered = delivered;
+    slot->delivered_ctx = ctx;
+    slot->state = MQTT_INFLIGHT_QUEUED;
+    xSemaphoreGive(client->lock);
+
+    if (client->task)
+        xTaskNotifyGive(client->task);
+
+    return ESP_OK;
+}
+
+esp_err_t mqtt_publish_owned(mqtt_client_t *client, int qos, unsigned char retained,
+                             const char *topicName, unsigned char *payload, int payloadlen)
+{
+    return mqtt_queue(client, qos, retained, topicName, payload, payloadlen, NULL, NULL);
+}
+
+esp_err_t mqtt_publish_delivered(mqtt_client_t *client, int qos, unsigned char retained, const char *topicName,
+                                 const unsigned char *payload, int payloadlen, mqtt_delivered_t delivered, void *ctx)
+{
+    unsigned char *copy = malloc(payloadlen ? payloadlen : 1);
+
+    if (!copy)
+        return ESP_ERR_NO_MEM;
+    memcpy(copy, payload, payloadlen);
+
+    return mqtt_queue(client, qos, retained, topicName, copy, payloadlen, delivered, ctx);
+}
+
+esp_err_t mqtt_publish(mqtt_client_t *client, int qos, unsigned char retained,
+                       const char *topicName, const unsigned char *payload, int payloadlen)
+{
+    return mqtt_publish_delivered(client, qos, retained, topicName, payload, payloadlen, NULL, NULL);
+}
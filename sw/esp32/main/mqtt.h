@@ -2,14 +2,14 @@
 #define MQTT_H
 
 #include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
 #include <freertos/task.h>
+#include <freertos/semphr.h>
 #include <MQTTPacket.h>
 #include <mbedtls/config.h>
 #include "mbedtls/platform.h"
 #include "mbedtls/net.h"
 #include "mbedtls/ssl.h"
-#include "mbedtls/entropy.h"
-#include "mbedtls/ctr_drbg.h"
 #include "mbedtls/certs.h"
 #include "mbedtls/x509.h"
 #include "mbedtls/error.h"
@@ -17,32 +17,141 @@
 #include "mbedtls/timing.h"
 #include <esp_err.h>
 
+#include "backoff.h"
+#include "endpoint.h"
+#include "hist.h"
+#include "keepalive.h"
+#include "mqtt_frame.h"
+#include "tls_creds.h"
+#include "tls_mem.h"
+#include "tls_pin.h"
+#include "tls_rng.h"
+#include "tls_session.h"
+#include "topic_trie.h"
+
 #define MQTT_CLIENT_ID_LEN 32
 #define MQTT_HOSTNAME_LEN 64
 #define MQTT_USERNAME_LEN 32
 #define MQTT_PASSWORD_LEN 32
 
+#define MQTT_TOPIC_LEN 64
+
+#define MQTT_INFLIGHT_MAX 8
+// Inbound packets: a control message with its topic. Larger ones are discarded, and acknowledged.
+#define MQTT_RX_BUF_LEN 1024
+// Fixed header (max 5), topic length, topic and packet id
+#define MQTT_PUBLISH_HEADER_LEN (5 + 2 + MQTT_TOPIC_LEN + 2)
+// Outbound packets are gathered into TLS records of up to this size; mbedTLS before 2.13 has one length for both
+// record buffers
+#if defined(MBEDTLS_SSL_OUT_CONTENT_LEN)
+#define MQTT_TX_RECORD_LEN MBEDTLS_SSL_OUT_CONTENT_LEN
+#else
+#define MQTT_TX_RECORD_LEN MBEDTLS_SSL_MAX_CONTENT_LEN
+#endif
+
+// Subscription trie: one node per distinct filter level
+#define MQTT_SUB_NODES 48
+#define MQTT_SUB_NAMES_LEN 384
+
+/**
+ * Connection states of the background task
+ */
+typedef enum {
+    MQTT_STATE_CONNECT = 0, // Resolve and open TCP connection
+    MQTT_STATE_TLS,         // TLS handshake
+    MQTT_STATE_CONNACK,     // MQTT CONNECT sent, awaiting CONNACK
+    MQTT_STATE_DRAINING,    // Session resumed: retransmitting unacknowledged publishes
+    MQTT_STATE_ONLINE,
+    MQTT_STATE_BACKOFF,     // Connection torn down, waiting to retry
+} mqtt_state_t;
+
+typedef enum {
+    MQTT_INFLIGHT_FREE = 0,
+    MQTT_INFLIGHT_QUEUED,
+    MQTT_INFLIGHT_SENDING, // Being written by the transmit task, without client->lock
+    MQTT_INFLIGHT_SENT,
+} mqtt_inflight_state_t;
+
+/**
+ * Called once a publish is delivered: acknowledged for QoS1, sent for QoS0. Runs on one of the client's tasks
+ * with its lock held, so it must not call into the client.
+ */
+typedef void (*mqtt_delivered_t)(void *ctx);
+
+/**
+ * Outbound PUBLISH awaiting transmission or acknowledgement
+ *
+ * Header and payload are kept apart and streamed to the TLS layer as separate segments, so the payload is
+ * never copied into a serialization buffer.
+ */
+typedef struct mqtt_inflight_t {
+    mqtt_inflight_state_t state;
+    int qos;
+    unsigned short packet_id;
+    unsigned char header[MQTT_PUBLISH_HEADER_LEN];
+    int header_len;
+    unsigned char *payload; // Owned by the slot
+    int payload_len;
+    TickType_t sent;
+    int acked; // PUBACK for an earlier transmission arrived while SENDING
+    mqtt_delivered_t delivered; // Optional
+    void *delivered_ctx;
+} mqtt_inflight_t;
+
+typedef struct mqtt_stats_t {
+    uint32_t connects;
+    uint32_t published;   // QoS0 publishes sent plus QoS1 publishes acknowledged
+    uint32_t retransmits;
+    uint32_t resumed;     // TLS handshakes that resumed the saved session
+    uint32_t full_handshakes;
+    hist_t connect_ms;    // TCP connect to CONNACK
+    hist_t ack_ms;        // QoS1 PUBLISH to PUBACK, from the last transmission
+} mqtt_stats_t;
+
 typedef struct mqtt_client_t {
-    mbedtls_entropy_context entropy;
-    mbedtls_ctr_drbg_context ctr_drbg;
     mbedtls_ssl_context ssl;
     mbedtls_ssl_config conf;
-    uint32_t flags;
-    mbedtls_x509_crt cacert;
-    mbedtls_x509_crt clicert;
-    mbedtls_pk_context pkey;
-    mbedtls_net_context ctx;
+    uint32_t flags; // Why the broker's chain was rejected
+    tls_creds_t creds; // Parsed once by mqtt_init and kept across reconnects
+    tls_pin_t pin; // Broker key, loaded by mqtt_init and saved again when it changes
+    mbedtls_net_context ctx; // Non-blocking: every wait is a select() on the socket
+    int read_timeout_ms; // Longest ssl_read waits for data
+    tls_session_t *session; // Offered on reconnect; NULL disables resumption
+    endpoint_list_t endpoints; // Brokers to fail over between; the cache survives deep sleep
+    int endpoint; // Index of the broker connected to, or last tried
+    int failover; // Another broker is ready: skip the backoff
+    EventGroupHandle_t conn; // See connectivity.h: waits for CONN_IP_BIT, keeps CONN_BROKER_BIT; NULL for neither
 
-    MQTTTransport transport;
+    mqtt_frame_t frame; // Inbound packets, read into rxbuf
     MQTTPacket_connectData data;
 
-    TaskHandle_t task;
+    TaskHandle_t task; // Connection state machine and transmit path
+    TaskHandle_t rx_task; // Receive path: reads and dispatches inbound packets
+    volatile mqtt_state_t state;
+    volatile int rx_failed;
+    volatile int rx_park; // Set while the TLS context belongs to the transmit task alone
+    SemaphoreHandle_t rx_parked; // Given by the receive task once it stopped using the TLS context
+    backoff_t backoff;
+    keepalive_t keepalive;
+    uint32_t connect_start_ms;
+    mqtt_stats_t stats; // Guarded by lock
+
+    SemaphoreHandle_t lock; // Guards inflight, packet_id and keepalive
+    SemaphoreHandle_t io_lock; // Serializes mbedTLS calls between the two tasks
+    SemaphoreHandle_t inflight_free; // Counts free inflight slots
+    mqtt_inflight_t inflight[MQTT_INFLIGHT_MAX];
+    unsigned short packet_id;
+    unsigned char rxbuf[MQTT_RX_BUF_LEN];
+    unsigned char txbuf[MQTT_TX_RECORD_LEN]; // First record of each outbound packet, guarded by io_lock
+
+    SemaphoreHandle_t sub_lock; // Guards subs, held while handlers run
+    topic_trie_t subs;
+    volatile int subscribed; // Every filter in subs was sent to the broker in this boot
+    topic_node_t sub_nodes[MQTT_SUB_NODES];
+    char sub_names[MQTT_SUB_NAMES_LEN];
 
     unsigned char client_id[MQTT_CLIENT_ID_LEN];
-    unsigned char *ca_cert_str;
-    unsigned char *client_cert_str;
-    unsigned char *client_key_str;
-    unsigned char hostname[MQTT_HOSTNAME_LEN];
+    unsigned char hostname[MQTT_HOSTNAME_LEN]; // Of the selected endpoint
     unsigned char port[6];
     unsigned char username[MQTT_USERNAME_LEN];
     unsigned char password[MQTT_PASSWORD_LEN];
@@ -66,6 +175,33 @@ esp_err_t mqtt_start(mqtt_client_t *client);
  */
 esp_err_t mqtt_stop(mqtt_client_t *client);
 
+/**
+ * Subscribe to a topic filter, which may contain `+` and `#` wildcards. Filters are kept across reconnects and
+ * subscribed again whenever the broker starts a new session, and on the first connect after boot: a session
+ * the broker kept from older firmware need not hold them all.
+ *
+ * Handlers run on the receive task. They may publish, but must not subscribe.
+ * \param handler Called for every inbound PUBLISH matching filter; topic is not null terminated
+ */
+esp_err_t mqtt_subscribe(mqtt_client_t *client, const char *filter, int qos, topic_handler_t handler, void *ctx);
+
+/**
+ * Copy the client's counters and latency histograms
+ */
+void mqtt_get_stats(mqtt_client_t *client, mqtt_stats_t *stats);
+
+/**
+ * \return true while the background task holds an established session with the broker
+ */
+int mqtt_is_connected(mqtt_client_t *client);
+
+/**
+ * Wait until everything published so far is delivered: sent, and acknowledged for QoS1. Publishes queued
+ * meanwhile wait for it to return.
+ * \return ESP_ERR_TIMEOUT if something is still in flight after timeout_ms
+ */
+esp_err_t mqtt_flush(mqtt_client_t *client, uint32_t timeout_ms);
+
 /**
  * Fills buf with client-id
  * \param buf Buffer to be filled: Must be at least MQTT_CLIENT_ID_LEN characters long. Will be null terminated.
@@ -73,10 +209,31 @@ esp_err_t mqtt_stop(mqtt_client_t *client);
 esp_err_t mqtt_client_id(char *buf);
 
 /**
- * Wraps MQTTSerialize_publish
- * /see MQTTSerialize_publish
+ * Queue a message for publishing
+ *
+ * The message is serialized into a free inflight slot and sent by the background task, which keeps up to
+ * MQTT_INFLIGHT_MAX messages unacknowledged on the wire. QoS1 messages are retransmitted with DUP set until
+ * their PUBACK arrives. Packet ids are assigned by the client.
+ * \param qos 0 or 1
+ * \return ESP_ERR_TIMEOUT if no inflight slot became free within MQTT_PUBLISH_WAIT_MS
+ */
+esp_err_t mqtt_publish(mqtt_client_t *client, int qos, unsigned char retained,
+        const char *topicName, const unsigned char *payload, int payloadlen);
+
+/**
+ * Queue a heap allocated payload for publishing without copying it
+ *
+ * Same as mqtt_publish, but ownership of payload passes to the client, which frees it once the message is
+ * acknowledged (or sent, for QoS0). payload is freed on failure as well.
+ */
+esp_err_t mqtt_publish_owned(mqtt_client_t *client, int qos, unsigned char retained,
+        const char *topicName, unsigned char *payload, int payloadlen);
+
+/**
+ * Same as mqtt_publish, calling delivered once the broker has the message, e.g. to release what it was read
+ * from. It is not called if the publish fails, or for a message still in flight when the node resets.
  */
-esp_err_t mqtt_publish(mqtt_client_t *client, unsigned char dup, int qos, unsigned char retained, unsigned short packetid,
-        const unsigned char *topicName, unsigned char* payload, int payloadlen);
+esp_err_t mqtt_publish_delivered(mqtt_client_t *client, int qos, unsigned char retained,
+        const char *topicName, const unsigned char *payload, int payloadlen, mqtt_delivered_t delivered, void *ctx);
 
 #endif // MQTT_H
\ No newline at end of file
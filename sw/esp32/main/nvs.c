@@ -2,6 +2,7 @@
 #include <nvs_flash.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "app_config.h"
 
 esp_err_t nvs_get_str_static(nvs_handle nvs, const char *param, char *buffer, size_t len)
@@ -21,4 +22,26 @@ esp_err_t nvs_get_str_heap(nvs_handle nvs, const char *param, char **buffer)
         err = nvs_get_str(nvs, param, *buffer, &len);
     }
     return err;
-}
\ No newline at end of file
+}
+esp_err_t nvs_get_blob_heap(nvs_handle nvs, const char *param, void **buffer, size_t *len)
+{
+    esp_err_t err;
+
+    *buffer = NULL;
+    *len = 0;
+    err = nvs_get_blob(nvs, param, NULL, len);
+    if (err == ESP_OK && *len) {
+        if (!(*buffer = malloc(*len)))
+            return ESP_ERR_NO_MEM;
+        err = nvs_get_blob(nvs, param, *buffer, len);
+    }
+    if (err != ESP_OK) {
+        free(*buffer);
+        *buffer = NULL;
+    }
+    return err;
+}
+void ssl_der_key(char *der_key, const char *key)
+{
+    snprintf(der_key, SSL_KEY_LEN + 1, SSL_DER_PREFIX "%s", key + strlen(SSL_PREFIX));
+}
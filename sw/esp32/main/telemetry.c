@@ -0,0 +1,317 @@
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_partition.h>
+#include <nvs.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "app_config.h"
+#include "batch.h"
+#include "ringlog.h"
+#include "telemetry.h"
+
+#define BATCH_COUNT_DEFAULT 10
+#define BATCH_WINDOW_MS_DEFAULT 5 * 60 * 1000
+#define BATCH_BUF_LEN 512
+
+// Drained batches awaiting their PUBACK; their records are consumed only once it arrives
+#define DRAIN_WINDOW 4
+
+#define RINGLOG_PARTITION_LABEL "ringlog"
+#define RINGLOG_PARTITION_SUBTYPE 0x40
+
+static mqtt_client_t *mqtt;
+static batch_t batch;
+static uint8_t batch_buf[BATCH_BUF_LEN];
+static uint8_t drain_buf[BATCH_BUF_LEN];
+
+static const esp_partition_t *partition;
+static ringlog_flash_t flash;
+static ringlog_t offline_log;
+static int log_ready = false;
+
+typedef struct drain_pending_t {
+    ringlog_cursor_t end; // Consume up to here once acknowledged
+    uint32_t dropped;     // offline_log.dropped when read: a wrap since may have reused the sectors
+    volatile int acked;
+} drain_pending_t;
+
+static drain_pending_t drain_pending[DRAIN_WINDOW]; // Oldest first from drain_head
+static int drain_head, drain_count;
+static TaskHandle_t drain_task; // Notified of each PUBACK
+
+static int partition_read(void *ctx, uint32_t addr, void *buf, size_t len)
+{
+    return esp_partition_read(partition, addr, buf, len) == ESP_OK ? 0 : -1;
+}
+
+static int partition_write(void *ctx, uint32_t addr, const void *buf, size_t len)
+{
+    return esp_partition_write(partition, addr, buf, len) == ESP_OK ? 0 : -1;
+}
+
+static int partition_erase(void *ctx, uint32_t addr)
+{
+    return esp_partition_erase_range(partition, addr, RINGLOG_SECTOR_SIZE) == ESP_OK ? 0 : -1;
+}
+
+static uint32_t now_ms(void)
+{
+    return xTaskGetTickCount() * portTICK_PERIOD_MS;
+}
+
+static void telemetry_init_log(void)
+{
+    int ret;
+
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, RINGLOG_PARTITION_SUBTYPE, RINGLOG_PARTITION_LABEL);
+    if (!partition) {
+        printf("No %s partition: offline readings will be dropped\n", RINGLOG_PARTITION_LABEL);
+        return;
+    }
+
+    flash.read = partition_read;
+    flash.write = partition_write;
+    flash.erase = partition_erase;
+    flash.size = partition->size - partition->size % RINGLOG_SECTOR_SIZE;
+
+    if ((ret = ringlog_mount(&offline_log, &flash)) != RINGLOG_OK) {
+        printf("Offline log mount failed (%d), formatting\n", ret);
+        if ((ret = ringlog_format(&offline_log, &flash)) != RINGLOG_OK) {
+            printf("Offline log format failed: %d\n", ret);
+            return;
+        }
+    }
+
+    printf("Offline log: %u KiB, %u readings pending\n", (unsigned)flash.size / 1024, (unsigned)ringlog_pending(&offline_log));
+    log_ready = true;
+}
+
+esp_err_t telemetry_init(mqtt_client_t *client)
+{
+    nvs_handle nvs;
+    char value[12];
+    int count = BATCH_COUNT_DEFAULT;
+    int window_ms = BATCH_WINDOW_MS_DEFAULT;
+
+    mqtt = client;
+    drain_task = xTaskGetCurrentTaskHandle();
+
+    ESPNODE_ERROR_CHECK(nvs_open(APP_NAMESPACE, NVS_READONLY, &nvs));
+    if (nvs_get_str_static(nvs, MQTT_PREFIX "batch_count", value, sizeof(value)) == ESP_OK)
+        count = atoi(value);
+    if (nvs_get_str_static(nvs, MQTT_PREFIX "batch_ms", value, sizeof(value)) == ESP_OK)
+        window_ms = atoi(value);
+    nvs_close(nvs);
+
+    if (count < 1)
+        count = 1;
+    else if (count > 255)
+        count = 255;
+
+    printf("Batching %d readings or %d ms\n", count, window_ms);
+    batch_init(&batch, batch_buf, sizeof(batch_buf), count, window_ms);
+
+    telemetry_init_log();
+
+    return ESP_OK;
+}
+
+static void telemetry_store(const void *data, size_t len)
+{
+    if (!log_ready || ringlog_append(&offline_log, data, len) != RINGLOG_OK)
+        printf("Reading dropped\n");
+}
+
+/**
+ * Move the records of an unsent batch into the offline offline_log
+ */
+static void telemetry_spill(batch_t *b)
+{
+    size_t pos = BATCH_HEADER_LEN;
+
+    while (pos < b->len) {
+        uint8_t len = b->buf[pos++];
+        telemetry_store(b->buf + pos, len);
+        pos += len;
+    }
+}
+
+static esp_err_t telemetry_publish(batch_t *b)
+{
+    size_t len = batch_finish(b);
+    esp_err_t err;
+
+    if (len == 0)
+        return ESP_OK;
+
+    printf("Publish batch %u: %u readings\n", (unsigned)b->seq, b->count);
+    if ((err = mqtt_publish(mqtt, 1, 0, TELEMETRY_TOPIC, b->buf, len)) != ESP_OK)
+        printf("Publish failed: %d\n", err);
+    return err;
+}
+
+static void telemetry_flush(void)
+{
+    if (telemetry_publish(&batch) != ESP_OK)
+        telemetry_spill(&batch);
+    batch_reset(&batch);
+}
+
+void telemetry_add(const void *data, size_t len)
+{
+    uint32_t now = now_ms();
+
+    if (!mqtt_is_connected(mqtt) || (log_ready && ringlog_pending(&offline_log) > 0)) {
+        telemetry_store(data, len);
+        return;
+    }
+
+    if (batch_add(&batch, data, len, now) != 0) {
+        telemetry_flush();
+        batch_add(&batch, data, len, now);
+    }
+    if (batch_ready(&batch, now))
+        telemetry_flush();
+}
+
+void telemetry_add_reading(const reading_t *reading)
+{
+    uint8_t buf[READING_CBOR_MAX];
+    size_t len = reading_encode(reading, buf, sizeof(buf));
+
+    if (len == 0) {
+        printf("Reading too large to encode\n");
+        return;
+    }
+    telemetry_add(buf, len);
+}
+
+/**
+ * Runs on an MQTT task when the broker acknowledged a drained batch
+ */
+static void telemetry_drain_acked(void *ctx)
+{
+    drain_pending_t *pending = ctx;
+
+    pending->acked = true;
+    xTaskNotifyGive(drain_task);
+}
+
+/**
+ * Consume the records of drained batches the broker has acknowledged, oldest first
+ */
+static void telemetry_drain_consume(void)
+{
+    while (drain_count > 0 && drain_pending[drain_head].acked) {
+        const drain_pending_t *pending = &drain_pending[drain_head];
+
+        // After a wrap the cursor may point into a reused sector; a later batch consumes up to its own end
+        if (pending->dropped == offline_log.dropped)
+            ringlog_consume(&offline_log, &pending->end);
+        drain_head = (drain_head + 1) % DRAIN_WINDOW;
+        drain_count--;
+    }
+}
+
+/**
+ * Publish the backlog in full batches, up to DRAIN_WINDOW of them unacknowledged
+ * \return true if more is left to publish once PUBACKs come in
+ */
+static int telemetry_drain(void)
+{
+    uint8_t record[RINGLOG_RECORD_MAX];
+    ringlog_cursor_t cursor, next;
+    batch_t drain;
+    int len;
+
+    telemetry_drain_consume();
+    // Drained batches share the live sequence counter so the collector sees one stream
+    batch_init(&drain, drain_buf, sizeof(drain_buf), 0xff, 0);
+
+    while (mqtt_is_connected(mqtt)) {
+        const drain_pending_t *last = &drain_pending[(drain_head + drain_count + DRAIN_WINDOW - 1) % DRAIN_WINDOW];
+        drain_pending_t *pending = &drain_pending[(drain_head + drain_count) % DRAIN_WINDOW];
+
+        if (drain_count == DRAIN_WINDOW)
+            return true;
+
+        // Carry on after the batches in flight, or from the start if a wrap invalidated their positions
+        if (drain_count > 0 && last->dropped == offline_log.dropped)
+            cursor = last->end;
+        else
+            ringlog_rewind(&offline_log, &cursor);
+        drain.seq = batch.seq;
+        for (;;) {
+            next = cursor;
+            if ((len = ringlog_read(&offline_log, &next, record, sizeof(record))) < 0)
+                break;
+            if (batch_add(&drain, record, len, 0) != 0)
+                break;
+            cursor = next;
+        }
+        if (drain.count == 0)
+            break;
+
+        pending->end = cursor;
+        pending->dropped = offline_log.dropped;
+        pending->acked = false;
+        printf("Publish backlog batch %u: %u readings\n", (unsigned)drain.seq, drain.count);
+        if (mqtt_publish_delivered(mqtt, 1, 0, TELEMETRY_TOPIC, drain.buf, batch_finish(&drain),
+                                   telemetry_drain_acked, pending) != ESP_OK) {
+            printf("Publish failed\n");
+            return true;
+        }
+        drain_count++;
+        batch_reset(&drain);
+        batch.seq++;
+    }
+
+    if (ringlog_pending(&offline_log) == 0 && drain_count == 0 && offline_log.dropped) {
+        printf("Offline log overflowed: %u readings lost\n", (unsigned)offline_log.dropped);
+        offline_log.dropped = 0;
+    }
+    return false;
+}
+
+void telemetry_service(void)
+{
+    if (!mqtt_is_connected(mqtt))
+        return;
+
+    if (log_ready && (ringlog_pending(&offline_log) > 0 || drain_count > 0))
+        telemetry_drain();
+
+    if (batch_ready(&batch, now_ms()))
+        telemetry_flush();
+}
+
+esp_err_t telemetry_sync(uint32_t timeout_ms)
+{
+    TickType_t start = xTaskGetTickCount();
+    TickType_t timeout = timeout_ms / portTICK_PERIOD_MS;
+
+    if (!mqtt_is_connected(mqtt))
+        return ESP_FAIL;
+
+    // A window of backlog batches at a time, woken by each PUBACK
+    while (log_ready && telemetry_drain()) {
+        TickType_t elapsed = xTaskGetTickCount() - start;
+
+        if (elapsed >= timeout || !ulTaskNotifyTake(pdTRUE, timeout - elapsed))
+            return ESP_ERR_TIMEOUT;
+    }
+
+    if (batch.count > 0)
+        telemetry_flush();
+
+    if (mqtt_flush(mqtt, timeout_ms) != ESP_OK)
+        return ESP_ERR_TIMEOUT;
+    if (!log_ready)
+        return ESP_OK;
+    telemetry_drain_consume();
+
+    // Left over if the connection dropped while draining
+    return ringlog_pending(&offline_log) > 0 ? ESP_FAIL : ESP_OK;
+}
@@ -0,0 +1,43 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <esp_err.h>
+#include <stddef.h>
+
+#include "mqtt.h"
+#include "reading.h"
+
+#define TELEMETRY_TOPIC "test"
+
+/**
+ * Initialize batching and mount the offline log partition
+ *
+ * Not thread safe: readings must be added and serviced from a single task.
+ */
+esp_err_t telemetry_init(mqtt_client_t *client);
+
+/**
+ * Add a reading. It joins the current batch while the broker is reachable and nothing is backlogged,
+ * otherwise it is appended to the offline log.
+ */
+void telemetry_add(const void *data, size_t len);
+
+/**
+ * Encode a reading as CBOR and add it, see telemetry_add
+ */
+void telemetry_add_reading(const reading_t *reading);
+
+/**
+ * Publish the current batch if its window has expired, and drain the offline log while connected
+ */
+void telemetry_service(void);
+
+/**
+ * Drain the offline log and publish the current batch without waiting for its window, e.g. before sleeping,
+ * then wait for the broker to acknowledge everything published. Records leave the offline log only once
+ * acknowledged, here or in telemetry_service, so a reset or timeout meanwhile sends them again later.
+ * \return ESP_ERR_TIMEOUT if not all acknowledged within timeout_ms, ESP_FAIL if the connection is down
+ */
+esp_err_t telemetry_sync(uint32_t timeout_ms);
+
+#endif // TELEMETRY_H
@@ -7,53 +7,278 @@
 #include <string.h>
 
 #include <FreeRTOS.h>
+#include <event_groups.h>
 #include <task.h>
 #include <queue.h>
+#include <semphr.h>
 #include <ssid_config.h>
 
 #include <espressif/esp_sta.h>
+#include <espressif/esp_system.h>
 #include <espressif/esp_wifi.h>
+#include <sysparam.h>
+
+#include <lwip/dhcp.h>
+#include <lwip/dns.h>
+#include <lwip/netdb.h>
+#include <lwip/sockets.h>
 
 #include <paho_mqtt_c/MQTTESP8266.h>
 #include <paho_mqtt_c/MQTTClient.h>
 
 // this must be ahead of any mbedtls header files so the local mbedtls/config.h can be properly referenced
 #include "ssl_connection.h"
+#include "batch.h"
+#include "endpoint.h"
+#include "filter.h"
+#include "reading.h"
+#include "ringlog_flash.h"
+#include "sensor.h"
+#include "spsc.h"
+#include "tls_mem.h"
+#include "tls_pin.h"
+#include "tls_session.h"
+#include "topic_trie.h"
+#include "wifi_cache.h"
 
 #define MQTT_PUB_TOPIC "espnode/status"
 #define MQTT_SUB_TOPIC "espnode/control"
 #define GPIO_LED 2
-
-/* certs, key, and endpoint */
-extern char *ca_cert, *client_endpoint, *client_cert, *client_key;
+/* paho restarts its ping timer on every packet sent, so PINGREQs only go out on an idle link */
+#define MQTT_KEEPALIVE_S 60
+
+/* publish once BATCH_COUNT readings are collected or the oldest is BATCH_WINDOW_MS old */
+#ifndef BATCH_COUNT
+#define BATCH_COUNT 6
+#endif
+#ifndef BATCH_WINDOW_MS
+#define BATCH_WINDOW_MS 60000
+#endif
+
+/* beat_task samples each sensor on its period into the sample ring; filter_task publishes only what the per
+ * sensor filter chains let through, so a flash write on the way to the offline log never delays a sample */
+#define HEAP_SAMPLE_MS 1000
+#define STACK_SAMPLE_MS 10000
+#define SAMPLE_SLACK_MS 20 /* sensors due this much later share the wake */
+#define SAMPLE_RING_LEN 8
+#define HEAP_AVERAGE 8
+#define HEAP_DEADBAND 512
+#define STACK_DEADBAND 16
+#define HEARTBEAT_MS (5 * 60 * 1000)
+
+/* subscription trie: one node per distinct filter level */
+#define SUB_NODES 24
+#define SUB_NAMES_LEN 192
+#define SUB_FILTER_LEN 64
+
+/* TLS session: RTC user memory (4 byte blocks from 64, 512 bytes) keeps it through resets and deep sleep,
+ * sysparam keeps a copy for cold boots */
+#define SESSION_RTC_BLOCK 64
+#define SESSION_PARAM "tls_session"
+/* broker addresses and latencies follow the session in RTC memory; reads and writes past its end fail, and
+ * the cache then only lasts until the next reset */
+#define ENDPOINT_RTC_BLOCK (SESSION_RTC_BLOCK + (sizeof(tls_session_t) + 3) / 4)
+/* broker key pin, learned from the first verified chain */
+#define PIN_PARAM "tls_pin"
+/* last access point and DHCP lease follow the endpoints in RTC memory; sysparam keeps a copy for cold boots,
+ * written when the access point changes */
+#define WIFI_RTC_BLOCK (ENDPOINT_RTC_BLOCK + (sizeof(endpoint_cache_t) + 3) / 4)
+#define WIFI_PARAM "wifi_cache"
+/* a join with the cached lease that takes longer falls back to DHCP; a full join gives up after
+ * WIFI_JOIN_TIMEOUT_MS and starts over */
+#define WIFI_FAST_TIMEOUT_MS 3000
+#define WIFI_JOIN_TIMEOUT_MS 30000
+/* in words: wifi_task writes the cache to sysparam and prints, on top of the SDK calls */
+#define WIFI_STACK_SIZE 640
+
+/* connectivity readiness: each layer sets its bit when it comes up and clears it when it goes down, and
+ * tasks block on the bits they need instead of polling flags */
+#define CONN_WIFI_BIT (1 << 0)
+#define CONN_IP_BIT (1 << 1)
+#define CONN_BROKER_BIT (1 << 2)
+
+/* endpoints ("host[:port]", comma separated, client_port by default), and DER certs and key, or the PSK
+ * for PKI=psk, as written by file_to_header.sh */
+extern char *client_endpoint;
 extern int client_port;
-
-static int wifi_alive = 0;
+#ifdef ESPNODE_PKI_PSK
+extern const unsigned char client_psk[];
+extern const unsigned int client_psk_len;
+#else
+extern const unsigned char ca_cert[], client_cert[], client_key[];
+extern const unsigned int ca_cert_len, client_cert_len, client_key_len;
+#endif
+
+static EventGroupHandle_t conn_events;
 static int ssl_reset;
 static SSLConnection *ssl_conn;
 static QueueHandle_t publish_queue;
+static spsc_t sample_ring;
+static reading_t sample_buf[SAMPLE_RING_LEN];
+static filter_chain_t filters[READING_SENSOR_MAX];
+static TaskHandle_t filter_handle;
+static sensor_sched_t sensor_sched;
+static batch_t batch;
+static uint8_t batch_buf[256];
+
+/* readings are kept here while the broker is unreachable */
+static ringlog_flash_t offline_flash;
+static ringlog_t offline_log;
+static SemaphoreHandle_t offline_lock;
+static int offline_ready = 0;
+
+static topic_trie_t subs;
+static topic_node_t sub_nodes[SUB_NODES];
+static char sub_names[SUB_NAMES_LEN];
+/* paho keeps a pointer to each filter; with no per-filter handler it is never used for delivery */
+static char sub_filter[SUB_FILTER_LEN + 1];
+
+static tls_creds_t tls_creds;
+static tls_session_t tls_session;
+static tls_pin_t tls_pin;
+
+static endpoint_list_t endpoints;
+static endpoint_cache_t endpoint_cache;
+static wifi_cache_t wifi_cache;
+static int endpoint_cur = 0;
+static uint32_t tls_resumed = 0;
+static uint32_t tls_full = 0;
+
+static void offline_init(void) {
+    int ret;
+
+    offline_lock = xSemaphoreCreateMutex();
+    ringlog_flash_init(&offline_flash);
+    ret = ringlog_mount(&offline_log, &offline_flash);
+    if (ret != RINGLOG_OK) {
+        printf("Offline log mount failed (%d), formatting\r\n", ret);
+        ret = ringlog_format(&offline_log, &offline_flash);
+    }
+    if (ret == RINGLOG_OK) {
+        printf("Offline log: %u readings pending\r\n",
+                (unsigned) ringlog_pending(&offline_log));
+        offline_ready = 1;
+    } else {
+        printf("Offline log unavailable: %d\r\n", ret);
+    }
+}
+
+static void offline_store(const void *data, size_t len) {
+    int ret = RINGLOG_ERR_IO;
+
+    if (offline_ready) {
+        xSemaphoreTake(offline_lock, portMAX_DELAY);
+        ret = ringlog_append(&offline_log, data, len);
+        xSemaphoreGive(offline_lock);
+    }
+    if (ret != RINGLOG_OK)
+        printf("Reading dropped: %d\r\n", ret);
+}
 
+static uint32_t offline_pending(void) {
+    return offline_ready ? ringlog_pending(&offline_log) : 0;
+}
+
+/* encode a reading into the offline log */
+static void offline_store_reading(const reading_t *reading) {
+    uint8_t buf[READING_CBOR_MAX];
+    size_t len = reading_encode(reading, buf, sizeof(buf));
+
+    if (len)
+        offline_store(buf, len);
+}
+
+static void queue_reading(const reading_t *reading) {
+    if (!(xEventGroupGetBits(conn_events) & CONN_BROKER_BIT) || offline_pending()) {
+        offline_store_reading(reading);
+    } else if (xQueueSend(publish_queue, (void *) reading, 0) == pdFALSE) {
+        printf("Publish queue overflow, storing reading\r\n");
+        offline_store_reading(reading);
+    }
+}
+
+static int heap_sample(sensor_t *sensor, reading_t *readings, int max) {
+    readings[0].sensor = READING_SENSOR_HEAP_FREE;
+    readings[0].unit = READING_UNIT_BYTES;
+    readings[0].value = xPortGetFreeHeapSize();
+    return 1;
+}
+
+/* runs in beat_task, so this is the sampler's own stack */
+static int stack_sample(sensor_t *sensor, reading_t *readings, int max) {
+    readings[0].sensor = READING_SENSOR_STACK_FREE;
+    readings[0].unit = READING_UNIT_BYTES;
+    readings[0].value = uxTaskGetStackHighWaterMark(NULL) * sizeof(portSTACK_TYPE);
+    return 1;
+}
+
+static const sensor_ops_t heap_ops = { .sample = heap_sample };
+static const sensor_ops_t stack_ops = { .sample = stack_sample };
+
+static sensor_t sensors[] = {
+    { .name = "heap", .ops = &heap_ops, .period_ms = HEAP_SAMPLE_MS },
+    { .name = "stack", .ops = &stack_ops, .period_ms = STACK_SAMPLE_MS },
+};
+
+static void push_reading(void *ctx, const reading_t *reading) {
+    spsc_push(&sample_ring, reading);
+}
+
+/* single scheduler task for all sensors: one wake, and one notify of filter_task, per batch of samples due */
 static void beat_task(void *pvParameters) {
-    char msg[16];
-    int count = 0;
+    uint32_t wake;
+    int32_t delay;
+
+    sensor_sched_init(&sensor_sched, sensors, sizeof(sensors) / sizeof(sensors[0]),
+            portTICK_PERIOD_MS, SAMPLE_SLACK_MS, xTaskGetTickCount());
+    while (sensor_sched_next(&sensor_sched, &wake) == 0) {
+        delay = wake - xTaskGetTickCount();
+        if (delay > 0)
+            vTaskDelay(delay);
+        if (sensor_sched_run(&sensor_sched, xTaskGetTickCount(), push_reading, NULL) > 0)
+            xTaskNotifyGive(filter_handle);
+    }
+    printf("No sensors to sample\r\n");
+    vTaskDelete(NULL);
+}
 
-    while (1) {
-        if (!wifi_alive) {
-            vTaskDelay(1000 / portTICK_PERIOD_MS);
-            continue;
-        }
+static void filter_task(void *pvParameters) {
+    reading_t reading;
+    uint32_t dropped = 0;
 
-        printf("Schedule to publish\r\n");
+    for (int i = 0; i < READING_SENSOR_MAX; i++)
+        filter_chain_init(&filters[i]);
+    filter_add_average(&filters[READING_SENSOR_HEAP_FREE], HEAP_AVERAGE);
+    filter_add_delta(&filters[READING_SENSOR_HEAP_FREE], HEAP_DEADBAND, HEARTBEAT_MS);
+    filter_add_delta(&filters[READING_SENSOR_STACK_FREE], STACK_DEADBAND, HEARTBEAT_MS);
 
-        snprintf(msg, sizeof(msg), "%d", count);
-        if (xQueueSend(publish_queue, (void *) msg, 0) == pdFALSE) {
-            printf("Publish queue overflow\r\n");
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        while (spsc_pop(&sample_ring, &reading) == 0) {
+            if (reading.sensor >= READING_SENSOR_MAX
+                    || filter_run(&filters[reading.sensor], &reading))
+                queue_reading(&reading);
+        }
+        if (sample_ring.dropped != dropped) {
+            printf("Sample ring full, %u readings dropped\r\n",
+                    (unsigned) (sample_ring.dropped - dropped));
+            dropped = sample_ring.dropped;
         }
+    }
+}
 
-        vTaskDelay(10000 / portTICK_PERIOD_MS);
+static void led_received(void *ctx, const char *topic, int topic_len,
+        const unsigned char *payload, int payload_len) {
+    if (payload_len >= 2 && !strncmp((const char *) payload, "on", 2)) {
+        printf("Turning on LED\r\n");
+        gpio_write(GPIO_LED, 0);
+    } else if (payload_len >= 3 && !strncmp((const char *) payload, "off", 3)) {
+        printf("Turning off LED\r\n");
+        gpio_write(GPIO_LED, 1);
     }
 }
 
+/* every inbound publish lands here and is routed through the subscription trie */
 static void topic_received(mqtt_message_data_t *md) {
     mqtt_message_t *message = md->message;
     int i;
@@ -67,13 +292,23 @@ static void topic_received(mqtt_message_data_t *md) {
         printf("%c", ((char *) (message->payload))[i]);
     printf("\r\n");
 
-    if (!strncmp(message->payload, "on", 2)) {
-        printf("Turning on LED\r\n");
-        gpio_write(GPIO_LED, 0);
-    } else if (!strncmp(message->payload, "off", 3)) {
-        printf("Turning off LED\r\n");
-        gpio_write(GPIO_LED, 1);
-    }
+    if (!topic_trie_dispatch(&subs, md->topic->lenstring.data,
+            md->topic->lenstring.len, message->payload, message->payloadlen))
+        printf("No subscription for topic\r\n");
+}
+
+static void subscribe_one(void *ctx, const char *filter, int qos) {
+    mqtt_client_t *client = (mqtt_client_t *) ctx;
+    int ret;
+
+    /* NULL handler: paho falls back to defaultMessageHandler, so the trie does the matching */
+    if ((ret = mqtt_subscribe(client, filter, (enum mqtt_qos) qos, NULL)) < 0)
+        printf("subscribe %s failed: %d\r\n", filter, ret);
+}
+
+static void subscribe_all(mqtt_client_t *client) {
+    client->defaultMessageHandler = topic_received;
+    topic_trie_walk(&subs, sub_filter, sizeof(sub_filter), subscribe_one, client);
 }
 
 static const char *get_my_id(void) {
@@ -126,25 +361,234 @@ static int mqtt_ssl_write(mqtt_network_t* n, unsigned char* buffer, int len,
     return r;
 }
 
+static int publish_batch(mqtt_client_t *client) {
+    mqtt_message_t message;
+    size_t len = batch_finish(&batch);
+    TickType_t start;
+    int ret;
+
+    if (len == 0)
+        return MQTT_SUCCESS;
+
+    printf("Publishing batch %u: %u readings\r\n", (unsigned) batch.seq,
+            batch.count);
+    message.payload = batch.buf;
+    message.payloadlen = len;
+    message.dup = 0;
+    message.qos = MQTT_QOS1;
+    message.retained = 0;
+    /* a QoS1 publish returns once the PUBACK is in */
+    start = xTaskGetTickCount();
+    ret = mqtt_publish(client, MQTT_PUB_TOPIC, &message);
+    if (ret == MQTT_SUCCESS) {
+        endpoint_acked(&endpoints, endpoint_cur,
+                (xTaskGetTickCount() - start) * portTICK_PERIOD_MS);
+        batch_reset(&batch);
+    }
+    return ret;
+}
+
+/* move the records of an unsent batch into the offline log */
+static void spill_batch(void) {
+    size_t pos = BATCH_HEADER_LEN;
+
+    while (pos < batch.len) {
+        uint8_t len = batch.buf[pos++];
+        offline_store(batch.buf + pos, len);
+        pos += len;
+    }
+    batch_reset(&batch);
+}
+
+/* publish the offline backlog in full batches, oldest first */
+static int drain_offline(mqtt_client_t *client) {
+    uint8_t record[RINGLOG_RECORD_MAX];
+    ringlog_cursor_t cursor, next;
+    int ret = MQTT_SUCCESS;
+    int len;
+
+    while (offline_pending() && ret == MQTT_SUCCESS) {
+        xSemaphoreTake(offline_lock, portMAX_DELAY);
+        ringlog_rewind(&offline_log, &cursor);
+        for (;;) {
+            next = cursor;
+            len = ringlog_read(&offline_log, &next, record, sizeof(record));
+            if (len < 0 || batch_add(&batch, record, len, 0) != 0)
+                break;
+            cursor = next;
+        }
+        xSemaphoreGive(offline_lock);
+
+        ret = publish_batch(client);
+
+        if (ret == MQTT_SUCCESS) {
+            xSemaphoreTake(offline_lock, portMAX_DELAY);
+            ringlog_consume(&offline_log, &cursor);
+            xSemaphoreGive(offline_lock);
+        } else {
+            /* records are still in the log: discard the frame but keep its sequence number */
+            batch_reset(&batch);
+            batch.seq--;
+        }
+    }
+
+    return ret;
+}
+
+/* parse the credentials once; every connection after that shares them */
+static void creds_load(const char *client_id) {
+    int ret;
+
+    tls_creds_init(&tls_creds);
+#ifdef ESPNODE_PKI_PSK
+    /* the broker looks the key up by identity, so it is the client ID */
+    ret = tls_creds_set_psk(&tls_creds, client_psk, client_psk_len, client_id);
+    if (ret != 0)
+        printf("PSK: invalid: -0x%x\r\n", -ret);
+#else
+    ret = tls_creds_set_ca(&tls_creds, ca_cert, ca_cert_len);
+    if (ret != 0)
+        printf("CA certificate: parse failed: -0x%x\r\n", -ret);
+    if (client_cert_len && client_key_len) {
+        ret = tls_creds_set_cert(&tls_creds, client_cert, client_cert_len,
+                client_key, client_key_len);
+        if (ret != 0)
+            printf("Client certificate: parse failed: -0x%x\r\n", -ret);
+    }
+#endif
+}
+
+/* what TLS holds now, the most it held since connect, and the record size the broker agreed to */
+static void tls_heap_report(const char *what) {
+    size_t used, peak;
+
+    tls_mem_stats(&used, &peak);
+    printf("TLS heap after %s: %u bytes, peak %u, fragment %u\r\n", what,
+            (unsigned) used, (unsigned) peak,
+            (unsigned) tls_mem_fragment_len(&ssl_conn->ssl_ctx));
+}
+
+static void pin_load(void) {
+    uint8_t hash[TLS_PIN_LEN];
+    size_t len;
+
+    tls_pin_init(&tls_pin);
+    if (sysparam_get_data_static(PIN_PARAM, hash, sizeof(hash), &len, NULL)
+            == SYSPARAM_OK && tls_pin_set(&tls_pin, hash, len) != 0)
+        printf("Broker pin: invalid, %u bytes\r\n", (unsigned) len);
+}
+
+/* a changed key is only pinned after its chain was verified */
+static void pin_store(int state) {
+    if (state == TLS_PIN_UPDATED) {
+        sysparam_set_data(PIN_PARAM, tls_pin.hash, sizeof(tls_pin.hash), true);
+        printf("Broker key verified and pinned\r\n");
+    }
+}
+
+/* seconds on the RTC timer, which keeps counting through deep sleep and resets; it wraps after a few hours,
+ * which only makes the endpoint cache look stale */
+static uint32_t rtc_seconds(void) {
+    uint64_t us = (uint64_t) sdk_system_get_rtc_time()
+            * sdk_system_rtc_clock_cali_proc() >> 12;
+
+    return us / 1000000;
+}
+
+static int endpoints_load(void) {
+    if (!sdk_system_rtc_mem_read(ENDPOINT_RTC_BLOCK, &endpoint_cache,
+            sizeof(endpoint_cache)))
+        memset(&endpoint_cache, 0, sizeof(endpoint_cache));
+    return endpoint_list_init(&endpoints, client_endpoint, client_port,
+            &endpoint_cache);
+}
+
+static void endpoints_store(void) {
+    sdk_system_rtc_mem_write(ENDPOINT_RTC_BLOCK, &endpoint_cache,
+            sizeof(endpoint_cache));
+}
+
+/* pick the broker with the best record; returns its address, cached or resolved now, or NULL to leave the
+ * lookup to ssl_connect */
+static const char *endpoint_next(char *addr) {
+    struct addrinfo hints, *res = NULL;
+    const char *host;
+
+    endpoint_cur = endpoint_select(&endpoints, rtc_seconds());
+    host = endpoints.endpoint[endpoint_cur].host;
+    if (endpoint_addr(&endpoints, endpoint_cur, rtc_seconds(), addr))
+        return addr;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, NULL, &hints, &res) != 0 || !res)
+        return NULL;
+    endpoint_resolved(&endpoints, endpoint_cur,
+            (const uint8_t *) &((struct sockaddr_in *) res->ai_addr)->sin_addr,
+            rtc_seconds());
+    freeaddrinfo(res);
+    endpoints_store();
+
+    return endpoint_addr(&endpoints, endpoint_cur, rtc_seconds(), addr);
+}
+
+static void endpoint_fail(void) {
+    endpoint_failed(&endpoints, endpoint_cur, rtc_seconds());
+    endpoints_store();
+}
+
+static void session_load(void) {
+    size_t len;
+
+    sdk_system_rtc_mem_read(SESSION_RTC_BLOCK, &tls_session, sizeof(tls_session));
+    if (tls_session_valid(&tls_session, endpoints.endpoint[0].host))
+        return;
+
+    if (sysparam_get_data_static(SESSION_PARAM, (uint8_t *) &tls_session,
+            sizeof(tls_session), &len, NULL) != SYSPARAM_OK
+            || len != sizeof(tls_session))
+        tls_session_clear(&tls_session);
+}
+
+static void session_store(int state) {
+    sdk_system_rtc_mem_write(SESSION_RTC_BLOCK, &tls_session, sizeof(tls_session));
+    /* flash is written once per full handshake, not on every resumption */
+    if (state == TLS_SESSION_NEW)
+        sysparam_set_data(SESSION_PARAM, (const uint8_t *) &tls_session,
+                sizeof(tls_session), true);
+}
+
 static void mqtt_task(void *pvParameters) {
     int ret = 0;
     struct mqtt_network network;
     mqtt_client_t client = mqtt_client_default;
     char mqtt_client_id[20];
-    uint8_t mqtt_buf[100];
+    reading_t reading;
+    uint8_t record[READING_CBOR_MAX];
+    uint8_t mqtt_buf[sizeof(batch_buf) + 32];
     uint8_t mqtt_readbuf[100];
     mqtt_packet_connect_data_t data = mqtt_packet_connect_data_initializer;
+    char addr[ENDPOINT_ADDR_STR_LEN];
+    const char *target;
+    TickType_t connect_start;
 
     memset(mqtt_client_id, 0, sizeof(mqtt_client_id));
     strcpy(mqtt_client_id, "ESP-");
     strcat(mqtt_client_id, get_my_id());
 
+    if (endpoints_load() != 0) {
+        printf("Invalid client_endpoint: %s\r\n", client_endpoint);
+        vTaskDelete(NULL);
+        return;
+    }
     ssl_conn = (SSLConnection *) malloc(sizeof(SSLConnection));
+    creds_load(mqtt_client_id);
+    pin_load();
+    session_load();
     while (1) {
-        if (!wifi_alive) {
-            vTaskDelay(1000 / portTICK_PERIOD_MS);
-            continue;
-        }
+        /* woken as soon as wifi_task has an address */
+        xEventGroupWaitBits(conn_events, CONN_IP_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
 
         if (ret) {
             // Rate limit loop in case of errors
@@ -153,29 +597,54 @@ static void mqtt_task(void *pvParameters) {
             continue;
         }
 
+        /* seeded once from the hardware RNG; every connection draws from it */
+        ret = tls_rng_init(mqtt_client_id, strlen(mqtt_client_id));
+        if (ret) {
+            printf("RNG seed failed: -0x%x\r\n", -ret);
+            continue;
+        }
+
         printf("%s: started node id %s\n\r", __func__, mqtt_client_id);
         ssl_reset = 0;
+        tls_mem_reset_peak();
         ssl_init(ssl_conn);
-        ssl_conn->ca_cert_str = ca_cert;
-        ssl_conn->client_cert_str = client_cert;
-        ssl_conn->client_key_str = client_key;
+        ssl_conn->creds = &tls_creds;
+        ssl_conn->pin = &tls_pin;
+        ssl_conn->session = &tls_session;
 
         mqtt_network_new(&network);
         network.mqttread = mqtt_ssl_read;
         network.mqttwrite = mqtt_ssl_write;
 
-        printf("%s: connecting to MQTT server %s:%d ... ", __func__,
-                client_endpoint, client_port);
-        ret = ssl_connect(ssl_conn, client_endpoint, client_port);
+        /* a cached address saves the DNS lookup */
+        target = endpoint_next(addr);
+        printf("%s: connecting to MQTT server %s:%d (%s) ... ", __func__,
+                endpoints.endpoint[endpoint_cur].host,
+                endpoints.endpoint[endpoint_cur].port, target ? target : "DNS");
+        connect_start = xTaskGetTickCount();
+        ret = ssl_connect(ssl_conn, endpoints.endpoint[endpoint_cur].host,
+                target, endpoints.endpoint[endpoint_cur].port);
+        /* also persists a session cleared by a failed handshake */
+        session_store(ret ? TLS_SESSION_ERR : ssl_conn->session_state);
 
         if (ret) {
             printf("error: %d\n\r", ret);
+            endpoint_fail();
             ssl_destroy(ssl_conn);
             continue;
         }
-        printf("done\n\r");
-        mqtt_client_new(&client, &network, 5000, mqtt_buf, 100, mqtt_readbuf,
-                100);
+        if (ssl_conn->session_state == TLS_SESSION_RESUMED)
+            tls_resumed++;
+        else
+            tls_full++;
+        printf("done (%s, %u full handshakes, %u resumed)\n\r",
+                ssl_conn->session_state == TLS_SESSION_RESUMED ?
+                        "resumed" : "full handshake",
+                (unsigned) tls_full, (unsigned) tls_resumed);
+        pin_store(ssl_conn->pin_state);
+        tls_heap_report("handshake");
+        mqtt_client_new(&client, &network, 5000, mqtt_buf, sizeof(mqtt_buf),
+                mqtt_readbuf, sizeof(mqtt_readbuf));
 
         data.willFlag = 0;
         data.MQTTVersion = 4;
@@ -183,37 +652,47 @@ static void mqtt_task(void *pvParameters) {
         data.clientID.cstring = mqtt_client_id;
         data.username.cstring = NULL;
         data.password.cstring = NULL;
-        data.keepAliveInterval = 1000;
+        data.keepAliveInterval = MQTT_KEEPALIVE_S;
         printf("Send MQTT connect ... ");
         ret = mqtt_connect(&client, &data);
         if (ret) {
             printf("error: %d\n\r", ret);
+            endpoint_fail();
             ssl_destroy(ssl_conn);
             continue;
         }
         printf("done\r\n");
-        mqtt_subscribe(&client, MQTT_SUB_TOPIC, MQTT_QOS1, topic_received);
-        xQueueReset(publish_queue);
-
-        while (wifi_alive && !ssl_reset) {
-            char msg[64];
-            while (xQueueReceive(publish_queue, (void *) msg, 0) == pdTRUE) {
-                TickType_t task_tick = xTaskGetTickCount();
-                uint32_t free_heap = xPortGetFreeHeapSize();
-                uint32_t free_stack = uxTaskGetStackHighWaterMark(NULL);
-                snprintf(msg, sizeof(msg), "%u: free heap %u, free stack %u",
-                        task_tick, free_heap, free_stack * 4);
-                printf("Publishing: %s\r\n", msg);
-
-                mqtt_message_t message;
-                message.payload = msg;
-                message.payloadlen = strlen(msg);
-                message.dup = 0;
-                message.qos = MQTT_QOS1;
-                message.retained = 0;
-                ret = mqtt_publish(&client, MQTT_PUB_TOPIC, &message);
+        endpoint_connected(&endpoints, endpoint_cur,
+                (xTaskGetTickCount() - connect_start) * portTICK_PERIOD_MS);
+        endpoints_store();
+        subscribe_all(&client);
+        xEventGroupSetBits(conn_events, CONN_BROKER_BIT);
+
+        while ((xEventGroupGetBits(conn_events) & CONN_IP_BIT) && !ssl_reset) {
+            if (offline_pending()) {
+                /* live batch goes out first so sequence numbers stay in order */
+                if ((ret = publish_batch(&client)) != MQTT_SUCCESS
+                        || (ret = drain_offline(&client)) != MQTT_SUCCESS) {
+                    printf("error while draining offline log: %d\n", ret);
+                    break;
+                }
+            }
+
+            while (xQueueReceive(publish_queue, (void *) &reading, 0) == pdTRUE) {
+                uint32_t now = xTaskGetTickCount() * portTICK_PERIOD_MS;
+                size_t len = reading_encode(&reading, record, sizeof(record));
+
+                if (batch_add(&batch, record, len, now) != 0) {
+                    if ((ret = publish_batch(&client)) != MQTT_SUCCESS)
+                        break;
+                    batch_add(&batch, record, len, now);
+                }
+            }
+
+            if (batch_ready(&batch, xTaskGetTickCount() * portTICK_PERIOD_MS)) {
+                ret = publish_batch(&client);
                 if (ret != MQTT_SUCCESS) {
-                    printf("error while publishing message: %d\n", ret);
+                    printf("error while publishing batch: %d\n", ret);
                     break;
                 }
             }
@@ -223,51 +702,156 @@ static void mqtt_task(void *pvParameters) {
                 break;
         }
         printf("Connection dropped, request restart\n\r");
+        xEventGroupClearBits(conn_events, CONN_BROKER_BIT);
+        spill_batch();
+        while (xQueueReceive(publish_queue, (void *) &reading, 0) == pdTRUE)
+            offline_store_reading(&reading);
+        tls_heap_report("connection");
+        /* keeps the PUBACK times of this connection */
+        endpoints_store();
         ssl_destroy(ssl_conn);
     }
 }
 
+static void wifi_load(void) {
+    size_t len;
+
+    sdk_system_rtc_mem_read(WIFI_RTC_BLOCK, &wifi_cache, sizeof(wifi_cache));
+    if (!wifi_cache_init(&wifi_cache, WIFI_SSID))
+        return;
+
+    if (sysparam_get_data_static(WIFI_PARAM, (uint8_t *) &wifi_cache,
+            sizeof(wifi_cache), &len, NULL) == SYSPARAM_OK
+            && len == sizeof(wifi_cache) && !wifi_cache_init(&wifi_cache, WIFI_SSID))
+        wifi_cache_restored(&wifi_cache);
+}
+
+static void wifi_store(int ap_changed) {
+    sdk_system_rtc_mem_write(WIFI_RTC_BLOCK, &wifi_cache, sizeof(wifi_cache));
+    if (ap_changed)
+        sysparam_set_data(WIFI_PARAM, (const uint8_t *) &wifi_cache,
+                sizeof(wifi_cache), true);
+}
+
+/* configure the cached lease statically, skipping DHCP */
+static void wifi_static(void) {
+    struct ip_info info;
+    ip_addr_t dns;
+
+    memcpy(&info.ip.addr, wifi_cache.ip, sizeof(info.ip.addr));
+    memcpy(&info.netmask.addr, wifi_cache.netmask, sizeof(info.netmask.addr));
+    memcpy(&info.gw.addr, wifi_cache.gw, sizeof(info.gw.addr));
+    IP_ADDR4(&dns, wifi_cache.dns[0], wifi_cache.dns[1], wifi_cache.dns[2],
+            wifi_cache.dns[3]);
+
+    sdk_wifi_station_dhcpc_stop();
+    sdk_wifi_set_ip_info(STATION_IF, &info);
+    dns_setserver(0, &dns);
+}
+
+/* lease time DHCP granted on the interface holding addr, 0 if unknown */
+static uint32_t wifi_lease_s(uint32_t addr) {
+    struct netif *netif;
+    struct dhcp *dhcp;
+
+    for (netif = netif_list; netif; netif = netif->next) {
+        if (ip4_addr_get_u32(netif_ip4_addr(netif)) == addr)
+            return (dhcp = netif_dhcp_data(netif)) ? dhcp->offered_t0_lease : 0;
+    }
+    return 0;
+}
+
+/* cache the access point joined and, when DHCP ran, its lease; the SDK does not report the BSSID */
+static void wifi_joined(int dhcp) {
+    struct ip_info info;
+    uint32_t dns;
+    int changed = wifi_cache_set_ap(&wifi_cache, NULL, sdk_wifi_get_channel());
+
+    if (dhcp && sdk_wifi_get_ip_info(STATION_IF, &info)) {
+        dns = ip4_addr_get_u32(ip_2_ip4(dns_getserver(0)));
+        wifi_cache_set_lease(&wifi_cache, (const uint8_t *) &info.ip.addr,
+                (const uint8_t *) &info.netmask.addr,
+                (const uint8_t *) &info.gw.addr, (const uint8_t *) &dns,
+                rtc_seconds(), wifi_lease_s(info.ip.addr));
+    }
+    wifi_store(changed);
+}
+
+/* returns 1 once the station has an address, 0 if the join failed or took longer than timeout_ms */
+static int wifi_wait(uint32_t timeout_ms) {
+    TickType_t start = xTaskGetTickCount();
+    uint8_t status;
+
+    while ((status = sdk_wifi_station_get_connect_status()) != STATION_GOT_IP) {
+        if (status == STATION_WRONG_PASSWORD) {
+            printf("WiFi: wrong password\n\r");
+            return 0;
+        } else if (status == STATION_NO_AP_FOUND) {
+            printf("WiFi: AP not found\n\r");
+            return 0;
+        } else if (status == STATION_CONNECT_FAIL) {
+            printf("WiFi: connection failed\r\n");
+            return 0;
+        }
+        if ((xTaskGetTickCount() - start) * portTICK_PERIOD_MS >= timeout_ms)
+            return 0;
+        vTaskDelay(100 / portTICK_PERIOD_MS);
+    }
+
+    printf("WiFi: Connected in %u ms%s\n\r",
+            (xTaskGetTickCount() - start) * portTICK_PERIOD_MS,
+            sdk_wifi_station_dhcpc_status() == DHCP_STOPPED ? ", cached lease" : "");
+    return 1;
+}
+
+/* join with the cached lease if there is one, then with DHCP; returns 1 once connected */
+static int wifi_join(void) {
+    if (wifi_cache_has_lease(&wifi_cache, rtc_seconds())) {
+        wifi_static();
+        sdk_wifi_station_connect();
+        if (wifi_wait(WIFI_FAST_TIMEOUT_MS)) {
+            wifi_joined(0);
+            return 1;
+        }
+
+        printf("WiFi: cached lease failed\n\r");
+        sdk_wifi_station_disconnect();
+        wifi_cache_failed(&wifi_cache);
+        wifi_store(1);
+    }
+
+    sdk_wifi_station_dhcpc_start();
+    sdk_wifi_station_connect();
+    if (!wifi_wait(WIFI_JOIN_TIMEOUT_MS)) {
+        sdk_wifi_station_disconnect();
+        return 0;
+    }
+    wifi_joined(1);
+    return 1;
+}
+
 static void wifi_task(void *pvParameters) {
-    uint8_t status = 0;
-    uint8_t retries = 30;
     struct sdk_station_config config = { .ssid = WIFI_SSID, .password =
             WIFI_PASS, };
 
     printf("%s: Connecting to WiFi\n\r", __func__);
+    wifi_load();
     sdk_wifi_set_opmode (STATION_MODE);
+    /* joins are started by wifi_join, after it has chosen between the cached lease and DHCP */
+    sdk_wifi_station_set_auto_connect(0);
     sdk_wifi_station_set_config(&config);
 
     while (1) {
-        wifi_alive = 0;
-
-        while ((status != STATION_GOT_IP) && (retries)) {
-            status = sdk_wifi_station_get_connect_status();
-            printf("%s: status = %d\n\r", __func__, status);
-            if (status == STATION_WRONG_PASSWORD) {
-                printf("WiFi: wrong password\n\r");
-                break;
-            } else if (status == STATION_NO_AP_FOUND) {
-                printf("WiFi: AP not found\n\r");
-                break;
-            } else if (status == STATION_CONNECT_FAIL) {
-                printf("WiFi: connection failed\r\n");
-                break;
-            }
-            vTaskDelay(1000 / portTICK_PERIOD_MS);
-            --retries;
+        if (wifi_join()) {
+            printf("WiFi: %u bytes of stack unused\n\r",
+                    (unsigned) (uxTaskGetStackHighWaterMark(NULL) * sizeof(portSTACK_TYPE)));
+            xEventGroupSetBits(conn_events, CONN_WIFI_BIT | CONN_IP_BIT);
+            /* the SDK has no event callback here, so this is the one task that still polls */
+            while (sdk_wifi_station_get_connect_status() == STATION_GOT_IP)
+                vTaskDelay(500 / portTICK_PERIOD_MS);
+            xEventGroupClearBits(conn_events, CONN_WIFI_BIT | CONN_IP_BIT);
+            printf("WiFi: disconnected\n\r");
         }
-
-        while ((status = sdk_wifi_station_get_connect_status())
-                == STATION_GOT_IP) {
-            if (wifi_alive == 0) {
-                printf("WiFi: Connected\n\r");
-                wifi_alive = 1;
-            }
-            vTaskDelay(500 / portTICK_PERIOD_MS);
-        }
-
-        wifi_alive = 0;
-        printf("WiFi: disconnected\n\r");
         vTaskDelay(1000 / portTICK_PERIOD_MS);
     }
 }
@@ -280,8 +864,18 @@ void user_init(void) {
     gpio_enable(GPIO_LED, GPIO_OUTPUT);
     gpio_write(GPIO_LED, 1);
 
-    publish_queue = xQueueCreate(3, 16);
-    xTaskCreate(&wifi_task, "wifi_task", 256, NULL, 2, NULL);
-    xTaskCreate(&beat_task, "beat_task", 256, NULL, 2, NULL);
+    tls_mem_init();
+    offline_init();
+    topic_trie_init(&subs, sub_nodes, SUB_NODES, sub_names, SUB_NAMES_LEN);
+    topic_trie_add(&subs, MQTT_SUB_TOPIC, MQTT_QOS1, led_received, NULL);
+    publish_queue = xQueueCreate(4, sizeof(reading_t));
+    spsc_init(&sample_ring, sample_buf, sizeof(sample_buf[0]), SAMPLE_RING_LEN);
+    conn_events = xEventGroupCreate();
+    batch_init(&batch, batch_buf, sizeof(batch_buf), BATCH_COUNT,
+            BATCH_WINDOW_MS);
+    xTaskCreate(&wifi_task, "wifi_task", WIFI_STACK_SIZE, NULL, 2, NULL);
+    /* created first, so beat_task has it to notify */
+    xTaskCreate(&filter_task, "filter_task", 512, NULL, 2, &filter_handle);
+    xTaskCreate(&beat_task, "beat_task", 256, NULL, 3, NULL);
     xTaskCreate(&mqtt_task, "mqtt_task", 2048, NULL, 2, NULL);
 }
@@ -7,11 +7,16 @@ fi
 
 filename="${1}"
 varname="${2:-$(basename ${filename} | tr '.' '_')}"
+pem_to_der="$(dirname "${0}")/../../ssl/clients/pem_to_der.sh"
 
-echo -n "const char *${varname} = "
-while IFS='' read -r line || [[ -n "${line}" ]]; do
-    echo
-    echo -n "   \"${line}\r\n\""
-done < "${filename}"
+# Certificates and keys are compiled in as DER, so the node skips the base64 decode when parsing them
+if grep -q -- "-----BEGIN " "${filename}"; then
+    der="$("${pem_to_der}" "${filename}" | od -A n -v -t x1)" || exit 1
+else
+    der="$(od -A n -v -t x1 < "${filename}")"
+fi
 
-echo ";"
\ No newline at end of file
+echo "const unsigned char ${varname}[] = {"
+echo "${der}" | sed -e 's/ \([0-9a-f][0-9a-f]\)/ 0x\1,/g' -e 's/^/   /'
+echo "};"
+echo "const unsigned int ${varname}_len = sizeof(${varname});"
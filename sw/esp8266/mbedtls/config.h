@@ -1,18 +1,9 @@
-/* Special mbedTLS config file for http_get_mbedtls example,
-   overrides supported cipher suite list.
+/* mbedTLS configuration for espnode, applied over the esp-open-rtos defaults.
 
-   Overriding the set of cipher suites saves small amounts of ROM and
-   RAM, and is a good practice in general if you know what server(s)
-   you want to connect to.
-
-  However it's extra important here because the howsmyssl API sends
-  back the list of ciphers we send it as a JSON list in the, and we
-  only have a 4096kB receive buffer. If the server supported maximum
-  fragment length option then we wouldn't have this problem either,
-  but we do so this is a good workaround.
-
-  The ciphers chosen below are common ECDHE ciphers, the same ones
-  Firefox uses when connecting to a TLSv1.2 server.
+   Sized for an MQTT node that talks to one broker: the record buffers are built to fit the traffic (see
+   ESPNODE_TLS_IN_LEN below and tls_mem.h) and max fragment length negotiation keeps the broker's records
+   within them, and the PKI=ec and PKI=psk build options (see Makefile) leave out the key exchanges and
+   the curves the node never uses.
 */
 #ifndef MBEDTLS_CONFIG_H
 
@@ -23,4 +14,106 @@
 // #define MBEDTLS_DEBUG_C
 #define MBEDTLS_ERROR_C
 
+/* PKI=ec (see Makefile): the CA and broker use ECDSA P-256 keys, made by the ssl/ca scripts with KEY_TYPE=ec.
+   Only ECDHE-ECDSA suites are offered and only P-256 is built, which keeps RSA out of the handshake and
+   leaves one curve, with the NIST fast reduction, for all the public key work. */
+#ifdef ESPNODE_PKI_EC
+#undef MBEDTLS_SSL_CIPHERSUITES
+#define MBEDTLS_SSL_CIPHERSUITES MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256, \
+                                 MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_CBC_SHA256, \
+                                 MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_CBC_SHA
+
+#undef MBEDTLS_ECP_DP_SECP192R1_ENABLED
+#undef MBEDTLS_ECP_DP_SECP224R1_ENABLED
+#undef MBEDTLS_ECP_DP_SECP384R1_ENABLED
+#undef MBEDTLS_ECP_DP_SECP521R1_ENABLED
+#undef MBEDTLS_ECP_DP_SECP192K1_ENABLED
+#undef MBEDTLS_ECP_DP_SECP224K1_ENABLED
+#undef MBEDTLS_ECP_DP_SECP256K1_ENABLED
+#undef MBEDTLS_ECP_DP_BP256R1_ENABLED
+#undef MBEDTLS_ECP_DP_BP384R1_ENABLED
+#undef MBEDTLS_ECP_DP_BP512R1_ENABLED
+#undef MBEDTLS_ECP_DP_CURVE25519_ENABLED
+#define MBEDTLS_ECP_NIST_OPTIM
+#endif
+
+/* PKI=psk (see Makefile): the node authenticates with a pre-shared key, see tls_creds.h. Only PSK suites
+   are offered, so the certificate parsing and all the public key code are left out of the build. */
+#ifdef ESPNODE_PKI_PSK
+#define MBEDTLS_KEY_EXCHANGE_PSK_ENABLED
+#undef MBEDTLS_SSL_CIPHERSUITES
+#define MBEDTLS_SSL_CIPHERSUITES MBEDTLS_TLS_PSK_WITH_AES_128_GCM_SHA256, \
+                                 MBEDTLS_TLS_PSK_WITH_AES_128_CBC_SHA256, \
+                                 MBEDTLS_TLS_PSK_WITH_AES_128_CBC_SHA
+
+#undef MBEDTLS_KEY_EXCHANGE_RSA_ENABLED
+#undef MBEDTLS_KEY_EXCHANGE_DHE_RSA_ENABLED
+#undef MBEDTLS_KEY_EXCHANGE_ECDHE_RSA_ENABLED
+#undef MBEDTLS_KEY_EXCHANGE_ECDHE_ECDSA_ENABLED
+#undef MBEDTLS_KEY_EXCHANGE_ECDH_ECDSA_ENABLED
+#undef MBEDTLS_KEY_EXCHANGE_ECDH_RSA_ENABLED
+#undef MBEDTLS_KEY_EXCHANGE_RSA_PSK_ENABLED
+#undef MBEDTLS_KEY_EXCHANGE_DHE_PSK_ENABLED
+#undef MBEDTLS_KEY_EXCHANGE_ECDHE_PSK_ENABLED
+#undef MBEDTLS_SSL_SERVER_NAME_INDICATION
+#undef MBEDTLS_X509_CRT_PARSE_C
+#undef MBEDTLS_X509_CRL_PARSE_C
+#undef MBEDTLS_X509_CSR_PARSE_C
+#undef MBEDTLS_X509_USE_C
+#undef MBEDTLS_CERTS_C
+#undef MBEDTLS_PEM_PARSE_C
+#undef MBEDTLS_PK_PARSE_C
+#undef MBEDTLS_PK_WRITE_C
+#undef MBEDTLS_PK_C
+#undef MBEDTLS_RSA_C
+#undef MBEDTLS_ECDSA_C
+#undef MBEDTLS_ECDH_C
+#undef MBEDTLS_ECP_C
+#undef MBEDTLS_DHM_C
+#endif
+
+/* TLS record buffers, allocated per connection: 16 KB each by default. The input buffer takes what the broker
+   sends, and must hold its certificate chain in one record (TLS_IN_LEN=8192 for a deep or RSA-4096 heavy
+   chain); up to 4 KB its size is requested as the max fragment length. The output buffer takes the node's client
+   certificate and its own MQTT packets, and longer writes are split into records. Set with TLS_IN_LEN and
+   TLS_OUT_LEN, see Makefile. */
+#ifndef ESPNODE_TLS_IN_LEN
+#if defined(ESPNODE_PKI_PSK)
+#define ESPNODE_TLS_IN_LEN 1024
+#elif defined(ESPNODE_PKI_EC)
+#define ESPNODE_TLS_IN_LEN 2048
+#else
+#define ESPNODE_TLS_IN_LEN 4096
+#endif
+#endif
+#ifndef ESPNODE_TLS_OUT_LEN
+#if defined(ESPNODE_PKI_PSK) || defined(ESPNODE_PKI_EC)
+#define ESPNODE_TLS_OUT_LEN 1024
+#else
+#define ESPNODE_TLS_OUT_LEN 2048
+#endif
+#endif
+
+#define MBEDTLS_SSL_MAX_FRAGMENT_LENGTH
+#undef MBEDTLS_SSL_IN_CONTENT_LEN
+#undef MBEDTLS_SSL_OUT_CONTENT_LEN
+#undef MBEDTLS_SSL_MAX_CONTENT_LEN
+#define MBEDTLS_SSL_IN_CONTENT_LEN ESPNODE_TLS_IN_LEN
+#define MBEDTLS_SSL_OUT_CONTENT_LEN ESPNODE_TLS_OUT_LEN
+/* mbedTLS before 2.13 sizes both buffers with this one */
+#define MBEDTLS_SSL_MAX_CONTENT_LEN ESPNODE_TLS_IN_LEN
+
+/* count mbedTLS allocations for the peak TLS heap report, see tls_mem.h */
+#ifndef MBEDTLS_PLATFORM_C
+#define MBEDTLS_PLATFORM_C
+#endif
+#ifndef MBEDTLS_PLATFORM_MEMORY
+#define MBEDTLS_PLATFORM_MEMORY
+#endif
+
+/* let the broker resume sessions by ticket as well as by session ID, see tls_session.h */
+#ifndef MBEDTLS_SSL_SESSION_TICKETS
+#define MBEDTLS_SSL_SESSION_TICKETS
+#endif
+
 #endif
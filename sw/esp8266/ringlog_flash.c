@@ -0,0 +1,67 @@
+#include <espressif/esp_common.h>
+#include <espressif/spi_flash.h>
+#include <string.h>
+
+#include "ringlog_flash.h"
+
+/* SPI flash access needs word aligned addresses, lengths and buffers */
+static uint32_t bounce[64];
+
+static int flash_read(void *ctx, uint32_t addr, void *buf, size_t len) {
+    uint8_t *dst = buf;
+
+    addr += RINGLOG_FLASH_ADDR;
+    while (len) {
+        uint32_t base = addr & ~3;
+        uint32_t skip = addr - base;
+        size_t n = sizeof(bounce) - skip;
+        if (n > len)
+            n = len;
+
+        if (sdk_spi_flash_read(base, bounce, (skip + n + 3) & ~3)
+                != SPI_FLASH_RESULT_OK)
+            return -1;
+        memcpy(dst, (uint8_t *) bounce + skip, n);
+
+        dst += n;
+        addr += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int flash_write(void *ctx, uint32_t addr, const void *buf, size_t len) {
+    const uint8_t *src = buf;
+
+    /* ring log writes are always word aligned and padded */
+    if ((addr & 3) || (len & 3))
+        return -1;
+
+    addr += RINGLOG_FLASH_ADDR;
+    while (len) {
+        size_t n = len < sizeof(bounce) ? len : sizeof(bounce);
+
+        memcpy(bounce, src, n);
+        if (sdk_spi_flash_write(addr, bounce, n) != SPI_FLASH_RESULT_OK)
+            return -1;
+
+        src += n;
+        addr += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int flash_erase(void *ctx, uint32_t addr) {
+    uint16_t sector = (RINGLOG_FLASH_ADDR + addr) / SPI_FLASH_SEC_SIZE;
+
+    return sdk_spi_flash_erase_sector(sector) == SPI_FLASH_RESULT_OK ? 0 : -1;
+}
+
+void ringlog_flash_init(ringlog_flash_t *flash) {
+    flash->read = flash_read;
+    flash->write = flash_write;
+    flash->erase = flash_erase;
+    flash->ctx = NULL;
+    flash->size = RINGLOG_FLASH_SIZE;
+}
@@ -0,0 +1,16 @@
+#ifndef _RINGLOG_FLASH_H_
+#define _RINGLOG_FLASH_H_
+
+#include "ringlog.h"
+
+/* flash region reserved for offline readings, must not overlap firmware or SDK parameter sectors */
+#ifndef RINGLOG_FLASH_ADDR
+#define RINGLOG_FLASH_ADDR 0x300000
+#endif
+#ifndef RINGLOG_FLASH_SIZE
+#define RINGLOG_FLASH_SIZE 0x80000
+#endif
+
+extern void ringlog_flash_init(ringlog_flash_t *flash);
+
+#endif /* _RINGLOG_FLASH_H_ */
@@ -1,4 +1,6 @@
 #include <espressif/esp_common.h>
+#include <FreeRTOS.h>
+#include <task.h>
 #include <lwip/sockets.h>
 #include <lwip/inet.h>
 #include <lwip/netdb.h>
@@ -8,9 +10,7 @@
 // this must be ahead of any mbedtls header files so the local mbedtls/config.h can be properly referenced
 #include "ssl_connection.h"
 
-#define SSL_READ_TIMEOUT_MS           2000
-
-const char *pers = "esp-tls";
+#define SSL_HANDSHAKE_TIMEOUT_MS      15000
 
 static int handle_error(int err) {
 
@@ -24,6 +24,40 @@ static int handle_error(int err) {
     return err;
 }
 
+static uint32_t now_ms(void) {
+    return xTaskGetTickCount() * portTICK_PERIOD_MS;
+}
+
+/*
+ * The socket is non-blocking: mbedTLS returns WANT_READ/WANT_WRITE and the task sleeps in select() until the
+ * socket is ready or timeout_ms (0 or less only polls) has passed. Returns true if ready.
+ */
+static int ssl_wait(SSLConnection* conn, int want, int timeout_ms) {
+    struct timeval tv;
+    fd_set fds;
+    int fd = conn->net_ctx.fd;
+
+    if (fd < 0) {
+        return 0;
+    }
+    if (timeout_ms < 0) {
+        timeout_ms = 0;
+    }
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+
+    FD_ZERO(&fds);
+    FD_SET(fd, &fds);
+    if (want == MBEDTLS_ERR_SSL_WANT_WRITE) {
+        return select(fd + 1, NULL, &fds, NULL, &tv) > 0;
+    }
+    return select(fd + 1, &fds, NULL, NULL, &tv) > 0;
+}
+
+static int is_want(int ret) {
+    return ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE;
+}
+
 #ifdef MBEDTLS_DEBUG_C
 static void my_debug(void *ctx, int level, const char *file, int line,
         const char *str) {
@@ -35,60 +69,40 @@ static void my_debug(void *ctx, int level, const char *file, int line,
 
 void ssl_init(SSLConnection* conn) {
     /*
-     * Initialize the RNG and the session data
+     * Initialize the session data; the RNG is shared and seeded once, see tls_rng.h
      */
     mbedtls_net_init(&conn->net_ctx);
     mbedtls_ssl_init(&conn->ssl_ctx);
     mbedtls_ssl_config_init(&conn->ssl_conf);
 
-    mbedtls_x509_crt_init(&conn->ca_cert);
-    mbedtls_x509_crt_init(&conn->client_cert);
-    mbedtls_pk_init(&conn->client_key);
-
-    mbedtls_ctr_drbg_init(&conn->drbg_ctx);
-    mbedtls_entropy_init(&conn->entropy_ctx);
-
+    conn->creds = NULL;
+    conn->pin = NULL;
+    conn->pin_state = TLS_PIN_OK;
+    conn->session = NULL;
+    conn->session_state = TLS_SESSION_ERR;
 }
 
-int ssl_connect(SSLConnection* conn, const char* host, int port) {
+/*
+ * Connect to addr, or to host if addr is NULL (it is resolved then). TLS uses host either way: it is the name
+ * sent to the server and checked in its certificate, and the session and pin are kept for it.
+ */
+int ssl_connect(SSLConnection* conn, const char* host, const char* addr,
+        int port) {
     int ret;
     char buffer[8];
-
-    ret = mbedtls_ctr_drbg_seed(&conn->drbg_ctx, mbedtls_entropy_func,
-            &conn->entropy_ctx, (const unsigned char *) pers, strlen(pers));
-    if (ret < 0) {
-        return -1;
-    }
-
-    ret = mbedtls_x509_crt_parse(&conn->ca_cert,
-            (const unsigned char *) conn->ca_cert_str,
-            strlen(conn->ca_cert_str) + 1);
-    if (ret < 0) {
-        return handle_error(ret);
-    }
-
-    if (conn->client_cert_str) {
-        ret = mbedtls_x509_crt_parse(&conn->client_cert,
-                (const unsigned char *) conn->client_cert_str,
-                strlen(conn->client_cert_str) + 1);
-        if (ret < 0) {
-            return handle_error(ret);
-        }
-
-        ret = mbedtls_pk_parse_key(&conn->client_key,
-                (const unsigned char *) conn->client_key_str,
-                strlen(conn->client_key_str) + 1, NULL, 0);
-        if (ret != 0) {
-            return handle_error(ret);
-        }
-    }
+    uint32_t start;
+    uint32_t flags;
 
     snprintf(buffer, sizeof(buffer), "%d", port);
-    ret = mbedtls_net_connect(&conn->net_ctx, host, buffer,
+    ret = mbedtls_net_connect(&conn->net_ctx, addr ? addr : host, buffer,
             MBEDTLS_NET_PROTO_TCP);
     if (ret != 0) {
         return handle_error(ret);
     }
+    ret = mbedtls_net_set_nonblock(&conn->net_ctx);
+    if (ret != 0) {
+        return handle_error(ret);
+    }
 
     ret = mbedtls_ssl_config_defaults(&conn->ssl_conf, MBEDTLS_SSL_IS_CLIENT,
             MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT);
@@ -102,17 +116,21 @@ int ssl_connect(SSLConnection* conn, const char* host, int port) {
 #endif
 
     mbedtls_ssl_conf_authmode(&conn->ssl_conf, MBEDTLS_SSL_VERIFY_NONE);
-    mbedtls_ssl_conf_rng(&conn->ssl_conf, mbedtls_ctr_drbg_random,
-            &conn->drbg_ctx);
-    mbedtls_ssl_conf_read_timeout(&conn->ssl_conf, SSL_READ_TIMEOUT_MS);
-    mbedtls_ssl_conf_ca_chain(&conn->ssl_conf, &conn->ca_cert, NULL);
-
-    if (conn->client_cert_str) {
-        ret = mbedtls_ssl_conf_own_cert(&conn->ssl_conf, &conn->client_cert,
-                &conn->client_key);
+    tls_rng_conf(&conn->ssl_conf);
+
+    if (conn->creds) {
+        ret = tls_creds_conf(conn->creds, &conn->ssl_conf);
         if (ret != 0) {
             return handle_error(ret);
         }
+        /* a pinned broker key is checked after the handshake instead of the chain */
+        tls_pin_conf(conn->pin, conn->creds, &conn->ssl_conf);
+    }
+
+    /* keep the broker's records within the input buffer */
+    ret = tls_mem_conf(&conn->ssl_conf);
+    if (ret != 0) {
+        return handle_error(ret);
     }
 
     ret = mbedtls_ssl_setup(&conn->ssl_ctx, &conn->ssl_conf);
@@ -120,30 +138,60 @@ int ssl_connect(SSLConnection* conn, const char* host, int port) {
         return handle_error(ret);
     }
 
+#ifdef MBEDTLS_X509_CRT_PARSE_C
     ret = mbedtls_ssl_set_hostname(&conn->ssl_ctx, host);
     if (ret != 0) {
         return handle_error(ret);
     }
+#endif
+
+    /* a resumed handshake skips the certificate exchange and the public key operations */
+    if (conn->session) {
+        tls_session_offer(conn->session, host, &conn->ssl_ctx);
+    }
 
-    mbedtls_ssl_set_bio(&conn->ssl_ctx, &conn->net_ctx, mbedtls_net_send, NULL,
-            mbedtls_net_recv_timeout);
+    mbedtls_ssl_set_bio(&conn->ssl_ctx, &conn->net_ctx, mbedtls_net_send,
+            mbedtls_net_recv, NULL);
 
+    /* each flight from the server is waited for in select(); any other error ends the attempt and
+       mqtt_task retries the connection */
+    start = now_ms();
     while ((ret = mbedtls_ssl_handshake(&conn->ssl_ctx)) != 0) {
-        if (ret != MBEDTLS_ERR_SSL_WANT_READ
-                && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
-            if (ret == MBEDTLS_ERR_X509_CERT_VERIFY_FAILED) {
-                return handle_error(ret);
-            }
+        if (is_want(ret) && ssl_wait(conn, ret,
+                SSL_HANDSHAKE_TIMEOUT_MS - (int) (now_ms() - start))) {
+            continue;
         }
-        handle_error(ret);
-
-        vTaskDelay(5000 / portTICK_PERIOD_MS);
+        /* do not offer a session the server may be choking on again */
+        if (conn->session) {
+            tls_session_clear(conn->session);
+        }
+        if (is_want(ret)) {
+            printf("Handshake timed out\n");
+            return MBEDTLS_ERR_SSL_TIMEOUT;
+        }
+        return handle_error(ret);
     }
 
     mbedtls_ssl_get_record_expansion(&conn->ssl_ctx);
-    ret = mbedtls_ssl_get_verify_result(&conn->ssl_ctx);
-    if (ret != 0) {
-        return handle_error(ret);
+    /* nothing is sent before the broker is trusted, and only a trusted session is saved */
+    if (conn->creds) {
+        ret = tls_pin_check(conn->pin, conn->creds, &conn->ssl_ctx, host, &flags);
+        if (ret < 0) {
+            if (conn->session) {
+                tls_session_clear(conn->session);
+            }
+            if (flags) {
+                printf("Server certificate rejected: flags 0x%x\n", (unsigned) flags);
+            }
+            return handle_error(ret);
+        }
+        conn->pin_state = ret;
+        ret = 0;
+    }
+
+    if (conn->session) {
+        conn->session_state = tls_session_update(conn->session, host,
+                &conn->ssl_ctx);
     }
 
     return ret;
@@ -153,22 +201,54 @@ int ssl_destroy(SSLConnection* conn) {
     mbedtls_net_free(&conn->net_ctx);
     mbedtls_ssl_free(&conn->ssl_ctx);
     mbedtls_ssl_config_free(&conn->ssl_conf);
-    mbedtls_ctr_drbg_free(&conn->drbg_ctx);
-    mbedtls_entropy_free(&conn->entropy_ctx);
-    mbedtls_x509_crt_free(&conn->ca_cert);
-    mbedtls_x509_crt_free(&conn->client_cert);
-    mbedtls_pk_free(&conn->client_key);
 
     return 0;
 }
 
+/*
+ * Read up to len bytes, waiting at most timeout_ms for them. Returns the bytes read, MBEDTLS_ERR_SSL_TIMEOUT
+ * if there were none, or an mbedTLS error (0 when the server closed the connection).
+ */
 int ssl_read(SSLConnection* n, unsigned char* buffer, int len, int timeout_ms) {
-    // NB: timeout_ms is ignored, so blocking read will timeout after SSL_READ_TIMEOUT_MS
-    return mbedtls_ssl_read(&n->ssl_ctx, buffer, len);
+    uint32_t start = now_ms();
+    int got = 0;
+    int ret;
+
+    while (got < len) {
+        ret = mbedtls_ssl_read(&n->ssl_ctx, buffer + got, len - got);
+        if (ret > 0) {
+            got += ret;
+        } else if (!is_want(ret)) {
+            return got ? got : ret;
+        } else if (!ssl_wait(n, ret, timeout_ms - (int) (now_ms() - start))) {
+            break;
+        }
+    }
+
+    return got ? got : MBEDTLS_ERR_SSL_TIMEOUT;
 }
 
+/*
+ * Write len bytes, waiting at most timeout_ms for the socket to take them. Returns the bytes written, or an
+ * mbedTLS error if none were.
+ */
 int ssl_write(SSLConnection* n, unsigned char* buffer, int len,
         int timeout_ms) {
-    // NB: timeout_ms is ignored, so write is always block write
-    return mbedtls_ssl_write(&n->ssl_ctx, buffer, len);
+    uint32_t start = now_ms();
+    int sent = 0;
+    int ret;
+
+    while (sent < len) {
+        ret = mbedtls_ssl_write(&n->ssl_ctx, buffer + sent, len - sent);
+        if (ret > 0) {
+            sent += ret;
+        } else if (!is_want(ret)) {
+            return sent ? sent : ret;
+        } else if (!ssl_wait(n, ret, timeout_ms - (int) (now_ms() - start))) {
+            /* mbedTLS holds the unsent record; the connection cannot continue without it */
+            return sent ? sent : MBEDTLS_ERR_SSL_TIMEOUT;
+        }
+    }
+
+    return sent;
 }
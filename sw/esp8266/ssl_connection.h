@@ -7,30 +7,36 @@
 #include "mbedtls/net.h"
 #include "mbedtls/debug.h"
 #include "mbedtls/ssl.h"
-#include "mbedtls/entropy.h"
-#include "mbedtls/ctr_drbg.h"
 #include "mbedtls/error.h"
 #include "mbedtls/certs.h"
 
+#include "tls_creds.h"
+#include "tls_mem.h"
+#include "tls_pin.h"
+#include "tls_rng.h"
+#include "tls_session.h"
+
 typedef struct SSLConnection {
     mbedtls_net_context net_ctx;
     mbedtls_ssl_context ssl_ctx;
     mbedtls_ssl_config ssl_conf;
 
-    mbedtls_ctr_drbg_context drbg_ctx;
-    mbedtls_entropy_context entropy_ctx;
+    /* parsed once at boot and shared by every connection */
+    tls_creds_t *creds;
 
-    mbedtls_x509_crt ca_cert;
-    mbedtls_x509_crt client_cert;
-    mbedtls_pk_context client_key;
+    /* broker key checked instead of its chain, and refreshed when the chain is verified; NULL verifies the
+       chain on every full handshake */
+    tls_pin_t *pin;
+    int pin_state; /* TLS_PIN_* result of the last handshake */
 
-    char *ca_cert_str;
-    char *client_cert_str;
-    char *client_key_str;
+    /* offered on connect and refreshed after the handshake; NULL disables resumption */
+    tls_session_t *session;
+    int session_state; /* TLS_SESSION_* result of the last handshake */
 } SSLConnection;
 
 extern void ssl_init(SSLConnection* n);
-extern int ssl_connect(SSLConnection* n, const char* host, int port);
+extern int ssl_connect(SSLConnection* n, const char* host, const char* addr,
+        int port);
 extern int ssl_destroy(SSLConnection* n);
 extern int ssl_read(SSLConnection* n, unsigned char* buffer, int len,
         int timeout_ms);
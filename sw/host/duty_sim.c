@@ -0,0 +1,337 @@
+/*
+ * Duty cycle policy simulator: runs the node's wake/sample/upload scheduler (../common/dutycycle.c) on a
+ * simulated clock and reports reading latency against average current for each policy, next to a node that
+ * stays connected.
+ *
+ * The energy model is a handful of phases at a constant current each. The defaults are ESP32 estimates;
+ * measure the node's own phases and pass them in before trusting the battery life column.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "dutycycle.h"
+#include "reading.h"
+
+#define POLICY_MAX 16
+#define BATCH_BUF_LEN 512 // As the node's telemetry
+
+typedef struct energy_t {
+    double sleep_ua;   // Deep sleep
+    double wake_ms;    // Boot from deep sleep, sample and go back to sleep
+    double wake_ma;
+    double connect_ms; // Wi-Fi association, DHCP, TLS resumption and MQTT CONNECT
+    double radio_ma;
+    double publish_ms; // Per batch frame, up to its PUBACK
+    double fail_ms;    // Spent on an upload that fails before giving up
+    double always_ma;  // Average while staying connected, with modem sleep
+    double battery_mah;
+} energy_t;
+
+typedef struct sim_t {
+    const energy_t *energy;
+    duty_state_t state;
+    uint32_t *log;     // Sample times of readings moved to the offline log
+    size_t log_len, log_size;
+    uint64_t now_ms;
+    double charge;     // mA ms
+    long uploads, failures, spills, frames, readings;
+    double latency_sum, latency_max;
+} sim_t;
+
+static int per_wake = 2;
+static int batch_count = 10;
+static double fail_rate;
+
+static void sim_run(sim_t *sim, double ms, double ma)
+{
+    sim->now_ms += ms;
+    sim->charge += ms * ma;
+}
+
+static void sim_delivered(sim_t *sim, uint32_t sampled_ms)
+{
+    double latency = (uint32_t)sim->now_ms - sampled_ms;
+
+    sim->latency_sum += latency;
+    if (latency > sim->latency_max)
+        sim->latency_max = latency;
+    sim->readings++;
+}
+
+static void frame_add(batch_t *batch, const uint8_t *data, size_t len, long *frames)
+{
+    if (batch_add(batch, data, len, 0) != 0) {
+        (*frames)++;
+        batch_reset(batch);
+        batch_add(batch, data, len, 0);
+    }
+    if (batch_ready(batch, 0)) {
+        (*frames)++;
+        batch_reset(batch);
+    }
+}
+
+/**
+ * \return Number of batch frames the readings are published in, as the node's telemetry packs them: the
+ * offline log drains first in full frames, then the buffer goes out in frames of batch_count
+ */
+static long frame_count(const sim_t *sim)
+{
+    uint8_t buf[BATCH_BUF_LEN], record[READING_CBOR_MAX];
+    reading_t reading = { .sensor = READING_SENSOR_TEMPERATURE, .unit = READING_UNIT_CELSIUS, .value = 21.5 };
+    const uint8_t *data;
+    size_t pos = 0;
+    uint8_t len;
+    batch_t batch;
+    long frames = 0;
+
+    batch_init(&batch, buf, sizeof(buf), 0xff, UINT32_MAX);
+    for (size_t i = 0; i < sim->log_len; i++) {
+        reading.ts = sim->log[i];
+        frame_add(&batch, record, reading_encode(&reading, record, sizeof(record)), &frames);
+    }
+    frames += batch.count > 0;
+
+    batch_init(&batch, buf, sizeof(buf), batch_count, UINT32_MAX);
+    while ((data = duty_next(&sim->state, &pos, &len)) != NULL)
+        frame_add(&batch, data, len, &frames);
+
+    return frames + (batch.count > 0);
+}
+
+static void sim_upload(sim_t *sim, const duty_policy_t *policy)
+{
+    const uint8_t *data;
+    size_t pos = 0;
+    uint8_t len;
+    reading_t reading;
+    int version;
+    long frames;
+
+    duty_upload_begin(&sim->state, policy, sim->now_ms / 1000);
+    sim->uploads++;
+    if (rand() < fail_rate * RAND_MAX) {
+        sim_run(sim, sim->energy->fail_ms, sim->energy->radio_ma);
+        sim->failures++;
+        return;
+    }
+
+    frames = frame_count(sim);
+    sim_run(sim, sim->energy->connect_ms + frames * sim->energy->publish_ms, sim->energy->radio_ma);
+    sim->frames += frames;
+
+    while ((data = duty_next(&sim->state, &pos, &len)) != NULL) {
+        if (reading_decode(&reading, &version, data, len) == 0)
+            sim_delivered(sim, reading.ts);
+    }
+    for (size_t i = 0; i < sim->log_len; i++)
+        sim_delivered(sim, sim->log[i]);
+    sim->log_len = 0;
+    duty_upload_done(&sim->state);
+}
+
+/**
+ * Move the buffer to the offline log, as the node does when it fills up while uploads are failing
+ */
+static void sim_spill(sim_t *sim)
+{
+    const uint8_t *data;
+    size_t pos = 0;
+    uint8_t len;
+    reading_t reading;
+    int version;
+
+    while ((data = duty_next(&sim->state, &pos, &len)) != NULL) {
+        if (sim->log_len == sim->log_size) {
+            sim->log_size = sim->log_size ? sim->log_size * 2 : 256;
+            sim->log = realloc(sim->log, sim->log_size * sizeof(*sim->log));
+            if (!sim->log)
+                abort();
+        }
+        if (reading_decode(&reading, &version, data, len) == 0)
+            sim->log[sim->log_len++] = reading.ts;
+    }
+    duty_clear(&sim->state);
+    sim->spills++;
+}
+
+static void sim_sample(sim_t *sim, const duty_policy_t *policy)
+{
+    uint32_t now_s = sim->now_ms / 1000;
+    uint8_t buf[READING_CBOR_MAX];
+
+    for (int i = 0; i < per_wake; i++) {
+        reading_t reading = {
+            .ts = sim->now_ms,
+            .sensor = READING_SENSOR_TEMPERATURE + i % 3,
+            .unit = READING_UNIT_CELSIUS + i % 3,
+            .value = 20 + rand() % 1000 / 100.0,
+        };
+        size_t len = reading_encode(&reading, buf, sizeof(buf));
+
+        if (duty_add(&sim->state, buf, len, now_s) != 0) {
+            sim_spill(sim);
+            duty_add(&sim->state, buf, len, now_s);
+        }
+    }
+    duty_sampled(&sim->state, policy, now_s);
+}
+
+static void report(const char *name, const sim_t *sim, double days)
+{
+    double ua = sim->charge / sim->now_ms * 1000;
+
+    printf("%-14s %9.1f %8ld %8ld %10.0f %10.0f %10.1f %9.0f\n", name, sim->uploads / days, sim->failures,
+           sim->spills, sim->readings ? sim->latency_sum / sim->readings / 1000 : 0, sim->latency_max / 1000, ua,
+           sim->energy->battery_mah * 1000 / ua / 24);
+}
+
+static void simulate(const energy_t *energy, const duty_policy_t *policy, double days)
+{
+    uint64_t end_ms = days * 24 * 3600 * 1000;
+    sim_t sim;
+    char name[32];
+
+    memset(&sim, 0, sizeof(sim));
+    sim.energy = energy;
+    duty_init(&sim.state);
+
+    while (sim.now_ms < end_ms) {
+        uint32_t now_s = sim.now_ms / 1000;
+        uint32_t sleep_s;
+
+        sim_run(&sim, energy->wake_ms, energy->wake_ma);
+        if (duty_sample_due(&sim.state, policy, now_s))
+            sim_sample(&sim, policy);
+        if (duty_upload_due(&sim.state, policy, now_s))
+            sim_upload(&sim, policy);
+
+        sleep_s = duty_sleep_s(&sim.state, policy, sim.now_ms / 1000);
+        // Wake on the second, as the node's RTC timer would
+        sim_run(&sim, sleep_s * 1000 - sim.now_ms % 1000, energy->sleep_ua / 1000);
+    }
+
+    snprintf(name, sizeof(name), "%u/%us", policy->upload_count, policy->max_latency_s);
+    report(name, &sim, days);
+    free(sim.log);
+}
+
+/**
+ * The node without duty cycling: connected throughout, publishing a frame per batch_count readings
+ */
+static void simulate_always_on(const energy_t *energy, uint32_t sample_s, double days)
+{
+    uint64_t end_ms = days * 24 * 3600 * 1000;
+    uint32_t pending[256];
+    int count = 0;
+    sim_t sim;
+
+    memset(&sim, 0, sizeof(sim));
+    sim.energy = energy;
+
+    while (sim.now_ms < end_ms) {
+        for (int i = 0; i < per_wake && count < (int)(sizeof(pending) / sizeof(pending[0])); i++)
+            pending[count++] = sim.now_ms;
+        if (count >= batch_count) {
+            for (int i = 0; i < count; i++)
+                sim_delivered(&sim, pending[i]);
+            sim.uploads++;
+            count = 0;
+        }
+        sim_run(&sim, sample_s * 1000, energy->always_ma);
+    }
+
+    report("always on", &sim, days);
+}
+
+/**
+ * Parse a comma separated list of numbers
+ * \return Number parsed
+ */
+static int parse_list(const char *arg, uint32_t *values, int max)
+{
+    int n = 0;
+
+    while (n < max && *arg) {
+        char *end;
+
+        values[n++] = strtoul(arg, &end, 10);
+        if (*end != ',')
+            break;
+        arg = end + 1;
+    }
+    return n;
+}
+
+int main(int argc, char *argv[])
+{
+    energy_t energy = {
+        .sleep_ua = 10,
+        .wake_ms = 60,
+        .wake_ma = 40,
+        .connect_ms = 2500,
+        .radio_ma = 120,
+        .publish_ms = 80,
+        .fail_ms = 15000,
+        .always_ma = 30,
+        .battery_mah = 2000,
+    };
+    uint32_t counts[POLICY_MAX] = { 2, 10, 40, 0 }, latencies[POLICY_MAX] = { 600, 3600, 21600 };
+    int count_n = 4, latency_n = 3;
+    uint32_t sample_s = 60, retry_s = 300;
+    double days = 30;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "i:r:u:l:d:f:b:R:S:W:C:P:A:B:s:h")) != -1) {
+        switch (opt) {
+        case 'i': sample_s = atoi(optarg); break;
+        case 'r': per_wake = atoi(optarg); break;
+        case 'u': count_n = parse_list(optarg, counts, POLICY_MAX); break;
+        case 'l': latency_n = parse_list(optarg, latencies, POLICY_MAX); break;
+        case 'd': days = atof(optarg); break;
+        case 'f': fail_rate = atof(optarg); break;
+        case 'b': batch_count = atoi(optarg); break;
+        case 'R': retry_s = atoi(optarg); break;
+        case 'S': energy.sleep_ua = atof(optarg); break;
+        case 'W': energy.wake_ms = atof(optarg); break;
+        case 'C': energy.connect_ms = atof(optarg); break;
+        case 'P': energy.publish_ms = atof(optarg); break;
+        case 'A': energy.always_ma = atof(optarg); break;
+        case 'B': energy.battery_mah = atof(optarg); break;
+        case 's': srand(atoi(optarg)); break;
+        default:
+            fprintf(stderr, "Usage: %s [-i sample_s] [-r readings_per_wake] [-u counts,...] [-l latencies_s,...]\n"
+                    "  [-d days] [-f failure_rate] [-b batch_count] [-R retry_s] [-s seed]\n"
+                    "  [-S sleep_ua] [-W wake_ms] [-C connect_ms] [-P publish_ms] [-A always_on_ma] [-B battery_mah]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (sample_s == 0 || per_wake < 1 || batch_count < 1 || batch_count > 255 || days <= 0) {
+        fprintf(stderr, "Invalid settings\n");
+        return 1;
+    }
+
+    printf("Sampling %d readings every %u s for %.0f days, %.0f%% of uploads failing\n", per_wake, sample_s, days,
+           fail_rate * 100);
+    printf("%-14s %9s %8s %8s %10s %10s %10s %9s\n", "count/latency", "uploads/d", "failed", "spills",
+           "mean lat s", "max lat s", "avg uA", "life d");
+
+    simulate_always_on(&energy, sample_s, days);
+    for (int c = 0; c < count_n; c++) {
+        for (int l = 0; l < latency_n; l++) {
+            duty_policy_t policy = {
+                .sample_s = sample_s,
+                .upload_count = counts[c],
+                .max_latency_s = latencies[l],
+                .retry_s = retry_s,
+            };
+            simulate(&energy, &policy, days);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,389 @@
+/*
+ * Sampling pipeline checks and benchmark: the filter stages (../common/filter.c) against reference
+ * implementations, the SPSC ring (../common/spsc.c) between two threads, and then the uplink traffic each
+ * filter chain leaves of a day of fast sampling, against how far what the broker last received strays from
+ * the true signal.
+ *
+ * The signal is a slow daily swing with a few steps, plus Gaussian sampling noise.
+ */
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "filter.h"
+#include "spsc.h"
+
+#define LIST_MAX 8
+#define CHECK_READINGS 10000
+#define RING_LEN 256
+#define RING_ITEMS 1000000u
+
+static double now_s(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double gaussian(void)
+{
+    double u = (rand() + 1.0) / (RAND_MAX + 2.0), v = (rand() + 1.0) / (RAND_MAX + 2.0);
+
+    return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+/**
+ * Noise free signal at t_ms: a daily swing around 21 with a step up and back down
+ */
+static double signal_at(uint64_t t_ms)
+{
+    double day = t_ms / 86400000.0;
+    double value = 21 + 2 * sin(2 * M_PI * day);
+
+    if (fmod(day, 1) > 0.4 && fmod(day, 1) < 0.45)
+        value += 3;
+    return value;
+}
+
+static int close_enough(double a, double b)
+{
+    return fabs(a - b) <= 1e-4 * (1 + fabs(b));
+}
+
+static int check_average(uint16_t n)
+{
+    filter_chain_t chain;
+    float in[CHECK_READINGS];
+
+    filter_chain_init(&chain);
+    filter_add_average(&chain, n);
+    for (int i = 0; i < CHECK_READINGS; i++) {
+        reading_t reading = { .ts = i, .value = in[i] = rand() % 10000 / 100.0 };
+        double sum = 0;
+        int from = i + 1 >= n ? i + 1 - n : 0;
+
+        for (int j = from; j <= i; j++)
+            sum += in[j];
+        if (filter_run(&chain, &reading) != 1 || !close_enough(reading.value, sum / (i + 1 - from))) {
+            printf("  average %u: reading %d is %f, expected %f\n", n, i, reading.value, sum / (i + 1 - from));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int check_window(uint16_t n, filter_stat_t stat)
+{
+    filter_chain_t chain;
+    double acc = 0;
+
+    filter_chain_init(&chain);
+    filter_add_window(&chain, n, stat);
+    for (int i = 0; i < CHECK_READINGS; i++) {
+        reading_t reading = { .ts = i, .value = rand() % 10000 / 100.0 };
+        int pass;
+
+        if (i % n == 0)
+            acc = reading.value;
+        else if (stat == FILTER_STAT_MIN)
+            acc = fmin(acc, reading.value);
+        else if (stat == FILTER_STAT_MAX)
+            acc = fmax(acc, reading.value);
+        else
+            acc += reading.value;
+
+        pass = filter_run(&chain, &reading);
+        if (pass != ((i + 1) % n == 0)) {
+            printf("  window %u/%d: reading %d %s\n", n, stat, i, pass ? "passed" : "held back");
+            return -1;
+        }
+        if (pass && !close_enough(reading.value, stat == FILTER_STAT_MEAN ? acc / n : acc)) {
+            printf("  window %u/%d: reading %d is %f\n", n, stat, i, reading.value);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * The delta stage passes exactly the readings that moved deadband from the last one passed or are due a
+ * heartbeat
+ */
+static int check_delta(float deadband, uint32_t heartbeat_ms)
+{
+    filter_chain_t chain;
+    float last = 0;
+    uint32_t last_ts = 0;
+
+    filter_chain_init(&chain);
+    filter_add_delta(&chain, deadband, heartbeat_ms);
+    for (int i = 0; i < CHECK_READINGS; i++) {
+        reading_t reading = { .ts = i * 100, .value = 20 + (rand() % 200 - 100) / 100.0 };
+        int due = i == 0 || fabsf(reading.value - last) >= deadband
+                  || (heartbeat_ms && reading.ts - last_ts >= heartbeat_ms);
+        float value = reading.value;
+
+        if (filter_run(&chain, &reading) != due || reading.value != value) {
+            printf("  delta %g/%u: reading %d %s\n", deadband, heartbeat_ms, i, due ? "held back" : "passed");
+            return -1;
+        }
+        if (due) {
+            last = value;
+            last_ts = reading.ts;
+        }
+    }
+    return 0;
+}
+
+static int check_filters(void)
+{
+    static const uint16_t lengths[] = { 1, 2, 7, FILTER_WINDOW_MAX };
+    filter_chain_t chain;
+    int failed = 0;
+
+    printf("Filter checks\n");
+    for (unsigned i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+        failed |= check_average(lengths[i]);
+        for (int stat = FILTER_STAT_MEAN; stat <= FILTER_STAT_MAX; stat++)
+            failed |= check_window(lengths[i] * 3, stat);
+    }
+    failed |= check_delta(0, 0);
+    failed |= check_delta(0.25, 0);
+    failed |= check_delta(0.5, 5000);
+
+    filter_chain_init(&chain);
+    if (filter_add_average(&chain, 0) == 0 || filter_add_average(&chain, FILTER_WINDOW_MAX + 1) == 0
+            || filter_add_window(&chain, 0, FILTER_STAT_MEAN) == 0 || filter_add_delta(&chain, -1, 0) == 0) {
+        printf("  invalid stage accepted\n");
+        failed = -1;
+    }
+    for (int i = 0; i < FILTER_STAGES_MAX; i++)
+        filter_add_average(&chain, 1);
+    if (filter_add_average(&chain, 1) == 0) {
+        printf("  stage beyond FILTER_STAGES_MAX accepted\n");
+        failed = -1;
+    }
+
+    printf("  %s\n", failed ? "FAILED" : "passed");
+    return failed;
+}
+
+typedef struct ring_test_t {
+    spsc_t ring;
+    uint32_t buf[RING_LEN];
+    uint32_t count;
+    uint32_t full;
+} ring_test_t;
+
+static void *ring_producer(void *arg)
+{
+    ring_test_t *test = arg;
+
+    for (uint32_t i = 0; i < test->count; i++) {
+        // Yield while waiting, so the test also finishes on a single CPU
+        while (spsc_push(&test->ring, &i) != 0) {
+            test->full++;
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Push sequence numbers from one thread and pop them on another, which must see every one in order
+ */
+static int check_ring(void)
+{
+    static ring_test_t test;
+    pthread_t producer;
+    uint32_t expected = 0, value;
+    double t;
+
+    printf("SPSC ring: %u elements through %d slots between two threads\n", RING_ITEMS, RING_LEN);
+    if (spsc_init(&test.ring, test.buf, sizeof(test.buf[0]), RING_LEN - 1) == 0) {
+        printf("  accepted a count that is not a power of two\n");
+        return -1;
+    }
+    spsc_init(&test.ring, test.buf, sizeof(test.buf[0]), RING_LEN);
+    test.count = RING_ITEMS;
+
+    t = now_s();
+    pthread_create(&producer, NULL, ring_producer, &test);
+    while (expected < RING_ITEMS) {
+        if (spsc_pop(&test.ring, &value) != 0) {
+            sched_yield();
+            continue;
+        }
+        if (value != expected) {
+            printf("  popped %u, expected %u\n", value, expected);
+            exit(1);
+        }
+        expected++;
+    }
+    pthread_join(producer, NULL);
+    t = now_s() - t;
+
+    printf("  in order, %.1f M elements/s, producer found it full %u times\n", RING_ITEMS / t / 1e6, test.full);
+    return 0;
+}
+
+typedef struct run_t {
+    long published;
+    double err_max, err_sq; // What the broker last received against the true signal, at every sample
+    double ns;              // Per reading through the chain
+} run_t;
+
+/**
+ * Run the same sampled signal through a chain, timing the chain alone
+ * \param out Scratch, samples readings
+ */
+static void run_chain(filter_chain_t *chain, const reading_t *samples, const float *truth, long count,
+                      reading_t *out, run_t *run)
+{
+    double last = 0, t;
+
+    memset(run, 0, sizeof(*run));
+    memcpy(out, samples, count * sizeof(*out));
+    t = now_s();
+    for (long i = 0; i < count; i++) {
+        if (!filter_run(chain, &out[i]))
+            out[i].sensor = READING_SENSOR_MAX; // Held back
+    }
+    run->ns = (now_s() - t) / count * 1e9;
+
+    for (long i = 0; i < count; i++) {
+        double err;
+
+        if (out[i].sensor != READING_SENSOR_MAX) {
+            last = out[i].value;
+            run->published++;
+        }
+        err = run->published ? fabs(last - truth[i]) : 0;
+        run->err_sq += err * err;
+        if (err > run->err_max)
+            run->err_max = err;
+    }
+}
+
+static void report(const char *name, const run_t *run, long samples)
+{
+    printf("%-24s %10ld %8.2f%% %8.1fx %9.3f %9.3f %8.0f\n", name, run->published, 100.0 * run->published / samples,
+           run->published ? (double)samples / run->published : 0, run->err_max, sqrt(run->err_sq / samples),
+           run->ns);
+}
+
+/**
+ * Parse a comma separated list of numbers
+ * \return Number parsed
+ */
+static int parse_list(const char *arg, double *values, int max)
+{
+    int n = 0;
+
+    while (n < max && *arg) {
+        char *end;
+
+        values[n++] = strtod(arg, &end);
+        if (*end != ',')
+            break;
+        arg = end + 1;
+    }
+    return n;
+}
+
+int main(int argc, char *argv[])
+{
+    double deadbands[LIST_MAX] = { 0.05, 0.1, 0.25, 0.5 };
+    int deadband_n = 4;
+    long samples = 86400;
+    uint32_t interval_ms = 1000, heartbeat_s = 900;
+    int average_n = 8, window_n = 60;
+    double noise = 0.05;
+    reading_t *readings, *out;
+    float *truth;
+    filter_chain_t chain;
+    run_t run;
+    char name[32];
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:i:N:d:a:w:H:s:h")) != -1) {
+        switch (opt) {
+        case 'n': samples = atol(optarg); break;
+        case 'i': interval_ms = atoi(optarg); break;
+        case 'N': noise = atof(optarg); break;
+        case 'd': deadband_n = parse_list(optarg, deadbands, LIST_MAX); break;
+        case 'a': average_n = atoi(optarg); break;
+        case 'w': window_n = atoi(optarg); break;
+        case 'H': heartbeat_s = atoi(optarg); break;
+        case 's': srand(atoi(optarg)); break;
+        default:
+            fprintf(stderr, "Usage: %s [-n samples] [-i interval_ms] [-N noise] [-d deadbands,...] [-a average_n]\n"
+                    "  [-w window_n] [-H heartbeat_s] [-s seed]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (samples < 1 || interval_ms == 0 || average_n < 1 || average_n > FILTER_WINDOW_MAX || window_n < 1) {
+        fprintf(stderr, "Invalid settings\n");
+        return 1;
+    }
+
+    if (check_filters() != 0 || check_ring() != 0)
+        return 1;
+
+    readings = malloc(samples * sizeof(*readings));
+    out = malloc(samples * sizeof(*out));
+    truth = malloc(samples * sizeof(*truth));
+    if (!readings || !out || !truth)
+        abort();
+    for (long i = 0; i < samples; i++) {
+        uint64_t t_ms = (uint64_t)i * interval_ms;
+
+        truth[i] = signal_at(t_ms);
+        readings[i] = (reading_t){
+            .ts = t_ms,
+            .sensor = READING_SENSOR_TEMPERATURE,
+            .unit = READING_UNIT_CELSIUS,
+            .value = truth[i] + noise * gaussian(),
+        };
+    }
+
+    printf("\n%ld samples every %u ms, noise %.3f, heartbeat %u s\n", samples, interval_ms, noise, heartbeat_s);
+    printf("%-24s %10s %9s %9s %9s %9s %8s\n", "chain", "published", "share", "cut", "max err", "rms err",
+           "ns/read");
+
+    filter_chain_init(&chain);
+    run_chain(&chain, readings, truth, samples, out, &run);
+    report("raw", &run, samples);
+
+    filter_chain_init(&chain);
+    filter_add_window(&chain, window_n, FILTER_STAT_MEAN);
+    run_chain(&chain, readings, truth, samples, out, &run);
+    snprintf(name, sizeof(name), "mean/%d", window_n);
+    report(name, &run, samples);
+
+    for (int i = 0; i < deadband_n; i++) {
+        filter_chain_init(&chain);
+        filter_add_delta(&chain, deadbands[i], heartbeat_s * 1000);
+        run_chain(&chain, readings, truth, samples, out, &run);
+        snprintf(name, sizeof(name), "delta %g", deadbands[i]);
+        report(name, &run, samples);
+
+        filter_chain_init(&chain);
+        filter_add_average(&chain, average_n);
+        filter_add_delta(&chain, deadbands[i], heartbeat_s * 1000);
+        run_chain(&chain, readings, truth, samples, out, &run);
+        snprintf(name, sizeof(name), "avg/%d, delta %g", average_n, deadbands[i]);
+        report(name, &run, samples);
+    }
+
+    free(readings);
+    free(out);
+    free(truth);
+    return 0;
+}
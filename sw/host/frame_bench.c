@@ -0,0 +1,280 @@
+/*
+ * MQTT receive framing (../common/mqtt_frame.c) checks and benchmark: packets of every size, fed in random
+ * pieces with reads that return nothing in between, must come out whole when they fit the node's receive
+ * buffer, and otherwise be discarded without losing step, keeping the packet ID a PUBACK needs. Then the
+ * framing rate over a stream of telemetry-sized packets.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mqtt_frame.h"
+
+#define RX_BUF_LEN 1024 // MQTT_RX_BUF_LEN of the ESP32 client
+#define STREAM_MAX (1 << 20)
+#define PUBLISH 3
+#define PINGRESP 13
+
+typedef struct stream_t {
+    uint8_t *data;
+    size_t len;
+    size_t pos;
+    int max_read;   // Largest piece one read returns
+    int fail_at;    // Position at which reads fail, -1 for never
+    long reads;
+} stream_t;
+
+static double now_s(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * As ssl_read does when data arrives in pieces: fewer bytes than asked for, or none for now
+ */
+static int stream_read(void *ctx, uint8_t *buf, int len)
+{
+    stream_t *stream = ctx;
+    size_t n;
+
+    stream->reads++;
+    if (stream->fail_at >= 0 && stream->pos >= (size_t)stream->fail_at)
+        return -1;
+    if (stream->max_read > 1 && rand() % 4 == 0)
+        return 0;
+    n = stream->max_read > 1 ? (size_t)(rand() % stream->max_read + 1) : (size_t)len;
+    if (n > (size_t)len)
+        n = len;
+    if (n > stream->len - stream->pos)
+        n = stream->len - stream->pos;
+    memcpy(buf, stream->data + stream->pos, n);
+    stream->pos += n;
+    return n;
+}
+
+static size_t put_length(uint8_t *p, uint32_t len)
+{
+    size_t n = 0;
+
+    do {
+        p[n] = len % 128;
+        len /= 128;
+        if (len)
+            p[n] |= 0x80;
+        n++;
+    } while (len);
+    return n;
+}
+
+/**
+ * Serialize a PUBLISH with a payload of payload_len bytes, derived from packet_id
+ * \return Its length
+ */
+static size_t put_publish(uint8_t *p, const char *topic, int qos, uint16_t packet_id, uint32_t payload_len)
+{
+    size_t topic_len = strlen(topic), n = 0;
+    uint32_t rem_len = 2 + topic_len + (qos ? 2 : 0) + payload_len;
+
+    p[n++] = PUBLISH << 4 | qos << 1;
+    n += put_length(p + n, rem_len);
+    p[n++] = topic_len >> 8;
+    p[n++] = topic_len & 0xff;
+    memcpy(p + n, topic, topic_len);
+    n += topic_len;
+    if (qos) {
+        p[n++] = packet_id >> 8;
+        p[n++] = packet_id & 0xff;
+    }
+    for (uint32_t i = 0; i < payload_len; i++)
+        p[n++] = (uint8_t)(packet_id + i);
+    return n;
+}
+
+static size_t put_pingresp(uint8_t *p)
+{
+    p[0] = PINGRESP << 4;
+    p[1] = 0;
+    return 2;
+}
+
+/**
+ * Read one packet, retrying reads that return nothing
+ */
+static int frame_next(mqtt_frame_t *frame, stream_t *stream)
+{
+    int ret;
+
+    while ((ret = mqtt_frame_read(frame, stream_read, stream)) == 0) {
+        if (stream->pos == stream->len)
+            return 0;
+    }
+    return ret;
+}
+
+/**
+ * Frame a PUBLISH of payload_len bytes followed by a PINGRESP, read in pieces of at most max_read bytes
+ */
+static int check_publish(uint32_t payload_len, int qos, int max_read)
+{
+    static uint8_t data[STREAM_MAX];
+    static uint8_t buf[RX_BUF_LEN];
+    uint16_t packet_id = rand() & 0xffff, id;
+    stream_t stream = { data, 0, 0, max_read, -1, 0 };
+    mqtt_frame_t frame;
+    size_t publish_len;
+    int ret, truncated;
+
+    publish_len = put_publish(data, "espnode/control", qos, packet_id, payload_len);
+    stream.len = publish_len + put_pingresp(data + publish_len);
+    mqtt_frame_init(&frame, buf, sizeof(buf));
+
+    if ((ret = frame_next(&frame, &stream)) != PUBLISH) {
+        fprintf(stderr, "%u byte payload: read %d, expected PUBLISH\n", payload_len, ret);
+        return -1;
+    }
+    truncated = publish_len > sizeof(buf);
+    if (frame.total != publish_len || mqtt_frame_truncated(&frame) != truncated
+            || memcmp(buf, data, truncated ? sizeof(buf) : publish_len) != 0) {
+        fprintf(stderr, "%u byte payload: framed %u of %u bytes, %s\n", payload_len, (unsigned)frame.len,
+                (unsigned)frame.total, mqtt_frame_truncated(&frame) ? "truncated" : "whole");
+        return -1;
+    }
+    if (mqtt_frame_publish_qos(&frame, &id) != qos || (qos && id != packet_id)) {
+        fprintf(stderr, "%u byte payload: packet ID %u, expected %u\n", payload_len, id, packet_id);
+        return -1;
+    }
+    // Still in step after the discarded part
+    if ((ret = frame_next(&frame, &stream)) != PINGRESP || mqtt_frame_truncated(&frame)) {
+        fprintf(stderr, "%u byte payload: read %d after it, expected PINGRESP\n", payload_len, ret);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Transport errors and malformed lengths fail; nothing else does
+ */
+static int check_errors(void)
+{
+    static uint8_t data[64];
+    uint8_t buf[RX_BUF_LEN];
+    stream_t stream = { data, 0, 0, 1, -1, 0 };
+    mqtt_frame_t frame;
+    int errors = 0;
+
+    // Remaining length continued past four bytes
+    data[0] = PUBLISH << 4;
+    memset(data + 1, 0xff, 5);
+    stream.len = 6;
+    mqtt_frame_init(&frame, buf, sizeof(buf));
+    errors += frame_next(&frame, &stream) != MQTT_FRAME_ERR;
+
+    // Connection lost part way through a body being discarded
+    stream.len = put_publish(data, "t", 1, 1, 40);
+    stream.pos = 0;
+    stream.fail_at = 30;
+    stream.max_read = 4;
+    mqtt_frame_init(&frame, buf, MQTT_FRAME_MIN + 2);
+    errors += frame_next(&frame, &stream) != MQTT_FRAME_ERR;
+
+    // A topic too long for the buffer hides the packet ID
+    stream.len = put_publish(data, "espnode/a/long/topic", 1, 1, 10);
+    stream.pos = 0;
+    stream.fail_at = -1;
+    mqtt_frame_init(&frame, buf, 16);
+    if (frame_next(&frame, &stream) == PUBLISH) {
+        uint16_t id;
+        errors += mqtt_frame_publish_qos(&frame, &id) != -1;
+    } else {
+        errors++;
+    }
+
+    if (errors)
+        fprintf(stderr, "%d error checks failed\n", errors);
+    return errors ? -1 : 0;
+}
+
+static int run_checks(void)
+{
+    static const uint32_t sizes[] = { 0, 1, 100, 127, 128, 200, 1000, 1003, 1004, 16383, 16384, 200000 };
+    int count = 0;
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        for (int qos = 0; qos <= 1; qos++) {
+            for (int max_read = 1; max_read <= 256; max_read *= 4) {
+                if (check_publish(sizes[i], qos, max_read) != 0)
+                    return -1;
+                count++;
+            }
+        }
+    }
+    for (int i = 0; i < 1000; i++, count++) {
+        if (check_publish(rand() % 4000, rand() % 2, rand() % 300 + 1) != 0)
+            return -1;
+    }
+    if (check_errors() != 0)
+        return -1;
+
+    printf("Framing: %d packets from 0 to %u bytes in random pieces, oversized ones discarded in step\n", count,
+           sizes[sizeof(sizes) / sizeof(sizes[0]) - 1]);
+    return 0;
+}
+
+/**
+ * Frame a stream of PUBLISH packets of payload_len bytes, read whole as far as the caller asks
+ */
+static void run_bench(uint32_t payload_len, int packets)
+{
+    static uint8_t data[STREAM_MAX];
+    static uint8_t buf[RX_BUF_LEN];
+    stream_t stream = { data, 0, 0, 0, -1, 0 };
+    mqtt_frame_t frame;
+    long framed = 0;
+    double t;
+
+    while (stream.len + payload_len + 100 < sizeof(data))
+        stream.len += put_publish(data + stream.len, "espnode/control", 1, framed++, payload_len);
+    framed = 0;
+
+    mqtt_frame_init(&frame, buf, sizeof(buf));
+    t = now_s();
+    for (int i = 0; i < packets; i++) {
+        if (mqtt_frame_read(&frame, stream_read, &stream) == PUBLISH)
+            framed++;
+        if (stream.pos == stream.len)
+            stream.pos = 0;
+    }
+    t = now_s() - t;
+
+    printf("%6u byte payloads: %ld packets, %.0f ns and %.1f reads each%s\n", payload_len, framed,
+           framed ? t * 1e9 / framed : 0, framed ? (double)stream.reads / framed : 0,
+           payload_len + 20 > RX_BUF_LEN ? ", discarded" : "");
+}
+
+int main(int argc, char *argv[])
+{
+    int packets = 1000000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:h")) != -1) {
+        switch (opt) {
+        case 'n': packets = atoi(optarg); break;
+        case 's': srand(atoi(optarg)); break;
+        default:
+            fprintf(stderr, "Usage: %s [-n packets] [-s seed]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (run_checks() != 0)
+        return 1;
+    run_bench(32, packets);
+    run_bench(200, packets);
+    run_bench(4096, packets / 10);
+    return 0;
+}
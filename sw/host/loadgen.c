@@ -0,0 +1,182 @@
+/*
+ * Broker load generator: runs N copies of the ESP32 MQTT client (sw/esp32/main/mqtt.c, built against the
+ * POSIX shim in posix/) in one process and reports connect time, publish rate and PUBACK latency.
+ *
+ *   ./build/loadgen -f loadgen.nvs -n 50 -r 2 -d 60
+ *
+ * The NVS file holds the same mqtt.* and ssl.* parameters the node reads from flash, see README.md.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "nvs.h"
+#include "mqtt.h"
+
+typedef struct node_t {
+    mqtt_client_t client;
+    tls_session_t session; // Each node resumes its own session
+    endpoint_cache_t endpoints; // And scores the brokers on its own
+    int index;
+    uint32_t queued;
+    uint32_t dropped; // Publish slots exhausted
+} node_t;
+
+static int rate_ms = 1000;
+static int resume = 1;
+static int qos = 1;
+static int payload_len = 64;
+static const char *topic = "loadgen";
+static volatile int running = 1;
+
+static void publisher_task(void *param)
+{
+    node_t *node = (node_t *)param;
+    unsigned char *payload = malloc(payload_len);
+    // Spread the nodes out over one interval, as a fleet would be
+    TickType_t next = xTaskGetTickCount() + (uint32_t)node->index * 7919 % rate_ms;
+
+    memset(payload, 'a' + node->index % 26, payload_len);
+    while (running) {
+        TickType_t now = xTaskGetTickCount();
+
+        if ((int32_t)(next - now) > 0) {
+            vTaskDelay(next - now);
+            continue;
+        }
+        next += rate_ms;
+
+        if (!mqtt_is_connected(&node->client))
+            continue;
+        if (mqtt_publish(&node->client, qos, 0, topic, payload, payload_len) == ESP_OK)
+            node->queued++;
+        else
+            node->dropped++;
+    }
+
+    free(payload);
+    vTaskDelete(NULL);
+}
+
+static void report(node_t *nodes, int count, double elapsed_s)
+{
+    mqtt_stats_t total, stats;
+    uint32_t queued = 0, dropped = 0, connected = 0;
+    size_t tls_used, tls_peak;
+
+    memset(&total, 0, sizeof(total));
+    for (int i = 0; i < count; i++) {
+        mqtt_get_stats(&nodes[i].client, &stats);
+        total.connects += stats.connects;
+        total.published += stats.published;
+        total.retransmits += stats.retransmits;
+        total.resumed += stats.resumed;
+        total.full_handshakes += stats.full_handshakes;
+        hist_merge(&total.connect_ms, &stats.connect_ms);
+        hist_merge(&total.ack_ms, &stats.ack_ms);
+        queued += nodes[i].queued;
+        dropped += nodes[i].dropped;
+        connected += mqtt_is_connected(&nodes[i].client) ? 1 : 0;
+    }
+
+    fprintf(stderr, "%d nodes, %u connected, %.0f s\n", count, (unsigned)connected, elapsed_s);
+    fprintf(stderr, "  connects     %u (%u full handshakes, %u resumed)\n", (unsigned)total.connects,
+            (unsigned)total.full_handshakes, (unsigned)total.resumed);
+    fprintf(stderr, "  connect ms   p50 %u  p90 %u  p99 %u  max %u\n",
+            (unsigned)hist_percentile(&total.connect_ms, 50), (unsigned)hist_percentile(&total.connect_ms, 90),
+            (unsigned)hist_percentile(&total.connect_ms, 99), (unsigned)total.connect_ms.max);
+    fprintf(stderr, "  published    %u of %u queued (%.1f/s), %u not queued, %u retransmits\n",
+            (unsigned)total.published, (unsigned)queued, total.published / elapsed_s, (unsigned)dropped,
+            (unsigned)total.retransmits);
+    // One process holds every node's connection
+    tls_mem_stats(&tls_used, &tls_peak);
+    if (tls_used)
+        fprintf(stderr, "  tls heap     %u bytes, %u per connected node\n", (unsigned)tls_used,
+                (unsigned)(connected ? tls_used / connected : 0));
+    if (qos > 0) {
+        fprintf(stderr, "  puback ms    p50 %u  p90 %u  p99 %u  max %u\n",
+                (unsigned)hist_percentile(&total.ack_ms, 50), (unsigned)hist_percentile(&total.ack_ms, 90),
+                (unsigned)hist_percentile(&total.ack_ms, 99), (unsigned)total.ack_ms.max);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const char *nvs_path = "loadgen.nvs";
+    int count = 10;
+    int duration_s = 30;
+    int verbose = 0;
+    node_t *nodes;
+    TickType_t start;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:n:r:s:q:t:d:Rvh")) != -1) {
+        switch (opt) {
+        case 'f': nvs_path = optarg; break;
+        case 'n': count = atoi(optarg); break;
+        case 'r': rate_ms = 1000 / (atof(optarg) > 0 ? atof(optarg) : 1); break;
+        case 's': payload_len = atoi(optarg); break;
+        case 'q': qos = atoi(optarg); break;
+        case 't': topic = optarg; break;
+        case 'd': duration_s = atoi(optarg); break;
+        case 'R': resume = 0; break;
+        case 'v': verbose = 1; break;
+        default:
+            fprintf(stderr, "Usage: %s [-f nvs file] [-n nodes] [-r publishes/s per node] [-s payload bytes] "
+                    "[-q qos] [-t topic] [-d seconds] [-R] [-v]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (count < 1 || payload_len < 1 || qos < 0 || qos > 1 || rate_ms < 1) {
+        fprintf(stderr, "Invalid arguments\n");
+        return 1;
+    }
+    if (nvs_posix_load(nvs_path) != ESP_OK)
+        return 1;
+
+    // The client logs every state change; keep the report readable unless asked
+    if (!verbose && !freopen("/dev/null", "w", stdout))
+        return 1;
+
+    if (!(nodes = calloc(count, sizeof(*nodes))))
+        return 1;
+    tls_mem_init();
+
+    for (int i = 0; i < count; i++) {
+        node_t *node = &nodes[i];
+
+        node->index = i;
+        if (mqtt_init(&node->client) != ESP_OK) {
+            fprintf(stderr, "mqtt_init failed for node %d\n", i);
+            return 1;
+        }
+        // The session mqtt_init restored is shared by the whole process; give each node its own
+        tls_session_clear(&node->session);
+        node->client.session = resume ? &node->session : NULL;
+        node->endpoints = *node->client.endpoints.cache;
+        node->client.endpoints.cache = &node->endpoints;
+        snprintf((char *)node->client.client_id, MQTT_CLIENT_ID_LEN, "loadgen-%d-%d", (int)getpid(), i);
+    }
+
+    start = xTaskGetTickCount();
+    for (int i = 0; i < count; i++) {
+        mqtt_start(&nodes[i].client);
+        xTaskCreate(publisher_task, "publisher", 4096, &nodes[i], tskIDLE_PRIORITY, NULL);
+    }
+
+    for (int s = 1; s <= duration_s; s++) {
+        vTaskDelay(1000);
+        if (s % 10 == 0 && s != duration_s)
+            report(nodes, count, (xTaskGetTickCount() - start) / 1000.0);
+    }
+    running = 0;
+
+    report(nodes, count, (xTaskGetTickCount() - start) / 1000.0);
+
+    // mqtt_stop is not implemented yet; the client tasks end with the process
+    return 0;
+}
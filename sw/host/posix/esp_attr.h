@@ -0,0 +1,7 @@
+#ifndef ESP_ATTR_POSIX_H
+#define ESP_ATTR_POSIX_H
+
+// There is no RTC memory; such variables are ordinary statics
+#define RTC_DATA_ATTR
+
+#endif // ESP_ATTR_POSIX_H
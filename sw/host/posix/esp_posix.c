@@ -0,0 +1,40 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include <unistd.h>
+
+#include "esp_system.h"
+
+uint32_t esp_random(void)
+{
+    uint32_t value;
+
+    if (getrandom(&value, sizeof(value), 0) != sizeof(value))
+        value = random();
+    return value;
+}
+
+esp_err_t esp_efuse_read_mac(uint8_t *mac)
+{
+    char host[64] = "";
+    uint32_t hash = 2166136261u;
+    uint32_t pid = getpid();
+
+    gethostname(host, sizeof(host) - 1);
+    for (char *p = host; *p; p++)
+        hash = (hash ^ (uint8_t)*p) * 16777619u;
+
+    mac[0] = 0x02; // Locally administered
+    mac[1] = hash >> 8;
+    mac[2] = hash;
+    mac[3] = pid >> 16;
+    mac[4] = pid >> 8;
+    mac[5] = pid;
+
+    return ESP_OK;
+}
+
+uint32_t esp_get_free_heap_size(void)
+{
+    return 0;
+}
@@ -0,0 +1,17 @@
+#ifndef ESP_SYSTEM_POSIX_H
+#define ESP_SYSTEM_POSIX_H
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+uint32_t esp_random(void);
+
+/**
+ * Derived from the host name and process id, so concurrent processes get distinct client ids
+ */
+esp_err_t esp_efuse_read_mac(uint8_t *mac);
+
+uint32_t esp_get_free_heap_size(void);
+
+#endif // ESP_SYSTEM_POSIX_H
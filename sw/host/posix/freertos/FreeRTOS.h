@@ -0,0 +1,27 @@
+#ifndef FREERTOS_POSIX_H
+#define FREERTOS_POSIX_H
+
+/*
+ * Just enough of the FreeRTOS API, on top of pthreads, to run the ESP32 MQTT client on Linux.
+ * Ticks are milliseconds.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define configTICK_RATE_HZ 1000
+#define portTICK_PERIOD_MS 1
+#define portMAX_DELAY 0xffffffffUL
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+
+#define tskIDLE_PRIORITY 0
+
+typedef uint32_t TickType_t;
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+
+#endif // FREERTOS_POSIX_H
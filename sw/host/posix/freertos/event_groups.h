@@ -0,0 +1,23 @@
+#ifndef FREERTOS_POSIX_EVENT_GROUPS_H
+#define FREERTOS_POSIX_EVENT_GROUPS_H
+
+#include "FreeRTOS.h"
+
+typedef struct posix_event_group_t *EventGroupHandle_t;
+typedef uint32_t EventBits_t;
+
+EventGroupHandle_t xEventGroupCreate(void);
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits);
+/**
+ * \return The bits before they were cleared
+ */
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits);
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group);
+/**
+ * \return The bits when the wait ended, before any were cleared: check them, as on the target
+ */
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear, BaseType_t all,
+                                TickType_t ticks);
+void vEventGroupDelete(EventGroupHandle_t group);
+
+#endif // FREERTOS_POSIX_EVENT_GROUPS_H
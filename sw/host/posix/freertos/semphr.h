@@ -0,0 +1,18 @@
+#ifndef FREERTOS_POSIX_SEMPHR_H
+#define FREERTOS_POSIX_SEMPHR_H
+
+#include "FreeRTOS.h"
+
+typedef struct posix_sem_t *SemaphoreHandle_t;
+
+/**
+ * Mutexes are binary semaphores here: no priority inheritance and no recursion, as on the target
+ */
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial);
+SemaphoreHandle_t xSemaphoreCreateBinary(void); // Created empty
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem);
+void vSemaphoreDelete(SemaphoreHandle_t sem);
+
+#endif // FREERTOS_POSIX_SEMPHR_H
@@ -0,0 +1,21 @@
+#ifndef FREERTOS_POSIX_TASK_H
+#define FREERTOS_POSIX_TASK_H
+
+#include "FreeRTOS.h"
+
+typedef struct posix_task_t *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+/**
+ * Runs fn on a detached thread; stack depth and priority are ignored
+ */
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *param,
+                       UBaseType_t priority, TaskHandle_t *handle);
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount(void);
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks);
+
+#endif // FREERTOS_POSIX_TASK_H
@@ -0,0 +1,297 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+struct posix_sem_t {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    UBaseType_t count;
+    UBaseType_t max;
+};
+
+struct posix_event_group_t {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    EventBits_t bits;
+};
+
+struct posix_task_t {
+    pthread_t thread;
+    TaskFunction_t fn;
+    void *param;
+    struct posix_sem_t notify;
+};
+
+static __thread struct posix_task_t *current_task;
+
+TickType_t xTaskGetTickCount(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    struct timespec ts = { ticks / 1000, (ticks % 1000) * 1000000L };
+
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+        ;
+}
+
+static void cond_init(pthread_mutex_t *mutex, pthread_cond_t *cond)
+{
+    pthread_condattr_t attr;
+
+    pthread_mutex_init(mutex, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+static void deadline_after(struct timespec *deadline, TickType_t ticks)
+{
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += ticks / 1000;
+    deadline->tv_nsec += (ticks % 1000) * 1000000L;
+    if (deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+static void sem_init(struct posix_sem_t *sem, UBaseType_t max, UBaseType_t initial)
+{
+    cond_init(&sem->mutex, &sem->cond);
+    sem->max = max;
+    sem->count = initial;
+}
+
+/**
+ * Wait until the count is non-zero
+ * \return pdTRUE with sem->mutex held, or pdFALSE on timeout
+ */
+static BaseType_t sem_wait(struct posix_sem_t *sem, TickType_t ticks)
+{
+    struct timespec deadline;
+
+    deadline_after(&deadline, ticks);
+    pthread_mutex_lock(&sem->mutex);
+    while (sem->count == 0) {
+        if (ticks == portMAX_DELAY) {
+            pthread_cond_wait(&sem->cond, &sem->mutex);
+        } else if (pthread_cond_timedwait(&sem->cond, &sem->mutex, &deadline) == ETIMEDOUT) {
+            pthread_mutex_unlock(&sem->mutex);
+            return pdFALSE;
+        }
+    }
+
+    return pdTRUE;
+}
+
+static BaseType_t sem_give(struct posix_sem_t *sem)
+{
+    BaseType_t ret = pdFALSE;
+
+    pthread_mutex_lock(&sem->mutex);
+    if (sem->count < sem->max) {
+        sem->count++;
+        ret = pdTRUE;
+        pthread_cond_signal(&sem->cond);
+    }
+    pthread_mutex_unlock(&sem->mutex);
+
+    return ret;
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial)
+{
+    struct posix_sem_t *sem = malloc(sizeof(*sem));
+
+    if (sem)
+        sem_init(sem, max, initial);
+    return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return xSemaphoreCreateCounting(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return xSemaphoreCreateCounting(1, 1);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks)
+{
+    if (sem_wait(sem, ticks) != pdTRUE)
+        return pdFALSE;
+
+    sem->count--;
+    pthread_mutex_unlock(&sem->mutex);
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+    return sem_give(sem);
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem)
+{
+    pthread_cond_destroy(&sem->cond);
+    pthread_mutex_destroy(&sem->mutex);
+    free(sem);
+}
+
+EventGroupHandle_t xEventGroupCreate(void)
+{
+    struct posix_event_group_t *group = malloc(sizeof(*group));
+
+    if (group) {
+        cond_init(&group->mutex, &group->cond);
+        group->bits = 0;
+    }
+    return group;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    EventBits_t now;
+
+    pthread_mutex_lock(&group->mutex);
+    now = group->bits |= bits;
+    pthread_cond_broadcast(&group->cond);
+    pthread_mutex_unlock(&group->mutex);
+
+    return now;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    EventBits_t before;
+
+    pthread_mutex_lock(&group->mutex);
+    before = group->bits;
+    group->bits &= ~bits;
+    pthread_mutex_unlock(&group->mutex);
+
+    return before;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group)
+{
+    EventBits_t bits;
+
+    pthread_mutex_lock(&group->mutex);
+    bits = group->bits;
+    pthread_mutex_unlock(&group->mutex);
+
+    return bits;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear, BaseType_t all,
+                                TickType_t ticks)
+{
+    struct timespec deadline;
+    EventBits_t now;
+
+    deadline_after(&deadline, ticks);
+    pthread_mutex_lock(&group->mutex);
+    for (;;) {
+        now = group->bits;
+        if (all ? (now & bits) == bits : (now & bits) != 0) {
+            if (clear)
+                group->bits &= ~bits;
+            break;
+        }
+        if (ticks == portMAX_DELAY)
+            pthread_cond_wait(&group->cond, &group->mutex);
+        else if (ticks == 0 || pthread_cond_timedwait(&group->cond, &group->mutex, &deadline) == ETIMEDOUT)
+            break;
+    }
+    pthread_mutex_unlock(&group->mutex);
+
+    return now;
+}
+
+void vEventGroupDelete(EventGroupHandle_t group)
+{
+    pthread_cond_destroy(&group->cond);
+    pthread_mutex_destroy(&group->mutex);
+    free(group);
+}
+
+static void *task_entry(void *arg)
+{
+    struct posix_task_t *task = arg;
+
+    current_task = task;
+    task->fn(task->param);
+    return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *param,
+                       UBaseType_t priority, TaskHandle_t *handle)
+{
+    struct posix_task_t *task = calloc(1, sizeof(*task));
+
+    (void)name, (void)stack_depth, (void)priority;
+    if (!task)
+        return pdFAIL;
+
+    task->fn = fn;
+    task->param = param;
+    sem_init(&task->notify, UINT32_MAX, 0);
+    // Published before the thread runs, so the new task can already be notified
+    if (handle)
+        *handle = task;
+
+    if (pthread_create(&task->thread, NULL, task_entry, task) != 0) {
+        if (handle)
+            *handle = NULL;
+        free(task);
+        return pdFAIL;
+    }
+    pthread_detach(task->thread);
+
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    if (task == NULL || task == current_task)
+        pthread_exit(NULL);
+    // Deleting another task is not supported: threads cannot be stopped safely from outside
+    abort();
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    sem_give(&task->notify);
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks)
+{
+    struct posix_sem_t *notify = &current_task->notify;
+    uint32_t value;
+
+    if (sem_wait(notify, ticks) != pdTRUE)
+        return 0;
+
+    value = notify->count;
+    notify->count = clear ? 0 : value - 1;
+    pthread_mutex_unlock(&notify->mutex);
+
+    return value;
+}
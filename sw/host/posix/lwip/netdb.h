@@ -0,0 +1,7 @@
+#ifndef LWIP_NETDB_POSIX_H
+#define LWIP_NETDB_POSIX_H
+
+#include <netdb.h>
+#include <netinet/in.h>
+
+#endif // LWIP_NETDB_POSIX_H
@@ -0,0 +1,8 @@
+#ifndef LWIP_SOCKETS_POSIX_H
+#define LWIP_SOCKETS_POSIX_H
+
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#endif // LWIP_SOCKETS_POSIX_H
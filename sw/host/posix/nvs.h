@@ -0,0 +1,36 @@
+#ifndef NVS_POSIX_H
+#define NVS_POSIX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/*
+ * NVS backed by a text file of key=value lines, one namespace per file. A value of @path is replaced by the
+ * contents of that file (relative to the NVS file), which is how PEM certificates and keys are given.
+ * The file is load-only: writes are kept in memory, and nvs_commit succeeds without persisting them.
+ */
+typedef uint32_t nvs_handle;
+
+typedef enum {
+    NVS_READONLY,
+    NVS_READWRITE,
+} nvs_open_mode;
+
+/**
+ * Load the file that backs every namespace. Must be called before nvs_open.
+ */
+esp_err_t nvs_posix_load(const char *path);
+
+esp_err_t nvs_open(const char *name, nvs_open_mode open_mode, nvs_handle *out_handle);
+void nvs_close(nvs_handle handle);
+esp_err_t nvs_commit(nvs_handle handle);
+
+esp_err_t nvs_get_str(nvs_handle handle, const char *key, char *out_value, size_t *length);
+esp_err_t nvs_get_blob(nvs_handle handle, const char *key, void *out_value, size_t *length);
+esp_err_t nvs_set_str(nvs_handle handle, const char *key, const char *value);
+esp_err_t nvs_set_blob(nvs_handle handle, const char *key, const void *value, size_t length);
+esp_err_t nvs_erase_key(nvs_handle handle, const char *key);
+
+#endif // NVS_POSIX_H
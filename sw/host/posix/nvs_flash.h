@@ -0,0 +1,11 @@
+#ifndef NVS_FLASH_POSIX_H
+#define NVS_FLASH_POSIX_H
+
+#include "nvs.h"
+
+static inline esp_err_t nvs_flash_init(void)
+{
+    return ESP_OK;
+}
+
+#endif // NVS_FLASH_POSIX_H
@@ -0,0 +1,211 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nvs.h"
+
+typedef struct nvs_entry_t {
+    struct nvs_entry_t *next;
+    char *key;
+    uint8_t *value;
+    size_t len; // For strings, including the terminator
+} nvs_entry_t;
+
+static nvs_entry_t *entries;
+static pthread_mutex_t nvs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static nvs_entry_t *nvs_find(const char *key)
+{
+    for (nvs_entry_t *e = entries; e; e = e->next) {
+        if (!strcmp(e->key, key))
+            return e;
+    }
+    return NULL;
+}
+
+static esp_err_t nvs_store(const char *key, const void *value, size_t len)
+{
+    nvs_entry_t *e = nvs_find(key);
+    uint8_t *copy = malloc(len ? len : 1);
+
+    if (!copy)
+        return ESP_ERR_NO_MEM;
+    memcpy(copy, value, len);
+
+    if (!e) {
+        if (!(e = calloc(1, sizeof(*e))) || !(e->key = strdup(key))) {
+            free(e);
+            free(copy);
+            return ESP_ERR_NO_MEM;
+        }
+        e->next = entries;
+        entries = e;
+    }
+    free(e->value);
+    e->value = copy;
+    e->len = len;
+
+    return ESP_OK;
+}
+
+/**
+ * \return Contents of path, resolved relative to the directory of base, null terminated
+ */
+static char *read_file(const char *base, const char *path, size_t *len)
+{
+    char full[512];
+    const char *slash = strrchr(base, '/');
+    char *buf = NULL;
+    long size;
+    FILE *f;
+
+    if (path[0] != '/' && slash)
+        snprintf(full, sizeof(full), "%.*s/%s", (int)(slash - base), base, path);
+    else
+        snprintf(full, sizeof(full), "%s", path);
+
+    if (!(f = fopen(full, "rb"))) {
+        perror(full);
+        return NULL;
+    }
+    if (fseek(f, 0, SEEK_END) == 0 && (size = ftell(f)) >= 0 && fseek(f, 0, SEEK_SET) == 0
+            && (buf = malloc(size + 1)) && fread(buf, 1, size, f) == (size_t)size) {
+        buf[size] = '\0';
+        *len = size + 1;
+    } else {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(f);
+
+    return buf;
+}
+
+esp_err_t nvs_posix_load(const char *path)
+{
+    char line[1024];
+    esp_err_t err = ESP_OK;
+    FILE *f;
+
+    if (!(f = fopen(path, "r"))) {
+        perror(path);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    pthread_mutex_lock(&nvs_lock);
+    while (err == ESP_OK && fgets(line, sizeof(line), f)) {
+        char *eq, *value;
+        size_t len;
+
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '#' || !(eq = strchr(line, '=')))
+            continue;
+        *eq = '\0';
+        value = eq + 1;
+
+        if (value[0] == '@') {
+            char *contents = read_file(path, value + 1, &len);
+            if (!contents) {
+                err = ESP_ERR_NOT_FOUND;
+                break;
+            }
+            err = nvs_store(line, contents, len);
+            free(contents);
+        } else {
+            err = nvs_store(line, value, strlen(value) + 1);
+        }
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    fclose(f);
+
+    return err;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode open_mode, nvs_handle *out_handle)
+{
+    (void)name, (void)open_mode;
+    *out_handle = 1;
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle handle)
+{
+    (void)handle;
+}
+
+/**
+ * Nothing to do: the file is load-only, so that the nodes of loadgen sharing it never rewrite a config whose
+ * values may come from @path files, and a run starts from the same credentials every time
+ */
+esp_err_t nvs_commit(nvs_handle handle)
+{
+    (void)handle;
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle handle, const char *key, void *out_value, size_t *length)
+{
+    esp_err_t err = ESP_OK;
+    nvs_entry_t *e;
+
+    (void)handle;
+    pthread_mutex_lock(&nvs_lock);
+    if (!(e = nvs_find(key))) {
+        err = ESP_ERR_NVS_NOT_FOUND;
+    } else if (!out_value) {
+        *length = e->len;
+    } else if (*length < e->len) {
+        err = ESP_ERR_NVS_INVALID_LENGTH;
+    } else {
+        memcpy(out_value, e->value, e->len);
+        *length = e->len;
+    }
+    pthread_mutex_unlock(&nvs_lock);
+
+    return err;
+}
+
+esp_err_t nvs_get_str(nvs_handle handle, const char *key, char *out_value, size_t *length)
+{
+    return nvs_get_blob(handle, key, out_value, length);
+}
+
+esp_err_t nvs_set_blob(nvs_handle handle, const char *key, const void *value, size_t length)
+{
+    esp_err_t err;
+
+    (void)handle;
+    pthread_mutex_lock(&nvs_lock);
+    err = nvs_store(key, value, length);
+    pthread_mutex_unlock(&nvs_lock);
+
+    return err;
+}
+
+esp_err_t nvs_set_str(nvs_handle handle, const char *key, const char *value)
+{
+    return nvs_set_blob(handle, key, value, strlen(value) + 1);
+}
+
+esp_err_t nvs_erase_key(nvs_handle handle, const char *key)
+{
+    esp_err_t err = ESP_ERR_NVS_NOT_FOUND;
+
+    (void)handle;
+    pthread_mutex_lock(&nvs_lock);
+    for (nvs_entry_t **p = &entries; *p; p = &(*p)->next) {
+        nvs_entry_t *e = *p;
+        if (!strcmp(e->key, key)) {
+            *p = e->next;
+            free(e->key);
+            free(e->value);
+            free(e);
+            err = ESP_OK;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&nvs_lock);
+
+    return err;
+}
@@ -0,0 +1,135 @@
+/*
+ * Decode telemetry batch frames (as published by the nodes) into one line per reading.
+ *
+ *   mosquitto_sub -t espnode/status -C 1 | ./build/reading_dump
+ *   ./build/reading_dump -g 10 | ./build/reading_dump
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "reading.h"
+
+#define FRAME_MAX 65536
+
+/**
+ * Write a frame of synthetic readings, along with how large the old text payloads would have been
+ */
+static int generate(int count)
+{
+    uint8_t buf[FRAME_MAX];
+    uint8_t record[READING_CBOR_MAX];
+    char text[64];
+    size_t text_len = 0, cbor_len = 0;
+    batch_t batch;
+    size_t len;
+
+    batch_init(&batch, buf, sizeof(buf), 0xff, 0);
+    for (int i = 0; i < count && i < 0xff; i++) {
+        reading_t reading = { .ts = 10000 * i, .sensor = READING_SENSOR_TEMPERATURE,
+                              .unit = READING_UNIT_CELSIUS, .value = 21.5f + i * 0.25f };
+
+        if (i % 2) {
+            reading.sensor = READING_SENSOR_HEAP_FREE;
+            reading.unit = READING_UNIT_BYTES;
+            reading.value = 41000 - i * 8;
+        }
+        len = reading_encode(&reading, record, sizeof(record));
+        if (len == 0 || batch_add(&batch, record, len, 0) != 0)
+            return 1;
+        cbor_len += len;
+        text_len += snprintf(text, sizeof(text), "%u: %s %.2f %s", (unsigned)reading.ts,
+                             reading_sensor_name(reading.sensor), reading.value, reading_unit_name(reading.unit));
+    }
+
+    len = batch_finish(&batch);
+    fprintf(stderr, "%d readings: %u bytes as CBOR, %u as text\n", count, (unsigned)cbor_len, (unsigned)text_len);
+    return fwrite(buf, 1, len, stdout) == len ? 0 : 1;
+}
+
+/**
+ * \return Bytes consumed, or 0 on a malformed frame
+ */
+static size_t dump_frame(const uint8_t *buf, size_t len)
+{
+    size_t pos = BATCH_HEADER_LEN;
+    uint32_t seq;
+    int count;
+
+    if (len < BATCH_HEADER_LEN || buf[0] != BATCH_VERSION) {
+        fprintf(stderr, "Not a version %d batch frame\n", BATCH_VERSION);
+        return 0;
+    }
+    seq = (uint32_t)buf[1] << 24 | buf[2] << 16 | buf[3] << 8 | buf[4];
+    count = buf[5];
+    printf("batch %u: %d readings\n", (unsigned)seq, count);
+
+    for (int i = 0; i < count; i++) {
+        reading_t reading;
+        int version;
+        uint8_t rlen;
+
+        if (pos >= len || pos + 1 + buf[pos] > len) {
+            fprintf(stderr, "Truncated frame\n");
+            return 0;
+        }
+        rlen = buf[pos++];
+        if (reading_decode(&reading, &version, buf + pos, rlen) != 0) {
+            printf("  [%d] malformed record (%u bytes)\n", i, rlen);
+        } else {
+            printf("  [%d] v%d ts=%u %s=%g %s\n", i, version, (unsigned)reading.ts,
+                   reading_sensor_name(reading.sensor), reading.value, reading_unit_name(reading.unit));
+        }
+        pos += rlen;
+    }
+
+    return pos;
+}
+
+static int dump(FILE *f)
+{
+    static uint8_t buf[FRAME_MAX];
+    size_t len = fread(buf, 1, sizeof(buf), f);
+    size_t pos = 0, used;
+
+    while (pos < len) {
+        if ((used = dump_frame(buf + pos, len - pos)) == 0)
+            return 1;
+        pos += used;
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int ret = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "g:h")) != -1) {
+        switch (opt) {
+        case 'g': return generate(atoi(optarg));
+        default:
+            fprintf(stderr, "Usage: %s [-g readings] [frame file...]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (optind == argc)
+        return dump(stdin);
+
+    for (int i = optind; i < argc; i++) {
+        FILE *f = fopen(argv[i], "rb");
+
+        if (!f) {
+            perror(argv[i]);
+            return 1;
+        }
+        ret |= dump(f);
+        fclose(f);
+    }
+
+    return ret;
+}
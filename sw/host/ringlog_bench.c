@@ -0,0 +1,216 @@
+/*
+ * Append/drain throughput and crash recovery check for the ring log, using a file in place of the flash
+ * partition.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ringlog.h"
+#include "ringlog_file.h"
+
+static double now_s(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void make_record(uint8_t *buf, int len, uint32_t index)
+{
+    memset(buf, index & 0x7f, len); // Never 0xff, or a torn write could leave a valid record
+    memcpy(buf, &index, sizeof(index));
+}
+
+/**
+ * Drain everything, checking records come out in order without gaps
+ * \return Number of records drained, -1 on a sequence error
+ */
+static long drain(ringlog_t *log, int batch, uint32_t *first, uint32_t *last)
+{
+    uint8_t buf[RINGLOG_RECORD_MAX];
+    ringlog_cursor_t cursor;
+    long total = 0;
+    int len;
+
+    for (;;) {
+        int n;
+
+        ringlog_rewind(log, &cursor);
+        for (n = 0; n < batch; n++) {
+            uint32_t index;
+
+            if ((len = ringlog_read(log, &cursor, buf, sizeof(buf))) < 0)
+                break;
+            memcpy(&index, buf, sizeof(index));
+            if (total == 0 && n == 0) {
+                *first = index;
+            } else if (index != *last + 1) {
+                printf("  sequence error: %u after %u\n", index, *last);
+                return -1;
+            }
+            *last = index;
+        }
+        if (n == 0)
+            break;
+        if (ringlog_consume(log, &cursor) != RINGLOG_OK)
+            return -1;
+        total += n;
+    }
+
+    return total;
+}
+
+static int bench(const char *path, uint32_t size, int record_len, long count, int batch)
+{
+    ringlog_file_t file;
+    ringlog_t log;
+    uint8_t buf[RINGLOG_RECORD_MAX];
+    uint32_t first = 0, last = 0;
+    double t;
+    long drained;
+
+    if (ringlog_file_open(&file, path, size) != 0 || ringlog_format(&log, &file.flash) != RINGLOG_OK) {
+        perror(path);
+        return 1;
+    }
+    file.erases = 0;
+
+    printf("Throughput: %u KiB log, %d byte records, batches of %d\n", size / 1024, record_len, batch);
+
+    t = now_s();
+    for (long i = 0; i < count; i++) {
+        make_record(buf, record_len, i);
+        if (ringlog_append(&log, buf, record_len) != RINGLOG_OK) {
+            printf("  append failed at %ld\n", i);
+            return 1;
+        }
+    }
+    t = now_s() - t;
+    printf("  append:  %ld records in %.3f s (%.0f records/s), %u erases, %u dropped\n",
+           count, t, count / t, file.erases, log.dropped);
+
+    t = now_s();
+    if (ringlog_mount(&log, &file.flash) != RINGLOG_OK) {
+        printf("  mount failed\n");
+        return 1;
+    }
+    t = now_s() - t;
+    printf("  mount:   %.3f ms, %u pending\n", t * 1000, ringlog_pending(&log));
+
+    t = now_s();
+    drained = drain(&log, batch, &first, &last);
+    t = now_s() - t;
+    if (drained < 0 || last != count - 1)
+        return 1;
+    printf("  drain:   %ld records (%u..%u) in %.3f s (%.0f records/s)\n",
+           drained, first, last, t, drained / t);
+
+    ringlog_file_close(&file);
+    return 0;
+}
+
+/**
+ * Consume a prefix of the log, then cut power at a random byte of the appends that follow, tearing a record
+ * mid-write. Check that the remounted log starts after the consumed records (unless the ring wrapped) and
+ * ends with the last append that completed.
+ */
+static int crash(const char *path, uint32_t size, int record_len, int rounds)
+{
+    ringlog_file_t file;
+    ringlog_t log;
+    uint8_t buf[RINGLOG_RECORD_MAX];
+    int failures = 0;
+
+    printf("Crash recovery: %d rounds\n", rounds);
+
+    for (int round = 0; round < rounds; round++) {
+        ringlog_cursor_t cursor;
+        uint32_t acked = 0, consumed = 0, dropped, first = 0, last = 0;
+        long drained;
+
+        unlink(path);
+        if (ringlog_file_open(&file, path, size) != 0 || ringlog_format(&log, &file.flash) != RINGLOG_OK) {
+            perror(path);
+            return 1;
+        }
+
+        // Fill part of the log and consume a prefix, then lose power somewhere in further appends
+        for (uint32_t i = 0; i < 200; i++, acked++) {
+            make_record(buf, record_len, i);
+            ringlog_append(&log, buf, record_len);
+        }
+        ringlog_rewind(&log, &cursor);
+        for (consumed = 0; consumed < 50; consumed++)
+            ringlog_read(&log, &cursor, buf, sizeof(buf));
+        ringlog_consume(&log, &cursor);
+
+        file.fail_after = rand() % (size / 2);
+        for (;; acked++) {
+            make_record(buf, record_len, acked);
+            if (ringlog_append(&log, buf, record_len) != RINGLOG_OK)
+                break;
+        }
+
+        // Power cycle
+        dropped = log.dropped;
+        file.fail_after = -1;
+        if (ringlog_mount(&log, &file.flash) != RINGLOG_OK) {
+            printf("  round %d: mount failed\n", round);
+            failures++;
+            continue;
+        }
+
+        drained = drain(&log, 16, &first, &last);
+        if (drained < 0 || (drained > 0 && last != acked - 1) || (dropped == 0 && first != consumed)) {
+            printf("  round %d: recovered %ld records (%u..%u), expected up to %u\n",
+                   round, drained, first, last, acked - 1);
+            failures++;
+        }
+        ringlog_file_close(&file);
+    }
+
+    printf("  %d/%d rounds recovered every acknowledged record\n", rounds - failures, rounds);
+    return failures != 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *path = "ringlog.bin";
+    uint32_t size = 1024 * 1024;
+    int record_len = 16;
+    long count = 100000;
+    int batch = 32;
+    int rounds = 100;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:s:r:n:b:c:h")) != -1) {
+        switch (opt) {
+        case 'f': path = optarg; break;
+        case 's': size = atoi(optarg) * 1024; break;
+        case 'r': record_len = atoi(optarg); break;
+        case 'n': count = atol(optarg); break;
+        case 'b': batch = atoi(optarg); break;
+        case 'c': rounds = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-f file] [-s size KiB] [-r record bytes] [-n records] [-b batch] [-c crash rounds]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (record_len < (int)sizeof(uint32_t) || record_len > RINGLOG_RECORD_MAX) {
+        fprintf(stderr, "Record length must be between %u and %d\n", (unsigned)sizeof(uint32_t), RINGLOG_RECORD_MAX);
+        return 1;
+    }
+
+    if (bench(path, size, record_len, count, batch) != 0)
+        return 1;
+    if (crash(path, 64 * 1024, record_len, rounds) != 0)
+        return 1;
+
+    unlink(path);
+    return 0;
+}
@@ -0,0 +1,103 @@
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ringlog_file.h"
+
+static int file_read(void *ctx, uint32_t addr, void *buf, size_t len)
+{
+    ringlog_file_t *file = ctx;
+
+    return pread(file->fd, buf, len, addr) == (ssize_t)len ? 0 : -1;
+}
+
+static int file_write(void *ctx, uint32_t addr, const void *buf, size_t len)
+{
+    ringlog_file_t *file = ctx;
+    const uint8_t *src = buf;
+    uint8_t cell[256];
+    size_t allowed = len;
+    size_t done = 0;
+
+    if (file->fail_after >= 0 && (long)len > file->fail_after)
+        allowed = file->fail_after;
+
+    // Programming can only clear bits
+    while (done < allowed) {
+        size_t n = allowed - done < sizeof(cell) ? allowed - done : sizeof(cell);
+        if (pread(file->fd, cell, n, addr + done) != (ssize_t)n)
+            return -1;
+        for (size_t i = 0; i < n; i++)
+            cell[i] &= src[done + i];
+        if (pwrite(file->fd, cell, n, addr + done) != (ssize_t)n)
+            return -1;
+        done += n;
+    }
+
+    file->bytes_written += done;
+    if (file->fail_after >= 0) {
+        file->fail_after -= done;
+        if (done < len)
+            return -1;
+    }
+
+    return 0;
+}
+
+static int file_erase(void *ctx, uint32_t addr)
+{
+    ringlog_file_t *file = ctx;
+    uint8_t sector[RINGLOG_SECTOR_SIZE];
+
+    if (file->fail_after == 0)
+        return -1;
+
+    memset(sector, 0xff, sizeof(sector));
+    if (pwrite(file->fd, sector, sizeof(sector), addr) != sizeof(sector))
+        return -1;
+    file->erases++;
+
+    return 0;
+}
+
+int ringlog_file_open(ringlog_file_t *file, const char *path, uint32_t size)
+{
+    struct stat st;
+
+    memset(file, 0, sizeof(*file));
+    file->fail_after = -1;
+    file->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (file->fd < 0)
+        return -1;
+
+    if (fstat(file->fd, &st) != 0)
+        goto err;
+    if (st.st_size != (off_t)size) {
+        // Fresh "chip": every byte erased
+        if (ftruncate(file->fd, 0) != 0)
+            goto err;
+        for (uint32_t addr = 0; addr < size; addr += RINGLOG_SECTOR_SIZE) {
+            if (file_erase(file, addr) != 0)
+                goto err;
+        }
+        file->erases = 0;
+    }
+
+    file->flash.read = file_read;
+    file->flash.write = file_write;
+    file->flash.erase = file_erase;
+    file->flash.ctx = file;
+    file->flash.size = size;
+
+    return 0;
+
+err:
+    close(file->fd);
+    return -1;
+}
+
+void ringlog_file_close(ringlog_file_t *file)
+{
+    close(file->fd);
+}
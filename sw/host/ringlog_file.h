@@ -0,0 +1,23 @@
+#ifndef RINGLOG_FILE_H
+#define RINGLOG_FILE_H
+
+#include "ringlog.h"
+
+/**
+ * File standing in for a flash partition, with NOR write semantics
+ */
+typedef struct ringlog_file_t {
+    int fd;
+    long fail_after; // Bytes that may still be written before simulated power loss, -1 for no limit
+    uint64_t bytes_written;
+    uint32_t erases;
+    ringlog_flash_t flash;
+} ringlog_file_t;
+
+/**
+ * Open (creating and erasing if needed) a file of size bytes
+ */
+int ringlog_file_open(ringlog_file_t *file, const char *path, uint32_t size);
+void ringlog_file_close(ringlog_file_t *file);
+
+#endif // RINGLOG_FILE_H
@@ -0,0 +1,287 @@
+/*
+ * Sensor scheduler checks and benchmark: the timer wheel (../common/timer_wheel.c) against a reference, then
+ * the scheduler (../common/sensor.c) over fake drivers (sensor_fake.c), first in real time for sampling
+ * jitter and how many wakes coalescing saves, then on a simulated clock for throughput with many sensors.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sensor.h"
+#include "sensor_fake.h"
+#include "timer_wheel.h"
+
+#define CHECK_TIMERS 256
+#define CHECK_STEPS 100000
+#define CHECK_START (0xffffffffu - (1u << 24)) // Crosses the tick wrap
+
+#define REALTIME_SENSORS 8
+#define SIM_PERIODS 8
+
+typedef struct check_t {
+    tw_wheel_t wheel;
+    tw_timer_t timers[CHECK_TIMERS];
+    uint32_t fire_at[CHECK_TIMERS];
+    int pending[CHECK_TIMERS];
+    long fired;
+    int errors;
+} check_t;
+
+static uint32_t random_u32(void)
+{
+    return (uint32_t)rand() << 16 ^ (uint32_t)rand();
+}
+
+static void check_expired(void *ctx, tw_timer_t *timer)
+{
+    check_t *check = ctx;
+    int i = timer - check->timers;
+
+    if (!check->pending[i] || check->wheel.now != check->fire_at[i]) {
+        if (check->errors++ < 5)
+            fprintf(stderr, "Timer %d fired at %u, due %u%s\n", i, check->wheel.now, check->fire_at[i],
+                    check->pending[i] ? "" : " while not pending");
+    }
+    check->pending[i] = 0;
+    check->fired++;
+}
+
+/**
+ * Delay for a random level of the wheel, or beyond it, or overdue
+ */
+static int32_t check_delay(void)
+{
+    switch (rand() % 5) {
+    case 0: return rand() % 100 - 50;
+    case 1: return rand() % TW_SLOTS;
+    case 2: return random_u32() % (TW_SLOTS * TW_SLOTS);
+    case 3: return random_u32() % (TW_SLOTS * TW_SLOTS * TW_SLOTS);
+    default: return random_u32() % (1u << 22);
+    }
+}
+
+/**
+ * Random adds, re-arms, cancels and advances, checking every expiry tick and the next expiry reported
+ */
+static int check_wheel(void)
+{
+    static check_t check;
+    long advanced = 0;
+
+    memset(&check, 0, sizeof(check));
+    tw_init(&check.wheel, CHECK_START);
+    for (int i = 0; i < CHECK_TIMERS; i++)
+        check.timers[i].ctx = &check;
+
+    for (int step = 0; step < CHECK_STEPS && check.errors == 0; step++) {
+        int i = rand() % CHECK_TIMERS;
+        int op = rand() % 10;
+
+        if (op < 4) {
+            uint32_t now = check.wheel.now;
+            int32_t delay = check_delay();
+
+            tw_add(&check.wheel, &check.timers[i], now + delay);
+            check.fire_at[i] = delay > 0 ? now + delay : now + 1;
+            check.pending[i] = 1;
+        } else if (op < 5) {
+            tw_cancel(&check.wheel, &check.timers[i]);
+            check.pending[i] = 0;
+        } else {
+            uint32_t next = 0, expected = 0, target;
+            int found = 0, next_found = tw_next(&check.wheel, &next) == 0;
+            uint32_t step_ticks = rand() % 1000 == 0 ? random_u32() % (1u << 20) : (uint32_t)rand() % 200 + 1;
+
+            for (int j = 0; j < CHECK_TIMERS; j++) {
+                if (check.pending[j] && (!found || (int32_t)(check.fire_at[j] - expected) < 0)) {
+                    expected = check.fire_at[j];
+                    found = 1;
+                }
+            }
+            if (found != next_found || (found && next != expected)) {
+                fprintf(stderr, "Next expiry %u%s, expected %u%s\n", next, next_found ? "" : " (none)", expected,
+                        found ? "" : " (none)");
+                check.errors++;
+            }
+
+            target = check.wheel.now + step_ticks;
+            tw_advance(&check.wheel, target, check_expired, &check);
+            advanced += step_ticks;
+            for (int j = 0; j < CHECK_TIMERS; j++) {
+                if (check.pending[j] && (int32_t)(check.fire_at[j] - target) <= 0) {
+                    if (check.errors++ < 5)
+                        fprintf(stderr, "Timer %d due %u not fired by %u\n", j, check.fire_at[j], target);
+                }
+            }
+        }
+    }
+
+    if (check.errors) {
+        fprintf(stderr, "Timer wheel check failed\n");
+        return -1;
+    }
+    printf("Timer wheel: %d operations over %ld ticks across the wrap, %ld expiries on time\n", CHECK_STEPS,
+           advanced, check.fired);
+    return 0;
+}
+
+typedef struct emitted_t {
+    long readings;
+} emitted_t;
+
+static void count_reading(void *ctx, const reading_t *reading)
+{
+    emitted_t *emitted = ctx;
+
+    (void)reading;
+    emitted->readings++;
+}
+
+static void sleep_until_us(uint64_t t_us)
+{
+    struct timespec ts = { .tv_sec = t_us / 1000000, .tv_nsec = t_us % 1000000 * 1000 };
+
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+/**
+ * Sample a mix of sensors in real time for duration_s, sleeping between wakes as the scheduler task does
+ */
+static void run_realtime(uint32_t duration_s, uint32_t tick_ms, uint32_t slack_ms, uint32_t cost_us)
+{
+    static const uint32_t periods_ms[REALTIME_SENSORS] = { 100, 250, 500, 1000, 990, 2000, 5000, 10000 };
+    static sensor_fake_t fakes[REALTIME_SENSORS];
+    static sensor_t sensors[REALTIME_SENSORS];
+    static sensor_sched_t sched;
+    static char names[REALTIME_SENSORS][16];
+    uint32_t tick_us = tick_ms * 1000, end = duration_s * 1000 / tick_ms;
+    uint64_t origin;
+    emitted_t emitted = { 0 };
+    long wakes = 0, samples = 0;
+
+    for (int i = 0; i < REALTIME_SENSORS; i++) {
+        snprintf(names[i], sizeof(names[i]), "fake%d", i);
+        fakes[i] = (sensor_fake_t){
+            .sensor = READING_SENSOR_TEMPERATURE,
+            .unit = READING_UNIT_CELSIUS,
+            .readings = 1 + i % 3,
+            .cost_us = cost_us,
+        };
+        sensors[i] = (sensor_t){ .name = names[i], .period_ms = periods_ms[i] };
+        sensor_fake_attach(&sensors[i], &fakes[i]);
+    }
+
+    origin = sensor_fake_now_us();
+    sensor_fake_clock(origin, tick_us);
+    sensor_sched_init(&sched, sensors, REALTIME_SENSORS, tick_ms, slack_ms, 0);
+
+    for (;;) {
+        uint32_t now = (sensor_fake_now_us() - origin) / tick_us, wake;
+
+        if (now >= end)
+            break;
+        wakes++;
+        samples += sensor_sched_run(&sched, now, count_reading, &emitted);
+        if (sensor_sched_next(&sched, &wake) != 0)
+            break;
+        sleep_until_us(origin + (uint64_t)wake * tick_us);
+    }
+
+    printf("\nReal time, %u s, %u ms ticks, slack %u ms, %u us per sample\n", duration_s, tick_ms, slack_ms,
+           cost_us);
+    printf("%-8s %9s %8s %7s %7s %9s %9s %9s\n", "sensor", "period ms", "samples", "missed", "early", "late p50",
+           "late p99", "late max");
+    for (int i = 0; i < REALTIME_SENSORS; i++) {
+        const sensor_fake_t *fake = &fakes[i];
+
+        printf("%-8s %9u %8u %7u %7u %7u us %6u us %6u us\n", sensors[i].name, sensors[i].period_ms,
+               sensors[i].samples, sensors[i].missed, fake->early, (unsigned)hist_percentile(&fake->late_us, 50),
+               (unsigned)hist_percentile(&fake->late_us, 99), (unsigned)fake->late_us.max);
+    }
+    printf("%ld samples, %ld readings in %ld wakes: %.2f samples per wake, %.0f%% fewer wakes than a task per "
+           "sensor\n", samples, emitted.readings, wakes, wakes ? (double)samples / wakes : 0,
+           samples ? 100.0 * (samples - wakes) / samples : 0);
+}
+
+/**
+ * Schedule count sensors of assorted periods on a simulated clock, measuring the scheduler alone
+ */
+static int run_simulated(int count, uint32_t hours, uint32_t tick_ms, uint32_t slack_ms)
+{
+    static const uint32_t periods_ms[SIM_PERIODS] = { 100, 250, 1000, 2000, 5000, 10000, 60000, 3600000 };
+    sensor_fake_t *fakes = calloc(count, sizeof(*fakes));
+    sensor_t *sensors = calloc(count, sizeof(*sensors));
+    static sensor_sched_t sched;
+    uint32_t end = (uint64_t)hours * 3600 * 1000 / tick_ms, now = 0;
+    emitted_t emitted = { 0 };
+    long wakes = 0, samples = 0, expected = 0, missed = 0;
+    double t;
+
+    if (!fakes || !sensors)
+        abort();
+    for (int i = 0; i < count; i++) {
+        fakes[i] = (sensor_fake_t){ .sensor = READING_SENSOR_COUNTER, .unit = READING_UNIT_COUNT, .readings = 1 };
+        sensors[i] = (sensor_t){ .name = "sim", .period_ms = periods_ms[rand() % SIM_PERIODS] };
+        sensor_fake_attach(&sensors[i], &fakes[i]);
+        expected += (uint64_t)end * tick_ms / sensors[i].period_ms;
+    }
+    sensor_fake_clock(0, 0);
+
+    t = sensor_fake_now_us();
+    sensor_sched_init(&sched, sensors, count, tick_ms, slack_ms, 0);
+    while (sensor_sched_next(&sched, &now) == 0 && now <= end) {
+        wakes++;
+        samples += sensor_sched_run(&sched, now, count_reading, &emitted);
+    }
+    t = (sensor_fake_now_us() - t) / 1e6;
+
+    for (int i = 0; i < count; i++)
+        missed += sensors[i].missed;
+    printf("\nSimulated, %d sensors for %u h, %u ms ticks, slack %u ms\n", count, hours, tick_ms, slack_ms);
+    printf("%ld samples in %ld wakes (%.1f per wake), %.0f ns per sample, %.2f M samples/s\n", samples, wakes,
+           wakes ? (double)samples / wakes : 0, samples ? t * 1e9 / samples : 0, t > 0 ? samples / t / 1e6 : 0);
+
+    free(fakes);
+    free(sensors);
+    // On a simulated clock nothing runs late: without slack every grid point is sampled exactly once
+    if (missed || (slack_ms == 0 && samples != expected)) {
+        fprintf(stderr, "Expected %ld samples and none missed, got %ld with %ld missed\n", expected, samples, missed);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t duration_s = 10, tick_ms = 10, slack_ms = 0, cost_us = 200, hours = 1;
+    int count = 1000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:t:S:c:n:H:s:h")) != -1) {
+        switch (opt) {
+        case 'd': duration_s = atoi(optarg); break;
+        case 't': tick_ms = atoi(optarg); break;
+        case 'S': slack_ms = atoi(optarg); break;
+        case 'c': cost_us = atoi(optarg); break;
+        case 'n': count = atoi(optarg); break;
+        case 'H': hours = atoi(optarg); break;
+        case 's': srand(atoi(optarg)); break;
+        default:
+            fprintf(stderr, "Usage: %s [-d duration_s] [-t tick_ms] [-S slack_ms] [-c sample_cost_us]\n"
+                    "  [-n simulated_sensors] [-H simulated_hours] [-s seed]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (tick_ms == 0 || count < 1) {
+        fprintf(stderr, "Invalid settings\n");
+        return 1;
+    }
+
+    if (check_wheel() != 0)
+        return 1;
+    if (duration_s)
+        run_realtime(duration_s, tick_ms, slack_ms, cost_us);
+    return run_simulated(count, hours, tick_ms, slack_ms) != 0;
+}
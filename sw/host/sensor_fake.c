@@ -0,0 +1,87 @@
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+#include "sensor_fake.h"
+
+static uint64_t clock_origin_us;
+static uint32_t clock_tick_us;
+
+uint64_t sensor_fake_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void sensor_fake_clock(uint64_t origin_us, uint32_t tick_us)
+{
+    clock_origin_us = origin_us;
+    clock_tick_us = tick_us;
+}
+
+static int fake_init(sensor_t *sensor)
+{
+    sensor_fake_t *fake = sensor->ctx;
+
+    return fake->fail_init ? -1 : 0;
+}
+
+static int fake_sample(sensor_t *sensor, reading_t *readings, int max)
+{
+    sensor_fake_t *fake = sensor->ctx;
+    uint64_t start = sensor_fake_now_us();
+    int count = fake->readings < max ? fake->readings : max;
+
+    if (clock_tick_us) {
+        int64_t late = (int64_t)(start - clock_origin_us) - (int64_t)sensor->due * clock_tick_us;
+
+        if (late < 0)
+            fake->early++;
+        hist_add(&fake->late_us, late < 0 ? 0 : late);
+    }
+
+    fake->awake = 1;
+    fake->calls++;
+    if (fake->fail_every && fake->calls % fake->fail_every == 0)
+        return -1;
+
+    // Stands in for the bus transaction
+    while (fake->cost_us && sensor_fake_now_us() - start < fake->cost_us)
+        ;
+
+    for (int i = 0; i < count; i++) {
+        readings[i] = (reading_t){
+            .sensor = fake->sensor + i,
+            .unit = fake->unit,
+            .value = 20 + sinf(fake->calls / 100.0f),
+        };
+    }
+    return count;
+}
+
+static void fake_sleep(sensor_t *sensor)
+{
+    sensor_fake_t *fake = sensor->ctx;
+
+    fake->awake = 0;
+    fake->sleeps++;
+}
+
+static const sensor_ops_t fake_ops = {
+    .init = fake_init,
+    .sample = fake_sample,
+    .sleep = fake_sleep,
+};
+
+void sensor_fake_attach(sensor_t *sensor, sensor_fake_t *fake)
+{
+    sensor->ops = &fake_ops;
+    sensor->ctx = fake;
+    fake->calls = 0;
+    fake->sleeps = 0;
+    fake->awake = 0;
+    fake->early = 0;
+    hist_init(&fake->late_us);
+}
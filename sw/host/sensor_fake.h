@@ -0,0 +1,39 @@
+#ifndef SENSOR_FAKE_H
+#define SENSOR_FAKE_H
+
+#include "hist.h"
+#include "sensor.h"
+
+/**
+ * Driver standing in for a sensor on a bus: each sample takes cost_us of busy time and gives readings of a
+ * slowly changing value. Against the real clock it also records how late each sample started.
+ */
+typedef struct sensor_fake_t {
+    uint16_t sensor;     // reading_sensor_t
+    uint8_t unit;        // reading_unit_t
+    uint8_t readings;    // Per sample, at most SENSOR_READINGS_MAX
+    uint32_t cost_us;
+    uint32_t fail_every; // Every nth sample fails, 0 for none
+    int fail_init;
+    // Filled in
+    uint32_t calls;
+    uint32_t sleeps;
+    int awake;
+    hist_t late_us;      // Sample start against its due tick, real clock only
+    uint32_t early;      // Samples started before their due tick
+} sensor_fake_t;
+
+/**
+ * Point sensor at a fake and clear its counters
+ */
+void sensor_fake_attach(sensor_t *sensor, sensor_fake_t *fake);
+
+/**
+ * Measure lateness against the monotonic clock, with tick 0 of the scheduler at origin_us
+ * \param tick_us 0 to not measure, e.g. on a simulated clock
+ */
+void sensor_fake_clock(uint64_t origin_us, uint32_t tick_us);
+
+uint64_t sensor_fake_now_us(void);
+
+#endif // SENSOR_FAKE_H
@@ -0,0 +1,626 @@
+/*
+ * TLS handshake cost per security profile: key type, ciphersuite, chain depth, and how the broker is
+ * authenticated: chain verification, a pinned key or session resumption.
+ *
+ * The node side is set up as ssl_connection.c does it (preset defaults, credentials through tls_creds,
+ * pins through tls_pin, sessions through tls_session) and handshakes with an in-process broker stand-in over
+ * a memory transport, so there is no network noise and every byte on the wire is counted. mbedTLS is compiled
+ * from the SDK with the firmware's configuration, see the Makefile.
+ *
+ *   ./tls_bench_pki.sh build/pki && ./build/tls_bench -p build/pki
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/random.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "tls_creds.h"
+#include "tls_mem.h"
+#include "tls_pin.h"
+#include "tls_rng.h"
+#include "tls_session.h"
+
+#include "mbedtls/entropy.h"
+#include "mbedtls/platform.h"
+#include "mbedtls/ssl_cache.h"
+
+#if !defined(MBEDTLS_SSL_SRV_C)
+#error "tls_bench runs the broker side in process and needs MBEDTLS_SSL_SRV_C"
+#endif
+
+#define HOSTNAME "bench.local"
+#define PIPE_LEN 32768
+#define STEPS_MAX 1000
+
+/*
+ * Heap accounting: calloc and free are wrapped at link time (-Wl,--wrap), and every allocation is charged to
+ * whichever side is running.
+ */
+enum { SIDE_CLIENT, SIDE_SERVER, SIDE_SETUP, SIDE_COUNT };
+
+typedef struct heap_stats_t {
+    size_t current;
+    size_t peak;
+} heap_stats_t;
+
+typedef union alloc_header_t {
+    struct {
+        size_t size;
+        int side;
+    } h;
+    long double align; // Keeps the block as aligned as calloc would
+} alloc_header_t;
+
+static heap_stats_t heap[SIDE_COUNT];
+static int heap_side = SIDE_SETUP;
+
+void *__real_calloc(size_t n, size_t size);
+void __real_free(void *ptr);
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+    alloc_header_t *a;
+
+    if (size && n > (SIZE_MAX - sizeof(*a)) / size)
+        return NULL;
+    if (!(a = __real_calloc(1, sizeof(*a) + n * size)))
+        return NULL;
+    a->h.size = n * size;
+    a->h.side = heap_side;
+    heap[heap_side].current += a->h.size;
+    if (heap[heap_side].current > heap[heap_side].peak)
+        heap[heap_side].peak = heap[heap_side].current;
+
+    return a + 1;
+}
+
+void __wrap_free(void *ptr)
+{
+    alloc_header_t *a;
+
+    if (!ptr)
+        return;
+    a = (alloc_header_t *)ptr - 1;
+    heap[a->h.side].current -= a->h.size;
+    __real_free(a);
+}
+
+static void heap_mark(int side)
+{
+    heap[side].peak = heap[side].current;
+}
+
+#if defined(MBEDTLS_ENTROPY_HARDWARE_ALT)
+// Stands in for the ESP8266 hardware RNG
+int mbedtls_hardware_poll(void *data, unsigned char *output, size_t len, size_t *olen)
+{
+    (void)data;
+    *olen = getrandom(output, len, 0) == (ssize_t)len ? len : 0;
+    return *olen ? 0 : MBEDTLS_ERR_ENTROPY_SOURCE_FAILED;
+}
+#endif
+
+/*
+ * Memory transport: one pipe per direction
+ */
+typedef struct pipe_t {
+    unsigned char buf[PIPE_LEN];
+    size_t head, tail;
+    size_t total; // Bytes ever written
+} pipe_t;
+
+typedef struct endpoint_t {
+    pipe_t *tx, *rx;
+} endpoint_t;
+
+static int pipe_send(void *ctx, const unsigned char *buf, size_t len)
+{
+    pipe_t *p = ((endpoint_t *)ctx)->tx;
+
+    if (len > PIPE_LEN - p->tail) {
+        // Compact; a handshake flight always fits once the reader has caught up
+        memmove(p->buf, p->buf + p->head, p->tail - p->head);
+        p->tail -= p->head;
+        p->head = 0;
+        if (len > PIPE_LEN - p->tail)
+            len = PIPE_LEN - p->tail;
+        if (len == 0)
+            return MBEDTLS_ERR_SSL_WANT_WRITE;
+    }
+    memcpy(p->buf + p->tail, buf, len);
+    p->tail += len;
+    p->total += len;
+
+    return len;
+}
+
+static int pipe_recv(void *ctx, unsigned char *buf, size_t len)
+{
+    pipe_t *p = ((endpoint_t *)ctx)->rx;
+
+    if (p->head == p->tail)
+        return MBEDTLS_ERR_SSL_WANT_READ;
+    if (len > p->tail - p->head)
+        len = p->tail - p->head;
+    memcpy(buf, p->buf + p->head, len);
+    p->head += len;
+
+    return len;
+}
+
+/*
+ * Profiles
+ */
+typedef struct suite_t {
+    const char *name;
+    int id;       // 0: whatever the preset defaults negotiate
+    int ec;       // Needs an ECDSA PKI; -1 for either
+} suite_t;
+
+static const suite_t suites[] = {
+    { "default", 0, -1 },
+    { "ECDHE-RSA-AES128-GCM", MBEDTLS_TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256, 0 },
+    { "DHE-RSA-AES128-GCM", MBEDTLS_TLS_DHE_RSA_WITH_AES_128_GCM_SHA256, 0 },
+    { "RSA-AES128-GCM", MBEDTLS_TLS_RSA_WITH_AES_128_GCM_SHA256, 0 },
+    { "ECDHE-ECDSA-AES128-GCM", MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256, 1 },
+    { "ECDHE-ECDSA-AES128-CBC", MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_CBC_SHA256, 1 },
+};
+#define SUITE_COUNT (int)(sizeof(suites) / sizeof(suites[0]))
+
+static const char *key_types[] = { "rsa4096", "rsa2048", "ec256" };
+#define KEY_TYPE_COUNT (int)(sizeof(key_types) / sizeof(key_types[0]))
+
+// How the node authenticates the broker
+enum { VERIFY_CHAIN, VERIFY_PINNED, VERIFY_RESUMED, VERIFY_COUNT };
+static const char *verify_names[] = { "chain", "pinned", "resumed" };
+
+typedef struct pki_t {
+    tls_creds_t client[2]; // By chain depth - 1
+    tls_creds_t server[2];
+} pki_t;
+
+typedef struct result_t {
+    double client_ms, server_ms;
+    double client_cycles;
+    size_t client_heap;   // Peak during connect, on top of the long-lived credentials
+    size_t client_tx, client_rx;
+    int resumed;
+    const char *suite;
+} result_t;
+
+static int suite_list[2];
+
+/**
+ * \return true if the build offers the suite; MBEDTLS_SSL_CIPHERSUITES can narrow it down to a few
+ */
+static int suite_available(int id)
+{
+    for (const int *list = mbedtls_ssl_list_ciphersuites(); *list; list++) {
+        if (*list == id)
+            return 1;
+    }
+    return 0;
+}
+
+static double cpu_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static uint64_t cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/**
+ * \return NUL terminated contents, length including the terminator in len
+ */
+static unsigned char *read_file(const char *dir, const char *type, const char *name, size_t *len)
+{
+    char path[512];
+    unsigned char *buf = NULL;
+    long size;
+    FILE *f;
+
+    snprintf(path, sizeof(path), "%s/%s/%s", dir, type, name);
+    if (!(f = fopen(path, "rb"))) {
+        perror(path);
+        return NULL;
+    }
+    if (fseek(f, 0, SEEK_END) == 0 && (size = ftell(f)) >= 0 && fseek(f, 0, SEEK_SET) == 0
+            && (buf = calloc(1, size + 1)) && fread(buf, 1, size, f) == (size_t)size) {
+        *len = size + 1;
+    } else {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(f);
+
+    return buf;
+}
+
+static int load_creds(tls_creds_t *creds, const char *dir, const char *type, const char *cert_name,
+                      const char *key_name)
+{
+    unsigned char *ca, *cert = NULL, *key = NULL;
+    size_t ca_len, cert_len, key_len;
+    int ret = -1;
+
+    if ((ca = read_file(dir, type, "root.pem", &ca_len)) && (cert = read_file(dir, type, cert_name, &cert_len))
+            && (key = read_file(dir, type, key_name, &key_len))) {
+        if ((ret = tls_creds_set_ca(creds, ca, ca_len)) == 0)
+            ret = tls_creds_set_cert(creds, cert, cert_len, key, key_len);
+        if (ret != 0)
+            fprintf(stderr, "%s/%s: parse failed: -0x%x\n", type, cert_name, -ret);
+    }
+    free(ca);
+    free(cert);
+    free(key);
+
+    return ret;
+}
+
+static int load_pki(pki_t *pki, const char *dir, const char *type)
+{
+    for (int i = 0; i < 2; i++) {
+        tls_creds_init(&pki->client[i]);
+        tls_creds_init(&pki->server[i]);
+    }
+
+    return load_creds(&pki->client[0], dir, type, "d1-client.pem", "client.key")
+        || load_creds(&pki->client[1], dir, type, "d2-client.pem", "client.key")
+        || load_creds(&pki->server[0], dir, type, "d1-server.pem", "server.key")
+        || load_creds(&pki->server[1], dir, type, "d2-server.pem", "server.key");
+}
+
+static void free_pki(pki_t *pki)
+{
+    for (int i = 0; i < 2; i++) {
+        tls_creds_free(&pki->client[i]);
+        tls_creds_free(&pki->server[i]);
+    }
+}
+
+/**
+ * One connection: set up both sides, handshake, tear down
+ * \return 0 on success
+ */
+/**
+ * Offer a session with a ticket, as the resumed cells cannot: a ticket carrying the broker's certificate does
+ * not fit in tls_session_t. The ticket is copied and freed through mbedTLS's allocator, which tls_mem_init has
+ * replaced on the node, so the copy must come from that allocator too; the count must end where it started.
+ */
+static int check_session_ticket(void)
+{
+#if defined(MBEDTLS_SSL_SESSION_TICKETS) && defined(MBEDTLS_SSL_CLI_C)
+    mbedtls_ssl_config conf;
+    mbedtls_ssl_context ssl;
+    mbedtls_ssl_session saved;
+    tls_session_t session;
+    size_t used, peak, before;
+    int ret = -1;
+
+    tls_mem_stats(&before, &peak);
+    mbedtls_ssl_config_init(&conf);
+    mbedtls_ssl_init(&ssl);
+    mbedtls_ssl_session_init(&saved);
+    tls_session_clear(&session);
+    if (mbedtls_ssl_config_defaults(&conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                    MBEDTLS_SSL_PRESET_DEFAULT) != 0)
+        goto out;
+    tls_rng_conf(&conf);
+    if (mbedtls_ssl_setup(&ssl, &conf) != 0)
+        goto out;
+
+    // As a handshake that was given a ticket leaves it
+    saved.ciphersuite = MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256;
+    saved.id_len = 32;
+    tls_rng_random(NULL, saved.id, saved.id_len);
+    tls_rng_random(NULL, saved.master, sizeof(saved.master));
+    saved.ticket_len = TLS_SESSION_TICKET_MAX;
+    if (!(saved.ticket = mbedtls_calloc(1, saved.ticket_len)))
+        goto out;
+    tls_rng_random(NULL, saved.ticket, saved.ticket_len);
+    saved.ticket_lifetime = 3600;
+    ssl.session = &saved;
+    if (tls_session_update(&session, HOSTNAME, &ssl) != TLS_SESSION_NEW || session.ticket_len != saved.ticket_len)
+        goto out;
+    ssl.session = NULL;
+
+    if (tls_session_offer(&session, HOSTNAME, &ssl) != 0 || ssl.session_negotiate->ticket_len != saved.ticket_len
+            || memcmp(ssl.session_negotiate->ticket, saved.ticket, saved.ticket_len))
+        goto out;
+    ret = 0;
+
+out:
+    ssl.session = NULL;
+    mbedtls_ssl_session_free(&saved);
+    mbedtls_ssl_free(&ssl);
+    mbedtls_ssl_config_free(&conf);
+    tls_mem_stats(&used, &peak);
+    if (ret == 0 && used != before) {
+        fprintf(stderr, "mbedTLS heap %zu bytes after offering a ticket, %zu before\n", used, before);
+        ret = -1;
+    }
+    if (ret != 0)
+        fprintf(stderr, "Session ticket check failed\n");
+    return ret;
+#else
+    return 0;
+#endif
+}
+
+static int connect_once(tls_creds_t *client_creds, tls_creds_t *server_creds, int suite, tls_session_t *session,
+                        tls_pin_t *pin, void *cache, result_t *r)
+{
+    static pipe_t c2s, s2c;
+    endpoint_t client_ep = { &c2s, &s2c }, server_ep = { &s2c, &c2s };
+    mbedtls_ssl_config cconf, sconf;
+    mbedtls_ssl_context cssl, sssl;
+    int cret = MBEDTLS_ERR_SSL_WANT_READ, sret = MBEDTLS_ERR_SSL_WANT_READ;
+    double t;
+    uint64_t c;
+    uint32_t flags;
+    int ret = -1;
+
+    memset(&c2s, 0, sizeof(c2s));
+    memset(&s2c, 0, sizeof(s2c));
+    memset(r, 0, sizeof(*r));
+
+    // Broker stand-in, requiring a client certificate as the broker does
+    heap_side = SIDE_SERVER;
+    mbedtls_ssl_config_init(&sconf);
+    mbedtls_ssl_init(&sssl);
+    if (mbedtls_ssl_config_defaults(&sconf, MBEDTLS_SSL_IS_SERVER, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                    MBEDTLS_SSL_PRESET_DEFAULT) != 0)
+        goto out;
+    tls_rng_conf(&sconf);
+    mbedtls_ssl_conf_authmode(&sconf, MBEDTLS_SSL_VERIFY_REQUIRED);
+    if (tls_creds_conf(server_creds, &sconf) != 0)
+        goto out;
+#if defined(MBEDTLS_SSL_CACHE_C)
+    if (cache)
+        mbedtls_ssl_conf_session_cache(&sconf, cache, mbedtls_ssl_cache_get, mbedtls_ssl_cache_set);
+#else
+    (void)cache;
+#endif
+    if (mbedtls_ssl_setup(&sssl, &sconf) != 0)
+        goto out;
+    mbedtls_ssl_set_bio(&sssl, &server_ep, pipe_send, pipe_recv, NULL);
+
+    // Node, as ssl_connection.c sets it up, but verifying the broker
+    heap_side = SIDE_CLIENT;
+    heap_mark(SIDE_CLIENT);
+    t = cpu_ms();
+    c = cycles();
+    mbedtls_ssl_config_init(&cconf);
+    mbedtls_ssl_init(&cssl);
+    if (mbedtls_ssl_config_defaults(&cconf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                    MBEDTLS_SSL_PRESET_DEFAULT) != 0)
+        goto out;
+    tls_rng_conf(&cconf);
+    if (tls_creds_conf(client_creds, &cconf) != 0 || tls_mem_conf(&cconf) != 0)
+        goto out;
+    tls_pin_conf(pin, client_creds, &cconf);
+    if (suite) {
+        suite_list[0] = suite;
+        mbedtls_ssl_conf_ciphersuites(&cconf, suite_list);
+    }
+    if (mbedtls_ssl_setup(&cssl, &cconf) != 0 || mbedtls_ssl_set_hostname(&cssl, HOSTNAME) != 0)
+        goto out;
+    mbedtls_ssl_set_bio(&cssl, &client_ep, pipe_send, pipe_recv, NULL);
+    if (session)
+        tls_session_offer(session, HOSTNAME, &cssl);
+    r->client_ms += cpu_ms() - t;
+    r->client_cycles += cycles() - c;
+
+    for (int steps = 0; cret != 0 || sret != 0; steps++) {
+        if (steps == STEPS_MAX) {
+            fprintf(stderr, "Handshake stalled\n");
+            goto out;
+        }
+        if (cret != 0) {
+            heap_side = SIDE_CLIENT;
+            t = cpu_ms();
+            c = cycles();
+            cret = mbedtls_ssl_handshake(&cssl);
+            r->client_ms += cpu_ms() - t;
+            r->client_cycles += cycles() - c;
+            if (cret != 0 && cret != MBEDTLS_ERR_SSL_WANT_READ && cret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+                fprintf(stderr, "Client handshake failed: -0x%x\n", -cret);
+                goto out;
+            }
+        }
+        if (sret != 0) {
+            heap_side = SIDE_SERVER;
+            t = cpu_ms();
+            sret = mbedtls_ssl_handshake(&sssl);
+            r->server_ms += cpu_ms() - t;
+            if (sret != 0 && sret != MBEDTLS_ERR_SSL_WANT_READ && sret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+                fprintf(stderr, "Server handshake failed: -0x%x\n", -sret);
+                goto out;
+            }
+        }
+    }
+
+    // The node's own check of the broker, part of its connect time
+    heap_side = SIDE_CLIENT;
+    t = cpu_ms();
+    c = cycles();
+    cret = tls_pin_check(pin, client_creds, &cssl, HOSTNAME, &flags);
+    r->client_ms += cpu_ms() - t;
+    r->client_cycles += cycles() - c;
+    if (cret < 0) {
+        fprintf(stderr, "Broker rejected: -0x%x, flags 0x%x\n", -cret, (unsigned)flags);
+        goto out;
+    }
+
+    if (session)
+        r->resumed = tls_session_update(session, HOSTNAME, &cssl) == TLS_SESSION_RESUMED;
+    r->client_heap = heap[SIDE_CLIENT].peak;
+    r->client_tx = c2s.total;
+    r->client_rx = s2c.total;
+    r->suite = mbedtls_ssl_get_ciphersuite(&cssl);
+    ret = 0;
+
+out:
+    heap_side = SIDE_CLIENT;
+    mbedtls_ssl_free(&cssl);
+    mbedtls_ssl_config_free(&cconf);
+    heap_side = SIDE_SERVER;
+    mbedtls_ssl_free(&sssl);
+    mbedtls_ssl_config_free(&sconf);
+    heap_side = SIDE_SETUP;
+
+    return ret;
+}
+
+/**
+ * Average over runs connections. A pin or session is set up by one connection beforehand, so each run checks
+ * the pin or resumes the session.
+ */
+static int run_cell(pki_t *pki, int depth, int suite, int verify, int runs, result_t *avg)
+{
+    tls_session_t session;
+    tls_pin_t pin;
+    tls_session_t *use_session = verify == VERIFY_RESUMED ? &session : NULL;
+    tls_pin_t *use_pin = verify == VERIFY_PINNED ? &pin : NULL;
+    result_t r;
+    void *cache = NULL;
+    int ret = 0;
+
+#if defined(MBEDTLS_SSL_CACHE_C)
+    static mbedtls_ssl_cache_context cache_ctx;
+
+    mbedtls_ssl_cache_init(&cache_ctx);
+    cache = &cache_ctx;
+#else
+    if (verify == VERIFY_RESUMED)
+        return -1;
+#endif
+
+    tls_session_clear(&session);
+    tls_pin_init(&pin);
+    memset(avg, 0, sizeof(*avg));
+    if (verify != VERIFY_CHAIN && connect_once(&pki->client[depth - 1], &pki->server[depth - 1], suite, use_session,
+                                               use_pin, cache, &r) != 0)
+        ret = -1;
+
+    for (int i = 0; i < runs && ret == 0; i++) {
+        if (connect_once(&pki->client[depth - 1], &pki->server[depth - 1], suite, use_session, use_pin, cache,
+                         &r) != 0) {
+            ret = -1;
+            break;
+        }
+        avg->client_ms += r.client_ms / runs;
+        avg->server_ms += r.server_ms / runs;
+        avg->client_cycles += r.client_cycles / runs;
+        if (r.client_heap > avg->client_heap)
+            avg->client_heap = r.client_heap;
+        avg->client_tx = r.client_tx;
+        avg->client_rx = r.client_rx;
+        avg->resumed += r.resumed;
+        avg->suite = r.suite;
+    }
+
+#if defined(MBEDTLS_SSL_CACHE_C)
+    heap_side = SIDE_SERVER;
+    mbedtls_ssl_cache_free(&cache_ctx);
+    heap_side = SIDE_SETUP;
+#endif
+
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *dir = "build/pki";
+    const char *only_type = NULL;
+    int runs = 5;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:k:n:h")) != -1) {
+        switch (opt) {
+        case 'p': dir = optarg; break;
+        case 'k': only_type = optarg; break;
+        case 'n': runs = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-p pki dir] [-k key type] [-n runs per cell]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (runs < 1) {
+        fprintf(stderr, "Invalid arguments\n");
+        return 1;
+    }
+
+    // Counted as on the node, so that anything mbedTLS frees must come from its allocator
+    tls_mem_init();
+    // Both sides draw from the node's shared generator, seeded before any timing starts
+    if (tls_rng_init("tls_bench", 9) != 0) {
+        fprintf(stderr, "DRBG seed failed\n");
+        return 1;
+    }
+    if (check_session_ticket() != 0)
+        return 1;
+
+#if defined(MBEDTLS_SSL_IN_CONTENT_LEN)
+    printf("Record buffers: %d in, %d out\n\n", MBEDTLS_SSL_IN_CONTENT_LEN, MBEDTLS_SSL_OUT_CONTENT_LEN);
+#endif
+    printf("%-8s %-23s %5s %7s %10s %8s %10s %9s %8s %8s  %s\n", "keys", "suite", "depth", "verify", "client ms",
+           "Mcycles", "server ms", "heap B", "tx B", "rx B", "negotiated");
+
+    for (int k = 0; k < KEY_TYPE_COUNT; k++) {
+        int ec = !strncmp(key_types[k], "ec", 2);
+        pki_t pki;
+
+        if (only_type && strcmp(only_type, key_types[k]))
+            continue;
+        if (load_pki(&pki, dir, key_types[k]) != 0) {
+            fprintf(stderr, "%s: no PKI in %s, see tls_bench_pki.sh\n", key_types[k], dir);
+            free_pki(&pki);
+            continue;
+        }
+
+        for (int s = 0; s < SUITE_COUNT; s++) {
+            if (suites[s].ec != -1 && suites[s].ec != ec)
+                continue;
+            if (suites[s].id && !suite_available(suites[s].id)) {
+                printf("%-8s %-23s (not in this mbedTLS configuration)\n", key_types[k], suites[s].name);
+                continue;
+            }
+
+            for (int depth = 1; depth <= 2; depth++) {
+                for (int verify = 0; verify < VERIFY_COUNT; verify++) {
+                    result_t r;
+
+                    if (run_cell(&pki, depth, suites[s].id, verify, runs, &r) != 0) {
+                        printf("%-8s %-23s %5d %7s  failed\n", key_types[k], suites[s].name, depth,
+                               verify_names[verify]);
+                        continue;
+                    }
+                    printf("%-8s %-23s %5d %7s %10.2f %8.2f %10.2f %9zu %8zu %8zu  %s%s\n", key_types[k],
+                           suites[s].name, depth, verify_names[verify], r.client_ms, r.client_cycles / 1e6,
+                           r.server_ms, r.client_heap, r.client_tx, r.client_rx, r.suite,
+                           verify == VERIFY_RESUMED && r.resumed != runs ? " (not resumed)" : "");
+                    fflush(stdout);
+                }
+            }
+        }
+        free_pki(&pki);
+    }
+
+    return 0;
+}
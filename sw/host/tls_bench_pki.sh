@@ -0,0 +1,73 @@
+#!/bin/bash
+#
+# Test PKIs for tls_bench: one directory per key type, each with a root and an intermediate CA, and server
+# and client certificates issued directly by the root (chain depth 1) and by the intermediate (depth 2).
+#
+#   rsa4096  RSA-4096 CA keys and RSA-2048 leaves, as ssl/ca makes by default
+#   rsa2048  RSA-2048 throughout
+#   ec256    ECDSA P-256 throughout, as ssl/ca makes with KEY_TYPE=ec
+#
+# The server certificates are for "bench.local". Nothing here is fit for real use.
+
+if [ $# -lt 1 ]; then
+    echo "Usage: ${0} <output dir>" >&2
+    exit 1
+fi
+
+OUT="${1}"
+
+new_key() {
+    case "${1}" in
+    ec*) openssl genpkey -algorithm EC -pkeyopt ec_paramgen_curve:P-256 -pkeyopt ec_param_enc:named_curve \
+            -out "${2}" 2>/dev/null ;;
+    *) openssl genrsa -out "${2}" "${3}" 2>/dev/null ;;
+    esac
+}
+
+# <dir> <name> <key name> <subject> <issuer name> <extensions>
+issue() {
+    openssl req -new -key "${1}/${3}.key" -subj "${4}" -out "${1}/${2}.csr" &&
+    openssl x509 -req -in "${1}/${2}.csr" -CA "${1}/${5}.pem" -CAkey "${1}/${5}.key" -CAcreateserial \
+        -days 30 -sha256 -extfile "${1}/ext.cnf" -extensions "${6}" -out "${1}/${2}.pem" 2>/dev/null &&
+    rm "${1}/${2}.csr"
+}
+
+for type in rsa4096 rsa2048 ec256; do
+    dir="${OUT}/${type}"
+    ca_bits=2048
+    [ "${type}" = "rsa4096" ] && ca_bits=4096
+
+    mkdir -p "${dir}" || exit 1
+    cat > "${dir}/ext.cnf" <<CNF
+[ ca ]
+basicConstraints = critical, CA:true
+keyUsage = critical, digitalSignature, cRLSign, keyCertSign
+subjectKeyIdentifier = hash
+[ leaf ]
+basicConstraints = CA:false
+subjectKeyIdentifier = hash
+authorityKeyIdentifier = keyid
+subjectAltName = DNS:bench.local
+CNF
+
+    new_key "${type}" "${dir}/root.key" "${ca_bits}" &&
+    openssl req -new -x509 -key "${dir}/root.key" -subj "/CN=tls_bench ${type} root" -days 30 -sha256 \
+        -config "${dir}/ext.cnf" -extensions ca -out "${dir}/root.pem" &&
+    new_key "${type}" "${dir}/int.key" "${ca_bits}" &&
+    issue "${dir}" int int "/CN=tls_bench ${type} intermediate" root ca &&
+    new_key "${type}" "${dir}/server.key" 2048 &&
+    new_key "${type}" "${dir}/client.key" 2048 || exit 1
+
+    # The same leaf keys at both depths, so only the chain differs
+    for depth in 1 2; do
+        issuer=root
+        [ "${depth}" = 2 ] && issuer=int
+        issue "${dir}" "d${depth}-server" server "/CN=bench.local" "${issuer}" leaf &&
+        issue "${dir}" "d${depth}-client" client "/CN=ESP-000000000000" "${issuer}" leaf || exit 1
+        if [ "${depth}" = 2 ]; then
+            cat "${dir}/int.pem" >> "${dir}/d2-server.pem"
+            cat "${dir}/int.pem" >> "${dir}/d2-client.pem"
+        fi
+    done
+    echo "${dir}"
+done
@@ -0,0 +1,170 @@
+/*
+ * Dispatch cost of the subscription trie against a linear scan over the same filters, checking that both
+ * agree on every topic.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "topic_trie.h"
+
+#define FILTER_LEN 64
+
+static const char *kinds[] = { "control", "config", "ota", "led", "sample", "calibrate" };
+#define KIND_COUNT (int)(sizeof(kinds) / sizeof(kinds[0]))
+
+static double now_s(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Reference matcher, one filter at a time
+ */
+static int filter_match(const char *filter, const char *topic, int topic_len)
+{
+    const char *t = topic, *end = topic + topic_len;
+
+    if (topic_len > 0 && *topic == '$' && (*filter == '+' || *filter == '#'))
+        return 0;
+
+    for (;;) {
+        const char *slash = strchr(filter, '/');
+        int flen = slash ? slash - filter : (int)strlen(filter);
+        const char *tslash = t ? memchr(t, '/', end - t) : NULL;
+        int tlen = t ? (tslash ? tslash - t : end - t) : 0;
+
+        if (flen == 1 && *filter == '#')
+            return 1;
+        if (!t)
+            return 0;
+        if (!(flen == 1 && *filter == '+') && (flen != tlen || memcmp(filter, t, flen)))
+            return 0;
+
+        t = tslash ? tslash + 1 : NULL;
+        if (!slash)
+            return !t;
+        filter = slash + 1;
+        // "a/#" also matches "a"
+        if (!t)
+            return !strcmp(filter, "#");
+    }
+}
+
+static long hits;
+
+static void count_hit(void *ctx, const char *topic, int topic_len, const unsigned char *payload, int payload_len)
+{
+    (void)ctx, (void)topic, (void)topic_len, (void)payload, (void)payload_len;
+    hits++;
+}
+
+int main(int argc, char *argv[])
+{
+    int nodes = 8;
+    long count = 1000000;
+    int opt;
+    int filter_count = 0;
+    char (*filters)[FILTER_LEN];
+    char (*topics)[FILTER_LEN];
+    int topic_count;
+    topic_node_t *pool;
+    char *names;
+    topic_trie_t trie;
+    long expect = 0, mismatches = 0;
+    double t, trie_s, linear_s;
+
+    while ((opt = getopt(argc, argv, "n:c:h")) != -1) {
+        switch (opt) {
+        case 'n': nodes = atoi(optarg); break;
+        case 'c': count = atol(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-n nodes] [-c dispatches]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    // Per node control and config topics plus a few fleet wide wildcards
+    filters = calloc(nodes * KIND_COUNT + 4, FILTER_LEN);
+    topics = calloc(nodes * KIND_COUNT * 2, FILTER_LEN);
+    pool = calloc(nodes * KIND_COUNT * 2 + 16, sizeof(*pool));
+    names = calloc(nodes * KIND_COUNT * 32 + 256, 1);
+    if (!filters || !topics || !pool || !names)
+        return 1;
+
+    for (int n = 0; n < nodes; n++) {
+        for (int k = 0; k < KIND_COUNT; k++)
+            snprintf(filters[filter_count++], FILTER_LEN, "espnode/%04x/%s", n, kinds[k]);
+    }
+    strcpy(filters[filter_count++], "espnode/+/ota");
+    strcpy(filters[filter_count++], "espnode/broadcast/#");
+    strcpy(filters[filter_count++], "+/+/config");
+    strcpy(filters[filter_count++], "$SYS/broker/#");
+
+    topic_trie_init(&trie, pool, nodes * KIND_COUNT * 2 + 16, names, nodes * KIND_COUNT * 32 + 256);
+    for (int i = 0; i < filter_count; i++) {
+        if (topic_trie_add(&trie, filters[i], 1, count_hit, NULL) != 0) {
+            fprintf(stderr, "Unable to add %s\n", filters[i]);
+            return 1;
+        }
+    }
+
+    topic_count = 0;
+    for (int n = 0; n < nodes; n++) {
+        for (int k = 0; k < KIND_COUNT; k++) {
+            snprintf(topics[topic_count++], FILTER_LEN, "espnode/%04x/%s", n, kinds[k]);
+            snprintf(topics[topic_count++], FILTER_LEN, "espnode/%04x/%s/extra", n, kinds[k]);
+        }
+    }
+
+    printf("%d filters, %d nodes, %d bytes of names\n", filter_count, trie.node_count, trie.names_len);
+
+    for (int i = 0; i < topic_count; i++) {
+        int len = strlen(topics[i]);
+        long before = hits;
+        int linear = 0;
+
+        topic_trie_dispatch(&trie, topics[i], len, NULL, 0);
+        for (int f = 0; f < filter_count; f++)
+            linear += filter_match(filters[f], topics[i], len);
+        if (hits - before != linear) {
+            printf("  mismatch on %s: trie %ld, linear %d\n", topics[i], hits - before, linear);
+            mismatches++;
+        }
+    }
+
+    t = now_s();
+    hits = 0;
+    for (long i = 0; i < count; i++) {
+        const char *topic = topics[i % topic_count];
+        topic_trie_dispatch(&trie, topic, strlen(topic), NULL, 0);
+    }
+    trie_s = now_s() - t;
+
+    t = now_s();
+    for (long i = 0; i < count; i++) {
+        const char *topic = topics[i % topic_count];
+        int len = strlen(topic);
+        for (int f = 0; f < filter_count; f++)
+            expect += filter_match(filters[f], topic, len);
+    }
+    linear_s = now_s() - t;
+
+    printf("  trie:   %.0f ns/dispatch\n", trie_s / count * 1e9);
+    printf("  linear: %.0f ns/dispatch\n", linear_s / count * 1e9);
+    if (hits != expect) {
+        printf("  hit count mismatch: trie %ld, linear %ld\n", hits, expect);
+        mismatches++;
+    }
+
+    free(filters);
+    free(topics);
+    free(pool);
+    free(names);
+    return mismatches != 0;
+}